@@ -0,0 +1,493 @@
+import { mkdtempSync, rmSync } from 'node:fs';
+import { createRequire } from 'node:module';
+import { tmpdir } from 'node:os';
+import { join, resolve } from 'node:path';
+
+const require = createRequire(import.meta.url);
+const bench = require(
+	resolve(import.meta.dirname, '..', 'build', 'Release', 'node_ios_device_bench.node')
+);
+
+const TOTAL_BYTES = 64 * 1024 * 1024;
+const TRICKLE_LINES = 2000;
+
+/**
+ * Simulates a listener doing `us` microseconds of work.
+ */
+function work(us) {
+	const until = process.hrtime.bigint() + BigInt(us * 1000);
+	while (process.hrtime.bigint() < until) {}
+}
+
+const X = 'x'.charCodeAt(0);
+
+/**
+ * Returns the latency in microseconds of a line stamped by the writer, or -1 if the line isn't
+ * stamped. Stamped lines start with the writer's `uv_hrtime()` in hex instead of an `x`.
+ */
+function stampLatency(line, now) {
+	const first = typeof line === 'string' ? line.charCodeAt(0) : line[0];
+	if (first === X || line.length < 16) {
+		return -1;
+	}
+	const hex = typeof line === 'string' ? line.slice(0, 16) : line.toString('latin1', 0, 16);
+	return Number(now - BigInt(`0x${hex}`)) / 1e3;
+}
+
+/**
+ * Formats the p50 and p99 of the latency samples.
+ */
+function percentiles(samples) {
+	if (!samples.length) {
+		return ' '.repeat(34);
+	}
+	samples.sort((a, b) => a - b);
+	const pct = (p) => samples[Math.floor((samples.length - 1) * p)].toFixed(0).padStart(8);
+	return `p50 ${pct(0.5)} us p99 ${pct(0.99)} us`;
+}
+
+/**
+ * Streams `TOTAL_BYTES` of synthetic lines through a socketpair-fed relay connection and reports
+ * the throughput and the write-to-listener latency. The first listener does the counting and any
+ * extra listeners only receive the events. If `slow` is set, the first listener spends that many
+ * microseconds on each frame.
+ */
+function relay(name, options, lineLength, slow = 0, listeners = 1) {
+	return new Promise((resolve) => {
+		let frames = 0;
+		let bytes = 0;
+		let pauses = 0;
+		let dropped = 0;
+		let peakRss = 0;
+		const latencies = [];
+		const start = process.hrtime.bigint();
+
+		const sample = (line) => {
+			const us = stampLatency(line, process.hrtime.bigint());
+			if (us >= 0) {
+				latencies.push(us);
+			}
+		};
+
+		const listener = (event, data, offsets) => {
+			if (event === 'data') {
+				frames++;
+				bytes += data.length;
+				if (options.framing !== 'raw' && (options.encoding !== 'buffer' || options.framing)) {
+					sample(data);
+				}
+				if (slow) {
+					work(slow);
+					if (frames % 1000 === 0) {
+						peakRss = Math.max(peakRss, process.memoryUsage.rss());
+					}
+				}
+			} else if (event === 'pause') {
+				pauses++;
+			} else if (event === 'drop') {
+				dropped += data;
+			} else if (event === 'batch') {
+				if (Buffer.isBuffer(data)) {
+					frames += offsets.length - 1;
+					bytes += data.length;
+					for (let i = 0; i < offsets.length - 1; i++) {
+						if (data[offsets[i]] !== X) {
+							sample(data.subarray(offsets[i], offsets[i + 1]));
+						}
+					}
+				} else {
+					frames += data.length;
+					for (const item of data) {
+						bytes += item.length;
+						if (item.charCodeAt(0) !== X) {
+							sample(item);
+						}
+					}
+				}
+			} else if (event === 'end') {
+				const secs = Number(process.hrtime.bigint() - start) / 1e9;
+				console.log(
+					`${name.padEnd(28)} ${(bytes / secs / 1048576).toFixed(1).padStart(8)} MB/s ${Math.round(frames / secs).toLocaleString().padStart(14)} frames/s ${percentiles(latencies)}` +
+						(slow
+							? ` ${pauses} pauses, ${dropped} dropped, peak RSS ${(peakRss / 1048576).toFixed(0)} MB`
+							: '')
+				);
+				resolve();
+			}
+		};
+
+		const others = Array.from({ length: listeners - 1 }, () => () => {});
+		bench.relay(options, TOTAL_BYTES, lineLength, [listener, ...others]);
+	});
+}
+
+/**
+ * Streams `TOTAL_BYTES` of copies of a JSON or logfmt line and reports the throughput and how much
+ * event loop time each frame took. With `jsParse`, the listener parses each line with
+ * `JSON.parse()` instead of the relay parsing it.
+ */
+function parse(name, options, line, jsParse = false) {
+	return new Promise((resolve) => {
+		let frames = 0;
+		let last;
+		const start = process.hrtime.bigint();
+		const elu = performance.eventLoopUtilization();
+
+		const listener = (event, data) => {
+			if (event === 'data') {
+				frames++;
+				last = jsParse ? JSON.parse(data) : data;
+			} else if (event === 'batch') {
+				frames += data.length;
+				for (const item of data) {
+					last = jsParse ? JSON.parse(item) : item;
+				}
+			} else if (event === 'end') {
+				const secs = Number(process.hrtime.bigint() - start) / 1e9;
+				const { active } = performance.eventLoopUtilization(elu);
+				const { framesMalformed } = bench.stats();
+				console.log(
+					`${name.padEnd(28)} ${Math.round(frames / secs).toLocaleString().padStart(14)} frames/s ${((active * 1000) / frames).toFixed(2).padStart(6)} us of event loop per frame, ${framesMalformed} malformed${last ? '' : ' (no frames)'}`
+				);
+				resolve();
+			}
+		};
+
+		// whole lines only so that the last line isn't cut off
+		const total = TOTAL_BYTES - (TOTAL_BYTES % (line.length + 1));
+		bench.relay(options, total, 0, listener, line);
+	});
+}
+
+/**
+ * Streams `TOTAL_BYTES` of 256 byte lines split evenly across `sources` devices, either merged into
+ * a single relay group like `forwardAll()` or through a relay connection per device like calling
+ * `forward()` for each one, and reports the throughput, the event loop time per line, and how many
+ * times the listener was woken up. If `interval` is set, each device instead logs `TRICKLE_LINES`
+ * lines at one line every `interval` microseconds.
+ */
+function fanIn(name, options, sources, separate = false, interval = 0) {
+	return new Promise((resolve) => {
+		let frames = 0;
+		let remaining = sources;
+		const start = process.hrtime.bigint();
+		const elu = performance.eventLoopUtilization();
+
+		const listener = (event, data) => {
+			if (event === 'data') {
+				frames++;
+			} else if (event === 'batch') {
+				frames += data.length;
+			} else if ((event === 'end' || event === 'detach') && --remaining === 0) {
+				const secs = Number(process.hrtime.bigint() - start) / 1e9;
+				const { active } = performance.eventLoopUtilization(elu);
+				const { dispatches } = bench.stats();
+				console.log(
+					`${name.padEnd(28)} ${Math.round(frames / secs).toLocaleString().padStart(14)} lines/s ${((active * 1e6) / frames).toFixed(0).padStart(5)} ns of event loop per line ${dispatches.toLocaleString().padStart(10)} dispatches`
+				);
+				resolve();
+			}
+		};
+
+		const names = Array.from({ length: sources }, (_, i) => `device-${i}`);
+		const bytes = interval ? TRICKLE_LINES * 256 : Math.floor(TOTAL_BYTES / sources);
+		bench.fanIn(options, names, bytes, 256, listener, null, separate, interval);
+	});
+}
+
+/**
+ * Streams `TOTAL_BYTES` of copies of a block of lines and reports how many lines were read and
+ * emitted per second and how much event loop time each line read took. With `jsFilter`, every
+ * line is emitted and the listener drops the ones the function rejects.
+ */
+function filter(name, options, block, jsFilter) {
+	return new Promise((resolve) => {
+		let frames = 0;
+		const start = process.hrtime.bigint();
+		const elu = performance.eventLoopUtilization();
+
+		const listener = (event, data) => {
+			if (event === 'data') {
+				if (!jsFilter || jsFilter(data)) {
+					frames++;
+				}
+			} else if (event === 'end') {
+				const secs = Number(process.hrtime.bigint() - start) / 1e9;
+				const { active } = performance.eventLoopUtilization(elu);
+				const { framesRead } = bench.stats();
+				console.log(
+					`${name.padEnd(28)} ${Math.round(framesRead / secs).toLocaleString().padStart(14)} lines/s ${Math.round(frames / secs).toLocaleString().padStart(12)} emitted/s ${((active * 1e6) / framesRead).toFixed(0).padStart(5)} ns of event loop per line`
+				);
+				resolve();
+			}
+		};
+
+		const total = TOTAL_BYTES - (TOTAL_BYTES % (block.length + 1));
+		bench.relay(options, total, 0, listener, block);
+	});
+}
+
+/**
+ * Replays the recorded `syslogRecords` through a relay connection framed like `syslog()` until
+ * `TOTAL_BYTES` have been sent and reports the throughput and the event loop time each record
+ * took. With `jsParse`, the listener parses each raw record with a regular expression instead of
+ * the relay parsing it.
+ */
+function syslog(name, options, jsParse = false) {
+	return new Promise((resolve) => {
+		let frames = 0;
+		let last;
+		const start = process.hrtime.bigint();
+		const elu = performance.eventLoopUtilization();
+		const parseRecord = (record) => {
+			const m = record.match(SYSLOG_RE);
+			return m
+				? {
+						time: m[1],
+						device: m[2],
+						process: m[3],
+						sender: m[4],
+						pid: Number(m[5]),
+						level: m[6],
+						message: m[7],
+					}
+				: { message: record };
+		};
+
+		const listener = (event, data) => {
+			if (event === 'data') {
+				frames++;
+				last = jsParse ? parseRecord(data) : data;
+			} else if (event === 'batch') {
+				frames += data.length;
+				for (const item of data) {
+					last = jsParse ? parseRecord(item) : item;
+				}
+			} else if (event === 'end') {
+				const secs = Number(process.hrtime.bigint() - start) / 1e9;
+				const { active } = performance.eventLoopUtilization(elu);
+				console.log(
+					`${name.padEnd(28)} ${Math.round(frames / secs).toLocaleString().padStart(14)} records/s ${((active * 1000) / frames).toFixed(2).padStart(6)} us of event loop per record${last ? '' : ' (no records)'}`
+				);
+				resolve();
+			}
+		};
+
+		bench.syslog(options, syslogRecords, Math.floor(TOTAL_BYTES / syslogRecords.length), listener);
+	});
+}
+
+/**
+ * Runs the framer over `TOTAL_BYTES` of synthetic frames split into reads of `chunkSize` bytes.
+ */
+function frame(name, options, frameLength, chunkSize) {
+	const { frames, bytes, ns } = bench.frame(options, frameLength, chunkSize, TOTAL_BYTES);
+	const secs = ns / 1e9;
+	console.log(
+		`${name.padEnd(28)} ${String(chunkSize).padStart(6)} B reads ${(TOTAL_BYTES / secs / 1048576).toFixed(1).padStart(8)} MB/s ${Math.round(frames / secs).toLocaleString().padStart(14)} frames/s (${bytes} payload bytes)`
+	);
+}
+
+/**
+ * Passes `count` frames between two threads through the relay's message queue and a mutex guarded
+ * queue for comparison.
+ */
+function queue(kind, count) {
+	const { frames, ns } = bench.queue(kind, count);
+	console.log(
+		`${kind.padEnd(28)} ${(ns / frames).toFixed(1).padStart(8)} ns/frame ${Math.round(frames / (ns / 1e9)).toLocaleString().padStart(14)} frames/s`
+	);
+}
+
+/**
+ * Calls a stand-in for `list()` `calls` times with `devices` connected devices and reports the
+ * cost per call.
+ */
+function deviceList(mode, devices, calls) {
+	const { ns } = bench.deviceList(mode, devices, calls);
+	console.log(
+		`${`${mode} x${devices}`.padEnd(28)} ${(ns / calls / 1e3).toFixed(2).padStart(10)} us/call`
+	);
+}
+
+/**
+ * Simulates `devices` devices connecting at once, each taking `handshakeUs` to probe, with
+ * `workers` probe workers and reports how long it takes until every device is listed.
+ */
+function probeStorm(devices, handshakeUs, workers) {
+	const { elapsedUs, firstPublishUs, stats } = bench.probeStorm(devices, handshakeUs, workers);
+	console.log(
+		`${`x${devices} ${workers} workers`.padEnd(28)} first ${(firstPublishUs / 1e3).toFixed(1).padStart(8)} ms all ${(elapsedUs / 1e3).toFixed(1).padStart(8)} ms probe p99 ${(stats.latency.p99 / 1e3).toFixed(1).padStart(8)} ms`
+	);
+}
+
+/**
+ * Disconnects and reconnects `devices` devices `flaps` times each with a flap window of `windowMs`.
+ */
+function flapStorm(devices, flaps, windowMs, handshakeUs) {
+	const { reused, handshakes, stormUs } = bench.flapStorm(devices, flaps, windowMs, handshakeUs);
+	console.log(
+		`${`window ${windowMs}ms`.padEnd(28)} reused ${String(reused).padStart(6)} handshakes ${String(handshakes).padStart(6)} storm ${(stormUs / 1e3).toFixed(1).padStart(8)} ms`
+	);
+}
+
+/**
+ * Writes a line to an echo peer, waits for it to come back, and repeats `count` times.
+ */
+function roundTrip(count) {
+	return new Promise((resolve) => {
+		const samples = [];
+		let start = process.hrtime.bigint();
+
+		bench.echo({}, (event) => {
+			if (event === 'data') {
+				samples.push(Number(process.hrtime.bigint() - start) / 1e3);
+				if (samples.length === count) {
+					bench.echoClose();
+				} else {
+					start = process.hrtime.bigint();
+					bench.echoWrite('ping\n');
+				}
+			} else if (event === 'end') {
+				samples.sort((a, b) => a - b);
+				const pct = (p) => samples[Math.floor(samples.length * p)].toFixed(1).padStart(8);
+				console.log(`${'echo'.padEnd(28)} p50 ${pct(0.5)} us p99 ${pct(0.99)} us`);
+				resolve();
+			}
+		});
+
+		bench.echoWrite('ping\n');
+	});
+}
+
+console.log('Queue');
+for (let i = 0; i < 3; i++) {
+	queue('mutex', 10_000_000);
+	queue('ring', 10_000_000);
+}
+
+console.log('\nDevice list (list() calls)');
+for (const devices of [1, 10, 50, 200]) {
+	const calls = Math.max(1000, 200_000 / devices);
+	deviceList('push', devices, calls);
+	deviceList('cached', devices, calls);
+	deviceList('changed', devices, calls);
+}
+
+console.log('\nDevice probing (30 devices, 50ms handshake)');
+for (const workers of [1, 8]) {
+	probeStorm(30, 50_000, workers);
+}
+
+console.log('\nDevice flapping (10 devices, 20 flaps each, 5ms handshake)');
+for (const windowMs of [0, 2000]) {
+	flapStorm(10, 20, windowMs, 5000);
+}
+
+console.log('\nRound trip');
+await roundTrip(10_000);
+
+console.log('\nFramer');
+for (const chunkSize of [100, 1021, 4093, 65536]) {
+	frame('newline', { framing: 'newline' }, 80, chunkSize);
+	frame('delimiter "\\r\\n"', { delimiter: '\r\n' }, 80, chunkSize);
+	frame('length-prefix', { framing: 'length-prefix' }, 80, chunkSize);
+	frame('raw', { framing: 'raw' }, 80, chunkSize);
+}
+
+console.log('\nRelay');
+for (const lineLength of [32, 256, 4096]) {
+	console.log(`\nLine length: ${lineLength} bytes`);
+	await relay('utf8 (lines)', { encoding: 'utf8' }, lineLength);
+	await relay('utf8 (lines, batched)', { batch: { maxSize: 1024 } }, lineLength);
+	await relay('buffer (lines, batched)', { encoding: 'buffer', framing: 'newline', batch: {} }, lineLength);
+	await relay('buffer (chunks)', { encoding: 'buffer' }, lineLength);
+}
+
+console.log('\nListeners (256 byte lines)');
+for (const listeners of [1, 4, 16]) {
+	await relay(`utf8 (lines) x${listeners}`, { encoding: 'utf8' }, 256, 0, listeners);
+	await relay(`utf8 (lines, batched) x${listeners}`, { batch: {} }, 256, 0, listeners);
+}
+
+console.log('\nCapture (256 byte lines)');
+const captureDir = mkdtempSync(join(tmpdir(), 'node-ios-device-bench-'));
+await relay('utf8 (lines)', { encoding: 'utf8' }, 256);
+await relay('utf8 (lines, captured)', { encoding: 'utf8', capture: join(captureDir, 'lines') }, 256);
+await relay('utf8 (lines, batched, captured)', { batch: {}, capture: join(captureDir, 'batched') }, 256);
+rmSync(captureDir, { recursive: true, force: true });
+
+console.log('\nParsing (JSON and logfmt lines)');
+const jsonLine = JSON.stringify({
+	time: '2026-10-17T04:44:00.000Z',
+	level: 'info',
+	msg: 'request completed',
+	status: 200,
+	duration: 12.5,
+	tags: ['net', 'http'],
+	ctx: { id: 1234, path: '/api/v1/items' },
+});
+await parse('JSON.parse() in listener', {}, jsonLine, true);
+await parse('parse: "json"', { parse: 'json' }, jsonLine);
+await parse('JSON.parse() batched', { batch: {} }, jsonLine, true);
+await parse('parse: "json" batched', { parse: 'json', batch: {} }, jsonLine);
+await parse(
+	'parse: "logfmt"',
+	{ parse: 'logfmt' },
+	'time=2026-10-17T04:44:00.000Z level=info msg="request completed" status=200 duration=12.5'
+);
+await parse(
+	'parse: "logfmt" batched',
+	{ parse: 'logfmt', batch: {} },
+	'time=2026-10-17T04:44:00.000Z level=info msg="request completed" status=200 duration=12.5'
+);
+
+console.log('\nFiltering (1 in 10 lines kept)');
+const block = [
+	...Array.from(
+		{ length: 9 },
+		(_, i) => `2026-10-17 04:44:00.${i}00 [DEBUG] cache lookup for key item:${i} took 0.0${i} ms`
+	),
+	'2026-10-17 04:44:01.000 [INFO] request completed status=200 duration=12.5',
+].join('\n');
+await filter('filter in listener', {}, block, (line) => !line.includes('[DEBUG]'));
+await filter('exclude: "[DEBUG]"', { exclude: '[DEBUG]' }, block);
+await filter('include: "[INFO]"', { include: '[INFO]' }, block);
+await filter(`include: ${/\[(INFO|WARN)\]/}`, { include: /\[(INFO|WARN)\]/ }, block);
+
+console.log('\nFan-in (256 byte lines)');
+for (const sources of [4, 16]) {
+	await fanIn(`forward() x${sources}`, {}, sources, true);
+	await fanIn(`forwardAll() x${sources}`, {}, sources);
+	await fanIn(`forward() x${sources} batched`, { batch: {} }, sources, true);
+	await fanIn(`forwardAll() x${sources} batched`, { batch: {} }, sources);
+}
+for (const sources of [4, 16]) {
+	await fanIn(`forward() x${sources} at 1k/s`, {}, sources, true, 1000);
+	await fanIn(`forwardAll() x${sources} at 1k/s`, {}, sources, false, 1000);
+}
+
+console.log('\nSyslog (recorded syslog relay records)');
+const SYSLOG_RE = /^(\w{3} [ \d]\d \d\d:\d\d:\d\d) (\S+) ([^[(]+)(?:\(([^)]*)\))?\[(\d+)\] <([^>]+)>: ?([\s\S]*?)\n?$/;
+const syslogRecords = Buffer.from(
+	[
+		'Oct 17 04:44:00 iPhone SpringBoard(FrontBoardServices)[58] <Notice>: [sceneID:com.apple.springboard] Scene lifecycle state did change: Foreground\n',
+		'Oct 17 04:44:00 iPhone kernel[0] <Notice>: AppleKeyStore: operation failed (pid: 1234 sel: 7 ret: e00002c2 \'-536870206\')\n',
+		'Oct 17 04:44:00 iPhone locationd[71] <Debug>: {"msg":"client authorization", "Client":"com.example.app", "Status":2}\n',
+		'Oct 17 04:44:01 iPhone MyApp(CFNetwork)[1234] <Error>: Task <8C1E2A>.<1> finished with error [-1001] Error Domain=NSURLErrorDomain Code=-1001 "The request timed out."\n',
+		'Oct 17 04:44:01 iPhone MyApp[1234] <Warning>: request completed status=200 duration=12.5\n',
+	]
+		.map((record) => `${record}\0`)
+		.join('')
+);
+await syslog('regex in listener', {}, true);
+await syslog('parse: "syslog"', { parse: 'syslog' });
+await syslog('regex in listener batched', { batch: {} }, true);
+await syslog('parse: "syslog" batched', { parse: 'syslog', batch: {} });
+await syslog('include: "<Error>" batched', { parse: 'syslog', batch: {}, include: '<Error>' });
+
+console.log('\nFlow control (slow listener, 256 byte lines)');
+// RSS never shrinks much, so the unbounded queue runs last
+await relay('pause', { highWaterMark: 1024 * 1024 }, 256, 2);
+await relay('drop-oldest', { highWaterMark: 1024 * 1024, overflow: 'drop-oldest' }, 256, 2);
+await relay('unbounded', { highWaterMark: Number.MAX_SAFE_INTEGER }, 256, 2);
@@ -0,0 +1,2034 @@
+/**
+ * Benchmark harness for the relay hot path. This addon is only built when the
+ * `node_ios_device_bench` gyp variable is set and it does not depend on CoreFoundation or
+ * MobileDevice, so it builds on any platform.
+ *
+ * Instead of a device socket, each relay connection is fed by one end of a socketpair while a
+ * writer thread streams synthetic data into the other end. Relay groups get a socketpair per
+ * device. Port proxies connect clients to a local TCP server that stands in for the device.
+ */
+
+#include "device-list.h"
+#include "device-notifier.h"
+#include "device-prop-cache.h"
+#include "port-proxy.h"
+#include "probe-pool.h"
+#include "relay-capture.h"
+#include "relay-connection.h"
+#include "relay-group.h"
+#include "relay-socket-pool.h"
+#include "watch-batch.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <queue>
+#include <random>
+#include <set>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace node_ios_device {
+	LOG_DEBUG_VARS
+}
+
+using namespace node_ios_device;
+
+/**
+ * Echoes everything read from the socket back to it until the other end shuts down its write side.
+ */
+static void echoPeer(int fd) {
+	char buffer[RELAY_SLAB_SIZE];
+	while (1) {
+		ssize_t n = ::read(fd, buffer, sizeof(buffer));
+		if (n <= 0) {
+			break;
+		}
+		for (ssize_t sent = 0; sent < n; ) {
+			ssize_t w = ::write(fd, buffer + sent, (size_t)(n - sent));
+			if (w <= 0) {
+				::close(fd);
+				return;
+			}
+			sent += w;
+		}
+	}
+	::close(fd);
+}
+
+/**
+ * A relay connection that reads from a socketpair on a background thread and flushes writes on a
+ * second thread.
+ */
+class SocketPairRelayConnection : public RelayConnection {
+public:
+	SocketPairRelayConnection(napi_env env, int fd, const RelayOptions& options) :
+		RelayConnection(env, options), fd(fd), readPaused(false), writeScheduled(false), stopping(false), failReconnects(0) {}
+
+	virtual ~SocketPairRelayConnection() {
+		disconnect();
+	}
+
+	void disconnect() {
+		if (writer.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(writerLock);
+				stopping = true;
+			}
+			writerWake.notify_one();
+			if (writer.get_id() != std::this_thread::get_id()) {
+				writer.join();
+			} else {
+				writer.detach();
+			}
+		}
+		if (reader.joinable()) {
+			::shutdown(fd, SHUT_RDWR);
+			resumeReading();
+			if (reader.get_id() != std::this_thread::get_id()) {
+				reader.join();
+			} else {
+				reader.detach();
+			}
+		}
+		if (fd != -1) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+protected:
+	void connect() {
+		reader = std::thread([this]() {
+			char buffer[RELAY_SLAB_SIZE];
+			while (1) {
+				{
+					std::unique_lock<std::mutex> lock(readLock);
+					readResumed.wait(lock, [this]() { return !readPaused; });
+				}
+				ssize_t n = ::read(fd, buffer, sizeof(buffer));
+				if (n <= 0) {
+					onClose();
+					return;
+				}
+				onData(buffer, (size_t)n);
+			}
+		});
+
+		writer = std::thread([this]() {
+			while (1) {
+				{
+					std::unique_lock<std::mutex> lock(writerLock);
+					writerWake.wait(lock, [this]() { return writeScheduled || stopping; });
+					if (stopping) {
+						return;
+					}
+					writeScheduled = false;
+				}
+
+				// wait for the socket to become writable while data is pending
+				while (flushWrites(fd)) {
+					struct pollfd pfd = { fd, POLLOUT, 0 };
+					::poll(&pfd, 1, 100);
+				}
+			}
+		});
+	}
+
+	void pauseReading() {
+		std::lock_guard<std::mutex> lock(readLock);
+		readPaused = true;
+	}
+
+	/**
+	 * Replaces the socketpair with a new one and a new echo peer, simulating the device coming
+	 * back. The first `failReconnects` attempts fail.
+	 */
+	void reconnect() {
+		if (failReconnects > 0) {
+			--failReconnects;
+			onReconnect(false);
+			return;
+		}
+
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+			onReconnect(false);
+			return;
+		}
+
+		disconnect();
+		fd = fds[0];
+		stopping = false;
+		writeScheduled = false;
+		readPaused = false;
+		std::thread(echoPeer, fds[1]).detach();
+		connect();
+		onReconnect(true);
+	}
+
+	void resumeReading() {
+		{
+			std::lock_guard<std::mutex> lock(readLock);
+			readPaused = false;
+		}
+		readResumed.notify_one();
+	}
+
+	void scheduleWrite() {
+		{
+			std::lock_guard<std::mutex> lock(writerLock);
+			writeScheduled = true;
+		}
+		writerWake.notify_one();
+	}
+
+public:
+	/**
+	 * Closes the write side of the socket so the peer sees the end of the stream.
+	 */
+	void shutdownWrite() {
+		::shutdown(fd, SHUT_WR);
+	}
+
+	/**
+	 * Returns the pool that the connection's slabs are acquired from.
+	 */
+	std::shared_ptr<RelaySlabPool> getSlabPool() {
+		return slabPool;
+	}
+
+protected:
+	int                     fd;
+	std::thread             reader;
+	std::mutex              readLock;
+	std::condition_variable readResumed;
+	bool                    readPaused;
+	std::thread             writer;
+	std::mutex              writerLock;
+	std::condition_variable writerWake;
+	bool                    writeScheduled;
+	bool                    stopping;
+
+public:
+	uint32_t                failReconnects;
+};
+
+/**
+ * A relay group whose devices are socketpairs, each read on a thread of its own. Unlike the device
+ * manager's run loop, the readers run in parallel and contend for the group's lock.
+ */
+class SocketPairRelayGroup : public RelayGroup {
+public:
+	SocketPairRelayGroup(napi_env env, const RelayOptions& options, const std::vector<std::string>& udids) :
+		RelayGroup(env, options, udids), readPaused(false) {}
+
+	virtual ~SocketPairRelayGroup() {
+		disconnect();
+	}
+
+	/**
+	 * Adds a device that streams from the socket. Returns false if the device doesn't belong in
+	 * the group, in which case the caller still owns the socket.
+	 */
+	bool attach(const std::string& udid, int fd) {
+		std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+		if (!accepts(udid)) {
+			return false;
+		}
+
+		uint32_t source = attachSource(udid);
+		if (!source) {
+			return false;
+		}
+
+		Reader& reader = readers[source];
+		reader.fd = fd;
+		reader.thread = std::thread([this, source, fd]() {
+			char buffer[RELAY_SLAB_SIZE];
+			while (1) {
+				{
+					std::unique_lock<std::mutex> lock(readLock);
+					readResumed.wait(lock, [this]() { return !readPaused; });
+				}
+				ssize_t n = ::read(fd, buffer, sizeof(buffer));
+				if (n <= 0) {
+					onSourceClose(source);
+					return;
+				}
+				onSourceData(source, buffer, (size_t)n);
+			}
+		});
+		return true;
+	}
+
+	void disconnect() {
+		std::list<Reader> stopped;
+		{
+			std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+			for (auto& it : readers) {
+				::shutdown(it.second.fd, SHUT_RDWR);
+				stopped.push_back(std::move(it.second));
+			}
+			readers.clear();
+			stopped.splice(stopped.end(), closed);
+			framers.clear();
+			attached.clear();
+		}
+
+		// the readers may be waiting on the lock or paused, so they're joined without holding it
+		resumeReading();
+		for (auto& reader : stopped) {
+			if (reader.thread.get_id() != std::this_thread::get_id()) {
+				reader.thread.join();
+			} else {
+				reader.thread.detach();
+			}
+			::close(reader.fd);
+		}
+	}
+
+protected:
+	/**
+	 * A device's socket and the thread reading it.
+	 */
+	struct Reader {
+		int         fd;
+		std::thread thread;
+	};
+
+	/**
+	 * Closing is usually done by the source's own reader thread while holding the group's lock, so
+	 * the reader is joined later by `disconnect()`.
+	 */
+	void closeSource(uint32_t source) {
+		auto it = readers.find(source);
+		if (it != readers.end()) {
+			::shutdown(it->second.fd, SHUT_RDWR);
+			closed.push_back(std::move(it->second));
+			readers.erase(it);
+		}
+	}
+
+	void connect() {}
+
+	void pauseReading() {
+		std::lock_guard<std::mutex> lock(readLock);
+		readPaused = true;
+	}
+
+	void resumeReading() {
+		{
+			std::lock_guard<std::mutex> lock(readLock);
+			readPaused = false;
+		}
+		readResumed.notify_all();
+	}
+
+	std::map<uint32_t, Reader> readers;
+	std::list<Reader>          closed;
+	std::mutex                 readLock;
+	std::condition_variable    readResumed;
+	bool                       readPaused;
+};
+
+static std::list<std::shared_ptr<RelayConnection>> connections;
+
+/**
+ * Reads a JavaScript string argument.
+ */
+static std::string getString(napi_env env, napi_value value) {
+	size_t len = 0;
+	std::string str;
+	if (::napi_get_value_string_utf8(env, value, NULL, 0, &len) != napi_ok) {
+		throw std::runtime_error("Expected a string");
+	}
+	str.resize(len);
+	::napi_get_value_string_utf8(env, value, &str[0], len + 1, NULL);
+	return str;
+}
+
+/**
+ * Writes `total` bytes of `lineLength` sized newline terminated lines to the socket, then closes
+ * it. If the lines are long enough, the first line of each chunk starts with the `uv_hrtime()` at
+ * which the chunk was written as 16 hex digits so that the listener can measure latency. If a line
+ * is passed, it's repeated as is instead.
+ */
+static void writeLines(int fd, size_t total, size_t lineLength, std::string line) {
+	std::string chunk;
+	while (chunk.size() < RELAY_SLAB_SIZE) {
+		if (line.empty()) {
+			chunk.append(lineLength - 1, 'x');
+		} else {
+			chunk += line;
+		}
+		chunk += '\n';
+	}
+
+	bool stamp = line.empty() && lineLength > 16;
+	size_t sent = 0;
+	while (sent < total) {
+		size_t len = std::min(chunk.size(), total - sent);
+		if (stamp) {
+			char hex[17];
+			::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)::uv_hrtime());
+			::memcpy(&chunk[0], hex, 16);
+		}
+
+		for (size_t offset = 0; offset < len; ) {
+			ssize_t n = ::write(fd, chunk.data() + offset, len - offset);
+			if (n <= 0) {
+				::close(fd);
+				return;
+			}
+			offset += (size_t)n;
+		}
+		sent += len;
+	}
+
+	::close(fd);
+}
+
+/**
+ * Writes `total` bytes of `lineLength` sized lines to the socket one line every `interval`
+ * microseconds, like a device logging at a steady pace, then closes it.
+ */
+static void trickleLines(int fd, size_t total, size_t lineLength, uint32_t interval) {
+	std::string line(lineLength - 1, 'x');
+	line += '\n';
+
+	auto next = std::chrono::steady_clock::now();
+	for (size_t sent = 0; sent < total; sent += line.size()) {
+		next += std::chrono::microseconds(interval);
+		std::this_thread::sleep_until(next);
+		if (::write(fd, line.data(), line.size()) != (ssize_t)line.size()) {
+			break;
+		}
+	}
+
+	::close(fd);
+}
+
+/**
+ * relay(options, totalBytes, lineLength, listeners, line)
+ * Streams synthetic lines through a socketpair-fed relay connection. Each listener receives the
+ * same events as a `forward()` handle. Accepts a single listener or an array of listeners. If
+ * `line` is set, it's streamed instead of the synthetic lines.
+ */
+NAPI_METHOD(relay) {
+	NAPI_ARGV(5);
+
+	int64_t total = 0;
+	uint32_t lineLength = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_int64(env, argv[1], &total))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &lineLength))
+
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		NAPI_THROW_ERROR("ERR_SOCKETPAIR", "socketpair() failed", NAPI_AUTO_LENGTH, NULL)
+	}
+
+	try {
+		// drop connections from previous runs
+		connections.clear();
+
+		RelayOptions options = RelayOptions::parse(env, argv[0]);
+		std::shared_ptr<RelayConnection> conn = std::make_shared<SocketPairRelayConnection>(env, fds[0], options);
+		conn->init();
+		connections.push_back(conn);
+
+		bool isArray = false;
+		NAPI_STATUS_THROWS(::napi_is_array(env, argv[3], &isArray))
+		if (isArray) {
+			uint32_t count = 0;
+			NAPI_STATUS_THROWS(::napi_get_array_length(env, argv[3], &count))
+			for (uint32_t i = 0; i < count; ++i) {
+				napi_value listener;
+				NAPI_STATUS_THROWS(::napi_get_element(env, argv[3], i, &listener))
+				conn->add(listener);
+			}
+		} else {
+			conn->add(argv[3]);
+		}
+	} catch (std::exception& e) {
+		::close(fds[1]);
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	napi_valuetype type;
+	std::string line;
+	NAPI_STATUS_THROWS(::napi_typeof(env, argv[4], &type))
+	if (type == napi_string) {
+		line = getString(env, argv[4]);
+	}
+
+	std::thread(writeLines, fds[1], (size_t)total, (size_t)(lineLength > 1 ? lineLength : 2), line).detach();
+
+	NAPI_RETURN_UNDEFINED("relay")
+}
+
+/**
+ * fanIn(options, sources, totalBytes, lineLength, listener, udids, separate, interval)
+ * Streams `totalBytes` of synthetic lines from each named source through a single relay group, the
+ * same as a `forwardAll()` handle with a device per source. If `udids` is an array, only those
+ * sources join the group. If `separate` is true, each source gets a relay connection of its own
+ * instead, the same as calling `forward()` for each device. If `interval` is set, each source
+ * writes a line every `interval` microseconds instead of as fast as it can.
+ */
+NAPI_METHOD(fanIn) {
+	NAPI_ARGV(8);
+
+	int64_t total = 0;
+	uint32_t lineLength = 0;
+	uint32_t count = 0;
+	bool isArray = false;
+	bool separate = false;
+	uint32_t interval = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_int64(env, argv[2], &total))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[3], &lineLength))
+	NAPI_STATUS_THROWS(::napi_get_array_length(env, argv[1], &count))
+	::napi_get_value_bool(env, argv[6], &separate);
+	::napi_get_value_uint32(env, argv[7], &interval);
+
+	std::vector<std::string> udids;
+	NAPI_STATUS_THROWS(::napi_is_array(env, argv[5], &isArray))
+	if (isArray) {
+		uint32_t len = 0;
+		NAPI_STATUS_THROWS(::napi_get_array_length(env, argv[5], &len))
+		for (uint32_t i = 0; i < len; ++i) {
+			napi_value udid;
+			NAPI_STATUS_THROWS(::napi_get_element(env, argv[5], i, &udid))
+			udids.push_back(getString(env, udid));
+		}
+	}
+
+	std::vector<int> peers;
+	try {
+		connections.clear();
+
+		RelayOptions options = RelayOptions::parse(env, argv[0]);
+		std::shared_ptr<SocketPairRelayGroup> group;
+		if (!separate) {
+			group = std::make_shared<SocketPairRelayGroup>(env, options, udids);
+			group->init();
+			connections.push_back(group);
+			group->add(argv[4]);
+		}
+
+		for (uint32_t i = 0; i < count; ++i) {
+			napi_value name;
+			NAPI_STATUS_THROWS(::napi_get_element(env, argv[1], i, &name))
+			std::string udid = getString(env, name);
+
+			int fds[2];
+			if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+				throw std::runtime_error("socketpair() failed");
+			}
+
+			if (separate) {
+				std::shared_ptr<RelayConnection> conn = std::make_shared<SocketPairRelayConnection>(env, fds[0], options);
+				conn->init();
+				connections.push_back(conn);
+				conn->add(argv[4]);
+			} else if (!group->attach(udid, fds[0])) {
+				::close(fds[0]);
+				::close(fds[1]);
+				continue;
+			}
+			peers.push_back(fds[1]);
+		}
+	} catch (std::exception& e) {
+		for (int fd : peers) {
+			::close(fd);
+		}
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	for (int fd : peers) {
+		if (interval > 0) {
+			std::thread(trickleLines, fd, (size_t)total, (size_t)(lineLength > 1 ? lineLength : 2), interval).detach();
+		} else {
+			std::thread(writeLines, fd, (size_t)total, (size_t)(lineLength > 1 ? lineLength : 2), std::string()).detach();
+		}
+	}
+
+	NAPI_RETURN_UNDEFINED("fanIn")
+}
+
+/**
+ * Writes the recorded bytes of a syslog relay service to the socket `repeat` times in chunks that
+ * don't line up with the records, like a device sending a burst of log records, then closes it.
+ */
+static void replaySyslog(int fd, std::string records, uint32_t repeat) {
+	std::string data;
+	data.reserve(records.size() * repeat);
+	for (uint32_t i = 0; i < repeat; ++i) {
+		data += records;
+	}
+
+	for (size_t offset = 0; offset < data.size(); ) {
+		ssize_t n = ::write(fd, data.data() + offset, std::min((size_t)RELAY_SLAB_SIZE / 4, data.size() - offset));
+		if (n <= 0) {
+			break;
+		}
+		offset += (size_t)n;
+	}
+
+	::close(fd);
+}
+
+/**
+ * syslog(options, records, repeat, listener)
+ * Streams recorded syslog relay service bytes through a socketpair-fed relay connection created
+ * with the same options as a `syslog()` handle. The records are replayed `repeat` times.
+ */
+NAPI_METHOD(syslog) {
+	NAPI_ARGV(4);
+
+	uint32_t repeat = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &repeat))
+
+	void* data = NULL;
+	size_t length = 0;
+	NAPI_STATUS_THROWS(::napi_get_buffer_info(env, argv[1], &data, &length))
+	std::string records((const char*)data, length);
+
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		NAPI_THROW_ERROR("ERR_SOCKETPAIR", "socketpair() failed", NAPI_AUTO_LENGTH, NULL)
+	}
+
+	try {
+		connections.clear();
+
+		RelayOptions options = RelayOptions::parseSyslog(env, argv[0]);
+		std::shared_ptr<RelayConnection> conn = std::make_shared<SocketPairRelayConnection>(env, fds[0], options);
+		conn->init();
+		connections.push_back(conn);
+		conn->add(argv[3]);
+	} catch (std::exception& e) {
+		::close(fds[1]);
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	std::thread(replaySyslog, fds[1], records, repeat).detach();
+
+	NAPI_RETURN_UNDEFINED("syslog")
+}
+
+/**
+ * echo(options, listener, failReconnects)
+ * Creates a relay connection whose peer echoes back everything written to it. Use `echoWrite()` to
+ * send data and `echoClose()` to end the stream. With the reconnect option, closing the stream
+ * disconnects instead and the connection reconnects to a new echo peer after `failReconnects`
+ * failed attempts.
+ */
+NAPI_METHOD(echo) {
+	NAPI_ARGV(3);
+
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		NAPI_THROW_ERROR("ERR_SOCKETPAIR", "socketpair() failed", NAPI_AUTO_LENGTH, NULL)
+	}
+
+	try {
+		connections.clear();
+
+		RelayOptions options = RelayOptions::parse(env, argv[0]);
+		std::shared_ptr<SocketPairRelayConnection> conn = std::make_shared<SocketPairRelayConnection>(env, fds[0], options);
+		::napi_get_value_uint32(env, argv[2], &conn->failReconnects);
+		conn->init();
+		connections.push_back(conn);
+		conn->add(argv[1]);
+	} catch (std::exception& e) {
+		::close(fds[1]);
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	std::thread(echoPeer, fds[1]).detach();
+
+	NAPI_RETURN_UNDEFINED("echo")
+}
+
+/**
+ * echoWrite(data, callback)
+ * Writes to the most recent relay connection. Returns false if the write queue is full.
+ */
+NAPI_METHOD(echoWrite) {
+	NAPI_ARGV(2);
+
+	if (connections.empty()) {
+		NAPI_THROW_ERROR("ERR_RELAY", "No relay connection", NAPI_AUTO_LENGTH, NULL)
+	}
+
+	bool ok = false;
+	try {
+		ok = connections.back()->write(argv[0], argv[1]);
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	napi_value rval;
+	NAPI_STATUS_THROWS(::napi_get_boolean(env, ok, &rval))
+	return rval;
+}
+
+/**
+ * echoClose()
+ * Shuts down the write side of the most recent relay connection. The echo peer then closes its
+ * end, which ends the relay.
+ */
+NAPI_METHOD(echoClose) {
+	if (!connections.empty()) {
+		static_cast<SocketPairRelayConnection*>(connections.back().get())->shutdownWrite();
+	}
+	NAPI_RETURN_UNDEFINED("echoClose")
+}
+
+/**
+ * echoSlabs()
+ * Returns the number of slabs of the most recent relay connection that are still referenced and
+ * the number waiting in its pool to be reused.
+ */
+NAPI_METHOD(echoSlabs) {
+	if (connections.empty()) {
+		NAPI_THROW_ERROR("ERR_RELAY", "No relay connection", NAPI_AUTO_LENGTH, NULL)
+	}
+
+	std::shared_ptr<RelaySlabPool> pool = static_cast<SocketPairRelayConnection*>(connections.back().get())->getSlabPool();
+	napi_value rval, tmp;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &rval))
+	NAPI_STATUS_THROWS(::napi_create_uint32(env, (uint32_t)pool->idle(), &tmp))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, rval, "idle", tmp))
+	NAPI_STATUS_THROWS(::napi_create_uint32(env, pool->inUse(), &tmp))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, rval, "inUse", tmp))
+	return rval;
+}
+
+/**
+ * A port proxy that watches its sockets with `poll()` on a background thread and connects clients
+ * to a TCP port on the loopback interface instead of a device.
+ */
+class PollPortProxy : public PortProxy {
+public:
+	PollPortProxy(uint32_t targetPort, uint32_t localPort) :
+		PortProxy(targetPort, localPort), stopping(false) {
+		if (::pipe(wakeFds) != 0) {
+			throw std::runtime_error("pipe() failed");
+		}
+		::fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
+		::fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+		poller = std::thread(&PollPortProxy::run, this);
+	}
+
+	virtual ~PollPortProxy() {
+		stop();
+		stopping = true;
+		wake();
+		poller.join();
+		::close(wakeFds[0]);
+		::close(wakeFds[1]);
+	}
+
+protected:
+	int connectDevice() {
+		int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			return -1;
+		}
+
+		struct sockaddr_in addr;
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)devicePort);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	/**
+	 * Polls the watched sockets and hands readiness to the proxy until stopped. The set of watched
+	 * sockets is copied so that the proxy can change it while the events are being handled.
+	 */
+	void run() {
+		std::vector<struct pollfd> fds;
+		while (!stopping) {
+			fds.clear();
+			fds.push_back({ wakeFds[0], POLLIN, 0 });
+			{
+				std::lock_guard<std::mutex> guard(watchLock);
+				for (auto& it : watches) {
+					if (it.second) {
+						fds.push_back({ it.first, it.second, 0 });
+					}
+				}
+			}
+
+			if (::poll(fds.data(), fds.size(), -1) <= 0) {
+				continue;
+			}
+
+			if (fds[0].revents) {
+				char buffer[64];
+				while (::read(wakeFds[0], buffer, sizeof(buffer)) > 0);
+			}
+
+			for (size_t i = 1; i < fds.size(); ++i) {
+				if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+					onReadable(fds[i].fd);
+				}
+				if (fds[i].revents & POLLOUT) {
+					onWritable(fds[i].fd);
+				}
+			}
+		}
+	}
+
+	void unwatch(int fd) {
+		std::lock_guard<std::mutex> guard(watchLock);
+		watches.erase(fd);
+	}
+
+	void wake() {
+		char c = 0;
+		ssize_t n = ::write(wakeFds[1], &c, 1);
+		(void)n;
+	}
+
+	void watch(int fd, bool read, bool write) {
+		{
+			std::lock_guard<std::mutex> guard(watchLock);
+			watches[fd] = (short)((read ? POLLIN : 0) | (write ? POLLOUT : 0));
+		}
+		if (std::this_thread::get_id() != poller.get_id()) {
+			wake();
+		}
+	}
+
+	std::atomic<bool>    stopping;
+	int                  wakeFds[2];
+	std::thread          poller;
+	std::mutex           watchLock;
+	std::map<int, short> watches;
+};
+
+static std::list<std::shared_ptr<PortProxy>> proxies;
+
+/**
+ * proxy(targetPort, localPort)
+ * Listens on the local port and proxies each client to the target port on the loopback interface.
+ * Returns the local port.
+ */
+NAPI_METHOD(proxy) {
+	NAPI_ARGV(2);
+
+	uint32_t targetPort = 0;
+	uint32_t localPort = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &targetPort))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &localPort))
+
+	try {
+		std::shared_ptr<PortProxy> proxy = std::make_shared<PollPortProxy>(targetPort, localPort);
+		proxy->init();
+		proxy->start();
+		proxies.push_back(proxy);
+		localPort = proxy->getLocalPort();
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_PROXY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	napi_value rval;
+	NAPI_STATUS_THROWS(::napi_create_uint32(env, localPort, &rval))
+	return rval;
+}
+
+/**
+ * proxyClose()
+ * Stops all port proxies and disconnects their clients.
+ */
+NAPI_METHOD(proxyClose) {
+	proxies.clear();
+	NAPI_RETURN_UNDEFINED("proxyClose")
+}
+
+/**
+ * Echoes everything read from the socket back to it prefixed with the peer's name, standing in for
+ * a port on the device that answers each connection separately.
+ */
+static void namedEchoPeer(int fd, std::string name) {
+	char buffer[4096];
+	while (1) {
+		ssize_t n = ::read(fd, buffer, sizeof(buffer));
+		if (n <= 0) {
+			break;
+		}
+		std::string reply = name + ":" + std::string(buffer, (size_t)n);
+		if (::write(fd, reply.data(), reply.size()) != (ssize_t)reply.size()) {
+			break;
+		}
+	}
+	::close(fd);
+}
+
+/**
+ * socketPool(poolSize, steps)
+ * Drives an idle socket pool for a single port through the steps, each an array of the action, the
+ * handle, and for some actions a string:
+ *
+ *   - `open`: acquires a socket for the handle, connecting a new socketpair if the pool is empty
+ *   - `stop`: parks the handle's socket, or closes it if the pool is full
+ *   - `write`: writes the string to the handle's socket and reads back the reply
+ *   - `send`: writes the string from the device's end of the handle's socket, even once stopped
+ *   - `closePeer`: closes the device's end of the handle's socket, even once stopped
+ *
+ * Each socketpair's device end is echoed back prefixed with `peer<n>`, numbered in the order they
+ * were connected. Returns the number of connects, the number of idle sockets left, and the replies.
+ */
+NAPI_METHOD(socketPool) {
+	NAPI_ARGV(2);
+
+	const uint32_t port = 1;
+	uint32_t poolSize = 0;
+	uint32_t count = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &poolSize))
+	NAPI_STATUS_THROWS(::napi_get_array_length(env, argv[1], &count))
+
+	std::map<uint32_t, int> handles;
+	std::map<uint32_t, int> handlePeers;
+	std::map<int, int> peers;
+	std::list<std::thread> threads;
+	std::vector<std::string> replies;
+	uint32_t connects = 0;
+	size_t idle = 0;
+
+	{
+		RelaySocketPool pool;
+		pool.reserve(port, poolSize);
+
+		auto connect = [&]() {
+			int fds[2];
+			if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+				return -1;
+			}
+			peers[fds[0]] = fds[1];
+			threads.emplace_back(namedEchoPeer, fds[1], "peer" + std::to_string(++connects));
+			return fds[0];
+		};
+
+		for (uint32_t i = 0; i < count; ++i) {
+			napi_value step, value;
+			uint32_t handle = 0;
+			std::string data;
+			NAPI_STATUS_THROWS(::napi_get_element(env, argv[1], i, &step))
+			NAPI_STATUS_THROWS(::napi_get_element(env, step, 0, &value))
+			std::string action = getString(env, value);
+			NAPI_STATUS_THROWS(::napi_get_element(env, step, 1, &value))
+			NAPI_STATUS_THROWS(::napi_get_value_uint32(env, value, &handle))
+			if (action == "write" || action == "send") {
+				NAPI_STATUS_THROWS(::napi_get_element(env, step, 2, &value))
+				data = getString(env, value);
+			}
+
+			if (action == "open") {
+				handles[handle] = pool.acquire(port, connect);
+				handlePeers[handle] = peers[handles[handle]];
+			} else if (action == "stop") {
+				if (pool.hasRoom(port)) {
+					pool.park(port, handles[handle]);
+				} else {
+					::close(handles[handle]);
+				}
+				handles.erase(handle);
+			} else if (action == "write") {
+				int fd = handles[handle];
+				char buffer[4096];
+				ssize_t n = -1;
+				struct pollfd pfd = { fd, POLLIN, 0 };
+				if (::write(fd, data.data(), data.size()) == (ssize_t)data.size() && ::poll(&pfd, 1, 1000) == 1) {
+					n = ::read(fd, buffer, sizeof(buffer));
+				}
+				replies.push_back(n > 0 ? std::string(buffer, (size_t)n) : std::string());
+			} else if (action == "send") {
+				::send(handlePeers[handle], data.data(), data.size(), 0);
+			} else if (action == "closePeer") {
+				::shutdown(handlePeers[handle], SHUT_RDWR);
+			}
+		}
+
+		idle = pool.idleCount(port);
+		for (auto const& it : handles) {
+			::close(it.second);
+		}
+	}
+
+	// the pool has closed its idle sockets, so every peer sees the end of its stream
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	napi_value result, value, list;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_uint32(env, connects, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "connects", value))
+	NAPI_STATUS_THROWS(::napi_create_uint32(env, (uint32_t)idle, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "idle", value))
+	NAPI_STATUS_THROWS(::napi_create_array_with_length(env, replies.size(), &list))
+	for (uint32_t i = 0; i < replies.size(); ++i) {
+		NAPI_STATUS_THROWS(::napi_create_string_utf8(env, replies[i].c_str(), replies[i].size(), &value))
+		NAPI_STATUS_THROWS(::napi_set_element(env, list, i, value))
+	}
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "replies", list))
+	return result;
+}
+
+/**
+ * stats()
+ * Returns the combined stats of the relay connections from the most recent run.
+ */
+NAPI_METHOD(stats) {
+	if (connections.empty()) {
+		NAPI_THROW_ERROR("ERR_RELAY", "No relay connection", NAPI_AUTO_LENGTH, NULL)
+	}
+	RelayStatsSnapshot total;
+	for (auto const& conn : connections) {
+		total.merge(conn->getStats());
+	}
+	return total.toJS(env);
+}
+
+/**
+ * captureFiles(path)
+ * Returns the capture files for a capture path from oldest to newest.
+ */
+NAPI_METHOD(captureFiles) {
+	NAPI_ARGV(1);
+	napi_value rval, tmp;
+	std::vector<std::string> files;
+
+	try {
+		files = RelayCaptureReader::list(getString(env, argv[0]));
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_CAPTURE_READ", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	NAPI_STATUS_THROWS(::napi_create_array_with_length(env, files.size(), &rval))
+	for (uint32_t i = 0; i < files.size(); ++i) {
+		NAPI_STATUS_THROWS(::napi_create_string_utf8(env, files[i].c_str(), NAPI_AUTO_LENGTH, &tmp))
+		NAPI_STATUS_THROWS(::napi_set_element(env, rval, i, tmp))
+	}
+	return rval;
+}
+
+/**
+ * captureRead(file, offset, maxFrames)
+ * Reads up to `maxFrames` frames from a capture file starting at a record offset.
+ */
+NAPI_METHOD(captureRead) {
+	NAPI_ARGV(3);
+	double offset = 0;
+	uint32_t maxFrames = 0;
+	::napi_get_value_double(env, argv[1], &offset);
+	::napi_get_value_uint32(env, argv[2], &maxFrames);
+
+	try {
+		return RelayCaptureReader(getString(env, argv[0])).read(env, (uint64_t)offset, maxFrames);
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_CAPTURE_READ", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+}
+
+/**
+ * captureSeek(file, time)
+ * Returns the offset of the first record in a capture file at or after a time in milliseconds
+ * since the epoch.
+ */
+NAPI_METHOD(captureSeek) {
+	NAPI_ARGV(2);
+	double time = 0;
+	uint64_t offset = 0;
+	::napi_get_value_double(env, argv[1], &time);
+
+	try {
+		offset = RelayCaptureReader(getString(env, argv[0])).seek(time);
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_CAPTURE_READ", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	napi_value rval;
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)offset, &rval))
+	return rval;
+}
+
+/**
+ * The properties `Device::toJS()` sets on each device object.
+ */
+static const char* benchDeviceProps[] = {
+	"name", "buildVersion", "cpuArchitecture", "deviceClass", "deviceColor", "hardwareModel",
+	"modelNumber", "productType", "productVersion", "serialNumber"
+};
+
+/**
+ * Builds a device object the same way `Device::toJS()` does, creating every string on each call.
+ * When `push` is set, the interfaces array is filled by calling `push()` like it used to be.
+ */
+static napi_value benchDeviceToJS(napi_env env, const std::string& udid, bool push) {
+	napi_value obj, tmp, ifaces;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &obj))
+	NAPI_STATUS_THROWS(::napi_create_string_utf8(env, udid.c_str(), NAPI_AUTO_LENGTH, &tmp))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, obj, "udid", tmp))
+
+	NAPI_STATUS_THROWS(::napi_create_string_utf8(env, "USB", NAPI_AUTO_LENGTH, &tmp))
+	if (push) {
+		napi_value fn;
+		NAPI_STATUS_THROWS(::napi_create_array(env, &ifaces))
+		NAPI_STATUS_THROWS(::napi_get_named_property(env, ifaces, "push", &fn))
+		NAPI_STATUS_THROWS(::napi_call_function(env, ifaces, fn, 1, &tmp, NULL))
+	} else {
+		NAPI_STATUS_THROWS(::napi_create_array_with_length(env, 1, &ifaces))
+		NAPI_STATUS_THROWS(::napi_set_element(env, ifaces, 0, tmp))
+	}
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, obj, "interfaces", ifaces))
+
+	for (auto name : benchDeviceProps) {
+		std::string value = std::string(name) + " of " + udid;
+		NAPI_STATUS_THROWS(::napi_create_string_utf8(env, value.c_str(), NAPI_AUTO_LENGTH, &tmp))
+		NAPI_STATUS_THROWS(::napi_set_named_property(env, obj, name, tmp))
+	}
+	NAPI_STATUS_THROWS(::napi_get_boolean(env, true, &tmp))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, obj, "trustedHostAttached", tmp))
+
+	return obj;
+}
+
+/**
+ * deviceList(mode, devices, calls)
+ * Calls a stand-in for `list()` `calls` times with `devices` connected devices. `mode` is "push"
+ * for the old list that rebuilt every device object and called `push()` for each one, "cached" for
+ * the generation-versioned cache when nothing changes between calls, or "changed" for the cache
+ * when one device changes before every call. Returns `{ calls, ns }`.
+ */
+NAPI_METHOD(deviceList) {
+	NAPI_ARGV(3);
+
+	char mode[16];
+	uint32_t count = 0, calls = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_string_utf8(env, argv[0], mode, sizeof(mode), NULL))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &count))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &calls))
+
+	bool push = ::strcmp(mode, "push") == 0;
+	bool changed = ::strcmp(mode, "changed") == 0;
+
+	std::vector<std::string> udids;
+	std::vector<uint64_t> generations(count, 1);
+	for (uint32_t i = 0; i < count; ++i) {
+		char udid[41];
+		::snprintf(udid, sizeof(udid), "%08x%032x", i, i * 2654435761u);
+		udids.push_back(udid);
+	}
+
+	DeviceListCache cache(env);
+	uint64_t generation = 1;
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t call = 0; call < calls; ++call) {
+		napi_handle_scope scope;
+		NAPI_STATUS_THROWS(::napi_open_handle_scope(env, &scope))
+
+		if (push) {
+			napi_value list, fn;
+			NAPI_STATUS_THROWS(::napi_create_array(env, &list))
+			NAPI_STATUS_THROWS(::napi_get_named_property(env, list, "push", &fn))
+			for (auto const& udid : udids) {
+				napi_value device = benchDeviceToJS(env, udid, true);
+				NAPI_STATUS_THROWS(::napi_call_function(env, list, fn, 1, &device, NULL))
+			}
+		} else {
+			if (changed && count > 0) {
+				generations[call % count] = ++generation;
+			}
+			if (!cache.get(generation)) {
+				std::vector<napi_value> objects;
+				for (uint32_t i = 0; i < count; ++i) {
+					napi_value device = cache.device(udids[i], generations[i], [&]() { return benchDeviceToJS(env, udids[i], false); });
+					NAPI_STATUS_THROWS(device ? napi_ok : napi_generic_failure)
+					objects.push_back(device);
+				}
+				NAPI_STATUS_THROWS(cache.set(generation, objects) ? napi_ok : napi_generic_failure)
+			}
+		}
+
+		NAPI_STATUS_THROWS(::napi_close_handle_scope(env, scope))
+	}
+
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)calls, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "calls", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, ns, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "ns", value))
+	return result;
+}
+
+/**
+ * propCacheGet(path, udid)
+ * Opens the device property cache at `path` and returns the cached properties for the device, or
+ * `null` if it isn't cached.
+ */
+NAPI_METHOD(propCacheGet) {
+	NAPI_ARGV(2);
+
+	DevicePropCache cache(getString(env, argv[0]));
+	std::map<std::string, std::string> props;
+	napi_value rval;
+
+	if (!cache.get(getString(env, argv[1]), props)) {
+		NAPI_STATUS_THROWS(::napi_get_null(env, &rval))
+		return rval;
+	}
+
+	NAPI_STATUS_THROWS(::napi_create_object(env, &rval))
+	for (auto const& it : props) {
+		napi_value value;
+		NAPI_STATUS_THROWS(::napi_create_string_utf8(env, it.second.c_str(), it.second.size(), &value))
+		NAPI_STATUS_THROWS(::napi_set_named_property(env, rval, it.first.c_str(), value))
+	}
+	return rval;
+}
+
+/**
+ * propCachePut(path, udid, props)
+ * Opens the device property cache at `path` and caches the string properties for the device.
+ */
+NAPI_METHOD(propCachePut) {
+	NAPI_ARGV(3);
+
+	DevicePropCache cache(getString(env, argv[0]));
+	std::map<std::string, std::string> props;
+	napi_value names;
+	uint32_t count = 0;
+
+	NAPI_STATUS_THROWS(::napi_get_property_names(env, argv[2], &names))
+	NAPI_STATUS_THROWS(::napi_get_array_length(env, names, &count))
+	for (uint32_t i = 0; i < count; ++i) {
+		napi_value name, value;
+		NAPI_STATUS_THROWS(::napi_get_element(env, names, i, &name))
+		NAPI_STATUS_THROWS(::napi_get_property(env, argv[2], name, &value))
+		props[getString(env, name)] = getString(env, value);
+	}
+
+	cache.put(getString(env, argv[1]), props);
+
+	napi_value rval;
+	NAPI_STATUS_THROWS(::napi_get_boolean(env, cache.isOpen(), &rval))
+	return rval;
+}
+
+/**
+ * The handle a simulated device notification carries. Each notification gets a new `id`, the same
+ * way MobileDevice hands out a new `am_device` every time an interface connects.
+ */
+struct BenchHandle {
+	uint32_t id;
+	bool     usb;
+};
+
+/**
+ * A stand-in for a `Device` in the registry. Like `Device`, it's created with the interface it was
+ * probed through and its interfaces are changed in place by the notifier thread and read from any
+ * thread.
+ */
+struct BenchDevice {
+	BenchDevice(BenchHandle& dev) : usb(false), wifi(false), handle(0), generation(0) {
+		config(dev, true);
+	}
+
+	/**
+	 * Connects or disconnects the interface the notification's handle is for and remembers the
+	 * handle, like `Device::config()`.
+	 */
+	void config(BenchHandle& dev, bool connected) {
+		(dev.usb ? usb : wifi) = connected;
+		handle = dev.id;
+	}
+
+	inline bool getUsb() const { return usb; }
+	inline bool getWifi() const { return wifi; }
+	inline bool isDisconnected() const { return !usb && !wifi; }
+	inline bool isResumable() const { return false; }
+
+	std::atomic<bool> usb;
+	std::atomic<bool> wifi;
+	std::atomic<uint32_t> handle;
+	std::atomic<uint64_t> generation;
+};
+
+/**
+ * A device probed by a bench notifier's probe workers, waiting to be published.
+ */
+struct BenchProbed {
+	std::string                  udid;
+	BenchHandle                  dev;
+	std::shared_ptr<BenchDevice> device;
+};
+
+/**
+ * Drives the same device notification logic as `DeviceMan` with stand-in devices. New devices are
+ * handed to a probe pool of `workers` threads that takes `handshakeUs` microseconds to handshake
+ * with each one, followed by a refresh that checks probes for the same device never overlap or run
+ * out of order. Without workers, devices are probed right away on the notifier thread. Listeners
+ * are always ready, so every change is queued and counted.
+ */
+class BenchNotifier : public DeviceNotifier<BenchDevice, BenchHandle> {
+public:
+	BenchNotifier(uint32_t flapWindow, uint32_t workers, uint32_t handshakeUs);
+	virtual ~BenchNotifier();
+
+	uint64_t errors();
+	inline uint32_t expire() { return expireHeld(); }
+	inline void notify(const std::string& udid, BenchHandle dev, bool connected) { onNotification(udid, dev, connected); }
+	bool onProbed();
+	inline void probeStats(ProbeStatsSnapshot& stats) { pool.snapshot(stats); }
+
+	std::atomic<uint64_t> attached;
+	std::atomic<uint64_t> detached;
+	std::atomic<int64_t>  firstPublishUs;
+	std::atomic<uint64_t> handshakes;
+	std::atomic<uint64_t> updated;
+
+private:
+	void onPublished(const std::string& udid, bool connected, const DevicePublished<BenchDevice>& published);
+	void probe(const std::string& udid, BenchHandle dev);
+	void queueChange(const std::string& udid, DeviceChangeType type, const char* iface);
+	void release(BenchHandle dev);
+	void retain(BenchHandle dev);
+
+	uint32_t workers;
+	uint32_t handshakeUs;
+	std::chrono::steady_clock::time_point start;
+	ProbePool pool;
+
+	// stands in for the run loop source the probe workers signal
+	std::mutex probedLock;
+	std::condition_variable probedCond;
+	std::vector<BenchProbed> probed;
+	std::set<std::string> running;
+	std::set<std::string> handshook;
+	uint32_t refreshing;
+	uint64_t overlaps;
+
+	// only used on the notifier thread
+	int64_t retained;
+};
+
+/**
+ * Creates the notifier with listeners that are ready right away.
+ */
+BenchNotifier::BenchNotifier(uint32_t flapWindow, uint32_t workers, uint32_t handshakeUs) :
+	DeviceNotifier<BenchDevice, BenchHandle>(flapWindow),
+	attached(0),
+	detached(0),
+	firstPublishUs(-1),
+	handshakes(0),
+	updated(0),
+	workers(workers),
+	handshakeUs(handshakeUs),
+	start(std::chrono::steady_clock::now()),
+	pool(workers ? workers : 1),
+	refreshing(0),
+	overlaps(0),
+	retained(0) {
+	initialized = true;
+}
+
+/**
+ * Waits for the probe workers to finish.
+ */
+BenchNotifier::~BenchNotifier() {
+	pool.stop();
+}
+
+/**
+ * Returns the number of probes that overlapped or ran out of order, plus one if a held
+ * notification's handle was never released.
+ */
+uint64_t BenchNotifier::errors() {
+	std::lock_guard<std::mutex> guard(probedLock);
+	return overlaps + (retained != 0 ? 1 : 0);
+}
+
+/**
+ * Waits for the probe workers to finish with a device, then publishes the devices they've finished
+ * with like `DeviceMan::onProbed()`. Returns false once nothing is being probed or refreshed.
+ */
+bool BenchNotifier::onProbed() {
+	std::vector<BenchProbed> done;
+	{
+		std::unique_lock<std::mutex> guard(probedLock);
+		probedCond.wait(guard, [this]() { return !probed.empty() || (!isProbing() && refreshing == 0); });
+		if (probed.empty()) {
+			return false;
+		}
+		done.swap(probed);
+	}
+
+	for (auto& it : done) {
+		finishProbe(it.udid, it.dev, it.device);
+	}
+	return true;
+}
+
+/**
+ * Nothing to do, the changes are counted as they're queued.
+ */
+void BenchNotifier::onPublished(const std::string& udid, bool connected, const DevicePublished<BenchDevice>& published) {}
+
+/**
+ * Handshakes with a new device, then queues a refresh of it behind the probe.
+ */
+void BenchNotifier::probe(const std::string& udid, BenchHandle dev) {
+	if (!workers) {
+		if (handshakeUs) {
+			std::this_thread::sleep_for(std::chrono::microseconds(handshakeUs));
+		}
+		++handshakes;
+		finishProbe(udid, dev, std::make_shared<BenchDevice>(dev));
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(probedLock);
+		++refreshing;
+	}
+
+	pool.submit(udid, [this, udid, dev]() mutable {
+		{
+			std::lock_guard<std::mutex> guard(probedLock);
+			if (!running.insert(udid).second) {
+				++overlaps;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds(handshakeUs));
+		++handshakes;
+
+		{
+			std::lock_guard<std::mutex> guard(probedLock);
+			running.erase(udid);
+			handshook.insert(udid);
+			probed.push_back({ udid, dev, std::make_shared<BenchDevice>(dev) });
+		}
+		probedCond.notify_one();
+		return true;
+	});
+
+	// a refresh of the same device must wait for the probe
+	pool.submit(udid, [this, udid]() {
+		{
+			std::lock_guard<std::mutex> guard(probedLock);
+			if (running.count(udid) || !handshook.count(udid)) {
+				++overlaps;
+			}
+			--refreshing;
+		}
+		probedCond.notify_one();
+		return true;
+	});
+}
+
+/**
+ * Counts a change and when the first device was published.
+ */
+void BenchNotifier::queueChange(const std::string& udid, DeviceChangeType type, const char* iface) {
+	if (type == AttachChange) {
+		if (attached++ == 0) {
+			firstPublishUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	} else if (type == DetachChange) {
+		++detached;
+	} else {
+		++updated;
+	}
+}
+
+/**
+ * Counts a held notification's handle as released.
+ */
+void BenchNotifier::release(BenchHandle dev) {
+	--retained;
+}
+
+/**
+ * Counts a held notification's handle as retained.
+ */
+void BenchNotifier::retain(BenchHandle dev) {
+	++retained;
+}
+
+/**
+ * registryStress(devices, changes, probeUs)
+ * Drives a storm of `changes` random connect and disconnect notifications for `devices` devices
+ * through a `BenchNotifier` on a simulated notifier thread while the calling thread keeps looking
+ * up and listing devices. New devices take `probeUs` microseconds to probe on the notifier thread
+ * and disconnected devices aren't held. Every snapshot the reader sees is checked for a generation
+ * that went backwards or too many devices, and the final generation is checked against the number
+ * of changes the notifier published. Returns `{ published, generation, reads, errors, maxReadNs }`.
+ */
+NAPI_METHOD(registryStress) {
+	NAPI_ARGV(3);
+
+	uint32_t count = 0, changes = 0, probeUs = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &count))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &changes))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &probeUs))
+
+	std::vector<std::string> udids;
+	for (uint32_t i = 0; i < count; ++i) {
+		udids.push_back("stress-" + std::to_string(i));
+	}
+
+	BenchNotifier notifier(0, 0, probeUs);
+	std::atomic<bool> done(false);
+
+	std::thread thread([&]() {
+		std::mt19937 rng(1234);
+		for (uint32_t i = 0; i < changes; ++i) {
+			const std::string& udid = udids[rng() % count];
+			bool usb = rng() & 1;
+			bool connected = rng() & 1;
+			notifier.notify(udid, { i, usb }, connected);
+		}
+		done = true;
+	});
+
+	uint64_t reads = 0, errors = 0, lastGeneration = 0;
+	int64_t maxReadNs = 0;
+	size_t next = 0;
+
+	do {
+		auto start = std::chrono::steady_clock::now();
+
+		auto snapshot = notifier.snapshot();
+		auto found = snapshot->devices.find(udids[next++ % count]);
+		size_t listed = 0;
+		for (auto const& it : snapshot->devices) {
+			if (it.second->usb || it.second->wifi) {
+				++listed;
+			}
+		}
+
+		int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		maxReadNs = std::max(maxReadNs, ns);
+
+		if (snapshot->generation < lastGeneration || snapshot->devices.size() > count || listed > count || (found != snapshot->devices.end() && !found->second)) {
+			++errors;
+		}
+		lastGeneration = snapshot->generation;
+		++reads;
+	} while (!done);
+
+	thread.join();
+
+	uint64_t published = notifier.attached + notifier.detached + notifier.updated;
+	uint64_t generation = notifier.snapshot()->generation;
+	if (generation != published) {
+		++errors;
+	}
+	errors += notifier.errors();
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)published, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "published", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)generation, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "generation", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)reads, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "reads", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)errors, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "errors", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)maxReadNs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "maxReadNs", value))
+	return result;
+}
+
+/**
+ * probeStorm(devices, handshakeUs, workers)
+ * Simulates a hub of `devices` devices powering on at once. A simulated notifier thread sends a USB
+ * and a Wi-Fi connect notification for each device to a `BenchNotifier`, which hands new devices to
+ * a probe pool of `workers` threads that takes `handshakeUs` microseconds to handshake with each
+ * one. The calling thread keeps listing devices meanwhile. Returns
+ * `{ published, elapsedUs, firstPublishUs, errors, maxReadNs, stats }`.
+ */
+NAPI_METHOD(probeStorm) {
+	NAPI_ARGV(3);
+
+	uint32_t count = 0, handshakeUs = 0, workers = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &count))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &handshakeUs))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &workers))
+
+	std::vector<std::string> udids;
+	for (uint32_t i = 0; i < count; ++i) {
+		udids.push_back("probe-" + std::to_string(i));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	BenchNotifier notifier(0, workers, handshakeUs);
+	std::atomic<bool> done(false);
+	uint64_t errors = 0;
+
+	std::thread thread([&]() {
+		for (uint32_t i = 0; i < count; ++i) {
+			notifier.notify(udids[i], { i * 2, true }, true);
+			notifier.notify(udids[i], { i * 2 + 1, false }, true);
+		}
+		while (notifier.onProbed()) {}
+		done = true;
+	});
+
+	int64_t maxReadNs = 0;
+	do {
+		auto readStart = std::chrono::steady_clock::now();
+		auto snapshot = notifier.snapshot();
+		size_t listed = 0;
+		for (auto const& it : snapshot->devices) {
+			if (it.second->usb || it.second->wifi) {
+				++listed;
+			}
+		}
+		int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStart).count();
+		maxReadNs = std::max(maxReadNs, ns);
+		if (listed > count) {
+			++errors;
+		}
+		std::this_thread::yield();
+	} while (!done);
+
+	thread.join();
+	int64_t elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	// every device must end up with both interfaces once the held notifications are applied
+	for (auto const& it : notifier.snapshot()->devices) {
+		if (!it.second->usb || !it.second->wifi) {
+			++errors;
+		}
+	}
+	errors += notifier.errors();
+
+	// the last refresh signals the notifier just before the pool records it
+	ProbeStatsSnapshot stats;
+	do {
+		std::this_thread::yield();
+		notifier.probeStats(stats);
+	} while (stats.probes < (uint64_t)count * 2);
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)notifier.attached, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "published", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)elapsedUs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "elapsedUs", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)notifier.firstPublishUs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "firstPublishUs", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)errors, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "errors", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)maxReadNs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "maxReadNs", value))
+	value = stats.toJS(env);
+	if (!value) {
+		return NULL;
+	}
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "stats", value))
+	return result;
+}
+
+/**
+ * flapStorm(devices, flaps, windowMs, handshakeUs)
+ * Simulates `devices` devices on flaky cables that each disconnect and reconnect `flaps` times in
+ * quick succession through a `BenchNotifier` with a `windowMs` flap window. Every reconnect carries
+ * a new handle. A device that reconnects while it's still held must be the same device configured
+ * with the new handle, otherwise it's probed again with a `handshakeUs` microsecond handshake.
+ * Every device then disconnects for good and is expired by following `expire()` like the expire
+ * timer does. Returns `{ reused, handshakes, flaps, expired, errors, stormUs, expireUs }`.
+ */
+NAPI_METHOD(flapStorm) {
+	NAPI_ARGV(4);
+
+	uint32_t count = 0, flaps = 0, window = 0, handshakeUs = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &count))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &flaps))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &window))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[3], &handshakeUs))
+
+	std::vector<std::string> udids;
+	for (uint32_t i = 0; i < count; ++i) {
+		udids.push_back("flap-" + std::to_string(i));
+	}
+
+	BenchNotifier notifier(window, 0, handshakeUs);
+	uint32_t handle = 0;
+	uint64_t reused = 0, expired = 0, errors = 0, total = 0;
+
+	for (auto const& udid : udids) {
+		notifier.notify(udid, { handle++, true }, true);
+	}
+	uint64_t probed = notifier.handshakes;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < flaps; ++i) {
+		for (auto const& udid : udids) {
+			std::shared_ptr<BenchDevice> before = notifier.snapshot()->devices.at(udid);
+			notifier.notify(udid, { before->handle, true }, false);
+
+			uint64_t handshakes = notifier.handshakes;
+			BenchHandle dev = { handle++, true };
+			notifier.notify(udid, dev, true);
+
+			auto snapshot = notifier.snapshot();
+			auto after = snapshot->devices.find(udid);
+			if (after == snapshot->devices.end() || !after->second->usb || after->second->handle != dev.id) {
+				++errors;
+			} else if (after->second == before) {
+				if (notifier.handshakes != handshakes) {
+					++errors;
+				}
+				++reused;
+			}
+		}
+	}
+	auto stormUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (auto const& udid : udids) {
+		notifier.notify(udid, { notifier.snapshot()->devices.at(udid)->handle, true }, false);
+	}
+	size_t held = notifier.snapshot()->devices.size();
+	for (uint32_t ms = notifier.expire(); ms > 0; ms = notifier.expire()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+	size_t remaining = notifier.snapshot()->devices.size();
+	expired = held - remaining;
+	auto expireUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (remaining != 0) {
+		++errors;
+	}
+	errors += notifier.errors();
+
+	std::map<std::string, uint64_t> stats;
+	notifier.flapStats(stats);
+	for (auto const& it : stats) {
+		total += it.second;
+	}
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)reused, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "reused", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)(notifier.handshakes - probed), &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "handshakes", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)total, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "flaps", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)expired, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "expired", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)errors, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "errors", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)stormUs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "stormUs", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)expireUs, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "expireUs", value))
+	return result;
+}
+
+/**
+ * watchBatch(coalesce, throttle, changes)
+ * Feeds `changes`, an array of `{ at, udid, type }` sorted by `at` where `type` is "attach",
+ * "detach", or "update", to a watch listener's `WatchBatch` on a simulated clock in milliseconds.
+ * The listener is primed at 0. A batch is taken right away when `add()` allows it, otherwise when
+ * the delay it returned passes, the same way `DeviceSubscriber::dispatch()` arms the listener's
+ * timer. Returns the batches that had changes left once folded as
+ * `[{ at, changes: [{ type, udid }] }]`.
+ */
+NAPI_METHOD(watchBatch) {
+	NAPI_ARGV(3);
+
+	WatchBatch batch;
+	uint32_t length = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[0], &batch.coalesce))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &batch.throttle))
+	NAPI_STATUS_THROWS(::napi_get_array_length(env, argv[2], &length))
+
+	napi_value result;
+	uint32_t taken = 0;
+	NAPI_STATUS_THROWS(::napi_create_array(env, &result))
+
+	auto take = [&](uint64_t now) -> bool {
+		napi_value entry, changes, value;
+		if (::napi_create_object(env, &entry) != napi_ok || ::napi_create_array(env, &changes) != napi_ok) {
+			return false;
+		}
+
+		std::vector<DeviceChange> folded = batch.take(now);
+		if (folded.empty()) {
+			return true;
+		}
+
+		uint32_t i = 0;
+		for (auto const& change : folded) {
+			napi_value obj;
+			const char* type = change.type == AttachChange ? "attach" : change.type == DetachChange ? "detach" : "update";
+			if (::napi_create_object(env, &obj) != napi_ok
+				|| ::napi_create_string_utf8(env, type, NAPI_AUTO_LENGTH, &value) != napi_ok
+				|| ::napi_set_named_property(env, obj, "type", value) != napi_ok
+				|| ::napi_create_string_utf8(env, change.udid.c_str(), NAPI_AUTO_LENGTH, &value) != napi_ok
+				|| ::napi_set_named_property(env, obj, "udid", value) != napi_ok
+				|| ::napi_set_element(env, changes, i++, obj) != napi_ok) {
+				return false;
+			}
+		}
+
+		return ::napi_create_double(env, (double)now, &value) == napi_ok
+			&& ::napi_set_named_property(env, entry, "at", value) == napi_ok
+			&& ::napi_set_named_property(env, entry, "changes", changes) == napi_ok
+			&& ::napi_set_element(env, result, taken++, entry) == napi_ok;
+	};
+
+	bool armed = false;
+	uint64_t due = 0;
+
+	for (uint32_t i = 0; i < length; ++i) {
+		napi_value change, value;
+		uint32_t at = 0;
+		NAPI_STATUS_THROWS(::napi_get_element(env, argv[2], i, &change))
+		NAPI_STATUS_THROWS(::napi_get_named_property(env, change, "at", &value))
+		NAPI_STATUS_THROWS(::napi_get_value_uint32(env, value, &at))
+		NAPI_STATUS_THROWS(::napi_get_named_property(env, change, "udid", &value))
+		std::string udid = getString(env, value);
+		NAPI_STATUS_THROWS(::napi_get_named_property(env, change, "type", &value))
+		std::string type = getString(env, value);
+
+		// the timer fires before a change that arrives after it's due
+		if (armed && due <= at) {
+			armed = false;
+			NAPI_STATUS_THROWS(take(due) ? napi_ok : napi_generic_failure)
+		}
+
+		DeviceChangeType changeType = type == "attach" ? AttachChange : type == "detach" ? DetachChange : UpdateChange;
+		uint64_t delay = batch.add({ { changeType, udid, "USB" } }, at);
+		if (delay == 0) {
+			NAPI_STATUS_THROWS(take(at) ? napi_ok : napi_generic_failure)
+		} else if (!armed) {
+			armed = true;
+			due = at + delay;
+		}
+	}
+
+	if (armed) {
+		NAPI_STATUS_THROWS(take(due) ? napi_ok : napi_generic_failure)
+	}
+
+	return result;
+}
+
+/**
+ * Builds roughly 1MB of complete frames, each with a `frameLength` byte payload, encoded for the
+ * specified framing mode.
+ */
+static std::string buildFrames(const RelayOptions& options, size_t frameLength) {
+	std::string data;
+	std::string payload(frameLength, 'x');
+
+	while (data.size() < 1024 * 1024) {
+		if (options.framing == LengthPrefixFraming) {
+			data += (char)((frameLength >> 24) & 0xff);
+			data += (char)((frameLength >> 16) & 0xff);
+			data += (char)((frameLength >> 8) & 0xff);
+			data += (char)(frameLength & 0xff);
+			data += payload;
+		} else if (options.framing == DelimiterFraming) {
+			data += payload;
+			data += options.delimiter;
+		} else {
+			data += payload;
+			data += '\n';
+		}
+	}
+
+	return data;
+}
+
+/**
+ * frame(options, frameLength, chunkSize, totalBytes)
+ * Runs the framer in isolation over synthetic data that is fed in `chunkSize` reads so that frames
+ * straddle read boundaries. Returns `{ frames, bytes, ns }`.
+ */
+NAPI_METHOD(frame) {
+	NAPI_ARGV(4);
+
+	uint32_t frameLength = 0, chunkSize = 0;
+	int64_t total = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[1], &frameLength))
+	NAPI_STATUS_THROWS(::napi_get_value_uint32(env, argv[2], &chunkSize))
+	NAPI_STATUS_THROWS(::napi_get_value_int64(env, argv[3], &total))
+
+	RelayOptions options;
+	try {
+		options = RelayOptions::parse(env, argv[0]);
+	} catch (std::exception& e) {
+		NAPI_THROW_ERROR("ERR_RELAY", e.what(), NAPI_AUTO_LENGTH, NULL)
+	}
+
+	std::string data = buildFrames(options, frameLength);
+	RelayFramer framer(std::make_shared<RelaySlabPool>(), options.framing, options.delimiter, options.maxFrameLength);
+
+	uint64_t frames = 0, bytes = 0;
+	size_t pos = 0, fed = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	while (fed < (size_t)total) {
+		size_t len = std::min((size_t)chunkSize, data.size() - pos);
+		for (auto const& span : framer.push(data.data() + pos, len)) {
+			++frames;
+			bytes += span.length;
+		}
+		fed += len;
+		pos = (pos + len) % data.size();
+	}
+	for (auto const& span : framer.flush()) {
+		++frames;
+		bytes += span.length;
+	}
+
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)frames, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "frames", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)bytes, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "bytes", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, ns, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "ns", value))
+	return result;
+}
+
+/**
+ * queue(kind, frames)
+ * Passes `frames` frames from a producer thread to the calling thread, which plays the role of the
+ * libuv thread. `kind` is either "ring" for the lock-free ring the relay uses or "mutex" for a
+ * mutex guarded `std::queue` as a baseline. Both queues are bounded to the ring's capacity and the
+ * producer yields when the queue is full. Returns `{ frames, ns }`.
+ */
+NAPI_METHOD(queue) {
+	NAPI_ARGV(2);
+
+	char kind[16];
+	int64_t total = 0;
+	NAPI_STATUS_THROWS(::napi_get_value_string_utf8(env, argv[0], kind, sizeof(kind), NULL))
+	NAPI_STATUS_THROWS(::napi_get_value_int64(env, argv[1], &total))
+
+	bool useRing = ::strcmp(kind, "ring") == 0;
+	uint64_t count = (uint64_t)total, sum = 0, popped = 0;
+	RelayRing<RelayFrame> ring;
+	std::mutex lock;
+	std::queue<RelayFrame> queue;
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread producer([&]() {
+		for (uint64_t i = 0; i < count; ++i) {
+			RelayFrame frame = { DataEvent, 0, NULL, 0, (uint32_t)(i & 0xff), i };
+			if (useRing) {
+				while (!ring.tryPush(frame)) {
+					std::this_thread::yield();
+				}
+			} else {
+				while (1) {
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						if (queue.size() < ring.capacity()) {
+							queue.push(frame);
+							break;
+						}
+					}
+					std::this_thread::yield();
+				}
+			}
+		}
+	});
+
+	RelayFrame frame;
+	while (popped < count) {
+		std::this_thread::yield();
+		if (useRing) {
+			while (ring.pop(frame)) {
+				sum += frame.length;
+				++popped;
+			}
+		} else {
+			while (1) {
+				std::lock_guard<std::mutex> guard(lock);
+				if (queue.empty()) {
+					break;
+				}
+				sum += queue.front().length;
+				queue.pop();
+				++popped;
+			}
+		}
+	}
+
+	producer.join();
+
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	napi_value result, value;
+	NAPI_STATUS_THROWS(::napi_create_object(env, &result))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)popped, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "frames", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, (double)sum, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "checksum", value))
+	NAPI_STATUS_THROWS(::napi_create_double(env, ns, &value))
+	NAPI_STATUS_THROWS(::napi_set_named_property(env, result, "ns", value))
+	return result;
+}
+
+/**
+ * The benchmark never adds a log sink, so debug log messages are dropped as they're logged.
+ */
+NAPI_INIT() {
+	NAPI_EXPORT_FUNCTION(captureFiles);
+	NAPI_EXPORT_FUNCTION(captureRead);
+	NAPI_EXPORT_FUNCTION(captureSeek);
+	NAPI_EXPORT_FUNCTION(deviceList);
+	NAPI_EXPORT_FUNCTION(echo);
+	NAPI_EXPORT_FUNCTION(echoClose);
+	NAPI_EXPORT_FUNCTION(echoSlabs);
+	NAPI_EXPORT_FUNCTION(echoWrite);
+	NAPI_EXPORT_FUNCTION(fanIn);
+	NAPI_EXPORT_FUNCTION(flapStorm);
+	NAPI_EXPORT_FUNCTION(frame);
+	NAPI_EXPORT_FUNCTION(probeStorm);
+	NAPI_EXPORT_FUNCTION(propCacheGet);
+	NAPI_EXPORT_FUNCTION(propCachePut);
+	NAPI_EXPORT_FUNCTION(proxy);
+	NAPI_EXPORT_FUNCTION(proxyClose);
+	NAPI_EXPORT_FUNCTION(queue);
+	NAPI_EXPORT_FUNCTION(registryStress);
+	NAPI_EXPORT_FUNCTION(relay);
+	NAPI_EXPORT_FUNCTION(socketPool);
+	NAPI_EXPORT_FUNCTION(stats);
+	NAPI_EXPORT_FUNCTION(syslog);
+	NAPI_EXPORT_FUNCTION(watchBatch);
+}
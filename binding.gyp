@@ -1,9 +1,68 @@
 {
 	'variables': {
 		'v8_enable_pointer_compression': 0,
-		'v8_enable_31bit_smis_on_64bit_arch': 0
+		'v8_enable_31bit_smis_on_64bit_arch': 0,
+		'node_ios_device_bench%': 0
 	},
 	'conditions': [
+		['node_ios_device_bench==1', {
+			'targets': [
+				{
+					'target_name': 'node_ios_device_bench',
+					'sources': [
+						'bench/relay-bench.cpp',
+						'src/device-list.cpp',
+						'src/device-list.h',
+						'src/device-notifier.h',
+						'src/device-prop-cache.cpp',
+						'src/device-prop-cache.h',
+						'src/device-registry.h',
+						'src/flap-tracker.cpp',
+						'src/flap-tracker.h',
+						'src/port-proxy.cpp',
+						'src/port-proxy.h',
+						'src/probe-pool.cpp',
+						'src/probe-pool.h',
+						'src/relay-capture.cpp',
+						'src/relay-capture.h',
+						'src/relay-connection.cpp',
+						'src/relay-connection.h',
+						'src/relay-filter.cpp',
+						'src/relay-filter.h',
+						'src/relay-framer.cpp',
+						'src/relay-framer.h',
+						'src/relay-group.cpp',
+						'src/relay-group.h',
+						'src/relay-parser.cpp',
+						'src/relay-parser.h',
+						'src/relay-ring.h',
+						'src/relay-slab.cpp',
+						'src/relay-slab.h',
+						'src/relay-socket-pool.cpp',
+						'src/relay-socket-pool.h',
+						'src/relay-stats.cpp',
+						'src/relay-stats.h',
+						'src/watch-batch.cpp',
+						'src/watch-batch.h'
+					],
+					'include_dirs': [
+						'<(module_root_dir)/src'
+					],
+					'cflags!': [
+						'-fno-exceptions'
+					],
+					'cflags_cc!': [
+						'-fno-exceptions'
+					],
+					'xcode_settings': {
+						'OTHER_CPLUSPLUSFLAGS' : [ '-std=c++17', '-stdlib=libc++' ],
+						'OTHER_LDFLAGS': [ '-stdlib=libc++' ],
+						'MACOSX_DEPLOYMENT_TARGET': '10.11',
+						'GCC_ENABLE_CPP_EXCEPTIONS': 'YES'
+					}
+				}
+			]
+		}],
 		['OS=="mac"', {
 			'targets': [
 				{
@@ -13,17 +72,54 @@
 						"NODE_IOS_DEVICE_URL=\"<!(node -e \"process.stdout.write(require(\'./package.json\').homepage)\")\""
 					],
 					'sources': [
+						'src/cf-value.cpp',
+						'src/cf-value.h',
 						'src/device.cpp',
 						'src/device.h',
 						'src/device-interface.cpp',
 						'src/device-interface.h',
+						'src/device-list.cpp',
+						'src/device-list.h',
+						'src/device-notifier.h',
+						'src/device-prop-cache.cpp',
+						'src/device-prop-cache.h',
+						'src/device-registry.h',
+						'src/device-subscriber.cpp',
+						'src/device-subscriber.h',
 						'src/deviceman.cpp',
 						'src/deviceman.h',
+						'src/flap-tracker.cpp',
+						'src/flap-tracker.h',
 						'src/mobiledevice.h',
 						'src/node-ios-device.cpp',
 						'src/node-ios-device.h',
+						'src/port-proxy.cpp',
+						'src/port-proxy.h',
+						'src/probe-pool.cpp',
+						'src/probe-pool.h',
+						'src/relay-capture.cpp',
+						'src/relay-capture.h',
+						'src/relay-connection.cpp',
+						'src/relay-connection.h',
+						'src/relay-filter.cpp',
+						'src/relay-filter.h',
+						'src/relay-framer.cpp',
+						'src/relay-framer.h',
+						'src/relay-group.cpp',
+						'src/relay-group.h',
+						'src/relay-parser.cpp',
+						'src/relay-parser.h',
+						'src/relay-ring.h',
+						'src/relay-slab.cpp',
+						'src/relay-slab.h',
+						'src/relay-socket-pool.cpp',
+						'src/relay-socket-pool.h',
+						'src/relay-stats.cpp',
+						'src/relay-stats.h',
 						'src/relay.cpp',
-						'src/relay.h'
+						'src/relay.h',
+						'src/watch-batch.cpp',
+						'src/watch-batch.h'
 					],
 					'libraries': [
 						'/System/Library/Frameworks/CoreFoundation.framework',
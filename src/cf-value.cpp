@@ -0,0 +1,122 @@
+#include "cf-value.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+// the largest integer a JavaScript number can hold without losing precision
+#define MAX_SAFE_INTEGER 9007199254740991LL
+
+/**
+ * Converts a Core Foundation property list value to a JavaScript value. Strings, booleans, numbers,
+ * data, dates, arrays, dictionaries, and null are converted to their JavaScript equivalents.
+ * Integers too big for a number are converted to a `BigInt`, data to a `Buffer`, and any other type
+ * to its description. Returns NULL with a pending exception if a value can't be created.
+ */
+napi_value cfValueToJS(napi_env env, CFTypeRef value) {
+	napi_value rval;
+
+	if (value == NULL || value == kCFNull) {
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_GET_NULL", ::napi_get_null(env, &rval), NULL)
+		return rval;
+	}
+
+	CFTypeID type = ::CFGetTypeID(value);
+
+	if (type == ::CFStringGetTypeID()) {
+		std::string str = cfStringToString((CFStringRef)value);
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, str.c_str(), str.length(), &rval), NULL)
+
+	} else if (type == ::CFBooleanGetTypeID()) {
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_GET_BOOLEAN", ::napi_get_boolean(env, ::CFBooleanGetValue((CFBooleanRef)value), &rval), NULL)
+
+	} else if (type == ::CFNumberGetTypeID()) {
+		if (::CFNumberIsFloatType((CFNumberRef)value)) {
+			double num = 0;
+			::CFNumberGetValue((CFNumberRef)value, kCFNumberDoubleType, &num);
+			NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, num, &rval), NULL)
+		} else {
+			int64_t num = 0;
+			::CFNumberGetValue((CFNumberRef)value, kCFNumberSInt64Type, &num);
+			if (num > MAX_SAFE_INTEGER || num < -MAX_SAFE_INTEGER) {
+				NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_BIGINT", ::napi_create_bigint_int64(env, num, &rval), NULL)
+			} else {
+				NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_INT64", ::napi_create_int64(env, num, &rval), NULL)
+			}
+		}
+
+	} else if (type == ::CFDataGetTypeID()) {
+		CFIndex length = ::CFDataGetLength((CFDataRef)value);
+		void* data;
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_BUFFER", ::napi_create_buffer_copy(env, (size_t)length, ::CFDataGetBytePtr((CFDataRef)value), &data, &rval), NULL)
+
+	} else if (type == ::CFDateGetTypeID()) {
+		double ms = (::CFDateGetAbsoluteTime((CFDateRef)value) + kCFAbsoluteTimeIntervalSince1970) * 1000.0;
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_DATE", ::napi_create_date(env, ms, &rval), NULL)
+
+	} else if (type == ::CFArrayGetTypeID()) {
+		CFIndex count = ::CFArrayGetCount((CFArrayRef)value);
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, (size_t)count, &rval), NULL)
+		for (CFIndex i = 0; i < count; ++i) {
+			napi_value item = cfValueToJS(env, ::CFArrayGetValueAtIndex((CFArrayRef)value, i));
+			if (!item) {
+				return NULL;
+			}
+			NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, rval, (uint32_t)i, item), NULL)
+		}
+
+	} else if (type == ::CFDictionaryGetTypeID()) {
+		CFIndex count = ::CFDictionaryGetCount((CFDictionaryRef)value);
+		std::unique_ptr<const void*[]> keys(new const void*[count]);
+		std::unique_ptr<const void*[]> values(new const void*[count]);
+		::CFDictionaryGetKeysAndValues((CFDictionaryRef)value, keys.get(), values.get());
+
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &rval), NULL)
+		for (CFIndex i = 0; i < count; ++i) {
+			std::string key;
+			if (::CFGetTypeID(keys[i]) == ::CFStringGetTypeID()) {
+				key = cfStringToString((CFStringRef)keys[i]);
+			} else {
+				CFStringRef desc = ::CFCopyDescription(keys[i]);
+				key = cfStringToString(desc);
+				::CFRelease(desc);
+			}
+			napi_value item = cfValueToJS(env, values[i]);
+			if (!item) {
+				return NULL;
+			}
+			NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, rval, key.c_str(), item), NULL)
+		}
+
+	} else {
+		CFStringRef desc = ::CFCopyDescription(value);
+		std::string str = cfStringToString(desc);
+		::CFRelease(desc);
+		NAPI_THROW_RETURN("cfValueToJS", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, str.c_str(), str.length(), &rval), NULL)
+	}
+
+	return rval;
+}
+
+/**
+ * Copies a Core Foundation string into a UTF-8 string.
+ */
+std::string cfStringToString(CFStringRef str) {
+	if (!str) {
+		return "";
+	}
+
+	const char* ptr = ::CFStringGetCStringPtr(str, kCFStringEncodingUTF8);
+	if (ptr) {
+		return ptr;
+	}
+
+	CFIndex length = ::CFStringGetLength(str);
+	CFIndex maxSize = ::CFStringGetMaximumSizeForEncoding(length, kCFStringEncodingUTF8) + 1;
+	std::unique_ptr<char[]> buffer(new char[maxSize]);
+	if (!::CFStringGetCString(str, buffer.get(), maxSize, kCFStringEncodingUTF8)) {
+		return "";
+	}
+	return buffer.get();
+}
+
+}
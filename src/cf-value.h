@@ -0,0 +1,17 @@
+#ifndef __CF_VALUE_H__
+#define __CF_VALUE_H__
+
+#include "node-ios-device.h"
+#include <CoreFoundation/CoreFoundation.h>
+#include <string>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+napi_value cfValueToJS(napi_env env, CFTypeRef value);
+std::string cfStringToString(CFStringRef str);
+
+}
+
+#endif
@@ -18,19 +18,19 @@ DeviceInterface::~DeviceInterface() {
 
 /**
  * Connects to the device, pairs with it, and starts a session. We use a
- * connected counter so that we don't connect more than once.
+ * connected counter so that we don't connect more than once. Connections may
+ * come from the run loop thread, the main thread, and worker threads, so the
+ * counter is guarded by a lock. Use a `DeviceSession` to also keep other
+ * threads off the session while it's in use.
  */
 void DeviceInterface::connect() {
-		if (numConnections > 0) {
-		LOG_DEBUG("DeviceInterface::connect", "Already connected")
-		return;
-	}
+	std::lock_guard<std::recursive_mutex> lock(connectLock);
 
 	// connection ref counter
-	if (numConnections < 0) {
-		numConnections = 0;
+	if (numConnections++ > 0) {
+		LOG_DEBUG("DeviceInterface::connect", "Already connected")
+		return;
 	}
-	++numConnections;
 
 	try {
 		// connect to the device
@@ -92,6 +92,8 @@ void DeviceInterface::connect() {
  * destructor.
  */
 void DeviceInterface::disconnect(const bool force) {
+	std::lock_guard<std::recursive_mutex> lock(connectLock);
+
 	if (dev && numConnections > 0) {
 		if (force || numConnections == 1) {
 			LOG_DEBUG_1("DeviceInterface::disconnect", "Stopping session: %s", udid.c_str())
@@ -105,6 +107,56 @@ void DeviceInterface::disconnect(const bool force) {
 	}
 }
 
+/**
+ * Retrieves lockdown values from the device in a single session. If `keys` is NULL, the whole
+ * domain is returned. Otherwise the whole domain is fetched with one request and the requested keys
+ * are picked from it. Keys that the device leaves out of the domain, such as some private ones, are
+ * requested one at a time. Keys the device doesn't have are omitted. The returned dictionary must
+ * be released by the caller. This is safe to call from any thread.
+ */
+CFDictionaryRef DeviceInterface::copyValues(const std::vector<std::string>* keys) {
+	DeviceSession session(this);
+
+	LOG_DEBUG_1("DeviceInterface::copyValues", "Getting values from device: %s", udid.c_str())
+	CFTypeRef domain = ::AMDeviceCopyValue(dev, 0, NULL);
+	if (domain && ::CFGetTypeID(domain) != ::CFDictionaryGetTypeID()) {
+		::CFRelease(domain);
+		domain = NULL;
+	}
+
+	if (!keys) {
+		if (!domain) {
+			std::stringstream error;
+			error << "Failed to get values from device " << udid;
+			throw std::runtime_error(error.str());
+		}
+		return (CFDictionaryRef)domain;
+	}
+
+	CFMutableDictionaryRef values = ::CFDictionaryCreateMutable(NULL, (CFIndex)keys->size(), &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+	for (auto const& key : *keys) {
+		CFStringRef keyStr = ::CFStringCreateWithCString(NULL, key.c_str(), kCFStringEncodingUTF8);
+		CFTypeRef value = domain ? ::CFDictionaryGetValue((CFDictionaryRef)domain, keyStr) : NULL;
+		if (value) {
+			::CFDictionarySetValue(values, keyStr, value);
+		} else {
+			value = ::AMDeviceCopyValue(dev, 0, keyStr);
+			if (value) {
+				::CFDictionarySetValue(values, keyStr, value);
+				::CFRelease(value);
+			}
+		}
+		::CFRelease(keyStr);
+	}
+
+	if (domain) {
+		::CFRelease(domain);
+	}
+
+	return values;
+}
+
 /**
  * Retrieves a boolean property from the device and converts it to a bool.
  */
@@ -147,14 +199,13 @@ void DeviceInterface::install(std::string& appPath) {
 	CFStringRef values[] = { CFSTR("Developer") };
 	CFDictionaryRef options = CFDictionaryCreate(NULL, (const void **)&keys, (const void **)&values, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
 
-	connect();
+	DeviceSession session(this);
 
 	LOG_DEBUG_1("DeviceInterface::install", "Transferring app to device: %s", udid.c_str())
 	mach_error_t rval = ::AMDeviceSecureTransferPath(0, dev, localUrl, options, NULL, 0);
 	if (rval != MDERR_OK) {
 		::CFRelease(options);
 		::CFRelease(localUrl);
-		disconnect();
 		if (rval == -402653177) {
 			throw std::runtime_error("Failed to copy app to device: can't install app that contains symlinks");
 		}
@@ -169,8 +220,6 @@ void DeviceInterface::install(std::string& appPath) {
 	::CFRelease(options);
 	::CFRelease(localUrl);
 
-	disconnect();
-
 	if (rval == -402620395) {
 		throw std::runtime_error("Failed to install app on device: most likely a provisioning profile issue");
 	} else if (rval != MDERR_OK) {
@@ -187,12 +236,12 @@ void DeviceInterface::install(std::string& appPath) {
  * we're connected and paired, but we're not.
  */
 void DeviceInterface::startService(const char* serviceName, service_conn_t* connection) {
-	connect();
-
-	LOG_DEBUG_2("DeviceInterface::startService", "Starting \'%s\' service: %s", serviceName, udid.c_str());
-	mach_error_t rval = ::AMDeviceStartService(dev, ::CFStringCreateWithCStringNoCopy(NULL, serviceName, kCFStringEncodingUTF8, NULL), connection, NULL);
-
-	disconnect();
+	mach_error_t rval;
+	{
+		DeviceSession session(this);
+		LOG_DEBUG_2("DeviceInterface::startService", "Starting \'%s\' service: %s", serviceName, udid.c_str());
+		rval = ::AMDeviceStartService(dev, ::CFStringCreateWithCStringNoCopy(NULL, serviceName, kCFStringEncodingUTF8, NULL), connection, NULL);
+	}
 
 	std::stringstream error;
 	if (rval == MDERR_SYSCALL) {
@@ -207,4 +256,19 @@ void DeviceInterface::startService(const char* serviceName, service_conn_t* conn
 	}
 }
 
+/**
+ * Locks the interface's session and connects to the device. If connecting fails, the lock is
+ * released and the error is rethrown.
+ */
+DeviceSession::DeviceSession(DeviceInterface* iface) : lock(iface->sessionLock), iface(iface) {
+	iface->connect();
+}
+
+/**
+ * Disconnects from the device, then releases the session lock.
+ */
+DeviceSession::~DeviceSession() {
+	iface->disconnect();
+}
+
 }
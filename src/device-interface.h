@@ -4,7 +4,9 @@
 #include "node-ios-device.h"
 #include "mobiledevice.h"
 #include <CoreFoundation/CoreFoundation.h>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace node_ios_device {
 
@@ -23,6 +25,7 @@ public:
 	~DeviceInterface();
 
 	void connect();
+	CFDictionaryRef copyValues(const std::vector<std::string>* keys);
 	void disconnect(const bool force = false);
 	bool getBoolean(CFStringRef key);
 	std::string getString(CFStringRef key);
@@ -33,10 +36,29 @@ public:
 	uint32_t    type;
 
 private:
+	friend class DeviceSession;
+
 	std::string udid;
+	std::recursive_mutex connectLock;
+	std::recursive_mutex sessionLock;
 	uint32_t    numConnections;
 };
 
+/**
+ * Holds a session with a device interface while it's in scope. The interface's session lock is
+ * held from connecting until disconnecting, so requests from different threads never interleave on
+ * the lockdown connection. Sessions on the same thread can be nested.
+ */
+class DeviceSession {
+public:
+	DeviceSession(DeviceInterface* iface);
+	~DeviceSession();
+
+private:
+	std::lock_guard<std::recursive_mutex> lock;
+	DeviceInterface* iface;
+};
+
 }
 
 #endif
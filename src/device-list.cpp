@@ -0,0 +1,94 @@
+#include "device-list.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Releases the cached list and device objects.
+ */
+DeviceListCache::~DeviceListCache() {
+	if (list) {
+		::napi_delete_reference(env, list);
+	}
+	for (auto const& it : devices) {
+		::napi_delete_reference(env, it.second.ref);
+	}
+}
+
+/**
+ * Returns the frozen object for a device, calling `create` to build it if the device changed after
+ * its cached object was built. Devices that aren't looked up again before the next `set()` are
+ * dropped from the cache.
+ */
+napi_value DeviceListCache::device(const std::string& udid, uint64_t generation, const std::function<napi_value()>& create) {
+	napi_value obj;
+	auto it = devices.find(udid);
+
+	if (it != devices.end()) {
+		it->second.build = build;
+		if (it->second.generation == generation) {
+			NAPI_THROW_RETURN("DeviceListCache::device", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, it->second.ref, &obj), NULL)
+			return obj;
+		}
+		::napi_delete_reference(env, it->second.ref);
+		devices.erase(it);
+	}
+
+	obj = create();
+	if (!obj) {
+		return NULL;
+	}
+
+	napi_ref ref;
+	NAPI_THROW_RETURN("DeviceListCache::device", "ERR_NAPI_OBJECT_FREEZE", ::napi_object_freeze(env, obj), NULL)
+	NAPI_THROW_RETURN("DeviceListCache::device", "ERR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, obj, 1, &ref), NULL)
+	devices.insert(std::make_pair(udid, Entry{ generation, build, ref }));
+	return obj;
+}
+
+/**
+ * Returns the cached list if it was built for this generation, otherwise `NULL`.
+ */
+napi_value DeviceListCache::get(uint64_t generation) {
+	napi_value rval = NULL;
+	if (list && this->generation == generation) {
+		NAPI_THROW_RETURN("DeviceListCache::get", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, list, &rval), NULL)
+	}
+	return rval;
+}
+
+/**
+ * Builds the frozen list from the device objects returned by `device()` and caches it for this
+ * generation. The array is created at its final length and filled by index rather than by calling
+ * `push()` for each device.
+ */
+napi_value DeviceListCache::set(uint64_t generation, const std::vector<napi_value>& objects) {
+	napi_value rval;
+	NAPI_THROW_RETURN("DeviceListCache::set", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, objects.size(), &rval), NULL)
+	for (uint32_t i = 0; i < objects.size(); ++i) {
+		NAPI_THROW_RETURN("DeviceListCache::set", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, rval, i, objects[i]), NULL)
+	}
+	NAPI_THROW_RETURN("DeviceListCache::set", "ERR_NAPI_OBJECT_FREEZE", ::napi_object_freeze(env, rval), NULL)
+
+	if (list) {
+		::napi_delete_reference(env, list);
+		list = NULL;
+	}
+	NAPI_THROW_RETURN("DeviceListCache::set", "ERR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, rval, 1, &list), NULL)
+	this->generation = generation;
+
+	// drop the devices that weren't looked up since the last build
+	for (auto it = devices.begin(); it != devices.end(); ) {
+		if (it->second.build != build) {
+			::napi_delete_reference(env, it->second.ref);
+			it = devices.erase(it);
+		} else {
+			++it;
+		}
+	}
+	++build;
+
+	return rval;
+}
+
+}
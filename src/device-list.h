@@ -0,0 +1,48 @@
+#ifndef __DEVICE_LIST_H__
+#define __DEVICE_LIST_H__
+
+#include "node-ios-device.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * Caches the frozen JavaScript array returned by `list()` along with the device objects in it.
+ *
+ * The device registry bumps a generation counter whenever a device or one of its interfaces
+ * connects or disconnects, and each device remembers the generation it last changed in. The array
+ * is only rebuilt when the registry generation moves, and a rebuild reuses the object of every
+ * device that hasn't changed since. This must only be used on the main thread.
+ */
+class DeviceListCache {
+public:
+	DeviceListCache(napi_env env) : env(env), generation(0), list(NULL), build(0) {}
+	~DeviceListCache();
+
+	napi_value device(const std::string& udid, uint64_t generation, const std::function<napi_value()>& create);
+	napi_value get(uint64_t generation);
+	napi_value set(uint64_t generation, const std::vector<napi_value>& devices);
+
+private:
+	struct Entry {
+		uint64_t generation;
+		uint64_t build;
+		napi_ref ref;
+	};
+
+	napi_env env;
+	uint64_t generation;
+	napi_ref list;
+	uint64_t build;
+	std::map<std::string, Entry> devices;
+};
+
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef __DEVICE_NOTIFIER_H__
+#define __DEVICE_NOTIFIER_H__
+
+#include "node-ios-device.h"
+#include "device-registry.h"
+#include "flap-tracker.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+enum DeviceChangeType { AttachChange, DetachChange, UpdateChange };
+
+/**
+ * A device or one of its interfaces connecting or disconnecting. The run loop thread queues these
+ * for the main thread of every Node environment, which emits them to the watch listeners as
+ * "attach", "detach", and "update" events.
+ */
+struct DeviceChange {
+	DeviceChangeType type;
+	std::string      udid;
+	const char*      iface;
+};
+
+/**
+ * A device notification that arrived while the device was being probed.
+ */
+template <typename D>
+struct PendingNotification {
+	D    dev;
+	bool connected;
+};
+
+/**
+ * The outcome of publishing a device notification. `device` is the device the notification was
+ * applied to, or NULL if the device isn't known and wasn't probed. `changed` is set if one of its
+ * interfaces connected or disconnected, and `held` if it disconnected from its last interface and is
+ * being held in case it comes right back.
+ */
+template <typename T>
+struct DevicePublished {
+	std::shared_ptr<T> device;
+	bool               changed;
+	bool               held;
+};
+
+/**
+ * Applies device notifications to a device registry.
+ *
+ * A notification for a device that isn't in the registry hands the device to `probe()`. Once the
+ * probe is done, `finishProbe()` publishes the device and then applies the notifications that
+ * arrived for it in the meantime, in the order they arrived. Notifications for known devices are
+ * published right away.
+ *
+ * A device that disconnects from its last interface is held by the flap tracker. If it comes back
+ * before the window passes, the same device is configured with the new notification's handle
+ * instead of being probed again and the reconnect is counted as a flap. `expireHeld()` drops the
+ * devices that are still gone once their window has passed.
+ *
+ * There's nothing platform specific in here, so the benchmark addon drives the same logic with
+ * stand-ins. `T` is the device type and `D` is the handle a notification carries, which is passed
+ * to `T::config()`. Subclasses start probes, keep the handles of held notifications alive, and act
+ * on each published change through the hooks. Notifications must all be delivered on one thread,
+ * which is also the thread that calls `finishProbe()`.
+ */
+template <typename T, typename D>
+class DeviceNotifier {
+public:
+	typedef std::shared_ptr<const typename DeviceRegistry<T>::Snapshot> Snapshot;
+
+	/**
+	 * Initializes the notifier with the number of milliseconds to hold a disconnected device for.
+	 */
+	DeviceNotifier(uint32_t flapWindow) : initialized(false), flaps(flapWindow) {}
+
+	virtual ~DeviceNotifier() {}
+
+	/**
+	 * Copies the number of times each device has disconnected and come back within the flap
+	 * window.
+	 */
+	void flapStats(std::map<std::string, uint64_t>& stats) {
+		flaps.snapshot(stats);
+	}
+
+	inline bool isHeld(const std::string& udid) { return flaps.isHeld(udid); }
+
+	/**
+	 * Drops devices that disconnected, aren't being held in case they come back, and no longer
+	 * have relay connections waiting to reconnect. The devices are already hidden from the device
+	 * lists, so the generation stays the same. They are checked again in case one came back in the
+	 * meantime.
+	 */
+	void prune(const std::vector<std::string>& udids) {
+		devices.update([this, &udids](typename DeviceRegistry<T>::Map& map, uint64_t generation) {
+			bool erased = false;
+			for (auto const& udid : udids) {
+				auto it = map.find(udid);
+				if (it != map.end() && it->second->isDisconnected() && !it->second->isResumable() && !flaps.isHeld(udid)) {
+					map.erase(it);
+					erased = true;
+				}
+			}
+			return erased;
+		}, false);
+	}
+
+	inline Snapshot snapshot() const { return devices.snapshot(); }
+
+protected:
+	/**
+	 * Stops holding the devices whose flap window has passed and drops them. Returns the number of
+	 * milliseconds until the next held device expires, or 0 if none are held.
+	 */
+	uint32_t expireHeld() {
+		std::vector<std::string> expired = flaps.expire();
+		if (!expired.empty()) {
+			LOG_DEBUG_1("DeviceNotifier::expireHeld", "Flap window passed for %ld devices", expired.size())
+			prune(expired);
+		}
+		return flaps.nextExpiry();
+	}
+
+	/**
+	 * Publishes a device that `probe()` was asked for, then applies the notifications that arrived
+	 * for it while it was being probed. `device` is NULL if the probe failed.
+	 */
+	void finishProbe(const std::string& udid, D dev, std::shared_ptr<T> device) {
+		std::vector<PendingNotification<D>> pending;
+		auto entry = probing.find(udid);
+		if (entry != probing.end()) {
+			pending.swap(entry->second);
+			probing.erase(entry);
+		}
+
+		publish(udid, dev, true, device);
+
+		for (auto const& notification : pending) {
+			onNotification(udid, notification.dev, notification.connected);
+			release(notification.dev);
+		}
+	}
+
+	inline bool isProbing() const { return !probing.empty(); }
+
+	/**
+	 * Applies a device notification. A new device is handed to `probe()`, while notifications for
+	 * a device that is being probed are held until its probe is done so that they're applied in the
+	 * order they arrived.
+	 */
+	void onNotification(const std::string& udid, D dev, bool connected) {
+		auto pending = probing.find(udid);
+		if (pending != probing.end()) {
+			LOG_DEBUG_1("DeviceNotifier::onNotification", "Device %s is being probed, holding notification", udid.c_str())
+			retain(dev);
+			pending->second.push_back({ dev, connected });
+			return;
+		}
+
+		if (connected) {
+			Snapshot current = devices.snapshot();
+			if (current->devices.find(udid) == current->devices.end()) {
+				LOG_DEBUG_1("DeviceNotifier::onNotification", "Queuing probe for %s", udid.c_str())
+				probing[udid];
+				probe(udid, dev);
+				return;
+			}
+		}
+
+		publish(udid, dev, connected, NULL);
+	}
+
+	/**
+	 * Applies a device interface connecting or disconnecting to the registry. `probed` is a new
+	 * device that has been probed, or NULL if the device is already known or couldn't be probed.
+	 * The change is queued while `changesLock` is held, then the subclass is told what changed.
+	 */
+	void publish(const std::string& udid, D dev, bool connected, std::shared_ptr<T> probed) {
+		DevicePublished<T> published{ NULL, false, false };
+
+		{
+			std::lock_guard<std::mutex> changesGuard(changesLock);
+			bool hadUsb = false, hadWifi = false, hasUsb = false, hasWifi = false;
+
+			devices.update([&](typename DeviceRegistry<T>::Map& map, uint64_t generation) {
+				auto it = map.find(udid);
+				std::shared_ptr<T> device = it != map.end() ? it->second : NULL;
+				bool erased = false;
+
+				if (device) {
+					hadUsb = (bool)device->getUsb();
+					hadWifi = (bool)device->getWifi();
+					if (connected && !hadUsb && !hadWifi && flaps.resume(udid)) {
+						LOG_DEBUG_1("DeviceNotifier::publish", "Device %s came back within the flap window, reusing it", udid.c_str())
+					}
+					device->config(dev, connected);
+
+					// hold the device for a moment in case it comes right back, and keep it around
+					// if any of its relay connections will reconnect when it does
+					if (!connected && device->isDisconnected()) {
+						flaps.hold(udid);
+						published.held = flaps.isHeld(udid);
+						if (!published.held && !device->isResumable()) {
+							map.erase(it);
+							erased = true;
+						}
+					}
+				} else if (probed) {
+					device = probed;
+					map.insert(std::make_pair(udid, device));
+				}
+
+				published.device = device;
+				hasUsb = device && device->getUsb();
+				hasWifi = device && device->getWifi();
+				published.changed = (hadUsb != hasUsb) || (hadWifi != hasWifi);
+				if (published.changed) {
+					device->generation = generation;
+				}
+				return published.changed || erased;
+			});
+
+			// changes during the initial enumeration aren't queued because listeners are sent
+			// every connected device once it's complete
+			if (published.changed && initialized) {
+				DeviceChangeType type = !hadUsb && !hadWifi ? AttachChange : !hasUsb && !hasWifi ? DetachChange : UpdateChange;
+				queueChange(udid, type, hadUsb != hasUsb ? "USB" : "Wi-Fi");
+			}
+		}
+
+		onPublished(udid, connected, published);
+	}
+
+	/**
+	 * Called after a notification has been published, without any locks held.
+	 */
+	virtual void onPublished(const std::string& udid, bool connected, const DevicePublished<T>& published) = 0;
+
+	/**
+	 * Starts probing a new device. Once the probe is done, `finishProbe()` must be called on the
+	 * notification thread, which may be right away.
+	 */
+	virtual void probe(const std::string& udid, D dev) = 0;
+
+	/**
+	 * Queues a change for the listeners. Called while `changesLock` is held.
+	 */
+	virtual void queueChange(const std::string& udid, DeviceChangeType type, const char* iface) = 0;
+
+	/**
+	 * Releases the handle of a held notification once it has been applied.
+	 */
+	virtual void release(D dev) = 0;
+
+	/**
+	 * Keeps the handle of a notification alive while it's held.
+	 */
+	virtual void retain(D dev) = 0;
+
+	// only changed by the notification thread, except for dropping devices that are gone for good
+	DeviceRegistry<T> devices;
+
+	std::atomic<bool> initialized;
+
+	// held while a snapshot is published and its change queued, so the changes drained along with a
+	// snapshot are always in it; locked before the registry
+	std::mutex changesLock;
+
+	// devices that disconnected are held here for a moment in case they come right back
+	FlapTracker flaps;
+
+	// only used on the notification thread
+	std::map<std::string, std::vector<PendingNotification<D>>> probing;
+};
+
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include "device-prop-cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace node_ios_device {
+
+/**
+ * Opens and maps the cache file, creating it if it doesn't exist. A file with a different format is
+ * reset. If the file can't be opened, the cache is disabled.
+ */
+DevicePropCache::DevicePropCache(const std::string& path) :
+	path(path),
+	fd(-1),
+	map(NULL),
+	size(sizeof(DevicePropCacheHeader) + DEVICE_PROP_CACHE_SLOTS * DEVICE_PROP_CACHE_SLOT_SIZE) {
+
+	if (path.empty()) {
+		return;
+	}
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd == -1) {
+		LOG_DEBUG_2("DevicePropCache", "Failed to open device property cache %s: %s", path.c_str(), ::strerror(errno))
+		return;
+	}
+
+	::flock(fd, LOCK_EX);
+
+	struct stat st;
+	bool valid = ::fstat(fd, &st) == 0 && (size_t)st.st_size == size;
+	if (!valid && (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, (off_t)size) != 0)) {
+		LOG_DEBUG_2("DevicePropCache", "Failed to size device property cache %s: %s", path.c_str(), ::strerror(errno))
+		::flock(fd, LOCK_UN);
+		::close(fd);
+		fd = -1;
+		return;
+	}
+
+	void* addr = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		LOG_DEBUG_2("DevicePropCache", "Failed to map device property cache %s: %s", path.c_str(), ::strerror(errno))
+		::flock(fd, LOCK_UN);
+		::close(fd);
+		fd = -1;
+		return;
+	}
+	map = static_cast<char*>(addr);
+
+	DevicePropCacheHeader* header = reinterpret_cast<DevicePropCacheHeader*>(map);
+	if (!valid || ::memcmp(header->magic, DEVICE_PROP_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->slotCount != DEVICE_PROP_CACHE_SLOTS || header->slotSize != DEVICE_PROP_CACHE_SLOT_SIZE) {
+		LOG_DEBUG_1("DevicePropCache", "Initializing device property cache %s", path.c_str())
+		::memset(map, 0, size);
+		::memcpy(header->magic, DEVICE_PROP_CACHE_MAGIC, sizeof(header->magic));
+		header->slotCount = DEVICE_PROP_CACHE_SLOTS;
+		header->slotSize = DEVICE_PROP_CACHE_SLOT_SIZE;
+	}
+
+	::flock(fd, LOCK_UN);
+}
+
+/**
+ * Unmaps and closes the cache file.
+ */
+DevicePropCache::~DevicePropCache() {
+	if (map) {
+		::munmap(map, size);
+	}
+	if (fd != -1) {
+		::close(fd);
+	}
+}
+
+/**
+ * Returns the cache file path from the `NODE_IOS_DEVICE_PROP_CACHE` environment variable, where an
+ * empty value disables the cache, or `~/.node-ios-device/device-props.cache` by default.
+ */
+std::string DevicePropCache::defaultPath() {
+	const char* env = ::getenv("NODE_IOS_DEVICE_PROP_CACHE");
+	if (env) {
+		return env;
+	}
+
+	const char* home = ::getenv("HOME");
+	if (!home || !*home) {
+		return "";
+	}
+
+	std::string dir = std::string(home) + "/.node-ios-device";
+	if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		return "";
+	}
+	return dir + "/device-props.cache";
+}
+
+/**
+ * Copies the cached properties for a device into `props`, including its `buildVersion`. Returns
+ * false if the device isn't cached.
+ */
+bool DevicePropCache::get(const std::string& udid, std::map<std::string, std::string>& props) {
+	if (!map || udid.size() >= sizeof(DevicePropCacheSlot::udid)) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	::flock(fd, LOCK_SH);
+
+	bool found = false;
+	for (uint32_t i = 0; i < DEVICE_PROP_CACHE_SLOTS; ++i) {
+		DevicePropCacheSlot* s = slot(i);
+		if (!s->updated || ::strncmp(s->udid, udid.c_str(), sizeof(s->udid)) != 0) {
+			continue;
+		}
+
+		const char* data = reinterpret_cast<const char*>(s + 1);
+		const char* end = data + std::min((size_t)s->length, DEVICE_PROP_CACHE_SLOT_SIZE - sizeof(DevicePropCacheSlot));
+		while (data < end) {
+			const char* key = data;
+			const char* value = key + ::strnlen(key, end - key) + 1;
+			if (value >= end) {
+				break;
+			}
+			data = value + ::strnlen(value, end - value) + 1;
+			props[key] = value;
+		}
+
+		props["buildVersion"] = std::string(s->buildVersion, ::strnlen(s->buildVersion, sizeof(s->buildVersion)));
+		found = true;
+		break;
+	}
+
+	::flock(fd, LOCK_UN);
+	return found;
+}
+
+/**
+ * Caches the properties for a device, replacing what was cached for it before. The build version
+ * is taken from the `buildVersion` property. Properties that don't fit in the slot are skipped.
+ */
+void DevicePropCache::put(const std::string& udid, const std::map<std::string, std::string>& props) {
+	if (!map || udid.size() >= sizeof(DevicePropCacheSlot::udid)) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	::flock(fd, LOCK_EX);
+
+	// reuse the device's slot, otherwise an empty slot, otherwise the least recently updated one
+	DevicePropCacheSlot* target = NULL;
+	for (uint32_t i = 0; i < DEVICE_PROP_CACHE_SLOTS; ++i) {
+		DevicePropCacheSlot* s = slot(i);
+		if (s->updated && ::strncmp(s->udid, udid.c_str(), sizeof(s->udid)) == 0) {
+			target = s;
+			break;
+		}
+		if (!target || (target->updated && s->updated < target->updated)) {
+			target = s;
+		}
+	}
+
+	target->updated = 0;
+	::memset(target->udid, 0, sizeof(target->udid));
+	::memcpy(target->udid, udid.data(), udid.size());
+	::memset(target->buildVersion, 0, sizeof(target->buildVersion));
+
+	char* data = reinterpret_cast<char*>(target + 1);
+	size_t capacity = DEVICE_PROP_CACHE_SLOT_SIZE - sizeof(DevicePropCacheSlot);
+	size_t length = 0;
+	for (auto const& it : props) {
+		if (it.first == "buildVersion") {
+			::strncpy(target->buildVersion, it.second.c_str(), sizeof(target->buildVersion) - 1);
+			continue;
+		}
+		size_t needed = it.first.size() + it.second.size() + 2;
+		if (length + needed > capacity) {
+			LOG_DEBUG_2("DevicePropCache::put", "Skipping %s for %s, the slot is full", it.first.c_str(), udid.c_str())
+			continue;
+		}
+		::memcpy(data + length, it.first.c_str(), it.first.size() + 1);
+		length += it.first.size() + 1;
+		::memcpy(data + length, it.second.c_str(), it.second.size() + 1);
+		length += it.second.size() + 1;
+	}
+	target->length = (uint32_t)length;
+
+	// publish the slot last so that a reader never sees it half written
+	target->updated = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	::flock(fd, LOCK_UN);
+}
+
+/**
+ * Returns a pointer to a slot in the mapping.
+ */
+DevicePropCacheSlot* DevicePropCache::slot(uint32_t index) {
+	return reinterpret_cast<DevicePropCacheSlot*>(map + sizeof(DevicePropCacheHeader) + (size_t)index * DEVICE_PROP_CACHE_SLOT_SIZE);
+}
+
+}
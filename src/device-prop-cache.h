@@ -0,0 +1,75 @@
+#ifndef __DEVICE_PROP_CACHE_H__
+#define __DEVICE_PROP_CACHE_H__
+
+#include "node-ios-device.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// identifies a device property cache file and its format version
+#define DEVICE_PROP_CACHE_MAGIC "NIDPRP01"
+
+// the number of devices the cache holds and the size of each device's slot
+#define DEVICE_PROP_CACHE_SLOTS 128
+#define DEVICE_PROP_CACHE_SLOT_SIZE 1024
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * The header at the start of the cache file.
+ */
+struct DevicePropCacheHeader {
+	char     magic[8];
+	uint32_t slotCount;
+	uint32_t slotSize;
+	uint64_t reserved[2];
+};
+
+/**
+ * The header of each slot. The properties follow as `length` bytes of NUL terminated key and value
+ * pairs. `updated` is cleared while a slot is being written and is 0 for an empty slot.
+ */
+struct DevicePropCacheSlot {
+	uint64_t updated;
+	uint32_t length;
+	uint32_t reserved;
+	char     udid[64];
+	char     buildVersion[48];
+};
+
+/**
+ * A persistent, memory-mapped cache of device properties keyed by udid. Each entry also records the
+ * build version it was read from so that callers can tell when the device has been updated.
+ *
+ * The file holds a fixed number of fixed size slots and is mapped once, so a lookup is a scan of
+ * the mapping and an update is a copy into it. The least recently updated slot is reused once the
+ * cache is full. The file is shared by every process using node-ios-device, so reads and writes
+ * take an advisory lock on it. A cache that can't be opened is disabled rather than failing.
+ */
+class DevicePropCache {
+public:
+	DevicePropCache(const std::string& path);
+	~DevicePropCache();
+
+	static std::string defaultPath();
+
+	bool get(const std::string& udid, std::map<std::string, std::string>& props);
+	inline bool isOpen() const { return map != NULL; }
+	void put(const std::string& udid, const std::map<std::string, std::string>& props);
+
+private:
+	DevicePropCacheSlot* slot(uint32_t index);
+
+	std::string path;
+	int fd;
+	char* map;
+	size_t size;
+	std::mutex lock;
+};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __DEVICE_REGISTRY_H__
+#define __DEVICE_REGISTRY_H__
+
+#include "node-ios-device.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * A copy-on-write map of devices by udid.
+ *
+ * Readers take an immutable snapshot with an atomic load, so they never wait on a writer and never
+ * see a half applied change. Writers copy the current snapshot, change the copy, and publish it with
+ * an atomic store. Writers are serialized by a mutex that readers never touch, and slow work such
+ * as probing a new device should be done before calling `update()` so that other writers aren't
+ * held up either. Each published snapshot carries a generation that is bumped for every change that
+ * affects the device list.
+ */
+template <typename T>
+class DeviceRegistry {
+public:
+	typedef std::map<std::string, std::shared_ptr<T>> Map;
+
+	struct Snapshot {
+		Map devices;
+		uint64_t generation;
+	};
+
+	DeviceRegistry() : current(std::make_shared<const Snapshot>(Snapshot{ Map(), 0 })) {}
+
+	/**
+	 * Returns the current snapshot. This never blocks on a writer.
+	 */
+	inline std::shared_ptr<const Snapshot> snapshot() const {
+		return std::atomic_load(&current);
+	}
+
+	/**
+	 * Calls `fn` with a copy of the devices and publishes the copy if `fn` returns true. The
+	 * generation is bumped unless `bump` is false, such as when dropping devices that are already
+	 * hidden from the list. Returns the snapshot that is current once the update is done.
+	 */
+	template <typename F>
+	std::shared_ptr<const Snapshot> update(F fn, bool bump = true) {
+		std::lock_guard<std::mutex> lock(writeLock);
+		std::shared_ptr<const Snapshot> prev = std::atomic_load(&current);
+		auto next = std::make_shared<Snapshot>(*prev);
+
+		if (!fn(next->devices, prev->generation + (bump ? 1 : 0))) {
+			return prev;
+		}
+
+		if (bump) {
+			++next->generation;
+		}
+		std::shared_ptr<const Snapshot> published = std::move(next);
+		std::atomic_store(&current, published);
+		return published;
+	}
+
+private:
+	std::shared_ptr<const Snapshot> current;
+	std::mutex writeLock;
+};
+
+}
+
+#endif
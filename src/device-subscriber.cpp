@@ -0,0 +1,582 @@
+#include "device-subscriber.h"
+
+namespace node_ios_device {
+
+/**
+ * Stops and closes a watch listener's coalescing timer.
+ */
+static void closeWatchTimer(WatchListener* watcher) {
+	if (watcher->timer) {
+		::uv_timer_stop(watcher->timer);
+		::uv_close(
+			(uv_handle_t*)watcher->timer,
+			[](uv_handle_t* handle) {
+				delete (uv_timer_t *)handle;
+			}
+		);
+		watcher->timer = NULL;
+	}
+}
+
+/**
+ * Creates the async device change and ready notification handlers on the environment's event loop,
+ * then immediately unrefs them as to not block Node from quitting, and subscribes to the shared
+ * device manager. This is run on the environment's main thread.
+ */
+DeviceSubscriber::DeviceSubscriber(napi_env env, std::shared_ptr<LogSink> log) :
+	env(env),
+	deviceman(DeviceMan::acquire()),
+	log(log),
+	listCache(env),
+	readyNotified(false) {
+
+	// wire up our dispatch change handler into Node's event loop, then unref it so that we don't
+	// block Node from exiting
+	uv_loop_t* loop;
+	::napi_get_uv_event_loop(env, &loop);
+
+	notifyChange = new uv_async_t;
+	notifyChange->data = this;
+	::uv_async_init(loop, notifyChange, [](uv_async_t* handle) {
+		static_cast<DeviceSubscriber*>(handle->data)->dispatch();
+	});
+	::uv_unref((uv_handle_t*)notifyChange);
+
+	notifyReady = new uv_async_t;
+	notifyReady->data = this;
+	::uv_async_init(loop, notifyReady, [](uv_async_t* handle) {
+		static_cast<DeviceSubscriber*>(handle->data)->onReady();
+	});
+	::uv_unref((uv_handle_t*)notifyReady);
+
+	deviceman->subscribe(this);
+}
+
+/**
+ * Unsubscribes from the device manager, then closes the async handles, the watch listeners, the
+ * relay groups, and the environment's relays to every device. This is run on the environment's
+ * main thread when the environment is torn down.
+ */
+DeviceSubscriber::~DeviceSubscriber() {
+	LOG_DEBUG_THREAD_ID("DeviceSubscriber::~DeviceSubscriber", "Closing device subscriber")
+
+	// once unsubscribed, the run loop thread no longer signals the async handles
+	deviceman->unsubscribe(this);
+
+	for (auto handle : { notifyChange, notifyReady }) {
+		::uv_close(
+			(uv_handle_t*)handle,
+			[](uv_handle_t* handle) {
+				delete (uv_async_t *)handle;
+			}
+		);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(listenersLock);
+		for (auto const& watcher : listeners) {
+			watcher->removed = true;
+			closeWatchTimer(watcher.get());
+			::napi_delete_reference(env, watcher->ref);
+		}
+		listeners.clear();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(groupsLock);
+		for (auto const& group : groups) {
+			group->disconnect();
+		}
+		groups.clear();
+	}
+
+	for (auto const& it : deviceman->snapshot()->devices) {
+		it.second->release(env);
+	}
+}
+
+/**
+ * Attaches a device that connected over USB to the relay groups, or detaches it from them if `usb`
+ * is NULL. This is run on the run loop thread after the device's snapshot has been published.
+ */
+void DeviceSubscriber::attach(const std::string& udid, std::shared_ptr<DeviceInterface> usb) {
+	std::lock_guard<std::mutex> groupsGuard(groupsLock);
+	for (auto const& group : groups) {
+		if (usb) {
+			group->attach(udid, usb);
+		} else {
+			group->detach(udid);
+		}
+	}
+}
+
+/**
+ * Configures the device notfication listeners. The watch options are `snapshot`, which also sends
+ * the listener the full device list after each batch of changes, `coalesce`, the number of
+ * milliseconds to collect changes for before sending them, and `throttle`, the minimum number of
+ * milliseconds between two batches.
+ */
+void DeviceSubscriber::config(napi_value listener, WatchAction action, napi_value options) {
+	if (action == Watch) {
+		auto watcher = std::make_shared<WatchListener>();
+		watcher->subscriber = this;
+		watcher->snapshot = false;
+		watcher->primed = false;
+		watcher->removed = false;
+		watcher->timer = NULL;
+
+		napi_valuetype type = napi_undefined;
+		if (options != NULL) {
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_TYPEOF", ::napi_typeof(env, options, &type))
+		}
+		if (type == napi_object) {
+			napi_value value;
+			bool has;
+
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_HAS_NAMED_PROPERTY", ::napi_has_named_property(env, options, "snapshot", &has))
+			if (has) {
+				NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, options, "snapshot", &value))
+				if (::napi_get_value_bool(env, value, &watcher->snapshot) != napi_ok) {
+					throw std::runtime_error("Expected snapshot to be a boolean");
+				}
+			}
+
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_HAS_NAMED_PROPERTY", ::napi_has_named_property(env, options, "coalesce", &has))
+			if (has) {
+				NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, options, "coalesce", &value))
+				if (::napi_get_value_uint32(env, value, &watcher->batch.coalesce) != napi_ok) {
+					throw std::runtime_error("Expected coalesce to be a non-negative number");
+				}
+			}
+
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_HAS_NAMED_PROPERTY", ::napi_has_named_property(env, options, "throttle", &has))
+			if (has) {
+				NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, options, "throttle", &value))
+				if (::napi_get_value_uint32(env, value, &watcher->batch.throttle) != napi_ok) {
+					throw std::runtime_error("Expected throttle to be a non-negative number");
+				}
+			}
+		}
+
+		NAPI_THROW("DeviceSubscriber::config", "ERROR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, listener, 1, &watcher->ref))
+
+		if (watcher->batch.coalesce > 0 || watcher->batch.throttle > 0) {
+			// the timer is unref'd because the listener already keeps Node alive through notifyChange
+			uv_loop_t* loop;
+			::napi_get_uv_event_loop(env, &loop);
+			watcher->timer = new uv_timer_t;
+			watcher->timer->data = watcher.get();
+			::uv_timer_init(loop, watcher->timer);
+			::uv_unref((uv_handle_t*)watcher->timer);
+		}
+
+		LOG_DEBUG("DeviceSubscriber::config", "Adding listener")
+		::uv_ref((uv_handle_t*)notifyChange);
+		{
+			std::lock_guard<std::mutex> lock(listenersLock);
+			listeners.push_back(watcher);
+		}
+
+		// if the initial devices haven't been enumerated yet, the listener is sent the connected
+		// devices once they have
+		deviceman->start();
+		if (readyNotified) {
+			dispatch();
+		}
+	} else {
+		std::lock_guard<std::mutex> lock(listenersLock);
+		for (auto it = listeners.begin(); it != listeners.end(); ) {
+			napi_value fn;
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, (*it)->ref, &fn))
+
+			bool same;
+			NAPI_THROW("DeviceSubscriber::config", "ERR_NAPI_STRICT_EQUALS", ::napi_strict_equals(env, listener, fn, &same))
+
+			if (same) {
+				LOG_DEBUG("DeviceSubscriber::config", "Removing listener")
+				::uv_unref((uv_handle_t*)notifyChange);
+				(*it)->removed = true;
+				closeWatchTimer(it->get());
+				::napi_delete_reference(env, (*it)->ref);
+				it = listeners.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+/**
+ * Returns the frozen JavaScript object for a device, which is reused until the device changes.
+ */
+napi_value DeviceSubscriber::deviceToJS(const std::string& udid, const std::shared_ptr<Device>& device) {
+	return listCache.device(udid, device->generation, [&]() { return device->toJS(env); });
+}
+
+/**
+ * Emits device changes to the watch listeners. Queued changes are handed to every primed listener,
+ * then each listener without a coalescing window, or whose window has just closed (`due`), is sent
+ * its changes folded into one "attach", "detach", or "update" event per device. A throttled
+ * listener that was sent changes less than `throttle` milliseconds ago keeps collecting them until
+ * the throttle has passed, so the last batch is never lost. A listener that
+ * hasn't been primed is sent an "attach" for every connected device instead. Listeners with the
+ * snapshot option also get the full device list as a "change" event. This function is invoked by
+ * libuv on the environment's main thread when the device manager signals a change.
+ */
+void DeviceSubscriber::dispatch(WatchListener* due) {
+	struct Event {
+		std::shared_ptr<WatchListener> watcher;
+		const char* name;
+		napi_value args[2];
+		size_t argc;
+	};
+
+	napi_handle_scope scope;
+	NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_OPEN_HANDLE_SCOPE", ::napi_open_handle_scope(env, &scope))
+
+	std::vector<std::shared_ptr<WatchListener>> watchers;
+	{
+		std::lock_guard<std::mutex> lock(listenersLock);
+		watchers.assign(listeners.begin(), listeners.end());
+	}
+
+	std::vector<DeviceChange> queued;
+	DeviceSnapshot snapshot = deviceman->drain(this, queued);
+
+	uv_loop_t* loop;
+	::napi_get_uv_event_loop(env, &loop);
+	uint64_t now = ::uv_now(loop);
+
+	std::vector<Event> events;
+	{
+		// device objects come from the list cache, so they are only built when a device changes
+		napi_value list = NULL;
+		auto findDevice = [&](const std::string& udid) -> napi_value {
+			auto it = snapshot->devices.find(udid);
+			return it != snapshot->devices.end() && !it->second->isDisconnected() ? deviceToJS(udid, it->second) : NULL;
+		};
+
+		for (auto const& watcher : watchers) {
+			if (watcher->removed) {
+				continue;
+			}
+
+			if (!watcher->primed) {
+				if (!readyNotified) {
+					continue;
+				}
+				watcher->primed = true;
+				watcher->batch.reset(now);
+				for (auto const& it : snapshot->devices) {
+					napi_value device = findDevice(it.first);
+					if (device) {
+						napi_value iface;
+						NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, it.second->getUsb() ? "USB" : "Wi-Fi", NAPI_AUTO_LENGTH, &iface))
+						events.push_back({ watcher, "attach", { device, iface }, 2 });
+					}
+				}
+			} else {
+				uint64_t delay = watcher->batch.add(queued, now);
+				if (watcher->batch.empty()) {
+					continue;
+				}
+				if (watcher.get() != due && delay > 0) {
+					if (!::uv_is_active((uv_handle_t*)watcher->timer)) {
+						::uv_timer_start(watcher->timer, [](uv_timer_t* handle) {
+							WatchListener* watcher = static_cast<WatchListener*>(handle->data);
+							watcher->subscriber->dispatch(watcher);
+						}, delay, 0);
+					}
+					continue;
+				}
+
+				for (auto const& change : watcher->batch.take(now)) {
+					napi_value iface;
+					NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, change.iface, NAPI_AUTO_LENGTH, &iface))
+					if (change.type == DetachChange) {
+						napi_value udid;
+						NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, change.udid.c_str(), NAPI_AUTO_LENGTH, &udid))
+						events.push_back({ watcher, "detach", { udid, iface }, 2 });
+					} else {
+						napi_value device = findDevice(change.udid);
+						if (device) {
+							events.push_back({ watcher, change.type == AttachChange ? "attach" : "update", { device, iface }, 2 });
+						}
+					}
+				}
+			}
+
+			if (watcher->snapshot) {
+				if (!list) {
+					list = listDevices(snapshot);
+				}
+				events.push_back({ watcher, "change", { list, NULL }, 1 });
+			}
+		}
+	}
+
+	if (!events.empty()) {
+		napi_value global, listener, argv[3], rval;
+		NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global))
+
+		size_t count = events.size();
+		LOG_DEBUG_THREAD_ID_2("DeviceSubscriber::dispatch", "Dispatching %ld device %s", count, count == 1 ? "event" : "events")
+
+		for (auto const& event : events) {
+			// a listener may unwatch while handling an earlier event
+			if (event.watcher->removed) {
+				continue;
+			}
+			NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, event.watcher->ref, &listener))
+			NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, event.name, NAPI_AUTO_LENGTH, &argv[0]))
+			argv[1] = event.args[0];
+			argv[2] = event.args[1];
+			NAPI_THROW("DeviceSubscriber::dispatch", "ERROR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, listener, event.argc + 1, argv, &rval))
+		}
+	}
+
+	NAPI_THROW("DeviceSubscriber::dispatch", "ERR_NAPI_CLOSE_HANDLE_SCOPE", ::napi_close_handle_scope(env, scope))
+}
+
+/**
+ * Starts or stops forwarding a port from every matching device into a single relay group. Each
+ * listener gets a group of its own. Devices that are already connected are attached right away and
+ * the rest are attached as they connect.
+ */
+void DeviceSubscriber::forwardAll(uint8_t action, napi_value nport, napi_value listener, napi_value options, const std::vector<std::string>& udids) {
+	if (action == RELAY_START) {
+		uint32_t port = 0;
+		napi_status status = ::napi_get_value_uint32(env, nport, &port);
+		if (status != napi_ok || port < 1 || port > 65535) {
+			throw std::runtime_error("Expected port to be a number between 1 and 65535");
+		}
+
+		RelayOptions opts = RelayOptions::parse(env, options);
+		deviceman->wait();
+		std::shared_ptr<SocketRelayGroup> group = SocketRelayGroup::create(env, deviceman->getRunLoop(), port, opts, udids);
+
+		LOG_DEBUG_1("DeviceSubscriber::forwardAll", "Creating relay group for port %d", port)
+		group->add(listener);
+
+		// the run loop thread publishes a device before it takes the groups lock to attach it to
+		// the groups, so a device can't slip in between reading the snapshot and adding the group
+		std::lock_guard<std::mutex> groupsGuard(groupsLock);
+		for (auto const& it : deviceman->snapshot()->devices) {
+			group->attach(it.first, it.second->getUsb());
+		}
+		groups.push_back(group);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(groupsLock);
+	for (auto it = groups.begin(); it != groups.end(); ++it) {
+		if ((*it)->has(listener)) {
+			LOG_DEBUG("DeviceSubscriber::forwardAll", "Removing relay group")
+			(*it)->remove(listener);
+			groups.erase(it);
+			return;
+		}
+	}
+}
+
+/**
+ * Returns the number of times each device has flapped, which is shared by every environment.
+ */
+napi_value DeviceSubscriber::flapStats() {
+	std::map<std::string, uint64_t> flaps;
+	deviceman->flapStats(flaps);
+
+	napi_value rval;
+	NAPI_THROW_RETURN("DeviceSubscriber::flapStats", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &rval), NULL)
+	for (auto const& it : flaps) {
+		napi_value count;
+		NAPI_THROW_RETURN("DeviceSubscriber::flapStats", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)it.second, &count), NULL)
+		NAPI_THROW_RETURN("DeviceSubscriber::flapStats", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, rval, it.first.c_str(), count), NULL)
+	}
+	return rval;
+}
+
+/**
+ * Returns the stats for the listener's relay group.
+ */
+napi_value DeviceSubscriber::forwardAllStats(napi_value listener) {
+	std::lock_guard<std::mutex> lock(groupsLock);
+	for (auto const& group : groups) {
+		if (group->has(listener)) {
+			return group->getStats().toJS(env);
+		}
+	}
+	throw std::runtime_error("Relay group has been stopped");
+}
+
+/**
+ * Returns the subscriber of a Node environment from the environment's instance data.
+ */
+DeviceSubscriber* DeviceSubscriber::get(napi_env env) {
+	void* data = NULL;
+	::napi_get_instance_data(env, &data);
+	return static_cast<DeviceSubscriber*>(data);
+}
+
+/**
+ * Attempts to find a connected device by udid or throws an error if not found.
+ */
+std::shared_ptr<Device> DeviceSubscriber::getDevice(std::string& udid) {
+	return deviceman->getDevice(udid);
+}
+
+/**
+ * Returns the connected devices as a JavaScript array of device objects, waiting for the initial
+ * devices to be enumerated first.
+ */
+napi_value DeviceSubscriber::list() {
+	deviceman->wait();
+	return listDevices(deviceman->snapshot());
+}
+
+/**
+ * Returns the devices in a snapshot as a frozen JavaScript array of device objects. The array is
+ * cached and only rebuilt when the registry generation changes. Disconnected devices that are held
+ * in case they come back or kept for their relay connections to reconnect are skipped, and are
+ * dropped from the registry on the next rebuild once neither is the case.
+ */
+napi_value DeviceSubscriber::listDevices(const DeviceSnapshot& snapshot) {
+	napi_value rval = listCache.get(snapshot->generation);
+	if (rval) {
+		return rval;
+	}
+
+	LOG_DEBUG_2("DeviceSubscriber::listDevices", "Creating device list with %ld devices (generation %llu)", snapshot->devices.size(), (unsigned long long)snapshot->generation)
+	std::vector<napi_value> objects;
+	std::vector<std::string> gone;
+	for (auto const& it : snapshot->devices) {
+		if (it.second->isDisconnected()) {
+			if (!it.second->isResumable() && !deviceman->isHeld(it.first)) {
+				gone.push_back(it.first);
+			}
+			continue;
+		}
+
+		napi_value device = deviceToJS(it.first, it.second);
+		if (!device) {
+			return NULL;
+		}
+		objects.push_back(device);
+	}
+
+	if (!gone.empty()) {
+		deviceman->prune(gone);
+	}
+
+	return listCache.set(snapshot->generation, objects);
+}
+
+/**
+ * Resolves the pending `ready()` promises, then emits the device list to the watch listeners that
+ * were added before the initial devices had been enumerated. This function is invoked by libuv on
+ * the environment's main thread once the device manager has been marked initialized.
+ */
+void DeviceSubscriber::onReady() {
+	if (readyNotified) {
+		return;
+	}
+	readyNotified = true;
+
+	if (!pendingReady.empty()) {
+		napi_value resource, name, undefined;
+		napi_async_context context;
+		napi_callback_scope scope;
+
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &resource))
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "DeviceMan::ready", NAPI_AUTO_LENGTH, &name))
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_ASYNC_INIT", ::napi_async_init(env, resource, name, &context))
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_OPEN_CALLBACK_SCOPE", ::napi_open_callback_scope(env, resource, context, &scope))
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_GET_UNDEFINED", ::napi_get_undefined(env, &undefined))
+
+		LOG_DEBUG_1("DeviceSubscriber::onReady", "Resolving %ld ready promises", pendingReady.size())
+		for (auto const& deferred : pendingReady) {
+			::napi_resolve_deferred(env, deferred, undefined);
+		}
+		pendingReady.clear();
+		::uv_unref((uv_handle_t*)notifyReady);
+
+		// closing the scope runs the promise reactions
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_CLOSE_CALLBACK_SCOPE", ::napi_close_callback_scope(env, scope))
+		NAPI_THROW("DeviceSubscriber::onReady", "ERR_NAPI_ASYNC_DESTROY", ::napi_async_destroy(env, context))
+	}
+
+	dispatch();
+}
+
+/**
+ * Returns the stats of the device probe workers, which are shared by every environment.
+ */
+napi_value DeviceSubscriber::probeStats() {
+	ProbeStatsSnapshot stats;
+	deviceman->probeStats(stats);
+	return stats.toJS(env);
+}
+
+/**
+ * Returns a promise that resolves once the initial devices have been enumerated, starting the
+ * device manager if needed. The promise keeps Node alive until it settles.
+ */
+napi_value DeviceSubscriber::ready() {
+	napi_deferred deferred;
+	napi_value promise;
+	NAPI_THROW_RETURN("DeviceSubscriber::ready", "ERR_NAPI_CREATE_PROMISE", ::napi_create_promise(env, &deferred, &promise), NULL)
+
+	deviceman->start();
+
+	if (readyNotified) {
+		napi_value undefined;
+		NAPI_THROW_RETURN("DeviceSubscriber::ready", "ERR_NAPI_GET_UNDEFINED", ::napi_get_undefined(env, &undefined), NULL)
+		NAPI_THROW_RETURN("DeviceSubscriber::ready", "ERR_NAPI_RESOLVE_DEFERRED", ::napi_resolve_deferred(env, deferred, undefined), NULL)
+		return promise;
+	}
+
+	if (pendingReady.empty()) {
+		::uv_ref((uv_handle_t*)notifyReady);
+	}
+	pendingReady.push_back(deferred);
+	return promise;
+}
+
+/**
+ * Sums the stats of every relay connection this environment has to the connected devices and every
+ * relay group.
+ */
+napi_value DeviceSubscriber::relayStats() {
+	RelayStatsSnapshot total;
+
+	for (auto const& it : deviceman->snapshot()->devices) {
+		it.second->stats(env, total);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(groupsLock);
+		for (auto const& group : groups) {
+			total.merge(group->getStats());
+		}
+	}
+
+	return total.toJS(env);
+}
+
+/**
+ * Wakes up the environment's main thread to dispatch the changes queued for it. This is called by
+ * the device manager from the run loop thread or a probe worker.
+ */
+void DeviceSubscriber::signalChange() {
+	::uv_async_send(notifyChange);
+}
+
+/**
+ * Wakes up the environment's main thread to settle its `ready()` promises. This is called by the
+ * device manager once the initial devices have been enumerated.
+ */
+void DeviceSubscriber::signalReady() {
+	::uv_async_send(notifyReady);
+}
+
+}
@@ -0,0 +1,94 @@
+#ifndef __DEVICE_SUBSCRIBER_H__
+#define __DEVICE_SUBSCRIBER_H__
+
+#include "node-ios-device.h"
+#include "deviceman.h"
+#include "device-list.h"
+#include "watch-batch.h"
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+enum WatchAction { Watch, Unwatch };
+
+class DeviceSubscriber;
+
+/**
+ * A watch listener along with its options. Changes wait in `batch` until the listener's coalescing
+ * window closes and its throttle has passed. A listener isn't primed until it has been sent the
+ * devices that were already connected.
+ */
+struct WatchListener {
+	DeviceSubscriber*         subscriber;
+	napi_ref                  ref;
+	bool                      snapshot;
+	WatchBatch                batch;
+	bool                      primed;
+	bool                      removed;
+	uv_timer_t*               timer;
+};
+
+/**
+ * The state of a single Node environment that has loaded the addon, such as the main thread or a
+ * worker thread. It's stored as the environment's instance data.
+ *
+ * The device manager is shared by every environment, while the watch listeners, the `ready()`
+ * promises, the relay groups, the device list cache, and the debug log belong to the environment
+ * they were created in. The device manager queues device changes for each subscriber and signals
+ * its async handles, which are dispatched on the environment's own event loop. Everything the
+ * environment has open is closed when it's torn down.
+ */
+class DeviceSubscriber {
+public:
+	DeviceSubscriber(napi_env env, std::shared_ptr<LogSink> log);
+	~DeviceSubscriber();
+
+	static DeviceSubscriber* get(napi_env env);
+
+	void attach(const std::string& udid, std::shared_ptr<DeviceInterface> usb);
+	void config(napi_value listener, WatchAction action, napi_value options = NULL);
+	napi_value flapStats();
+	void forwardAll(uint8_t action, napi_value nport, napi_value listener, napi_value options, const std::vector<std::string>& udids);
+	napi_value forwardAllStats(napi_value listener);
+	std::shared_ptr<Device> getDevice(std::string& udid);
+	inline LogSink* getLog() const { return log.get(); }
+	napi_value list();
+	napi_value probeStats();
+	napi_value ready();
+	napi_value relayStats();
+	void signalChange();
+	void signalReady();
+
+private:
+	napi_value deviceToJS(const std::string& udid, const std::shared_ptr<Device>& device);
+	void dispatch(WatchListener* due = NULL);
+	napi_value listDevices(const DeviceSnapshot& snapshot);
+	void onReady();
+
+	napi_env env;
+	std::shared_ptr<DeviceMan> deviceman;
+	std::shared_ptr<LogSink> log;
+	uv_async_t* notifyChange;
+	uv_async_t* notifyReady;
+
+	// only used on the main thread
+	DeviceListCache listCache;
+	bool readyNotified;
+	std::list<napi_deferred> pendingReady;
+
+	std::mutex listenersLock;
+	std::list<std::shared_ptr<WatchListener>> listeners;
+
+	// locked by the run loop thread after a snapshot is published
+	std::mutex groupsLock;
+	std::list<std::shared_ptr<SocketRelayGroup>> groups;
+};
+
+}
+
+#endif
@@ -1,78 +1,129 @@
 #include "device.h"
+#include "cf-value.h"
+#include <cstring>
 #include <sstream>
 
 namespace node_ios_device {
 
 /**
- * Initializes the device by creating the relays, initializing the supplied device interface, and
- * retrieving the device properties.
+ * The lockdown key for each device property. Volatile properties can change without the device
+ * being updated, so they are refreshed even when the rest of the properties come from the cache.
+ */
+static const struct {
+	const char* name;
+	CFStringRef key;
+	bool        boolean;
+	bool        isVolatile;
+} devicePropKeys[] = {
+	{ "name",                CFSTR("DeviceName"),          false, true },
+	{ "buildVersion",        CFSTR("BuildVersion"),        false, false },
+	{ "cpuArchitecture",     CFSTR("CPUArchitecture"),     false, false },
+	{ "deviceClass",         CFSTR("DeviceClass"),         false, false },
+	{ "deviceColor",         CFSTR("DeviceColor"),         false, false },
+	{ "hardwareModel",       CFSTR("HardwareModel"),       false, false },
+	{ "modelNumber",         CFSTR("ModelNumber"),         false, false },
+	{ "productType",         CFSTR("ProductType"),         false, false },
+	{ "productVersion",      CFSTR("ProductVersion"),      false, false },
+	{ "serialNumber",        CFSTR("SerialNumber"),        false, false },
+	{ "trustedHostAttached", CFSTR("TrustedHostAttached"), true,  true }
+};
+
+/**
+ * Initializes the device by initializing the supplied device interface and retrieving the device
+ * properties. The relays are created as each Node environment first uses the device.
+ *
+ * If the device is in the property cache, the cached properties are used as is and the device is
+ * marked stale so that `refresh()` can check them later. Otherwise the properties are read from the
+ * device and cached.
  *
  * Not that we only need to get the props from the first device interface since it's the same
  * regardless of the which interface.
  */
-Device::Device(napi_env env, std::string& udid, am_device& dev, std::weak_ptr<CFRunLoopRef> runloop) :
-	portRelay(env, runloop),
-	env(env),
-	udid(udid) {
+Device::Device(std::string& udid, am_device& dev, std::weak_ptr<CFRunLoopRef> runloop, std::shared_ptr<DevicePropCache> cache) :
+	generation(0),
+	stale(false),
+	udid(udid),
+	runloop(runloop),
+	cache(cache) {
 
 	auto iface = config(dev, true);
 
+	std::map<std::string, std::string> cached;
+	if (cache && cache->get(udid, cached) && cached.size() == sizeof(devicePropKeys) / sizeof(devicePropKeys[0])) {
+		LOG_DEBUG_1("Device", "Using cached device info for %s", udid.c_str())
+		for (auto const& prop : devicePropKeys) {
+			std::string& value = cached[prop.name];
+			if (prop.boolean) {
+				props[prop.name] = std::make_unique<DeviceProp>(value == "true");
+			} else {
+				props[prop.name] = std::make_unique<DeviceProp>(value);
+			}
+		}
+		stale = true;
+		return;
+	}
+
 	LOG_DEBUG_1("Device", "Getting device info for %s", udid.c_str())
-	iface->connect();
+	{
+		DeviceSession session(iface);
+		readProps(iface, false);
+	}
 
-	props["name"]            = std::make_unique<DeviceProp>(iface->getString(CFSTR("DeviceName")));
-	props["buildVersion"]    = std::make_unique<DeviceProp>(iface->getString(CFSTR("BuildVersion")));
-	props["cpuArchitecture"] = std::make_unique<DeviceProp>(iface->getString(CFSTR("CPUArchitecture")));
-	props["deviceClass"]     = std::make_unique<DeviceProp>(iface->getString(CFSTR("DeviceClass")));
+	cacheProps();
+}
 
-	std::string deviceColor = iface->getString(CFSTR("DeviceColor"));
-	if (deviceColor == "0") {
-		deviceColor = "White";
-	} else if (deviceColor == "1") {
-		deviceColor = "Black";
-	} else if (deviceColor == "2") {
-		deviceColor = "Silver";
-	} else if (deviceColor == "3") {
-		deviceColor = "Gold";
-	} else if (deviceColor == "4") {
-		deviceColor = "Rose Gold";
-	} else if (deviceColor == "5") {
-		deviceColor = "Jet Black";
+/**
+ * Writes the device properties to the property cache.
+ */
+void Device::cacheProps() {
+	if (!cache) {
+		return;
 	}
-	props["deviceColor"] = std::make_unique<DeviceProp>(deviceColor);
 
-	props["hardwareModel"]       = std::make_unique<DeviceProp>(iface->getString(CFSTR("HardwareModel")));
-	props["modelNumber"]         = std::make_unique<DeviceProp>(iface->getString(CFSTR("ModelNumber")));
-	props["productType"]         = std::make_unique<DeviceProp>(iface->getString(CFSTR("ProductType")));
-	props["productVersion"]      = std::make_unique<DeviceProp>(iface->getString(CFSTR("ProductVersion")));
-	props["serialNumber"]        = std::make_unique<DeviceProp>(iface->getString(CFSTR("SerialNumber")));
-	props["trustedHostAttached"] = std::make_unique<DeviceProp>(iface->getBoolean(CFSTR("TrustedHostAttached")));
-
-	iface->disconnect();
+	std::map<std::string, std::string> values;
+	{
+		std::lock_guard<std::mutex> lock(propsLock);
+		for (auto const& it : props) {
+			values[it.first] = it.second->type == Boolean ? (it.second->bval ? "true" : "false") : it.second->sval;
+		}
+	}
+	cache->put(udid, values);
 }
 
 /**
- * Adds or removes a device interface.
+ * Adds or removes a device interface. The port relays are told about the USB interface so that
+ * their relay connections can reconnect through it. This is only called on the run loop thread and
+ * the interfaces are swapped atomically since the main threads read them without a lock.
  */
 DeviceInterface* Device::config(am_device& dev, bool isAdd) {
 	uint32_t type = ::AMDeviceGetInterfaceType(dev);
 	if (type == 1) {
 		if (isAdd && !usb) {
 			LOG_DEBUG_1("Device::config", "Device %s connected via USB", udid.c_str())
-			usb = std::make_shared<DeviceInterface>(udid, dev, type);
-			return usb.get();
+			auto iface = std::make_shared<DeviceInterface>(udid, dev, type);
+			std::atomic_store(&usb, iface);
+			std::lock_guard<std::mutex> lock(relaysLock);
+			for (auto const& it : relays) {
+				it.second->portRelay.attach(iface);
+			}
+			return iface.get();
 		} else if (!isAdd && usb) {
 			LOG_DEBUG_1("Device::config", "Device %s disconnected via USB", udid.c_str())
-			usb = nullptr;
+			std::atomic_store(&usb, std::shared_ptr<DeviceInterface>());
+			std::lock_guard<std::mutex> lock(relaysLock);
+			for (auto const& it : relays) {
+				it.second->portRelay.attach(nullptr);
+			}
 		}
 	} else if (type == 2) {
 		if (isAdd && !wifi) {
 			LOG_DEBUG_1("Device::config", "Device %s connected via Wi-Fi", udid.c_str())
-			wifi = std::make_shared<DeviceInterface>(udid, dev, type);
-			return wifi.get();
+			auto iface = std::make_shared<DeviceInterface>(udid, dev, type);
+			std::atomic_store(&wifi, iface);
+			return iface.get();
 		} else if (!isAdd && wifi) {
 			LOG_DEBUG_1("Device::config", "Device %s disconnected via Wi-Fi", udid.c_str())
-			wifi = nullptr;
+			std::atomic_store(&wifi, std::shared_ptr<DeviceInterface>());
 		}
 	} else {
 		std::stringstream error;
@@ -86,17 +137,177 @@ DeviceInterface* Device::config(am_device& dev, bool isAdd) {
 /**
  * Starts or stops port forwarding.
  */
-void Device::forward(uint8_t action, napi_value nport, napi_value listener) {
+void Device::forward(napi_env env, uint8_t action, napi_value nport, napi_value listener, napi_value options) {
+	auto usb = getUsb();
 	if (action == RELAY_START && !usb) {
 		throw std::runtime_error("Port forward requires a USB connected iOS device");
 	}
-	portRelay.config(action, nport, listener, usb);
+	getRelays(env)->portRelay.config(action, nport, listener, options, usb);
+}
+
+/**
+ * Returns the relays of a Node environment, creating them the first time the environment uses the
+ * device. New relays are attached to the USB interface if the device is connected over USB.
+ */
+std::shared_ptr<DeviceRelays> Device::getRelays(napi_env env) {
+	std::lock_guard<std::mutex> lock(relaysLock);
+	auto it = relays.find(env);
+	if (it != relays.end()) {
+		return it->second;
+	}
+
+	auto deviceRelays = std::make_shared<DeviceRelays>(env, runloop);
+	auto usb = getUsb();
+	if (usb) {
+		deviceRelays->portRelay.attach(usb);
+	}
+	relays.insert(std::make_pair(env, deviceRelays));
+	return deviceRelays;
+}
+
+/**
+ * Starts or stops a local TCP listener that proxies each client to a port on the device. Returns
+ * the local port, which is picked by the OS when starting with a local port of 0.
+ */
+uint32_t Device::listen(napi_env env, uint8_t action, napi_value ndevicePort, napi_value nlocalPort) {
+	uint32_t localPort = 0;
+	napi_status status = ::napi_get_value_uint32(env, nlocalPort, &localPort);
+	if (status != napi_ok || localPort > 65535) {
+		throw std::runtime_error("Expected local port to be a number between 0 and 65535");
+	}
+
+	std::shared_ptr<DeviceRelays> deviceRelays = getRelays(env);
+	auto& proxies = deviceRelays->proxies;
+
+	if (action == RELAY_STOP) {
+		auto it = proxies.find(localPort);
+		if (it != proxies.end()) {
+			LOG_DEBUG_1("Device::listen", "Stopping listener on port %u", localPort)
+			it->second->stop();
+			proxies.erase(it);
+		}
+		return localPort;
+	}
+
+	uint32_t devicePort = 0;
+	status = ::napi_get_value_uint32(env, ndevicePort, &devicePort);
+	if (status != napi_ok || devicePort < 1 || devicePort > 65535) {
+		throw std::runtime_error("Expected port to be a number between 1 and 65535");
+	}
+
+	auto usb = getUsb();
+	if (!usb) {
+		throw std::runtime_error("Port listen requires a USB connected iOS device");
+	}
+
+	if (localPort && proxies.find(localPort) != proxies.end()) {
+		std::stringstream error;
+		error << "Port " << localPort << " is already being listened on";
+		throw std::runtime_error(error.str());
+	}
+
+	std::shared_ptr<PortProxy> proxy = SocketPortProxy::create(runloop, ::AMDeviceGetConnectionID(usb->dev), devicePort, localPort);
+	proxies.insert(std::make_pair(proxy->getLocalPort(), proxy));
+	return proxy->getLocalPort();
+}
+
+/**
+ * The state of a `getValues()` call while it runs on a worker thread.
+ */
+struct GetValuesRequest {
+	napi_async_work work;
+	napi_deferred deferred;
+	std::shared_ptr<DeviceInterface> iface;
+	bool all;
+	std::vector<std::string> keys;
+	CFDictionaryRef values;
+	std::string error;
+};
+
+/**
+ * Queries the device on a worker thread.
+ */
+static void getValuesExecute(napi_env env, void* data) {
+	GetValuesRequest* req = static_cast<GetValuesRequest*>(data);
+	try {
+		req->values = req->iface->copyValues(req->all ? NULL : &req->keys);
+	} catch (std::exception& e) {
+		req->error = e.what();
+	}
+}
+
+/**
+ * Converts the values on the main thread and settles the promise.
+ */
+static void getValuesComplete(napi_env env, napi_status status, void* data) {
+	std::unique_ptr<GetValuesRequest> req(static_cast<GetValuesRequest*>(data));
+	napi_value result = NULL;
+
+	if (req->values) {
+		result = cfValueToJS(env, req->values);
+		::CFRelease(req->values);
+		if (result) {
+			::napi_resolve_deferred(env, req->deferred, result);
+		} else {
+			// the conversion failed and left an exception pending
+			::napi_get_and_clear_last_exception(env, &result);
+			::napi_reject_deferred(env, req->deferred, result);
+		}
+	} else {
+		napi_value code, msg;
+		if (req->error.empty()) {
+			req->error = status == napi_cancelled ? "Get values cancelled" : "Failed to get values";
+		}
+		LOG_DEBUG_1("Device::getValues", "Error: %s", req->error.c_str())
+		::napi_create_string_utf8(env, "ERR_GET_VALUES", NAPI_AUTO_LENGTH, &code);
+		::napi_create_string_utf8(env, req->error.c_str(), req->error.length(), &msg);
+		::napi_create_error(env, code, msg, &result);
+		::napi_reject_deferred(env, req->deferred, result);
+	}
+
+	::napi_delete_async_work(env, req->work);
+}
+
+/**
+ * Gets lockdown values from the device on a worker thread. `keys` is NULL for the whole domain. Returns a promise that resolves an object of the values converted to JavaScript.
+ */
+napi_value Device::getValues(napi_env env, const std::vector<std::string>* keys) {
+	std::shared_ptr<DeviceInterface> iface = getUsb();
+	if (!iface) {
+		iface = getWifi();
+	}
+	if (!iface) {
+		std::stringstream error;
+		error << "No interfaces found for device " << udid;
+		throw std::runtime_error(error.str());
+	}
+
+	std::unique_ptr<GetValuesRequest> req = std::make_unique<GetValuesRequest>();
+	req->iface = iface;
+	req->values = NULL;
+
+	req->all = keys == NULL;
+	if (keys) {
+		req->keys = *keys;
+	}
+
+	napi_value promise, name;
+	NAPI_THROW_RETURN("Device::getValues", "ERR_NAPI_CREATE_PROMISE", ::napi_create_promise(env, &req->deferred, &promise), NULL)
+	NAPI_THROW_RETURN("Device::getValues", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "Device::getValues", NAPI_AUTO_LENGTH, &name), NULL)
+	NAPI_THROW_RETURN("Device::getValues", "ERR_NAPI_CREATE_ASYNC_WORK", ::napi_create_async_work(env, NULL, name, getValuesExecute, getValuesComplete, req.get(), &req->work), NULL)
+	NAPI_THROW_RETURN("Device::getValues", "ERR_NAPI_QUEUE_ASYNC_WORK", ::napi_queue_async_work(env, req->work), NULL)
+
+	// the request is freed by `getValuesComplete()`
+	req.release();
+	return promise;
 }
 
 /**
  * Installs the specified app on the device.
  */
 void Device::install(std::string& appPath) {
+	auto usb = getUsb();
+	auto wifi = getWifi();
 	if (usb) {
 		usb->install(appPath);
 	} else if (wifi) {
@@ -108,10 +319,135 @@ void Device::install(std::string& appPath) {
 	}
 }
 
+/**
+ * Returns true if any of the environments have a relay connection that will reconnect when the
+ * device comes back.
+ */
+bool Device::isResumable() {
+	std::lock_guard<std::mutex> lock(relaysLock);
+	for (auto const& it : relays) {
+		if (it.second->portRelay.isResumable()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Reads the device properties from the device, or only the volatile ones if `volatileOnly` is set.
+ * The interface must be held by a `DeviceSession`. Returns true if any property changed.
+ */
+bool Device::readProps(DeviceInterface* iface, bool volatileOnly) {
+	bool changed = false;
+
+	for (auto const& prop : devicePropKeys) {
+		if (volatileOnly && !prop.isVolatile) {
+			continue;
+		}
+
+		std::unique_ptr<DeviceProp> value;
+		if (prop.boolean) {
+			value = std::make_unique<DeviceProp>(iface->getBoolean(prop.key));
+		} else {
+			std::string str = iface->getString(prop.key);
+			if (::strcmp(prop.name, "deviceColor") == 0) {
+				if (str == "0") {
+					str = "White";
+				} else if (str == "1") {
+					str = "Black";
+				} else if (str == "2") {
+					str = "Silver";
+				} else if (str == "3") {
+					str = "Gold";
+				} else if (str == "4") {
+					str = "Rose Gold";
+				} else if (str == "5") {
+					str = "Jet Black";
+				}
+			}
+			value = std::make_unique<DeviceProp>(str);
+		}
+
+		std::lock_guard<std::mutex> lock(propsLock);
+		auto it = props.find(prop.name);
+		if (it == props.end() || it->second->type != value->type || it->second->bval != value->bval || it->second->sval != value->sval) {
+			props[prop.name] = std::move(value);
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * Checks the properties of a device that was created from the property cache. The volatile
+ * properties are read again, and if the build version changed because the device was updated, so
+ * are the rest. The cache is updated either way. Returns true if any property changed. This is run
+ * by a probe worker.
+ */
+bool Device::refresh() {
+	if (!stale) {
+		return false;
+	}
+
+	std::shared_ptr<DeviceInterface> iface = getUsb();
+	if (!iface) {
+		iface = getWifi();
+	}
+	if (!iface) {
+		return false;
+	}
+	stale = false;
+
+	LOG_DEBUG_1("Device::refresh", "Refreshing cached device info for %s", udid.c_str())
+	bool changed;
+	{
+		DeviceSession session(iface.get());
+
+		std::string buildVersion = iface->getString(CFSTR("BuildVersion"));
+		bool updated;
+		{
+			std::lock_guard<std::mutex> lock(propsLock);
+			auto it = props.find("buildVersion");
+			updated = it == props.end() || it->second->sval != buildVersion;
+		}
+		if (updated) {
+			LOG_DEBUG_2("Device::refresh", "Device %s was updated to %s, getting device info", udid.c_str(), buildVersion.c_str())
+		}
+		changed = readProps(iface.get(), !updated);
+	}
+
+	cacheProps();
+	return changed;
+}
+
+/**
+ * Stops the relays and port listeners of a Node environment that is going away. This is run on the
+ * environment's main thread.
+ */
+void Device::release(napi_env env) {
+	std::shared_ptr<DeviceRelays> deviceRelays;
+	{
+		std::lock_guard<std::mutex> lock(relaysLock);
+		auto it = relays.find(env);
+		if (it == relays.end()) {
+			return;
+		}
+		deviceRelays = it->second;
+		relays.erase(it);
+	}
+
+	LOG_DEBUG_1("Device::release", "Releasing relays for %s", udid.c_str())
+	deviceRelays->portRelay.disconnect();
+	for (auto const& it : deviceRelays->proxies) {
+		it.second->stop();
+	}
+}
+
 /**
  * Serialized the device info to a JavaScript object.
  */
-napi_value Device::toJS() {
+napi_value Device::toJS(napi_env env) {
 	napi_value obj;
 
 	NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &obj), NULL)
@@ -123,23 +459,28 @@ napi_value Device::toJS() {
 	}
 
 	{
-		napi_value ifaces, push, type;
-		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array(env, &ifaces), NULL)
-		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, ifaces, "push", &push), NULL)
+		napi_value ifaces, type;
+		uint32_t i = 0;
+		auto usb = getUsb();
+		auto wifi = getWifi();
+		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, (usb ? 1 : 0) + (wifi ? 1 : 0), &ifaces), NULL)
 
 		if (usb) {
 			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "USB", NAPI_AUTO_LENGTH, &type), NULL)
-			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CALL_FUNCTION", ::napi_call_function(env, ifaces, push, 1, &type, NULL), NULL)
+			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, ifaces, i++, type), NULL)
 		}
 
 		if (wifi) {
 			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "Wi-Fi", NAPI_AUTO_LENGTH, &type), NULL)
-			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_CALL_FUNCTION", ::napi_call_function(env, ifaces, push, 1, &type, NULL), NULL)
+			NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, ifaces, i++, type), NULL)
 		}
 
+		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_OBJECT_FREEZE", ::napi_object_freeze(env, ifaces), NULL)
+
 		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "interfaces", ifaces), NULL)
 	}
 
+	std::lock_guard<std::mutex> lock(propsLock);
 	for (auto const& it : props) {
 		napi_value tmp;
 		if (it.second->type == Boolean) {
@@ -149,10 +490,54 @@ napi_value Device::toJS() {
 		} else {
 			continue;
 		}
-		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, it.first, tmp), NULL)
+		NAPI_THROW_RETURN("Device::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, it.first.c_str(), tmp), NULL)
 	}
 
 	return obj;
 }
 
+/**
+ * Returns the relay stats for a forwarded port.
+ */
+napi_value Device::stats(napi_env env, napi_value nport, napi_value listener) {
+	return getRelays(env)->portRelay.stats(nport, listener);
+}
+
+/**
+ * Adds the stats of all of an environment's relay connections to the device to the total.
+ */
+void Device::stats(napi_env env, RelayStatsSnapshot& total) {
+	std::lock_guard<std::mutex> lock(relaysLock);
+	auto it = relays.find(env);
+	if (it != relays.end()) {
+		it->second->portRelay.stats(total);
+		it->second->syslogRelay.stats(total);
+	}
+}
+
+/**
+ * Starts or stops relaying the device's syslog.
+ */
+void Device::syslog(napi_env env, uint8_t action, napi_value listener, napi_value options) {
+	auto usb = getUsb();
+	if (action == RELAY_START && !usb) {
+		throw std::runtime_error("Syslog requires a USB connected iOS device");
+	}
+	getRelays(env)->syslogRelay.config(action, listener, options, usb);
+}
+
+/**
+ * Returns the relay stats for the device's syslog.
+ */
+napi_value Device::syslogStats(napi_env env, napi_value listener) {
+	return getRelays(env)->syslogRelay.stats(listener);
+}
+
+/**
+ * Writes data to a forwarded port.
+ */
+bool Device::write(napi_env env, napi_value nport, napi_value listener, napi_value data, napi_value callback) {
+	return getRelays(env)->portRelay.write(nport, listener, data, callback);
+}
+
 }
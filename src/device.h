@@ -3,12 +3,15 @@
 
 #include "node-ios-device.h"
 #include "device-interface.h"
+#include "device-prop-cache.h"
 #include "mobiledevice.h"
 #include "relay.h"
 #include <CoreFoundation/CoreFoundation.h>
+#include <atomic>
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace node_ios_device {
 
@@ -24,35 +27,81 @@ enum DevicePropType { Boolean, String };
 class DeviceProp {
 public:
 	DeviceProp(bool val) : type(Boolean), bval(val) {}
-	DeviceProp(std::string val) : type(String), sval(val) {}
+	DeviceProp(std::string val) : type(String), bval(false), sval(val) {}
 
 	DevicePropType type;
 	bool bval;
 	std::string sval;
 };
 
+/**
+ * The relays and port listeners a Node environment has open to a device. The listeners belong to
+ * the environment, so each environment that uses a device gets relays of its own.
+ */
+struct DeviceRelays {
+	DeviceRelays(napi_env env, std::weak_ptr<CFRunLoopRef> runloop) : portRelay(env, runloop), syslogRelay(env, runloop) {}
+
+	PortRelay   portRelay;
+	SyslogRelay syslogRelay;
+	std::map<uint32_t, std::shared_ptr<PortProxy>> proxies;
+};
+
 /**
  * Contains info for a connected device as well as the interfaces (USB/Wi-Fi) and the relays.
  * Any device-specific queries or execution needs to be run at the interface level.
+ *
+ * A device is shared by every Node environment that has loaded the addon, so the methods that take
+ * JavaScript values are passed the environment they're called from.
  */
 class Device {
 public:
-	Device(napi_env env, std::string& udid, am_device& dev, std::weak_ptr<CFRunLoopRef> runloop);
+	Device(std::string& udid, am_device& dev, std::weak_ptr<CFRunLoopRef> runloop, std::shared_ptr<DevicePropCache> cache);
 
 	DeviceInterface* config(am_device& dev, bool isAdd);
-	void forward(uint8_t action, napi_value nport, napi_value listener);
+	void forward(napi_env env, uint8_t action, napi_value nport, napi_value listener, napi_value options);
 	void install(std::string& appPath);
-	inline bool isDisconnected() const { return !usb && !wifi; }
-	napi_value toJS();
+	napi_value getValues(napi_env env, const std::vector<std::string>* keys);
+	inline std::shared_ptr<DeviceInterface> getUsb() const { return std::atomic_load(&usb); }
+	inline std::shared_ptr<DeviceInterface> getWifi() const { return std::atomic_load(&wifi); }
+	inline bool isDisconnected() const { return !getUsb() && !getWifi(); }
+	bool isResumable();
+	inline bool isStale() const { return stale; }
+	uint32_t listen(napi_env env, uint8_t action, napi_value ndevicePort, napi_value nlocalPort);
+	bool refresh();
+	void release(napi_env env);
+	napi_value stats(napi_env env, napi_value nport, napi_value listener);
+	void stats(napi_env env, RelayStatsSnapshot& total);
+	void syslog(napi_env env, uint8_t action, napi_value listener, napi_value options);
+	napi_value syslogStats(napi_env env, napi_value listener);
+	napi_value toJS(napi_env env);
+	bool write(napi_env env, napi_value nport, napi_value listener, napi_value data, napi_value callback);
+
+	// the device registry generation in which an interface last connected or disconnected or the
+	// properties last changed
+	std::atomic<uint64_t> generation;
 
+private:
+	void cacheProps();
+	std::shared_ptr<DeviceRelays> getRelays(napi_env env);
+	bool readProps(DeviceInterface* iface, bool volatileOnly);
+
+	// set when the properties came from the cache and haven't been checked against the device
+	std::atomic<bool> stale;
+
+	// only changed by `config()` on the run loop thread and read from any thread with the getters
 	std::shared_ptr<DeviceInterface> usb;
 	std::shared_ptr<DeviceInterface> wifi;
 
-private:
-	PortRelay   portRelay;
-	napi_env    env;
 	std::string udid;
-	std::map<const char*, std::unique_ptr<DeviceProp>> props;
+	std::weak_ptr<CFRunLoopRef> runloop;
+	std::shared_ptr<DevicePropCache> cache;
+	std::mutex propsLock;
+	std::map<std::string, std::unique_ptr<DeviceProp>> props;
+
+	// the relays of each environment, created when the environment first uses the device; the run
+	// loop thread attaches the USB interface to them while holding the lock
+	std::mutex relaysLock;
+	std::map<napi_env, std::shared_ptr<DeviceRelays>> relays;
 };
 
 }
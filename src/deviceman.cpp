@@ -1,104 +1,186 @@
 #include "deviceman.h"
+#include "device-subscriber.h"
+#include <cstring>
+#include <sys/time.h>
+#include <sys/un.h>
 
 namespace node_ios_device {
 
 /**
- * Initialize default properties.
+ * Asks usbmuxd how many devices it knows about and returns the count, or -1 if usbmuxd couldn't be
+ * asked or its reply is too long. MobileDevice sends a connect notification for each of them after
+ * subscribing, so the initial enumeration is complete once that many have arrived. This is run on
+ * the run loop thread.
  */
-DeviceMan::DeviceMan(napi_env env) :
-	env(env),
-	initialized(false),
-	initTimer(NULL),
-	runloop(NULL) {
+static int usbmuxDeviceCount() {
+	static const char request[] =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+		"<plist version=\"1.0\"><dict>"
+		"<key>MessageType</key><string>ListDevices</string>"
+		"<key>ClientVersionString</key><string>node-ios-device</string>"
+		"<key>ProgName</key><string>node-ios-device</string>"
+		"</dict></plist>\n";
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct timeval timeout = { 1, 0 };
+	::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	::strncpy(addr.sun_path, "/var/run/usbmuxd", sizeof(addr.sun_path) - 1);
+	if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		::close(fd);
+		return -1;
+	}
+
+	// each message is a 16 byte header of the length, version 1 (plist), message type 8 (plist),
+	// and a tag, followed by the plist
+	uint32_t header[4] = { (uint32_t)(sizeof(header) + sizeof(request) - 1), 1, 8, 1 };
+	std::string message((const char*)header, sizeof(header));
+	message.append(request, sizeof(request) - 1);
+
+	auto transfer = [fd](char* data, size_t length, bool send) {
+		for (size_t offset = 0; offset < length; ) {
+			ssize_t n = send ? ::write(fd, data + offset, length - offset) : ::read(fd, data + offset, length - offset);
+			if (n <= 0) {
+				return false;
+			}
+			offset += (size_t)n;
+		}
+		return true;
+	};
+
+	std::string reply;
+	if (transfer(&message[0], message.size(), true) && transfer((char*)header, sizeof(header), false) && header[0] > sizeof(header)) {
+		// the length comes from the socket, so a bogus one is treated as a failed request rather
+		// than allocated
+		if (header[0] - sizeof(header) > USBMUX_MAX_REPLY_LENGTH) {
+			::close(fd);
+			return -1;
+		}
+		reply.resize(header[0] - sizeof(header));
+		if (!transfer(&reply[0], reply.size(), false)) {
+			reply.clear();
+		}
+	}
+	::close(fd);
+
+	int count = -1;
+	if (reply.empty()) {
+		return count;
+	}
 
-	notifyChange = new uv_async_t;
+	CFDataRef data = ::CFDataCreateWithBytesNoCopy(NULL, (const uint8_t*)reply.data(), reply.size(), kCFAllocatorNull);
+	CFPropertyListRef plist = ::CFPropertyListCreateWithData(NULL, data, kCFPropertyListImmutable, NULL, NULL);
+	if (plist && ::CFGetTypeID(plist) == ::CFDictionaryGetTypeID()) {
+		CFArrayRef list = (CFArrayRef)::CFDictionaryGetValue((CFDictionaryRef)plist, CFSTR("DeviceList"));
+		if (list && ::CFGetTypeID(list) == ::CFArrayGetTypeID()) {
+			count = (int)::CFArrayGetCount(list);
+		}
+	}
+	if (plist) {
+		::CFRelease(plist);
+	}
+	::CFRelease(data);
+
+	return count;
 }
 
 /**
- * Releases the async handle, unsubscribes from iOS device notifications, and stops the runloop.
+ * Initialize default properties.
+ */
+DeviceMan::DeviceMan() :
+	DeviceNotifier<Device, am_device>(FlapTracker::defaultWindow()),
+	deviceNotification(NULL),
+	started(false),
+	initTimer(NULL),
+	expectedDevices(-1),
+	connectedCount(0),
+	refreshTimer(NULL),
+	expireTimer(NULL),
+	probeSource(NULL),
+	runloop(NULL) {}
+
+/**
+ * Unsubscribes from iOS device notifications and stops the runloop.
  */
 DeviceMan::~DeviceMan() {
 	LOG_DEBUG_THREAD_ID("DeviceMan::~DeviceMan", "Shutting down device manager")
 
-	::uv_close(
-		(uv_handle_t*)notifyChange,
-		[](uv_handle_t* handle) {
-			delete (uv_async_t *)handle;
-		}
-	);
+	// wait for the running probes before tearing down what they use
+	probePool.stop();
 
-	::AMDeviceNotificationUnsubscribe(deviceNotification);
+	if (deviceNotification) {
+		::AMDeviceNotificationUnsubscribe(deviceNotification);
+	}
 
 	stopInitTimer();
 
-	if (runloop) {
-		::CFRunLoopStop(*runloop);
-		runloop = NULL;
+	for (auto timer : { &refreshTimer, &expireTimer }) {
+		if (*timer) {
+			::CFRunLoopTimerInvalidate(*timer);
+			::CFRelease(*timer);
+			*timer = NULL;
+		}
 	}
-}
 
-/**
- * Configures the device notfication listeners.
- */
-void DeviceMan::config(napi_value listener, WatchAction action) {
-	if (action == Watch) {
-		napi_ref ref;
-		NAPI_THROW("DeviceMan::config", "ERROR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, listener, 1, &ref))
+	if (probeSource) {
+		::CFRunLoopSourceInvalidate(probeSource);
+		::CFRelease(probeSource);
+		probeSource = NULL;
+	}
 
-		LOG_DEBUG("DeviceMan::config", "Adding listener")
-		::uv_ref((uv_handle_t*)notifyChange);
-		{
-			std::lock_guard<std::mutex> lock(listenersLock);
-			listeners.push_back(ref);
+	for (auto const& it : probed) {
+		::AMDeviceRelease(it.dev);
+	}
+	for (auto const& it : probing) {
+		for (auto const& pending : it.second) {
+			::AMDeviceRelease(pending.dev);
 		}
+	}
 
-		// immediately fire the callback
-		napi_value global, argv[2], rval;
-
-		NAPI_THROW("DeviceMan::config", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global))
-		NAPI_THROW("DeviceMan::config", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "change", NAPI_AUTO_LENGTH, &argv[0]))
-		argv[1] = list();
-
-		NAPI_THROW("DeviceMan::config", "ERROR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, listener, 2, argv, &rval))
-	} else {
-		std::lock_guard<std::mutex> lock(listenersLock);
-		for (auto it = listeners.begin(); it != listeners.end(); ) {
-			napi_value fn;
-			NAPI_THROW("DeviceMan::config", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, *it, &fn))
-
-			bool same;
-			NAPI_THROW("DeviceMan::config", "ERR_NAPI_STRICT_EQUALS", ::napi_strict_equals(env, listener, fn, &same))
-
-			if (same) {
-				LOG_DEBUG("DeviceMan::config", "Removing listener")
-				::uv_unref((uv_handle_t*)notifyChange);
-				it = listeners.erase(it);
-			} else {
-				++it;
-			}
-		}
+	if (runloop) {
+		::CFRunLoopStop(*runloop);
+		runloop = NULL;
 	}
 }
 
 /**
- * Creates an shared pointer to an instance of the device manager.
+ * Returns the device manager, creating it the first time a Node environment loads the addon. Every
+ * environment, such as the main thread and each worker thread, shares the same device manager. It
+ * lives until the process exits since the run loop thread and the device notification callback
+ * hold on to it.
  */
-std::shared_ptr<DeviceMan> DeviceMan::create(napi_env env) {
-	auto deviceman = std::make_shared<DeviceMan>(env);
-	deviceman->init();
-	return deviceman;
+std::shared_ptr<DeviceMan> DeviceMan::acquire() {
+	static std::mutex instanceLock;
+	static std::shared_ptr<DeviceMan> instance;
+
+	std::lock_guard<std::mutex> lock(instanceLock);
+	if (!instance) {
+		LOG_DEBUG("DeviceMan::acquire", "Creating device manager")
+		instance = std::make_shared<DeviceMan>();
+		instance->self = instance;
+	}
+	return instance;
 }
 
 /**
- * Creates a timer on the background thread that will fire after 500ms and unlock the init mutex
- * on the main thread.
+ * Creates a timer on the background thread that will fire after 500ms and mark the device manager
+ * as initialized. This is the fallback for when usbmuxd didn't say how many devices to expect or
+ * one of them never shows up.
  */
 void DeviceMan::createInitTimer() {
 	if (initialized) {
 		return;
 	}
 
-	// set a timer for 500ms to unlock the initMutex
+	// set a timer for 500ms to settle the initial enumeration
 	CFRunLoopTimerContext timerContext = { 0, static_cast<void*>(&self), NULL, NULL, NULL };
 	initTimer = ::CFRunLoopTimerCreate(
 		kCFAllocatorDefault,
@@ -107,11 +189,16 @@ void DeviceMan::createInitTimer() {
 		0, // flags
 		0, // order
 		[](CFRunLoopTimerRef timer, void* info) {
-			LOG_DEBUG("DeviceMan::createInitTimer", "initTimer fired, unlocking init mutex")
 			std::shared_ptr<DeviceMan>* deviceman = static_cast<std::shared_ptr<DeviceMan>*>(info);
-			(*deviceman)->initialized = true;
-			(*deviceman)->initMutex.unlock();
-			(*deviceman)->stopInitTimer();
+
+			// a device that is still being probed will start the timer again once it's published
+			if ((*deviceman)->isProbing()) {
+				LOG_DEBUG("DeviceMan::createInitTimer", "initTimer fired, waiting for devices to be probed")
+				return;
+			}
+
+			LOG_DEBUG("DeviceMan::createInitTimer", "initTimer fired, device notifications have settled")
+			(*deviceman)->markInitialized();
 		},
 		&timerContext
 	);
@@ -121,48 +208,48 @@ void DeviceMan::createInitTimer() {
 }
 
 /**
- * Emits change events. This function is invoked by libuv on the main thread when a change
- * notification is sent from the background thread.
+ * Hands a subscriber the changes that were queued for it along with the registry snapshot they
+ * lead up to.
  */
-void DeviceMan::dispatch() {
-	napi_handle_scope scope;
-	napi_value global, argv[2], listener, rval;
-
-	NAPI_THROW("DeviceMan::dispatch", "ERR_NAPI_OPEN_HANDLE_SCOPE", ::napi_open_handle_scope(env, &scope))
-	NAPI_THROW("DeviceMan::dispatch", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global))
-	NAPI_THROW("DeviceMan::dispatch", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, "change", NAPI_AUTO_LENGTH, &argv[0]))
-	argv[1] = list();
-
-	std::list<napi_value> callbacks;
-	{
-		std::lock_guard<std::mutex> lock(listenersLock);
-		for (auto const& ref : listeners) {
-			NAPI_THROW("DeviceMan::dispatch", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, ref, &listener))
-			if (listener != NULL) {
-				callbacks.push_back(listener);
-			}
-		}
+DeviceSnapshot DeviceMan::drain(DeviceSubscriber* subscriber, std::vector<DeviceChange>& queued) {
+	std::lock_guard<std::mutex> changesGuard(changesLock);
+	auto it = changes.find(subscriber);
+	if (it != changes.end()) {
+		queued.swap(it->second);
 	}
+	return devices.snapshot();
+}
 
-	if (callbacks.empty()) {
-		return;
+/**
+ * Drops the devices whose flap window has passed without them reconnecting, unless they have relay
+ * connections waiting to reconnect. The timer is started again if more devices are being held. This
+ * is run on the run loop thread by the expire timer.
+ */
+void DeviceMan::expireDevices() {
+	// the timer is still valid while it fires, so it's dropped here for `scheduleExpiry()` to
+	// start a new one
+	if (expireTimer) {
+		::CFRunLoopTimerInvalidate(expireTimer);
+		::CFRelease(expireTimer);
+		expireTimer = NULL;
 	}
 
-	size_t count = callbacks.size();
-	LOG_DEBUG_THREAD_ID_2("DeviceMan::dispatch", "Dispatching device changes to %ld %s", count, count == 1 ? "listener" : "listeners")
-
-	for (auto const& callback : callbacks) {
-		NAPI_THROW("DeviceMan::dispatch", "ERROR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, 2, argv, &rval))
+	if (expireHeld() > 0) {
+		scheduleExpiry();
 	}
 }
 
 /**
- * Attempts to find a connected device by udid or throws an error if not found.
+ * Attempts to find a connected device by udid or throws an error if not found. The lookup is done
+ * on a snapshot of the registry, so it never waits on the run loop thread.
  */
 std::shared_ptr<Device> DeviceMan::getDevice(std::string& udid) {
-	auto it = devices.find(udid);
+	wait();
+
+	DeviceSnapshot snapshot = devices.snapshot();
+	auto it = snapshot->devices.find(udid);
 
-	if (it == devices.end()) {
+	if (it == snapshot->devices.end()) {
 		std::string msg = "Device \"" + udid + "\" not found";
 		throw std::runtime_error(msg);
 	}
@@ -171,56 +258,37 @@ std::shared_ptr<Device> DeviceMan::getDevice(std::string& udid) {
 }
 
 /**
- * Initializes the device manager by creating the async device change notification handler, then
- * immediately unrefs it as to not block Node from quitting. Next spawns the background thread and
- * locking the init mutex. This method is run on the main thread.
+ * Marks the initial device enumeration as complete, wakes up the main threads waiting in `wait()`,
+ * and notifies the subscribers so that they can settle their `ready()` promises. This is called
+ * from the run loop thread.
  */
-void DeviceMan::init() {
-	self = shared_from_this();
-
-	// wire up our dispatch change handler into Node's event loop, then unref it so that we don't
-	// block Node from exiting
-	uv_loop_t* loop;
-	::napi_get_uv_event_loop(env, &loop);
-	notifyChange->data = &self;
-	::uv_async_init(loop, notifyChange, [](uv_async_t* handle) {
-		std::shared_ptr<DeviceMan>* deviceman = static_cast<std::shared_ptr<DeviceMan>*>(handle->data);
-		(*deviceman)->dispatch();
-	});
-	::uv_unref((uv_handle_t*)notifyChange);
-
-	LOG_DEBUG_THREAD_ID("DeviceMan::init", "Starting background thread")
-	std::thread(&DeviceMan::run, this).detach();
+void DeviceMan::markInitialized() {
+	{
+		std::lock_guard<std::mutex> lock(initLock);
+		if (initialized) {
+			return;
+		}
+		initialized = true;
+	}
 
-	// we need to wait until the run loop has had time to process the initial
-	// device notifications, so we first lock the mutex ourselves, then we wait
-	// 2 seconds for the run loop will unlock it
-	LOG_DEBUG("DeviceMan::init", "Waiting for init mutex")
-	initMutex.lock();
+	LOG_DEBUG_1("DeviceMan::markInitialized", "Initial device enumeration complete (%d connect notifications)", connectedCount)
+	stopInitTimer();
+	initCond.notify_all();
 
-	// then we try to re-lock it, but we need to wait for the run loop thread
-	// to unlock it first
-	initMutex.try_lock_for(std::chrono::seconds(2));
+	std::lock_guard<std::mutex> subscribersGuard(subscribersLock);
+	for (auto subscriber : subscribers) {
+		subscriber->signalReady();
+	}
 }
 
 /**
- * Copies the connected devices into a JavaScript array of device objects.
+ * Notifies every subscriber that changes have been queued for it.
  */
-napi_value DeviceMan::list() {
-	napi_value rval;
-	napi_value push;
-
-	NAPI_THROW_RETURN("list", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array(env, &rval), NULL)
-	NAPI_THROW_RETURN("list", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, rval, "push", &push), NULL)
-
-	std::lock_guard<std::mutex> lock(deviceMutex);
-	LOG_DEBUG_1("DeviceMan::list", "Creating device list with %ld devices", devices.size())
-	for (auto const& it : devices) {
-		napi_value device = it.second->toJS();
-		NAPI_THROW_RETURN("list", "ERR_NAPI_CALL_FUNCTION", ::napi_call_function(env, rval, push, 1, &device, NULL), NULL)
+void DeviceMan::notifyChange() {
+	std::lock_guard<std::mutex> subscribersGuard(subscribersLock);
+	for (auto subscriber : subscribers) {
+		subscriber->signalChange();
 	}
-
-	return rval;
 }
 
 /**
@@ -231,49 +299,209 @@ void DeviceMan::onDeviceNotification(am_device_notification_callback_info* info)
 		return;
 	}
 
-	bool changed = false;
-
-	LOG_DEBUG("DeviceMan::onDeviceNotification", "Resetting timer due to new device notification")
-	stopInitTimer();
+	if (!initialized) {
+		LOG_DEBUG("DeviceMan::onDeviceNotification", "Resetting timer due to new device notification")
+		stopInitTimer();
+	}
 
 	std::string udid(::CFStringGetCStringPtr(::AMDeviceCopyDeviceIdentifier(info->dev), kCFStringEncodingUTF8));
-	std::lock_guard<std::mutex> lock(deviceMutex);
-
-	auto it = devices.find(udid);
-	std::shared_ptr<Device> device = it != devices.end() ? it->second : NULL;
-
-	if (device) {
-		if (info->msg == ADNCI_MSG_CONNECTED) {
-			changed = device->config(info->dev, true) != NULL;
-		} else if (info->msg == ADNCI_MSG_DISCONNECTED) {
-			changed = device->config(info->dev, false) == NULL;
-			if (device->isDisconnected()) {
-				devices.erase(udid);
-			}
+	onNotification(udid, info->dev, info->msg == ADNCI_MSG_CONNECTED);
+}
+
+/**
+ * Publishes the devices the probe workers have finished with, then applies the notifications that
+ * arrived for each device while it was being probed. This is run on the run loop thread when a
+ * probe worker signals `probeSource`.
+ */
+void DeviceMan::onProbed() {
+	std::vector<ProbedDevice> done;
+	{
+		std::lock_guard<std::mutex> guard(probedLock);
+		done.swap(probed);
+	}
+
+	for (auto& it : done) {
+		finishProbe(it.udid, it.dev, it.device);
+		::AMDeviceRelease(it.dev);
+	}
+}
+
+/**
+ * Acts on a published device notification. Devices created from the property cache are scheduled
+ * to be refreshed, held devices to expire, and the subscribers' relay groups follow the device's
+ * USB interface. This is run on the run loop thread.
+ */
+void DeviceMan::onPublished(const std::string& udid, bool connected, const DevicePublished<Device>& published) {
+	// devices created from the property cache are checked against the device once it's published
+	if (connected && published.device && published.device->isStale()) {
+		scheduleRefresh(udid);
+	}
+
+	if (published.held) {
+		scheduleExpiry();
+	}
+
+	// relay groups follow devices as they connect and disconnect over USB
+	{
+		std::shared_ptr<DeviceInterface> usb = published.device ? published.device->getUsb() : NULL;
+		std::lock_guard<std::mutex> subscribersGuard(subscribersLock);
+		for (auto subscriber : subscribers) {
+			subscriber->attach(udid, usb);
+		}
+	}
+
+	// the initial enumeration is complete once every device usbmuxd reported has connected,
+	// otherwise wait for the notifications to settle
+	if (!initialized) {
+		if (connected && expectedDevices >= 0 && ++connectedCount >= expectedDevices) {
+			markInitialized();
+		} else {
+			stopInitTimer();
+			createInitTimer();
 		}
-	} else if (info->msg == ADNCI_MSG_CONNECTED) {
+	}
+
+	// we need to notify if devices changed and this must be done outside the
+	// scopes above so that the locks are released
+	if (published.changed && initialized) {
+		notifyChange();
+	}
+}
+
+/**
+ * Hands a new device to the probe workers, which connect to it and read its properties, then pass
+ * it back to the run loop thread to be published. This is run on the run loop thread.
+ */
+void DeviceMan::probe(const std::string& udid, am_device dev) {
+	::AMDeviceRetain(dev);
+
+	std::weak_ptr<CFRunLoopRef> loop = runloop;
+	probePool.submit(udid, [this, udid, dev, loop]() {
+		std::string id = udid;
+		am_device device = dev;
+		std::shared_ptr<Device> probedDevice;
+
 		try {
-			devices.insert(std::make_pair(udid, std::make_shared<Device>(env, udid, info->dev, runloop)));
-			changed = true;
+			probedDevice = std::make_shared<Device>(id, device, loop, propCache);
 		} catch (std::exception& e) {
-			LOG_DEBUG_1("DeviceMan::onDeviceNotification", "%s", e.what())
+			LOG_DEBUG_2("DeviceMan::probe", "Failed to probe %s: %s", udid.c_str(), e.what())
 		}
+
+		{
+			std::lock_guard<std::mutex> guard(probedLock);
+			probed.push_back({ udid, dev, probedDevice });
+		}
+
+		std::shared_ptr<CFRunLoopRef> rl = loop.lock();
+		if (rl) {
+			::CFRunLoopSourceSignal(probeSource);
+			::CFRunLoopWakeUp(*rl);
+		}
+
+		return (bool)probedDevice;
+	});
+}
+
+/**
+ * Copies the stats of the device probe workers, including how long probes take from the device
+ * connecting to it being ready to publish.
+ */
+void DeviceMan::probeStats(ProbeStatsSnapshot& stats) {
+	probePool.snapshot(stats);
+}
+
+/**
+ * Queues a device change for every subscriber. This is called while `changesLock` is held.
+ */
+void DeviceMan::queueChange(const std::string& udid, DeviceChangeType type, const char* iface) {
+	for (auto& it : changes) {
+		it.second.push_back({ type, udid, iface });
 	}
+}
 
-	createInitTimer();
+/**
+ * Checks the devices that were created from the property cache against the devices themselves.
+ * Each device is refreshed by a probe worker, after any probe of the same device, and devices
+ * whose properties changed get a new generation and an "update" event. This is run on the run loop
+ * thread by the refresh timer.
+ */
+void DeviceMan::refreshDevices() {
+	std::vector<std::string> udids;
+	udids.swap(staleDevices);
+
+	for (auto const& udid : udids) {
+		probePool.submit(udid, [this, udid]() {
+			DeviceSnapshot snapshot = devices.snapshot();
+			auto it = snapshot->devices.find(udid);
+			if (it == snapshot->devices.end()) {
+				return true;
+			}
 
-	// we need to notify if devices changed and this must be done outside the
-	// scopes above so that the mutex is unlocked
-	if (changed) {
-		::uv_async_send(notifyChange);
+			std::shared_ptr<Device> device = it->second;
+			if (!device->refresh()) {
+				return true;
+			}
+
+			{
+				std::lock_guard<std::mutex> changesGuard(changesLock);
+				devices.update([&](DeviceRegistry<Device>::Map& map, uint64_t generation) {
+					auto current = map.find(udid);
+					if (current == map.end() || current->second != device) {
+						return false;
+					}
+					device->generation = generation;
+					return true;
+				});
+
+				if (!initialized || device->isDisconnected()) {
+					return true;
+				}
+				queueChange(udid, UpdateChange, device->getUsb() ? "USB" : "Wi-Fi");
+			}
+
+			notifyChange();
+			return true;
+		});
 	}
 }
 
+/**
+ * Releases the handle of a notification that was held while its device was being probed.
+ */
+void DeviceMan::release(am_device dev) {
+	::AMDeviceRelease(dev);
+}
+
+/**
+ * Keeps the handle of a notification alive while its device is being probed.
+ */
+void DeviceMan::retain(am_device dev) {
+	::AMDeviceRetain(dev);
+}
+
 /**
  * The background thread that runs the actual runloop and notifies the main thread of events.
  */
 void DeviceMan::run() {
 	LOG_DEBUG_THREAD_ID("DeviceMan::run", "Initializing run loop")
+	runloop = std::make_shared<CFRunLoopRef>(::CFRunLoopGetCurrent());
+
+	expectedDevices = usbmuxDeviceCount();
+	LOG_DEBUG_1("DeviceMan::run", "usbmuxd reported %d devices", expectedDevices)
+
+	propCache = std::make_shared<DevicePropCache>(DevicePropCache::defaultPath());
+	if (!propCache->isOpen()) {
+		LOG_DEBUG("DeviceMan::run", "Device property cache disabled")
+		propCache = NULL;
+	}
+
+	// probe workers signal this source when a device is ready to be published
+	CFRunLoopSourceContext sourceContext = { 0, static_cast<void*>(&self), NULL, NULL, NULL, NULL, NULL, NULL, NULL, [](void* info) {
+		std::shared_ptr<DeviceMan>* deviceman = static_cast<std::shared_ptr<DeviceMan>*>(info);
+		(*deviceman)->onProbed();
+	} };
+	probeSource = ::CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &sourceContext);
+	::CFRunLoopAddSource(*runloop, probeSource, kCFRunLoopCommonModes);
 
 	LOG_DEBUG("DeviceMan::run", "Subscribing to device notifications")
 	::AMDeviceNotificationSubscribe([](am_device_notification_callback_info* info, void* arg) {
@@ -281,16 +509,123 @@ void DeviceMan::run() {
 		(*deviceman)->onDeviceNotification(info);
 	}, 0, 0, static_cast<void*>(&self), &deviceNotification);
 
-	runloop = std::make_shared<CFRunLoopRef>(::CFRunLoopGetCurrent());
-
-	createInitTimer();
+	if (expectedDevices == 0) {
+		markInitialized();
+	} else {
+		createInitTimer();
+	}
 
 	LOG_DEBUG("DeviceMan::run", "Starting CoreFoundation run loop")
 	::CFRunLoopRun();
 }
 
 /**
- * Kills the init mutex timer.
+ * Starts the expire timer for the next held device if it isn't already running. This is run on
+ * the run loop thread.
+ */
+void DeviceMan::scheduleExpiry() {
+	if (expireTimer && ::CFRunLoopTimerIsValid(expireTimer)) {
+		return;
+	}
+	if (expireTimer) {
+		::CFRelease(expireTimer);
+	}
+
+	uint32_t ms = flaps.nextExpiry();
+	if (ms == 0) {
+		expireTimer = NULL;
+		return;
+	}
+
+	CFRunLoopTimerContext timerContext = { 0, static_cast<void*>(&self), NULL, NULL, NULL };
+	expireTimer = ::CFRunLoopTimerCreate(
+		kCFAllocatorDefault,
+		CFAbsoluteTimeGetCurrent() + ms / 1000.0,
+		0, // interval
+		0, // flags
+		0, // order
+		[](CFRunLoopTimerRef timer, void* info) {
+			std::shared_ptr<DeviceMan>* deviceman = static_cast<std::shared_ptr<DeviceMan>*>(info);
+			(*deviceman)->expireDevices();
+		},
+		&timerContext
+	);
+
+	::CFRunLoopAddTimer(*runloop, expireTimer, kCFRunLoopCommonModes);
+}
+
+/**
+ * Queues a device created from the property cache to be refreshed and starts the refresh timer if
+ * it isn't already running. The timer waits a moment so that devices are published to the
+ * registry, and the initial enumeration can finish, before any of them are connected to. This is
+ * run on the run loop thread.
+ */
+void DeviceMan::scheduleRefresh(const std::string& udid) {
+	staleDevices.push_back(udid);
+
+	if (refreshTimer && ::CFRunLoopTimerIsValid(refreshTimer)) {
+		return;
+	}
+	if (refreshTimer) {
+		::CFRelease(refreshTimer);
+	}
+
+	CFRunLoopTimerContext timerContext = { 0, static_cast<void*>(&self), NULL, NULL, NULL };
+	refreshTimer = ::CFRunLoopTimerCreate(
+		kCFAllocatorDefault,
+		CFAbsoluteTimeGetCurrent() + 0.25f,
+		0, // interval
+		0, // flags
+		0, // order
+		[](CFRunLoopTimerRef timer, void* info) {
+			std::shared_ptr<DeviceMan>* deviceman = static_cast<std::shared_ptr<DeviceMan>*>(info);
+			(*deviceman)->refreshDevices();
+		},
+		&timerContext
+	);
+
+	LOG_DEBUG("DeviceMan::scheduleRefresh", "Adding refresh timer to run loop")
+	::CFRunLoopAddTimer(*runloop, refreshTimer, kCFRunLoopCommonModes);
+}
+
+/**
+ * Starts the background thread that watches for devices if it hasn't been started yet. This method
+ * is run on the main thread of any Node environment.
+ */
+void DeviceMan::start() {
+	if (started.exchange(true)) {
+		return;
+	}
+
+	LOG_DEBUG_THREAD_ID("DeviceMan::start", "Starting background thread")
+	std::thread(&DeviceMan::run, this).detach();
+}
+
+/**
+ * Adds the subscriber of a Node environment that has loaded the addon. Changes are queued for it
+ * from now on, and it's notified right away if the initial devices have already been enumerated.
+ */
+void DeviceMan::subscribe(DeviceSubscriber* subscriber) {
+	{
+		std::lock_guard<std::mutex> changesGuard(changesLock);
+		changes[subscriber];
+	}
+
+	bool ready;
+	{
+		std::lock_guard<std::mutex> subscribersGuard(subscribersLock);
+		subscribers.push_back(subscriber);
+		ready = initialized;
+	}
+
+	// if the device manager is marked initialized after the check, it notifies the subscriber too
+	if (ready) {
+		subscriber->signalReady();
+	}
+}
+
+/**
+ * Kills the init timer.
  */
 void DeviceMan::stopInitTimer() {
 	if (initTimer) {
@@ -302,4 +637,33 @@ void DeviceMan::stopInitTimer() {
 	}
 }
 
+/**
+ * Removes the subscriber of a Node environment that is going away. Once this returns, the run loop
+ * thread and the probe workers no longer touch the subscriber.
+ */
+void DeviceMan::unsubscribe(DeviceSubscriber* subscriber) {
+	std::lock_guard<std::mutex> changesGuard(changesLock);
+	changes.erase(subscriber);
+
+	std::lock_guard<std::mutex> subscribersGuard(subscribersLock);
+	subscribers.remove(subscriber);
+}
+
+/**
+ * Starts the device manager if needed and blocks until the initial devices have been enumerated,
+ * but no longer than 2 seconds. This is used by the synchronous API and only blocks the first time.
+ * This method is run on the main thread of any Node environment.
+ */
+void DeviceMan::wait() {
+	start();
+
+	if (initialized) {
+		return;
+	}
+
+	LOG_DEBUG("DeviceMan::wait", "Waiting for initial device enumeration")
+	std::unique_lock<std::mutex> lock(initLock);
+	initCond.wait_for(lock, std::chrono::seconds(2), [this]() { return initialized.load(); });
+}
+
 } // end namespace node_ios_device
@@ -3,57 +3,135 @@
 
 #include "node-ios-device.h"
 #include "device.h"
+#include "device-notifier.h"
 #include "mobiledevice.h"
+#include "probe-pool.h"
 #include <CoreFoundation/CoreFoundation.h>
+#include <atomic>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <string>
 #include <thread>
+#include <vector>
+
+// the largest usbmuxd device list reply that is read, which is far more than the few KB a plist of
+// the connected devices takes
+#define USBMUX_MAX_REPLY_LENGTH (1024 * 1024)
 
 namespace node_ios_device {
 
 LOG_DEBUG_EXTERN_VARS
 
-enum WatchAction { Watch, Unwatch };
+class DeviceSubscriber;
+
+typedef std::shared_ptr<const DeviceRegistry<Device>::Snapshot> DeviceSnapshot;
+
+/**
+ * A device that a probe worker has finished connecting to and reading the properties of, waiting
+ * for the run loop thread to publish it. `device` is NULL if the probe failed.
+ */
+struct ProbedDevice {
+	std::string             udid;
+	am_device               dev;
+	std::shared_ptr<Device> device;
+};
 
 /**
  * Device Manager that tracks connected devices.
+ *
+ * There is one device manager per process. It's shared by every Node environment that loads the
+ * addon, such as the main thread and each worker thread, so there is only ever one subscription to
+ * device notifications and each device is handshaked once no matter how many environments use it.
+ * Each environment has a `DeviceSubscriber` of its own that the device manager queues device
+ * changes for and that emits them to the environment's watch listeners.
+ *
+ * The background thread that watches for devices isn't started until the device manager is first
+ * used, so loading the module never blocks. Subscribers are notified once the initial devices have
+ * been enumerated, while synchronous calls such as `list()` wait for it.
+ * Enumeration is complete once a connect notification has arrived for every device usbmuxd
+ * reported when asked up front, or once notifications have settled for 500ms if usbmuxd couldn't
+ * be asked.
+ *
+ * The devices are kept in a copy-on-write registry, so looking up or listing devices on the main
+ * thread never waits on a device handshake. The run loop thread applies device notifications to it
+ * through `DeviceNotifier`. New devices are handed to a bounded pool of probe workers which
+ * handshake with several devices at once, and each device is published by the run loop thread as
+ * soon as its probe finishes. Devices found in the persistent property cache skip the handshake and
+ * are refreshed by the probe workers shortly after they are published. A device that disconnects
+ * and comes right back is reused instead of being probed again.
+ *
+ * Watch listeners are sent a typed event for each device or interface that connects or
+ * disconnects rather than the whole device list, which is opt-in.
  */
-class DeviceMan : public std::enable_shared_from_this<DeviceMan> {
+class DeviceMan : public std::enable_shared_from_this<DeviceMan>, public DeviceNotifier<Device, am_device> {
 public:
-	DeviceMan(napi_env env);
+	DeviceMan();
 	virtual ~DeviceMan();
 
-	static std::shared_ptr<DeviceMan> create(napi_env env);
+	static std::shared_ptr<DeviceMan> acquire();
 
-	void config(napi_value listener, WatchAction action);
+	DeviceSnapshot drain(DeviceSubscriber* subscriber, std::vector<DeviceChange>& queued);
 	std::shared_ptr<Device> getDevice(std::string& udid);
-	void init();
-	napi_value list();
+	inline std::weak_ptr<CFRunLoopRef> getRunLoop() const { return runloop; }
+	inline bool isInitialized() const { return initialized; }
+	void probeStats(ProbeStatsSnapshot& stats);
+	void start();
+	void subscribe(DeviceSubscriber* subscriber);
+	void unsubscribe(DeviceSubscriber* subscriber);
+	void wait();
 
 private:
 	void createInitTimer();
-	void dispatch();
+	void expireDevices();
+	void markInitialized();
+	void notifyChange();
 	void onDeviceNotification(am_device_notification_callback_info* info);
+	void onProbed();
+	void onPublished(const std::string& udid, bool connected, const DevicePublished<Device>& published);
+	void probe(const std::string& udid, am_device dev);
+	void queueChange(const std::string& udid, DeviceChangeType type, const char* iface);
+	void refreshDevices();
+	void release(am_device dev);
+	void retain(am_device dev);
 	void run();
+	void scheduleExpiry();
+	void scheduleRefresh(const std::string& udid);
 	void stopInitTimer();
 
 	std::shared_ptr<DeviceMan> self;
 
-	napi_env env;
-	uv_async_t* notifyChange;
-
-	std::mutex deviceMutex;
-	std::map<std::string, std::shared_ptr<Device>> devices;
 	am_device_notification deviceNotification;
 
-	bool initialized;
+	std::atomic<bool> started;
 	CFRunLoopTimerRef initTimer;
-	std::timed_mutex initMutex;
+	std::mutex initLock;
+	std::condition_variable initCond;
+
+	// only used on the run loop thread
+	int expectedDevices;
+	int connectedCount;
+	std::shared_ptr<DevicePropCache> propCache;
+	CFRunLoopTimerRef refreshTimer;
+	std::vector<std::string> staleDevices;
+	CFRunLoopTimerRef expireTimer;
+	CFRunLoopSourceRef probeSource;
+
+	// probed devices are handed back to the run loop thread through `probeSource`
+	std::mutex probedLock;
+	std::vector<ProbedDevice> probed;
 
 	std::shared_ptr<CFRunLoopRef> runloop;
 
-	std::mutex listenersLock;
-	std::list<napi_ref> listeners;
+	// the changes queued for each subscriber; guarded by `changesLock`
+	std::map<DeviceSubscriber*, std::vector<DeviceChange>> changes;
+
+	// the subscriber of each Node environment that has loaded the addon; locked after `changesLock`
+	std::mutex subscribersLock;
+	std::list<DeviceSubscriber*> subscribers;
+
+	// stopped first when the device manager is destroyed since its probes use the members above
+	ProbePool probePool;
 };
 
 }
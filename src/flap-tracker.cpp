@@ -0,0 +1,120 @@
+#include "flap-tracker.h"
+#include <cstdlib>
+
+namespace node_ios_device {
+
+/**
+ * Initializes the tracker with the number of milliseconds to hold a disconnected device for.
+ */
+FlapTracker::FlapTracker(uint32_t window) : window(window) {}
+
+/**
+ * Returns the window from the `NODE_IOS_DEVICE_FLAP_WINDOW` environment variable, where `0`
+ * disables holding, or 2 seconds by default.
+ */
+uint32_t FlapTracker::defaultWindow() {
+	const char* env = ::getenv("NODE_IOS_DEVICE_FLAP_WINDOW");
+	if (env && *env) {
+		char* end = NULL;
+		unsigned long value = ::strtoul(env, &end, 10);
+		if (end && *end == '\0' && value <= UINT32_MAX) {
+			return (uint32_t)value;
+		}
+	}
+	return FLAP_TRACKER_WINDOW;
+}
+
+/**
+ * Stops holding the devices whose window has passed and returns their udids.
+ */
+std::vector<std::string> FlapTracker::expire() {
+	std::vector<std::string> expired;
+	auto now = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& it : devices) {
+		if (it.second.held && it.second.expires <= now) {
+			it.second.held = false;
+			expired.push_back(it.first);
+		}
+	}
+
+	return expired;
+}
+
+/**
+ * Holds a device that has disconnected from its last interface until the window passes.
+ */
+void FlapTracker::hold(const std::string& udid) {
+	if (window == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	Entry& entry = devices[udid];
+	entry.held = true;
+	entry.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(window);
+}
+
+/**
+ * Returns true if the device is being held.
+ */
+bool FlapTracker::isHeld(const std::string& udid) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = devices.find(udid);
+	return it != devices.end() && it->second.held;
+}
+
+/**
+ * Returns the number of milliseconds until the next held device expires, or 0 if none are held.
+ * A device that is already due is reported as 1 millisecond away.
+ */
+uint32_t FlapTracker::nextExpiry() {
+	auto now = std::chrono::steady_clock::now();
+	int64_t next = -1;
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto const& it : devices) {
+		if (it.second.held) {
+			int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(it.second.expires - now).count();
+			if (ms < 1) {
+				ms = 1;
+			}
+			if (next == -1 || ms < next) {
+				next = ms;
+			}
+		}
+	}
+
+	return next == -1 ? 0 : (uint32_t)next;
+}
+
+/**
+ * Stops holding a device that has reconnected. Returns true, and counts a flap, if the device was
+ * still being held.
+ */
+bool FlapTracker::resume(const std::string& udid) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = devices.find(udid);
+	if (it == devices.end() || !it->second.held) {
+		return false;
+	}
+
+	it->second.held = false;
+	++it->second.flaps;
+	return true;
+}
+
+/**
+ * Copies the flap count of every device that has flapped.
+ */
+void FlapTracker::snapshot(std::map<std::string, uint64_t>& out) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto const& it : devices) {
+		if (it.second.flaps > 0) {
+			out[it.first] = it.second.flaps;
+		}
+	}
+}
+
+}
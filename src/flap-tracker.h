@@ -0,0 +1,62 @@
+#ifndef __FLAP_TRACKER_H__
+#define __FLAP_TRACKER_H__
+
+#include "node-ios-device.h"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the default number of milliseconds a disconnected device is held for in case it comes right back
+#define FLAP_TRACKER_WINDOW 2000
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * Tracks devices that disconnect and reconnect in quick succession, such as a device on a flaky
+ * cable.
+ *
+ * When a device disconnects from its last interface it's held for the window. A device that
+ * reconnects while it's held is counted as a flap and the device manager reuses the device as is,
+ * skipping the handshake. Devices that are still disconnected once their window has passed are
+ * expired and dropped. A window of 0 disables holding. The flap counts are kept for as long as the
+ * process runs.
+ */
+class FlapTracker {
+public:
+	FlapTracker(uint32_t window);
+
+	static uint32_t defaultWindow();
+
+	std::vector<std::string> expire();
+	inline uint32_t getWindow() const { return window; }
+	void hold(const std::string& udid);
+	bool isHeld(const std::string& udid);
+	uint32_t nextExpiry();
+	bool resume(const std::string& udid);
+	void snapshot(std::map<std::string, uint64_t>& out);
+
+private:
+	/**
+	 * A device that has disconnected at least once.
+	 */
+	struct Entry {
+		Entry() : held(false), flaps(0) {}
+
+		bool held;
+		std::chrono::steady_clock::time_point expires;
+		uint64_t flaps;
+	};
+
+	uint32_t window;
+	std::mutex lock;
+	std::map<std::string, Entry> devices;
+};
+
+}
+
+#endif
@@ -40,31 +40,730 @@ function findBinding(): string {
 const req = createRequire(import.meta.url);
 const binding = req(findBinding());
 
+/**
+ * A rule for the `include` and `exclude` options of `forward()`. A string matches frames containing
+ * it, `{ prefix }` matches frames starting with the prefix, and a `RegExp` matches frames it finds
+ * a match in.
+ */
+export type RelayFilter = string | RegExp | { prefix: string };
+
+export type ForwardOptions = {
+	/**
+	 * When set, frames are emitted in batches via the `batch` event instead of one `data` event
+	 * per frame.
+	 */
+	batch?:
+		| boolean
+		| {
+				/**
+				 * The max time in milliseconds to hold frames while waiting for a batch to fill.
+				 * Defaults to `0` which emits whatever has been received on each wakeup.
+				 */
+				maxLatency?: number;
+
+				/**
+				 * The max number of frames per batch. Defaults to `1024`.
+				 */
+				maxSize?: number;
+		  };
+
+	/**
+	 * Writes every frame, with the time it was read, to rotating memory-mapped capture files named
+	 * `<path>.<sequence>`. Pass the path or an object with the path and how much to keep. Use
+	 * `replay()` to read a capture back.
+	 */
+	capture?:
+		| string
+		| {
+				/**
+				 * The path of the capture files without the sequence number.
+				 */
+				path: string;
+
+				/**
+				 * The size of each capture file in bytes. Defaults to 64MB.
+				 */
+				maxFileSize?: number;
+
+				/**
+				 * The number of capture files to keep. The oldest file is deleted once a new file
+				 * would exceed it. Defaults to `8`.
+				 */
+				maxFiles?: number;
+		  };
+
+	/**
+	 * A byte sequence that terminates each frame. Setting this implies `framing: 'delimiter'`.
+	 */
+	delimiter?: string;
+
+	/**
+	 * How data is delivered to `data` listeners. `utf8` (the default) emits a string for each
+	 * frame. `buffer` emits a `Buffer` backed by native memory for each frame.
+	 */
+	encoding?: 'utf8' | 'buffer';
+
+	/**
+	 * Drops frames matching any of these rules before they are queued for JavaScript. Applied
+	 * after `include`.
+	 */
+	exclude?: RelayFilter | RelayFilter[];
+
+	/**
+	 * When `true`, the handle gets its own connection to the device port instead of sharing one
+	 * connection with every other handle forwarding the same port.
+	 */
+	exclusive?: boolean;
+
+	/**
+	 * How the stream is split into frames. Defaults to `newline` for `utf8` and `raw` for
+	 * `buffer` encoding.
+	 */
+	framing?: 'newline' | 'delimiter' | 'length-prefix' | 'raw';
+
+	/**
+	 * The number of queued bytes at which the relay stops reading from the device (or starts
+	 * dropping frames when `overflow` is `drop-oldest`). Defaults to 8MB.
+	 */
+	highWaterMark?: number;
+
+	/**
+	 * Only frames matching at least one of these rules are queued for JavaScript. Frames are
+	 * filtered by the thread reading from the device, so filtered frames cost no event loop time.
+	 */
+	include?: RelayFilter | RelayFilter[];
+
+	/**
+	 * The number of queued bytes at which a paused relay resumes reading. Defaults to a quarter of
+	 * the `highWaterMark`.
+	 */
+	lowWaterMark?: number;
+
+	/**
+	 * The maximum number of bytes to buffer while waiting for a frame to complete. Defaults to
+	 * 1MB.
+	 */
+	maxFrameLength?: number;
+
+	/**
+	 * What to do when the queue reaches the `highWaterMark`. `pause` (the default) stops reading
+	 * so that the device is slowed down. `drop-oldest` keeps reading and discards the oldest
+	 * frames, which is useful when only recent log output matters.
+	 */
+	overflow?: 'pause' | 'drop-oldest';
+
+	/**
+	 * Parses each frame before it is emitted. `json` expects a JSON value per frame. `logfmt`
+	 * expects `key=value` pairs and emits an object of strings where keys without a value are
+	 * `true`. `syslog` expects device syslog records and emits an object with `time`, `device`,
+	 * `process`, `sender`, `pid`, `level`, and `message` fields. Frames are checked by the thread
+	 * reading from the device and malformed frames are counted in the `framesMalformed` stat instead
+	 * of being emitted. Requires `utf8` encoding.
+	 */
+	parse?: 'json' | 'logfmt' | 'syslog';
+
+	/**
+	 * The max number of idle connections to keep per device port. When a handle is stopped, its
+	 * connection is parked for reuse by the next handle instead of being closed. Defaults to `0`.
+	 */
+	poolSize?: number;
+
+	/**
+	 * Keeps the handle alive when the device disconnects or closes the connection. Instead of
+	 * `end`, the handle emits `disconnect` and keeps trying to reconnect with exponential backoff,
+	 * then emits `reconnect` once the connection is restored. Retrying starts right away when the
+	 * device is plugged back in. Writes made while disconnected are sent after reconnecting.
+	 */
+	reconnect?:
+		| boolean
+		| {
+				/**
+				 * The number of milliseconds to wait before the first retry. Each failed attempt
+				 * doubles the delay. Defaults to `250`.
+				 */
+				delay?: number;
+
+				/**
+				 * The max number of milliseconds between retries. Defaults to `10000`.
+				 */
+				maxDelay?: number;
+		  };
+};
+
+export type ForwardAllOptions = Omit<ForwardOptions, 'exclusive' | 'poolSize' | 'reconnect'> & {
+	/**
+	 * The udids of the devices to forward from. Defaults to every device connected over USB,
+	 * including devices connected later.
+	 */
+	udids?: string[];
+};
+
+export type SyslogOptions = Omit<
+	ForwardOptions,
+	'delimiter' | 'exclusive' | 'framing' | 'parse' | 'poolSize' | 'reconnect'
+> & {
+	/**
+	 * Emits each record as a `SyslogRecord` parsed by the thread reading from the device. When
+	 * `false`, each record is emitted as is. Defaults to `true` unless `encoding` is `buffer`.
+	 */
+	parse?: boolean;
+};
+
+export type SyslogRecord = {
+	/** The time the record was logged, such as `Oct 17 04:44:00`, in the device's time zone. */
+	time?: string;
+	/** The name of the device. */
+	device?: string;
+	/** The name of the process that logged the record. */
+	process?: string;
+	/** The library or subsystem within the process that logged the record, if any. */
+	sender?: string;
+	/** The id of the process that logged the record. */
+	pid?: number;
+	/** The level of the record, such as `Notice` or `Error`. */
+	level?: string;
+	/** The message. Records without a header only have a message. */
+	message: string;
+};
+
+export type RelayHistogram = {
+	/** The number of recorded values. */
+	count: number;
+	/** The average value. */
+	mean: number;
+	/** The median, rounded up to the end of its power of 2 bucket. */
+	p50: number;
+	/** The 99th percentile, rounded up to the end of its power of 2 bucket. */
+	p99: number;
+	/** The largest recorded value. */
+	max: number;
+	/** The number of values in each bucket. Bucket `i` counts values up to `2^i - 1`. */
+	buckets: number[];
+};
+
+export type RelayStats = {
+	/** The number of relay connections included in these stats. */
+	connections: number;
+	bytesRead: number;
+	framesRead: number;
+	bytesEmitted: number;
+	framesEmitted: number;
+	/** Data discarded by the `drop-oldest` overflow policy. */
+	bytesDropped: number;
+	framesDropped: number;
+	/** Frames discarded by the `parse` option because they couldn't be parsed. */
+	framesMalformed: number;
+	/** Frames kept by the `include` and `exclude` options. */
+	framesMatched: number;
+	/** Frames discarded by the `include` and `exclude` options. */
+	framesFiltered: number;
+	bytesWritten: number;
+	/** The number of times reading was paused because JavaScript fell behind. */
+	pauses: number;
+	/** The number of times frames were delivered to the listeners. */
+	dispatches: number;
+	/** The number of frames currently waiting to be emitted. */
+	queueDepth: number;
+	/** The most frames that have been waiting at once. */
+	maxQueueDepth: number;
+	/** The number of bytes currently waiting to be emitted. */
+	queuedBytes: number;
+	/** The number of bytes currently waiting to be written to the device. */
+	writeQueuedBytes: number;
+	/** The number of frames delivered per dispatch. */
+	batchSizes: RelayHistogram;
+	/** The number of microseconds from reading a frame to emitting it. */
+	latency: RelayHistogram;
+};
+
+export type ProbeStats = {
+	/** The number of device probes and property refreshes that have finished. */
+	probes: number;
+	/** The number of probes that couldn't connect to the device or read its properties. */
+	failures: number;
+	/** The number of probes waiting for a worker or for an earlier probe of the same device. */
+	pending: number;
+	/** The number of probes running right now. */
+	running: number;
+	/** The number of probe worker threads that have been started. */
+	workers: number;
+	/** The number of microseconds from a device connecting to it being ready to list. */
+	latency: RelayHistogram;
+};
+
+export type ReplayOptions = {
+	/**
+	 * Either `utf8` (the default) to emit each frame as a string or `buffer` to emit a `Buffer`.
+	 */
+	encoding?: 'utf8' | 'buffer';
+
+	/**
+	 * Skips frames read before this time.
+	 */
+	from?: Date | number;
+
+	/**
+	 * How fast to replay relative to how the frames were originally read. `1` (the default)
+	 * replays at the original pace, `10` replays 10 times faster, and `0` replays as fast as
+	 * possible.
+	 */
+	speed?: number;
+
+	/**
+	 * Stops at the first frame read after this time.
+	 */
+	to?: Date | number;
+};
+
+export type WatchOptions = {
+	/**
+	 * The number of milliseconds to collect device changes for before emitting them. Changes to
+	 * the same device within the window are folded into a single event. Defaults to `0` which
+	 * emits each change as it happens.
+	 */
+	coalesce?: number;
+
+	/**
+	 * When `true`, the full device list is also emitted as a `change` event after each batch of
+	 * device events. Defaults to `false`.
+	 */
+	snapshot?: boolean;
+
+	/**
+	 * The minimum number of milliseconds between two batches of device events. The first change
+	 * is emitted right away and later changes are held until the throttle has passed, then
+	 * emitted together. Defaults to `0` which doesn't throttle.
+	 */
+	throttle?: number;
+};
+
+type CaptureFrame = {
+	time: number;
+	data: Buffer;
+};
+
+const framingModes = ['newline', 'delimiter', 'length-prefix', 'raw'];
+
+/**
+ * Checks if a value is a valid `include` or `exclude` rule.
+ */
+function isFilter(value: unknown): boolean {
+	return (
+		typeof value === 'string' ||
+		value instanceof RegExp ||
+		(!!value && typeof value === 'object' && typeof (value as any).prefix === 'string')
+	);
+}
+
+/**
+ * Validates the options shared by `forward()` and `forwardAll()`.
+ */
+function validateForwardOptions(options: ForwardOptions): void {
+	if (
+		options.encoding !== undefined &&
+		options.encoding !== 'utf8' &&
+		options.encoding !== 'buffer'
+	) {
+		throw new TypeError('Expected encoding to be "utf8" or "buffer"');
+	}
+
+	if (options.framing !== undefined && !framingModes.includes(options.framing)) {
+		throw new TypeError('Expected framing to be "newline", "delimiter", "length-prefix", or "raw"');
+	}
+
+	if (
+		options.delimiter !== undefined &&
+		(typeof options.delimiter !== 'string' || !options.delimiter)
+	) {
+		throw new TypeError('Expected delimiter to be a non-empty string');
+	}
+
+	if (options.framing === 'delimiter' && options.delimiter === undefined) {
+		throw new TypeError('Expected delimiter to be a non-empty string');
+	}
+
+	for (const name of ['exclude', 'include'] as const) {
+		const rules = options[name];
+		if (rules !== undefined && !(Array.isArray(rules) ? rules : [rules]).every(isFilter)) {
+			throw new TypeError(
+				`Expected ${name} to be a string, RegExp, or { prefix } object, or an array of them`
+			);
+		}
+	}
+
+	if (options.capture !== undefined && typeof options.capture !== 'string') {
+		if (!options.capture || typeof options.capture !== 'object') {
+			throw new TypeError('Expected capture to be a string or an object');
+		}
+
+		const { maxFiles, maxFileSize, path } = options.capture;
+
+		if (!path || typeof path !== 'string') {
+			throw new TypeError('Expected path to be a non-empty string');
+		}
+
+		if (maxFileSize !== undefined && (typeof maxFileSize !== 'number' || maxFileSize < 1)) {
+			throw new TypeError('Expected maxFileSize to be a positive number');
+		}
+
+		if (maxFiles !== undefined && (typeof maxFiles !== 'number' || maxFiles < 1)) {
+			throw new TypeError('Expected maxFiles to be a positive number');
+		}
+	} else if (options.capture === '') {
+		throw new TypeError('Expected path to be a non-empty string');
+	}
+
+	if (options.batch !== undefined && typeof options.batch !== 'boolean') {
+		if (!options.batch || typeof options.batch !== 'object') {
+			throw new TypeError('Expected batch to be a boolean or an object');
+		}
+
+		const { maxLatency, maxSize } = options.batch;
+
+		if (maxSize !== undefined && (typeof maxSize !== 'number' || maxSize < 1)) {
+			throw new TypeError('Expected maxSize to be a positive number');
+		}
+
+		if (maxLatency !== undefined && (typeof maxLatency !== 'number' || maxLatency < 0)) {
+			throw new TypeError('Expected maxLatency to be a non-negative number');
+		}
+	}
+
+	if (
+		options.maxFrameLength !== undefined &&
+		(typeof options.maxFrameLength !== 'number' || options.maxFrameLength < 1)
+	) {
+		throw new TypeError('Expected maxFrameLength to be a positive number');
+	}
+
+	const { highWaterMark, lowWaterMark } = options;
+
+	if (highWaterMark !== undefined && (typeof highWaterMark !== 'number' || highWaterMark < 1)) {
+		throw new TypeError('Expected highWaterMark to be a positive number');
+	}
+
+	if (lowWaterMark !== undefined && (typeof lowWaterMark !== 'number' || lowWaterMark < 0)) {
+		throw new TypeError('Expected lowWaterMark to be a non-negative number');
+	}
+
+	if (lowWaterMark !== undefined && lowWaterMark >= (highWaterMark ?? 8 * 1024 * 1024)) {
+		throw new TypeError('Expected lowWaterMark to be less than highWaterMark');
+	}
+
+	if (
+		options.overflow !== undefined &&
+		options.overflow !== 'pause' &&
+		options.overflow !== 'drop-oldest'
+	) {
+		throw new TypeError('Expected overflow to be "pause" or "drop-oldest"');
+	}
+
+	if (options.parse !== undefined) {
+		if (options.parse !== 'json' && options.parse !== 'logfmt' && options.parse !== 'syslog') {
+			throw new TypeError('Expected parse to be "json", "logfmt", or "syslog"');
+		}
+
+		if (options.encoding === 'buffer') {
+			throw new TypeError('Expected encoding to be "utf8" when parsing');
+		}
+	}
+
+	if (options.exclusive !== undefined && typeof options.exclusive !== 'boolean') {
+		throw new TypeError('Expected exclusive to be a boolean');
+	}
+
+	if (
+		options.poolSize !== undefined &&
+		(typeof options.poolSize !== 'number' || options.poolSize < 0)
+	) {
+		throw new TypeError('Expected poolSize to be a non-negative number');
+	}
+
+	if (options.reconnect !== undefined && typeof options.reconnect !== 'boolean') {
+		if (!options.reconnect || typeof options.reconnect !== 'object') {
+			throw new TypeError('Expected reconnect to be a boolean or an object');
+		}
+
+		const { delay, maxDelay } = options.reconnect;
+
+		if (delay !== undefined && (typeof delay !== 'number' || delay < 1)) {
+			throw new TypeError('Expected delay to be a positive number');
+		}
+
+		if (maxDelay !== undefined && (typeof maxDelay !== 'number' || maxDelay < 1)) {
+			throw new TypeError('Expected maxDelay to be a positive number');
+		}
+	}
+}
+
+// the number of frames read from a capture file at a time
+const REPLAY_BATCH_SIZE = 1024;
+
 export class ForwardHandle extends EventEmitter {
 	emitFn: (event: string, ...args: any[]) => void;
 	udid: string;
 	port: number;
 
-	constructor(udid: string, port: number) {
+	constructor(udid: string, port: number, options: ForwardOptions = {}) {
 		super();
 		this.emitFn = this.emit.bind(this);
 		this.udid = udid;
 		this.port = port;
-		binding.startForward(udid, port, this.emitFn);
+		binding.startForward(udid, port, this.emitFn, {
+			...options,
+			batch: options.batch === true ? {} : options.batch || undefined,
+		});
+	}
+
+	/**
+	 * Returns the stats for this handle's connection. Handles sharing a connection share its stats.
+	 *
+	 * @returns {RelayStats}
+	 */
+	stats(): RelayStats {
+		return binding.forwardStats(this.udid, this.port, this.emitFn);
 	}
 
 	stop() {
 		binding.stopForward(this.udid, this.port, this.emitFn);
 	}
+
+	/**
+	 * Writes data to the app on the device over the forwarded connection. The data is queued and
+	 * written in the background.
+	 *
+	 * @param {String|Buffer|Uint8Array} data - The data to write.
+	 * @param {Function} [callback] - Called with an error or `null` once the data has been written.
+	 * @returns {Boolean} `false` if the write queue is full and the caller should wait for the
+	 * `writeDrain` event before writing more.
+	 */
+	write(data: string | Uint8Array, callback?: (err: Error | null) => void): boolean {
+		if (typeof data !== 'string' && !Buffer.isBuffer(data)) {
+			if (!ArrayBuffer.isView(data)) {
+				throw new TypeError('Expected data to be a string or Buffer');
+			}
+			data = Buffer.from(data.buffer, data.byteOffset, data.byteLength);
+		}
+
+		if (callback !== undefined && typeof callback !== 'function') {
+			throw new TypeError('Expected callback to be a function');
+		}
+
+		return binding.writeForward(this.udid, this.port, this.emitFn, data, callback);
+	}
+}
+
+export class ForwardAllHandle extends EventEmitter {
+	emitFn: (event: string, ...args: any[]) => void;
+	port: number;
+
+	constructor(port: number, options: ForwardAllOptions = {}) {
+		super();
+		this.emitFn = this.emit.bind(this);
+		this.port = port;
+		const { udids, ...opts } = options;
+		binding.startForwardAll(
+			port,
+			this.emitFn,
+			{
+				...opts,
+				batch: opts.batch === true ? {} : opts.batch || undefined,
+			},
+			udids || []
+		);
+	}
+
+	/**
+	 * Returns the stats for this handle's merged connection across all of its devices.
+	 *
+	 * @returns {RelayStats}
+	 */
+	stats(): RelayStats {
+		return binding.forwardAllStats(this.emitFn);
+	}
+
+	stop() {
+		binding.stopForwardAll(this.emitFn);
+	}
+}
+
+export class ListenHandle {
+	udid: string;
+	devicePort: number;
+	port: number;
+
+	constructor(udid: string, devicePort: number, localPort: number) {
+		this.udid = udid;
+		this.devicePort = devicePort;
+		this.port = binding.startListen(udid, devicePort, localPort);
+	}
+
+	/**
+	 * Stops accepting clients and disconnects all connected clients.
+	 */
+	close() {
+		binding.stopListen(this.udid, this.port);
+	}
+}
+
+export class ReplayHandle extends EventEmitter {
+	encoding: 'utf8' | 'buffer';
+	files: string[];
+	from?: number;
+	speed: number;
+	to?: number;
+
+	private fileIndex = 0;
+	private firstTime?: number;
+	private frames: CaptureFrame[] = [];
+	private offset?: number;
+	private pos = 0;
+	private startedAt = 0;
+	private timer?: NodeJS.Timeout;
+
+	constructor(path: string, options: ReplayOptions = {}) {
+		super();
+		this.encoding = options.encoding || 'utf8';
+		this.files = binding.captureFiles(path);
+		this.from = options.from === undefined ? undefined : +options.from;
+		this.speed = options.speed ?? 1;
+		this.to = options.to === undefined ? undefined : +options.to;
+		this.timer = setTimeout(() => this.pump(), 0);
+	}
+
+	/**
+	 * Reads the next batch of frames, moving on to the next capture file once the current one is
+	 * exhausted. The first file is searched for the `from` time using its index. Returns `false`
+	 * once every file has been read.
+	 */
+	private fill(): boolean {
+		while (this.fileIndex < this.files.length) {
+			const file = this.files[this.fileIndex];
+			if (this.offset === undefined) {
+				this.offset = this.from === undefined ? 0 : binding.captureSeek(file, this.from);
+			}
+
+			const { frames, next } = binding.captureRead(file, this.offset, REPLAY_BATCH_SIZE);
+			this.offset = next;
+			if (frames.length) {
+				this.frames = frames;
+				this.pos = 0;
+				// later files start after `from`, so they don't need to be searched
+				this.from = undefined;
+				return true;
+			}
+
+			this.fileIndex++;
+			this.offset = undefined;
+		}
+		return false;
+	}
+
+	/**
+	 * Emits every frame that is due, then waits for the next one. Frames are due relative to the
+	 * first frame, scaled by the speed. When replaying as fast as possible, the event loop gets a
+	 * turn after each batch.
+	 */
+	private pump() {
+		this.timer = undefined;
+
+		try {
+			for (let emitted = 0; this.timer === undefined; emitted++) {
+				if (this.pos >= this.frames.length && !this.fill()) {
+					this.finish();
+					return;
+				}
+
+				const frame = this.frames[this.pos];
+				if (this.to !== undefined && frame.time > this.to) {
+					this.finish();
+					return;
+				}
+
+				if (this.speed > 0) {
+					if (this.firstTime === undefined) {
+						this.firstTime = frame.time;
+						this.startedAt = performance.now();
+					}
+					const wait =
+						this.startedAt + (frame.time - this.firstTime) / this.speed - performance.now();
+					if (wait >= 1) {
+						this.timer = setTimeout(() => this.pump(), wait);
+						return;
+					}
+				} else if (emitted === REPLAY_BATCH_SIZE) {
+					this.timer = setTimeout(() => this.pump(), 0);
+					return;
+				}
+
+				this.pos++;
+				this.emit(
+					'data',
+					this.encoding === 'buffer' ? frame.data : frame.data.toString(),
+					frame.time
+				);
+			}
+		} catch (err) {
+			this.stop();
+			this.emit('error', err);
+		}
+	}
+
+	private finish() {
+		this.stop();
+		this.emit('end');
+	}
+
+	/**
+	 * Stops replaying. No more events are emitted.
+	 */
+	stop() {
+		if (this.timer) {
+			clearTimeout(this.timer);
+			this.timer = undefined;
+		}
+		this.fileIndex = this.files.length;
+		this.frames = [];
+	}
+}
+
+export class SyslogHandle extends EventEmitter {
+	emitFn: (event: string, ...args: any[]) => void;
+	udid: string;
+
+	constructor(udid: string, options: SyslogOptions = {}) {
+		super();
+		this.emitFn = this.emit.bind(this);
+		this.udid = udid;
+		const { parse, ...opts } = options;
+		binding.startSyslog(udid, this.emitFn, {
+			...opts,
+			batch: opts.batch === true ? {} : opts.batch || undefined,
+			parse: (parse ?? opts.encoding !== 'buffer') ? 'syslog' : undefined,
+		});
+	}
+
+	/**
+	 * Returns the stats for the device's syslog connection, which is shared by all of its handles.
+	 *
+	 * @returns {RelayStats}
+	 */
+	stats(): RelayStats {
+		return binding.syslogStats(this.udid, this.emitFn);
+	}
+
+	stop() {
+		binding.stopSyslog(this.udid, this.emitFn);
+	}
 }
 
 export class WatchHandle extends EventEmitter {
 	emitFn: (event: string, ...args: any[]) => void;
 
-	constructor() {
+	constructor(options: WatchOptions = {}) {
 		super();
 		this.emitFn = this.emit.bind(this);
-		setImmediate(() => binding.watch(this.emitFn));
+		setImmediate(() => binding.watch(this.emitFn, options));
 	}
 
 	stop() {
@@ -92,8 +791,8 @@ export class IOSDevice extends EventEmitter {
 	constructor() {
 		super();
 
-		// init node-ios-device's debug logging and device manager
-		// note: this is synchronous
+		// init node-ios-device's debug logging; the device manager isn't started until it's first
+		// used
 		binding.init((ns: string | undefined, msg: string) => {
 			this.emit('log', msg);
 			if (ns) {
@@ -104,16 +803,59 @@ export class IOSDevice extends EventEmitter {
 		});
 	}
 
+	/**
+	 * Returns the number of times each device has disconnected and come back within the flap
+	 * window, keyed by udid. Devices that haven't flapped are left out.
+	 *
+	 * @returns {Object}
+	 */
+	flapStats(): Record<string, number> {
+		return binding.flapStats();
+	}
+
 	/**
 	 * Connects to a server running on the iOS device and relays the data.
 	 *
 	 * @param {String} udid - The device udid to install the app to.
 	 * @param {Number} port - The port number to connect to and forward messages from.
+	 * @param {Object} [options] - Various options.
+	 * @param {Boolean|Object} [options.batch] - Emits frames in batches. Accepts `maxSize` (frames
+	 * per batch) and `maxLatency` (ms to wait for a batch to fill).
+	 * @param {String|Object} [options.capture] - Writes every frame to rotating capture files.
+	 * Accepts `path`, `maxFileSize` (bytes per file), and `maxFiles` (files to keep).
+	 * @param {String} [options.delimiter] - A byte sequence that terminates each frame.
+	 * @param {String} [options.encoding='utf8'] - Either `utf8` to emit each frame as a string or
+	 * `buffer` to emit each frame as a `Buffer`.
+	 * @param {String|RegExp|Object|Array} [options.exclude] - Drops frames matching any rule.
+	 * @param {Boolean} [options.exclusive=false] - Gives the handle its own device connection.
+	 * @param {String} [options.framing] - How to split the stream into frames: `newline`,
+	 * `delimiter`, `length-prefix` (4-byte big-endian length), or `raw`.
+	 * @param {Number} [options.highWaterMark] - The number of queued bytes at which to pause
+	 * reading or drop frames.
+	 * @param {String|RegExp|Object|Array} [options.include] - Only keeps frames matching a rule.
+	 * Rules are substrings, `RegExp`s, or `{ prefix }` objects.
+	 * @param {Number} [options.lowWaterMark] - The number of queued bytes at which to resume.
+	 * @param {Number} [options.maxFrameLength] - The max number of bytes to buffer per frame.
+	 * @param {String} [options.overflow='pause'] - Either `pause` or `drop-oldest`.
+	 * @param {String} [options.parse] - `json`, `logfmt`, or `syslog` to emit each frame parsed.
+	 * @param {Number} [options.poolSize=0] - The max number of idle connections kept per port.
+	 * @param {Boolean|Object} [options.reconnect=false] - Reconnects after the device goes away.
+	 * Accepts `delay` (ms before the first retry) and `maxDelay` (max ms between retries).
 	 * @returns {Promise<EventEmitter>} Resolves a handle to wire up listeners and stop watching.
-	 * @emits {data} Emits a buffer containing the data.
+	 * @emits {data} Emits a string for each line, a buffer containing the data, or the parsed
+	 * value.
+	 * @emits {batch} Emits an array of frames (or a buffer and frame offsets) when batching.
+	 * @emits {pause} Emits when reading has been paused because the queue is full.
+	 * @emits {drain} Emits when the queue has drained and reading has resumed.
+	 * @emits {drop} Emits the number of frames and bytes dropped by the `drop-oldest` policy.
+	 * @emits {writeDrain} Emits when all queued writes have been written after `write()` returned
+	 * `false`.
 	 * @emits {end} Emits when the device has been disconnected.
+	 * @emits {disconnect} Emits instead of `end` when the connection will be reconnected.
+	 * @emits {reconnect} Emits the number of milliseconds the connection was down and the number
+	 * of attempts it took to reconnect.
 	 */
-	forward(udid: string, port: number): ForwardHandle {
+	forward(udid: string, port: number, options: ForwardOptions = {}): ForwardHandle {
 		if (!udid || typeof udid !== 'string') {
 			throw new TypeError('Expected udid to be a non-empty string');
 		}
@@ -122,7 +864,110 @@ export class IOSDevice extends EventEmitter {
 			throw new TypeError('Expected port to be a number');
 		}
 
-		return new ForwardHandle(udid, port);
+		if (!options || typeof options !== 'object') {
+			throw new TypeError('Expected options to be an object');
+		}
+
+		validateForwardOptions(options);
+
+		return new ForwardHandle(udid, port, options);
+	}
+
+	/**
+	 * Connects to a server running on every iOS device connected over USB and relays the data of
+	 * all of them through a single handle. Each frame is emitted with the udid of the device it
+	 * came from. Devices are added as they connect and removed as they disconnect, so the handle
+	 * never ends on its own. The frames of all devices are emitted in the order they were read.
+	 *
+	 * @param {Number} port - The port number to connect to and forward messages from.
+	 * @param {Object} [options] - The same options as `forward()` except `exclusive`, `poolSize`,
+	 * and `reconnect`.
+	 * @param {Array.<String>} [options.udids] - Only forwards from these devices. Defaults to every
+	 * device.
+	 * @returns {ForwardAllHandle} A handle to wire up listeners and stop forwarding.
+	 * @emits {data} Emits each frame and the udid of the device it came from.
+	 * @emits {batch} Emits an array of frames (or a buffer and frame offsets), the number of
+	 * frames coalesced, and an array of each frame's udid when batching.
+	 * @emits {attach} Emits the udid of a device that has been added.
+	 * @emits {detach} Emits the udid of a device that has been removed, after its last frame.
+	 * @emits {pause} Emits when reading has been paused because the queue is full.
+	 * @emits {drain} Emits when the queue has drained and reading has resumed.
+	 * @emits {drop} Emits the number of frames and bytes dropped by the `drop-oldest` policy.
+	 */
+	forwardAll(port: number, options: ForwardAllOptions = {}): ForwardAllHandle {
+		if (!port || typeof port !== 'number') {
+			throw new TypeError('Expected port to be a number');
+		}
+
+		if (!options || typeof options !== 'object') {
+			throw new TypeError('Expected options to be an object');
+		}
+
+		validateForwardOptions(options);
+
+		const { udids } = options;
+		if (
+			udids !== undefined &&
+			(!Array.isArray(udids) || !udids.every((udid) => udid && typeof udid === 'string'))
+		) {
+			throw new TypeError('Expected udids to be an array of non-empty strings');
+		}
+
+		return new ForwardAllHandle(port, options);
+	}
+
+	/**
+	 * Gets lockdown values from an iOS device, such as `WiFiAddress`, `BasebandVersion`, or
+	 * `TimeZone`. The values are fetched in a single session on a worker thread and converted to
+	 * JavaScript natively: strings, booleans, numbers, dates, arrays, and objects as is, data as a
+	 * `Buffer`, and integers too big for a number as a `BigInt`.
+	 *
+	 * @param {String} udid - The device udid to query.
+	 * @param {Array.<String>|null} [keys=null] - The lockdown keys to get. Keys the device doesn't
+	 * have are omitted from the result. Pass `null` to get every value in the domain.
+	 * @returns {Promise<Object>} Resolves an object of the values by key.
+	 */
+	async getValues(udid: string, keys: string[] | null = null): Promise<Record<string, unknown>> {
+		if (!udid || typeof udid !== 'string') {
+			throw new TypeError('Expected udid to be a non-empty string');
+		}
+
+		if (
+			keys !== null &&
+			(!Array.isArray(keys) || !keys.every((key) => key && typeof key === 'string'))
+		) {
+			throw new TypeError('Expected keys to be an array of non-empty strings or null');
+		}
+
+		await this.ready();
+		return binding.getValues(udid, keys);
+	}
+
+	/**
+	 * Listens on a local TCP port and connects each client to a port on the iOS device, similar to
+	 * `iproxy`. The data is copied between the sockets natively and never passes through
+	 * JavaScript.
+	 *
+	 * @param {String} udid - The device udid to connect to.
+	 * @param {Number} devicePort - The port number on the device to connect clients to.
+	 * @param {Number} [localPort=0] - The local port to listen on. Defaults to a free port picked
+	 * by the OS.
+	 * @returns {ListenHandle} A handle with the bound `port` and a `close()` method.
+	 */
+	listen(udid: string, devicePort: number, localPort = 0): ListenHandle {
+		if (!udid || typeof udid !== 'string') {
+			throw new TypeError('Expected udid to be a non-empty string');
+		}
+
+		if (!devicePort || typeof devicePort !== 'number') {
+			throw new TypeError('Expected device port to be a number');
+		}
+
+		if (typeof localPort !== 'number' || localPort < 0 || localPort > 65535) {
+			throw new TypeError('Expected local port to be a number between 0 and 65535');
+		}
+
+		return new ListenHandle(udid, devicePort, localPort);
 	}
 
 	/**
@@ -160,21 +1005,193 @@ export class IOSDevice extends EventEmitter {
 	}
 
 	/**
-	 * Returns a list of all connected iOS devices.
+	 * Returns a list of all connected iOS devices. The first call blocks for up to 2 seconds while
+	 * the initial devices are enumerated. Use `listAsync()` to avoid blocking.
+	 *
+	 * The array and the device objects are frozen and the same array is returned until a device
+	 * connects or disconnects, so polling is cheap.
 	 *
 	 * @returns {Array.<Object>}
 	 */
-	list(): ReadonlyArray<DeviceInfo> {
+	list(): ReadonlyArray<Readonly<DeviceInfo>> {
+		return binding.list();
+	}
+
+	/**
+	 * Resolves a list of all connected iOS devices once the initial devices have been enumerated
+	 * without blocking the event loop.
+	 *
+	 * @returns {Promise<Array.<Object>>}
+	 */
+	async listAsync(): Promise<ReadonlyArray<Readonly<DeviceInfo>>> {
+		await this.ready();
 		return binding.list();
 	}
 
 	/**
-	 * Watches a key for changes to subkeys and values.
+	 * Returns the stats of the worker threads that connect to new devices and read their
+	 * properties, including how long it takes for a device to be listed after it connects.
+	 *
+	 * @returns {ProbeStats}
+	 */
+	probeStats(): ProbeStats {
+		return binding.probeStats();
+	}
+
+	/**
+	 * Starts the device manager if it hasn't been started and resolves once the initial devices
+	 * have been enumerated. Devices are enumerated as soon as every device usbmuxd knows about has
+	 * connected, so this resolves right away when no devices are connected.
+	 *
+	 * @returns {Promise<void>}
+	 */
+	ready(): Promise<void> {
+		return binding.ready();
+	}
+
+	/**
+	 * Replays the frames written to capture files by the `capture` option of `forward()`.
+	 *
+	 * @param {String} path - The capture path passed to `forward()`.
+	 * @param {Object} [options] - Various options.
+	 * @param {String} [options.encoding='utf8'] - Either `utf8` or `buffer`.
+	 * @param {Date|Number} [options.from] - Skips frames read before this time.
+	 * @param {Number} [options.speed=1] - The replay speed. `0` replays as fast as possible.
+	 * @param {Date|Number} [options.to] - Stops at the first frame read after this time.
+	 * @returns {ReplayHandle} A handle to wire up listeners and stop replaying.
+	 * @emits {data} Emits each frame and the time in milliseconds when it was read.
+	 * @emits {end} Emits when the replay has reached the end of the capture or the `to` time.
+	 * @emits {error} Emits when a capture file can't be read.
+	 */
+	replay(path: string, options: ReplayOptions = {}): ReplayHandle {
+		if (!path || typeof path !== 'string') {
+			throw new TypeError('Expected path to be a non-empty string');
+		}
+
+		if (!options || typeof options !== 'object') {
+			throw new TypeError('Expected options to be an object');
+		}
+
+		if (
+			options.encoding !== undefined &&
+			options.encoding !== 'utf8' &&
+			options.encoding !== 'buffer'
+		) {
+			throw new TypeError('Expected encoding to be "utf8" or "buffer"');
+		}
+
+		for (const name of ['from', 'to'] as const) {
+			const value = options[name];
+			if (value !== undefined && !(value instanceof Date) && typeof value !== 'number') {
+				throw new TypeError(`Expected ${name} to be a Date or a number`);
+			}
+		}
+
+		if (options.speed !== undefined && (typeof options.speed !== 'number' || options.speed < 0)) {
+			throw new TypeError('Expected speed to be a non-negative number');
+		}
+
+		return new ReplayHandle(path, options);
+	}
+
+	/**
+	 * Returns the combined stats of every forwarded connection across all devices.
+	 *
+	 * @returns {RelayStats}
+	 */
+	relayStats(): RelayStats {
+		return binding.relayStats();
+	}
+
+	/**
+	 * Relays the syslog of an iOS device connected over USB. The device sends NUL terminated
+	 * records which are split, filtered, and parsed natively by the thread reading from the device,
+	 * then emitted in batches or one at a time.
+	 *
+	 * @param {String} udid - The device udid to read the syslog from.
+	 * @param {Object} [options] - The same options as `forward()` except `delimiter`, `exclusive`,
+	 * `framing`, `poolSize`, and `reconnect`. Handles for the same device share a connection and
+	 * must use the same options.
+	 * @param {Boolean} [options.parse] - Emits each record as an object with `time`, `device`,
+	 * `process`, `sender`, `pid`, `level`, and `message`. Defaults to `true` unless `encoding` is
+	 * `buffer`.
+	 * @returns {SyslogHandle} A handle to wire up listeners and stop relaying.
+	 * @emits {data} Emits each record.
+	 * @emits {batch} Emits an array of records (or a buffer and record offsets) when batching.
+	 * @emits {pause} Emits when reading has been paused because the queue is full.
+	 * @emits {drain} Emits when the queue has drained and reading has resumed.
+	 * @emits {drop} Emits the number of records and bytes dropped by the `drop-oldest` policy.
+	 * @emits {end} Emits when the device has been disconnected.
+	 */
+	syslog(udid: string, options: SyslogOptions = {}): SyslogHandle {
+		if (!udid || typeof udid !== 'string') {
+			throw new TypeError('Expected udid to be a non-empty string');
+		}
+
+		if (!options || typeof options !== 'object') {
+			throw new TypeError('Expected options to be an object');
+		}
+
+		const { parse, ...opts } = options;
+		if (parse !== undefined && typeof parse !== 'boolean') {
+			throw new TypeError('Expected parse to be a boolean');
+		}
+
+		if (parse && opts.encoding === 'buffer') {
+			throw new TypeError('Expected encoding to be "utf8" when parsing');
+		}
+
+		for (const name of ['delimiter', 'exclusive', 'framing', 'poolSize', 'reconnect'] as const) {
+			if ((opts as ForwardOptions)[name] !== undefined) {
+				throw new TypeError(`Expected ${name} to not be set for syslog()`);
+			}
+		}
+
+		validateForwardOptions(opts);
+
+		return new SyslogHandle(udid, options);
+	}
+
+	/**
+	 * Watches for devices connecting and disconnecting. Every device that is already connected is
+	 * emitted as an `attach` event first.
 	 *
+	 * @param {WatchOptions} [options] - Various options.
 	 * @returns {EventEmitter} The handle to wire up listeners and stop watching.
-	 * @emits {change} Emits an array of device objects.
+	 * @emits {attach} Emits the device object and the interface (`USB` or `Wi-Fi`) when a device
+	 * connects.
+	 * @emits {detach} Emits the udid and the interface when a device disconnects.
+	 * @emits {update} Emits the device object and the interface that changed when a connected
+	 * device gains or loses an interface.
+	 * @emits {change} Emits an array of device objects when the `snapshot` option is set.
 	 */
-	watch(): WatchHandle {
-		return new WatchHandle();
+	watch(options: WatchOptions = {}): WatchHandle {
+		if (!options || typeof options !== 'object') {
+			throw new TypeError('Expected options to be an object');
+		}
+
+		if (
+			options.coalesce !== undefined &&
+			(typeof options.coalesce !== 'number' ||
+				!Number.isInteger(options.coalesce) ||
+				options.coalesce < 0)
+		) {
+			throw new TypeError('Expected coalesce to be a non-negative integer');
+		}
+
+		if (options.snapshot !== undefined && typeof options.snapshot !== 'boolean') {
+			throw new TypeError('Expected snapshot to be a boolean');
+		}
+
+		if (
+			options.throttle !== undefined &&
+			(typeof options.throttle !== 'number' ||
+				!Number.isInteger(options.throttle) ||
+				options.throttle < 0)
+		) {
+			throw new TypeError('Expected throttle to be a non-negative integer');
+		}
+
+		return new WatchHandle(options);
 	}
 }
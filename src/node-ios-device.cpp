@@ -1,20 +1,19 @@
 #include "node-ios-device.h"
-#include "deviceman.h"
+#include "device-subscriber.h"
+#include "relay-capture.h"
 
 namespace node_ios_device {
-	std::shared_ptr<DeviceMan> deviceman = NULL;
-	napi_ref logRef = NULL;
 	LOG_DEBUG_VARS
 }
 
 using namespace node_ios_device;
 
 /**
- * Flushes the debug log message queue. This can be called at anytime from the main thread. As soon
- * as new log messages are added to the queue, `dispatchLog()` is notified, but because it's async,
- * it's possible that a sync operation will complete before Node's runloop will come around and
- * process pending notifications, so it's encouraged to manually flush the log messages before a
- * public API function returns.
+ * Flushes the environment's debug log message queue. This can be called at anytime from the
+ * environment's main thread. As soon as new log messages are added to the queue, `dispatchLog()`
+ * is notified, but because it's async, it's possible that a sync operation will complete before
+ * Node's runloop will come around and process pending notifications, so it's encouraged to manually
+ * flush the log messages before a public API function returns.
  */
 void flushLog(napi_env env) {
 #ifndef ENABLE_RAW_DEBUGGING
@@ -23,11 +22,13 @@ void flushLog(napi_env env) {
 
 	NAPI_FATAL("flushLog", napi_open_handle_scope(env, &scope))
 
-	if (!logRef) {
+	DeviceSubscriber* subscriber = DeviceSubscriber::get(env);
+	LogSink* sink = subscriber ? subscriber->getLog() : NULL;
+	if (!sink || !sink->logRef) {
 		return;
 	}
 
-	NAPI_FATAL("flushLog", napi_get_reference_value(env, logRef, &logFn))
+	NAPI_FATAL("flushLog", napi_get_reference_value(env, sink->logRef, &logFn))
 
 	if (logFn == NULL) {
 		return;
@@ -37,9 +38,9 @@ void flushLog(napi_env env) {
 
 	std::lock_guard<std::mutex> lock(logLock);
 
-	while (!logQueue.empty()) {
-		std::shared_ptr<LogMessage> obj = logQueue.front();
-		logQueue.pop();
+	while (!sink->queue.empty()) {
+		std::shared_ptr<LogMessage> obj = sink->queue.front();
+		sink->queue.pop();
 		napi_value argv[2];
 
 		if (obj->ns.length()) {
@@ -74,14 +75,14 @@ void flushLog(napi_env env) {
  * any pending log notifications and you should explicitly call `flushLog()`.
  */
 void dispatchLog(uv_async_t* handle) {
-	flushLog((napi_env)handle->data);
+	flushLog(static_cast<LogSink*>(handle->data)->env);
 }
 #endif
 
 /**
  * init()
- * Wires up debug log message notification handler, prints the node-ios-device banner, and
- * initializes the device manager and it's background thread runloop.
+ * Wires up the environment's debug log callback and prints the node-ios-device banner. The device
+ * manager's background thread isn't started until it's first used.
  */
 NAPI_METHOD(init) {
 #ifndef ENABLE_RAW_DEBUGGING
@@ -89,7 +90,11 @@ NAPI_METHOD(init) {
 
 	// create the reference for the emit log callback so it doesn't get GC'd
 	napi_value logFn = argv[0];
-	NAPI_THROW_RETURN("init", "ERR_NAPI_CREATE_REFERENCE", napi_create_reference(env, logFn, 1, &logRef), NULL)
+	LogSink* sink = DeviceSubscriber::get(env)->getLog();
+	if (sink->logRef) {
+		napi_delete_reference(env, sink->logRef);
+	}
+	NAPI_THROW_RETURN("init", "ERR_NAPI_CREATE_REFERENCE", napi_create_reference(env, logFn, 1, &sink->logRef), NULL)
 
 	// print the banner
 	napi_value global, result, args[2];
@@ -123,6 +128,113 @@ std::string napi_string_to_std_string(napi_env env, napi_value str) {
 	return rval;
 }
 
+/**
+ * captureFiles()
+ * Returns the capture files for a capture path from oldest to newest.
+ */
+NAPI_METHOD(captureFiles) {
+	NAPI_ARGV(1);
+	napi_value rval, tmp;
+
+	std::string path = napi_string_to_std_string(env, argv[0]);
+	std::vector<std::string> files = RelayCaptureReader::list(path);
+
+	NAPI_THROW_RETURN("captureFiles", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, files.size(), &rval), NULL)
+	for (uint32_t i = 0; i < files.size(); ++i) {
+		NAPI_THROW_RETURN("captureFiles", "ERR_NAPI_CREATE_STRING", ::napi_create_string_utf8(env, files[i].c_str(), NAPI_AUTO_LENGTH, &tmp), NULL)
+		NAPI_THROW_RETURN("captureFiles", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, rval, i, tmp), NULL)
+	}
+
+	return rval;
+}
+
+/**
+ * captureRead()
+ * Reads up to `maxFrames` frames from a capture file starting at a record offset.
+ */
+NAPI_METHOD(captureRead) {
+	NAPI_ARGV(3);
+	napi_value rval = NULL;
+
+	try {
+		std::string file = napi_string_to_std_string(env, argv[0]);
+		double offset = 0;
+		uint32_t maxFrames = 0;
+		::napi_get_value_double(env, argv[1], &offset);
+		::napi_get_value_uint32(env, argv[2], &maxFrames);
+		rval = RelayCaptureReader(file).read(env, (uint64_t)offset, maxFrames);
+	} catch (std::exception& e) {
+		const char* msg = e.what();
+		LOG_DEBUG_1("captureRead", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_CAPTURE_READ", msg, ::strlen(msg), NULL)
+	}
+
+	return rval;
+}
+
+/**
+ * captureSeek()
+ * Returns the offset of the first record in a capture file at or after a time in milliseconds
+ * since the epoch.
+ */
+NAPI_METHOD(captureSeek) {
+	NAPI_ARGV(2);
+	uint64_t offset = 0;
+
+	try {
+		std::string file = napi_string_to_std_string(env, argv[0]);
+		double time = 0;
+		::napi_get_value_double(env, argv[1], &time);
+		offset = RelayCaptureReader(file).seek(time);
+	} catch (std::exception& e) {
+		const char* msg = e.what();
+		LOG_DEBUG_1("captureSeek", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_CAPTURE_READ", msg, ::strlen(msg), NULL)
+	}
+
+	napi_value rval;
+	NAPI_THROW_RETURN("captureSeek", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)offset, &rval), NULL)
+	return rval;
+}
+
+/**
+ * getValues()
+ * Gets lockdown values from a device on a worker thread and returns a promise.
+ */
+NAPI_METHOD(getValues) {
+	NAPI_ARGV(2);
+	napi_value rval = NULL;
+
+	try {
+		std::string udid = napi_string_to_std_string(env, argv[0]);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
+
+		napi_valuetype type;
+		NAPI_THROW_RETURN("getValues", "ERR_NAPI_TYPEOF", ::napi_typeof(env, argv[1], &type), NULL)
+
+		std::vector<std::string> keys;
+		if (type != napi_null && type != napi_undefined) {
+			uint32_t count = 0;
+			NAPI_THROW_RETURN("getValues", "ERR_NAPI_GET_ARRAY_LENGTH", ::napi_get_array_length(env, argv[1], &count), NULL)
+			for (uint32_t i = 0; i < count; ++i) {
+				napi_value key;
+				NAPI_THROW_RETURN("getValues", "ERR_NAPI_GET_ELEMENT", ::napi_get_element(env, argv[1], i, &key), NULL)
+				keys.push_back(napi_string_to_std_string(env, key));
+			}
+		}
+
+		rval = device->getValues(env, type == napi_null || type == napi_undefined ? NULL : &keys);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("getValues", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_GET_VALUES", msg, ::strlen(msg), NULL)
+	}
+
+	return rval;
+}
+
 /**
  * install()
  * Installs an app to the specified iOS device.
@@ -132,7 +244,7 @@ NAPI_METHOD(install) {
 
 	try {
 		std::string udid = napi_string_to_std_string(env, argv[0]);
-		std::shared_ptr<Device> device = deviceman->getDevice(udid);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
 		std::string appPath = napi_string_to_std_string(env, argv[1]);
 		device->install(appPath);
 	} catch (std::exception& e) {
@@ -150,7 +262,7 @@ NAPI_METHOD(install) {
  * Retrieves a list all connected iOS devices.
  */
 NAPI_METHOD(list) {
-	napi_value rval = deviceman->list();
+	napi_value rval = DeviceSubscriber::get(env)->list();
 	flushLog(env);
 	return rval;
 }
@@ -163,7 +275,7 @@ NAPI_METHOD(list) {
 		NAPI_ARGV(argc); \
 		try { \
 			std::string udid = napi_string_to_std_string(env, argv[0]); \
-			std::shared_ptr<Device> device = deviceman->getDevice(udid); \
+			std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid); \
 			code; \
 			flushLog(env); \
 		} catch (std::exception& e) { \
@@ -179,17 +291,245 @@ NAPI_METHOD(list) {
  * forward()
  * All of the logic is performed in the device's relay object.
  */
-CREATE_LOG_METHOD(startForward, 3, "ERR_FORWARD_START", device->forward(RELAY_START, argv[1], argv[2]))
-CREATE_LOG_METHOD(stopForward,  3, "ERR_FORWARD_STOP",  device->forward(RELAY_STOP, argv[1], argv[2]))
+CREATE_LOG_METHOD(startForward, 4, "ERR_FORWARD_START", device->forward(env, RELAY_START, argv[1], argv[2], argv[3]))
+CREATE_LOG_METHOD(stopForward,  3, "ERR_FORWARD_STOP",  device->forward(env, RELAY_STOP, argv[1], argv[2], NULL))
+
+/**
+ * syslog()
+ * All of the logic is performed in the device's syslog relay object.
+ */
+CREATE_LOG_METHOD(startSyslog, 3, "ERR_SYSLOG_START", device->syslog(env, RELAY_START, argv[1], argv[2]))
+CREATE_LOG_METHOD(stopSyslog,  2, "ERR_SYSLOG_STOP",  device->syslog(env, RELAY_STOP, argv[1], NULL))
+
+/**
+ * writeForward()
+ * Writes data to a forwarded port. Returns false if the write queue is full.
+ */
+NAPI_METHOD(writeForward) {
+	NAPI_ARGV(5);
+	bool ok = false;
+
+	try {
+		std::string udid = napi_string_to_std_string(env, argv[0]);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
+		ok = device->write(env, argv[1], argv[2], argv[3], argv[4]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("writeForward", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_FORWARD_WRITE", msg, ::strlen(msg), NULL)
+	}
+
+	napi_value rval;
+	NAPI_THROW_RETURN("writeForward", "ERR_NAPI_GET_BOOLEAN", ::napi_get_boolean(env, ok, &rval), NULL)
+	return rval;
+}
+
+/**
+ * flapStats()
+ * Returns the number of times each device has disconnected and come right back.
+ */
+NAPI_METHOD(flapStats) {
+	napi_value rval = DeviceSubscriber::get(env)->flapStats();
+	flushLog(env);
+	return rval;
+}
+
+/**
+ * forwardAllStats()
+ * Returns the relay stats for a forwardAll handle.
+ */
+NAPI_METHOD(forwardAllStats) {
+	NAPI_ARGV(1);
+	napi_value rval = NULL;
+
+	try {
+		rval = DeviceSubscriber::get(env)->forwardAllStats(argv[0]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("forwardAllStats", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_FORWARD_STATS", msg, ::strlen(msg), NULL)
+	}
+
+	return rval;
+}
+
+/**
+ * forwardStats()
+ * Returns the relay stats for a forward handle.
+ */
+NAPI_METHOD(forwardStats) {
+	NAPI_ARGV(3);
+	napi_value rval = NULL;
+
+	try {
+		std::string udid = napi_string_to_std_string(env, argv[0]);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
+		rval = device->stats(env, argv[1], argv[2]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("forwardStats", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_FORWARD_STATS", msg, ::strlen(msg), NULL)
+	}
+
+	return rval;
+}
+
+/**
+ * probeStats()
+ * Returns the stats of the device probe workers.
+ */
+NAPI_METHOD(probeStats) {
+	napi_value rval = DeviceSubscriber::get(env)->probeStats();
+	flushLog(env);
+	return rval;
+}
+
+/**
+ * ready()
+ * Returns a promise that resolves once the initial devices have been enumerated.
+ */
+NAPI_METHOD(ready) {
+	napi_value rval = DeviceSubscriber::get(env)->ready();
+	flushLog(env);
+	return rval;
+}
+
+/**
+ * relayStats()
+ * Returns the stats of all relay connections combined.
+ */
+NAPI_METHOD(relayStats) {
+	napi_value rval = DeviceSubscriber::get(env)->relayStats();
+	flushLog(env);
+	return rval;
+}
+
+/**
+ * startForwardAll()
+ * Forwards a port from every matching device into a single stream tagged with each device's udid.
+ */
+NAPI_METHOD(startForwardAll) {
+	NAPI_ARGV(4);
+
+	try {
+		std::vector<std::string> udids;
+		uint32_t count = 0;
+		NAPI_THROW_RETURN("startForwardAll", "ERR_NAPI_GET_ARRAY_LENGTH", ::napi_get_array_length(env, argv[3], &count), NULL)
+		for (uint32_t i = 0; i < count; ++i) {
+			napi_value udid;
+			NAPI_THROW_RETURN("startForwardAll", "ERR_NAPI_GET_ELEMENT", ::napi_get_element(env, argv[3], i, &udid), NULL)
+			udids.push_back(napi_string_to_std_string(env, udid));
+		}
+
+		DeviceSubscriber::get(env)->forwardAll(RELAY_START, argv[0], argv[1], argv[2], udids);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("startForwardAll", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_FORWARD_START", msg, ::strlen(msg), NULL)
+	}
+
+	NAPI_RETURN_UNDEFINED("startForwardAll")
+}
+
+/**
+ * startListen()
+ * Listens on a local port and proxies each client to a port on the device. Returns the local port.
+ */
+NAPI_METHOD(startListen) {
+	NAPI_ARGV(3);
+	uint32_t port = 0;
+
+	try {
+		std::string udid = napi_string_to_std_string(env, argv[0]);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
+		port = device->listen(env, RELAY_START, argv[1], argv[2]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("startListen", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_LISTEN_START", msg, ::strlen(msg), NULL)
+	}
+
+	napi_value rval;
+	NAPI_THROW_RETURN("startListen", "ERR_NAPI_CREATE_UINT32", ::napi_create_uint32(env, port, &rval), NULL)
+	return rval;
+}
+
+/**
+ * stopListen()
+ * Stops listening on a local port and disconnects its clients.
+ */
+CREATE_LOG_METHOD(stopListen, 2, "ERR_LISTEN_STOP", device->listen(env, RELAY_STOP, NULL, argv[1]))
+
+/**
+ * stopForwardAll()
+ * Stops forwarding a port from every device and closes the device sockets.
+ */
+NAPI_METHOD(stopForwardAll) {
+	NAPI_ARGV(1);
+
+	try {
+		DeviceSubscriber::get(env)->forwardAll(RELAY_STOP, NULL, argv[0], NULL, {});
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("stopForwardAll", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_FORWARD_STOP", msg, ::strlen(msg), NULL)
+	}
+
+	NAPI_RETURN_UNDEFINED("stopForwardAll")
+}
+
+/**
+ * syslogStats()
+ * Returns the relay stats for a syslog handle.
+ */
+NAPI_METHOD(syslogStats) {
+	NAPI_ARGV(2);
+	napi_value rval = NULL;
+
+	try {
+		std::string udid = napi_string_to_std_string(env, argv[0]);
+		std::shared_ptr<Device> device = DeviceSubscriber::get(env)->getDevice(udid);
+		rval = device->syslogStats(env, argv[1]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("syslogStats", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_SYSLOG_STATS", msg, ::strlen(msg), NULL)
+	}
+
+	return rval;
+}
 
 /**
  * watch()
  * Starts watching for connected devices.
  */
 NAPI_METHOD(watch) {
-	NAPI_ARGV(1);
-	deviceman->config(argv[0], node_ios_device::Watch);
-	flushLog(env);
+	NAPI_ARGV(2);
+
+	try {
+		DeviceSubscriber::get(env)->config(argv[0], node_ios_device::Watch, argv[1]);
+		flushLog(env);
+	} catch (std::exception& e) {
+		flushLog(env);
+		const char* msg = e.what();
+		LOG_DEBUG_1("watch", "Error: %s", msg)
+		NAPI_THROW_ERROR("ERR_WATCH", msg, ::strlen(msg), NULL)
+	}
+
 	NAPI_RETURN_UNDEFINED("watch")
 }
 
@@ -199,52 +539,103 @@ NAPI_METHOD(watch) {
  */
 NAPI_METHOD(unwatch) {
 	NAPI_ARGV(1);
-	deviceman->config(argv[0], node_ios_device::Unwatch);
+	DeviceSubscriber::get(env)->config(argv[0], node_ios_device::Unwatch);
 	flushLog(env);
 	NAPI_RETURN_UNDEFINED("unwatch")
 }
 
 /**
- * Destroys the Watchman instance and closes open handles.
+ * Destroys the environment's device subscriber and closes its log handle. The device manager is
+ * shared with the other environments and keeps running.
  */
 static void cleanup(void* arg) {
-	if (deviceman) {
-		LOG_DEBUG("cleanup", "Deleting deviceman")
-		deviceman.reset();
+	napi_env env = (napi_env)arg;
+	DeviceSubscriber* subscriber = DeviceSubscriber::get(env);
+	if (!subscriber) {
+		return;
 	}
 
+	LOG_DEBUG("cleanup", "Deleting device subscriber")
+	std::shared_ptr<LogSink> sink;
 #ifndef ENABLE_RAW_DEBUGGING
-	uv_close((uv_handle_t*)&logNotify, NULL);
-
-	if (logRef) {
-		napi_delete_reference((napi_env)arg, logRef);
-		logRef = NULL;
+	{
+		std::lock_guard<std::mutex> lock(logLock);
+		for (auto it = logSinks.begin(); it != logSinks.end(); ++it) {
+			if ((*it)->env == env) {
+				sink = *it;
+				logSinks.erase(it);
+				break;
+			}
+		}
 	}
 #endif
+
+	delete subscriber;
+	napi_set_instance_data(env, NULL, NULL, NULL);
+
+	if (sink) {
+		uv_close(
+			(uv_handle_t*)sink->notify,
+			[](uv_handle_t* handle) {
+				delete (uv_async_t *)handle;
+			}
+		);
+		if (sink->logRef) {
+			napi_delete_reference(env, sink->logRef);
+		}
+	}
 }
 
 /**
- * Wire up the public API and cleanup handler and creates the Watchman instance.
+ * Wire up the public API and cleanup handler and creates the environment's device subscriber. Each
+ * Node environment that loads the addon, such as a worker thread, gets a subscriber of its own
+ * while they all share the process-wide device manager.
  */
 NAPI_INIT() {
+	std::shared_ptr<LogSink> sink;
 #ifndef ENABLE_RAW_DEBUGGING
 	// wire up the log notification handler
 	uv_loop_t* loop;
 	napi_get_uv_event_loop(env, &loop);
-	logNotify.data = env;
-	uv_async_init(loop, &logNotify, &dispatchLog);
-	uv_unref((uv_handle_t*)&logNotify);
+	sink = std::make_shared<LogSink>();
+	sink->env = env;
+	sink->logRef = NULL;
+	sink->notify = new uv_async_t;
+	sink->notify->data = sink.get();
+	uv_async_init(loop, sink->notify, &dispatchLog);
+	uv_unref((uv_handle_t*)sink->notify);
+	{
+		std::lock_guard<std::mutex> lock(logLock);
+		logSinks.push_back(sink);
+	}
 #endif
 
+	NAPI_EXPORT_FUNCTION(captureFiles);
+	NAPI_EXPORT_FUNCTION(captureRead);
+	NAPI_EXPORT_FUNCTION(captureSeek);
+	NAPI_EXPORT_FUNCTION(flapStats);
+	NAPI_EXPORT_FUNCTION(forwardAllStats);
+	NAPI_EXPORT_FUNCTION(forwardStats);
+	NAPI_EXPORT_FUNCTION(getValues);
 	NAPI_EXPORT_FUNCTION(init);
 	NAPI_EXPORT_FUNCTION(install);
 	NAPI_EXPORT_FUNCTION(list);
+	NAPI_EXPORT_FUNCTION(probeStats);
+	NAPI_EXPORT_FUNCTION(ready);
+	NAPI_EXPORT_FUNCTION(relayStats);
 	NAPI_EXPORT_FUNCTION(startForward);
+	NAPI_EXPORT_FUNCTION(startForwardAll);
+	NAPI_EXPORT_FUNCTION(startListen);
+	NAPI_EXPORT_FUNCTION(startSyslog);
 	NAPI_EXPORT_FUNCTION(stopForward);
+	NAPI_EXPORT_FUNCTION(stopForwardAll);
+	NAPI_EXPORT_FUNCTION(stopListen);
+	NAPI_EXPORT_FUNCTION(stopSyslog);
+	NAPI_EXPORT_FUNCTION(syslogStats);
+	NAPI_EXPORT_FUNCTION(writeForward);
 	NAPI_EXPORT_FUNCTION(watch);
 	NAPI_EXPORT_FUNCTION(unwatch);
 
+	NAPI_THROW("napi_init", "ERR_NAPI_SET_INSTANCE_DATA", napi_set_instance_data(env, new DeviceSubscriber(env, sink), NULL, NULL))
 	NAPI_THROW("napi_init", "ERR_NAPI_ADD_ENV_CLEANUP_HOOK", napi_add_env_cleanup_hook(env, cleanup, env))
-
-	deviceman = DeviceMan::create(env);
 }
@@ -6,11 +6,13 @@
 
 #define NAPI_VERSION 8
 
+#include <list>
 #include <memory>
 #include <mutex>
 #include "macro.h"
 #include <node_api.h>
 #include <queue>
+#include <sys/socket.h>
 #include <thread>
 #include <uv.h>
 
@@ -24,11 +26,31 @@ namespace node_ios_device {
 		std::string ns;
 		std::string msg;
 	};
+
+	/**
+	 * The debug log of a single Node environment. Log messages are queued for every environment
+	 * that has loaded the addon, and each environment's main thread is notified through its own
+	 * async handle. The queue is guarded by `logLock`.
+	 */
+	struct LogSink {
+		napi_env env;
+		napi_ref logRef;
+		uv_async_t* notify;
+		std::queue<std::shared_ptr<LogMessage>> queue;
+	};
 }
 
 #define RELAY_START 0
 #define RELAY_STOP 1
 
+// flags for socket writes that must never block or raise SIGPIPE; macOS doesn't have MSG_NOSIGNAL,
+// so sockets there set SO_NOSIGPIPE instead
+#ifdef MSG_NOSIGNAL
+	#define SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+	#define SEND_FLAGS MSG_DONTWAIT
+#endif
+
 #define STRINGIFY(s) STRINGIFY_HELPER(s)
 #define STRINGIFY_HELPER(s) #s
 
@@ -113,22 +135,22 @@ namespace node_ios_device {
 #else
 	#define LOG_DEBUG_VARS \
 		std::mutex logLock; \
-		uv_async_t logNotify; \
-		std::queue<std::shared_ptr<node_ios_device::LogMessage>> logQueue;
+		std::list<std::shared_ptr<node_ios_device::LogSink>> logSinks;
 
 	#define LOG_DEBUG_EXTERN_VARS \
 		extern uv_thread_t mainThread; \
 		extern std::mutex logLock; \
-		extern uv_async_t logNotify; \
-		extern std::queue<std::shared_ptr<node_ios_device::LogMessage>> logQueue;
+		extern std::list<std::shared_ptr<node_ios_device::LogSink>> logSinks;
 
 	#define LOG_DEBUG(ns, msg) \
 		{ \
 			std::string str(msg); \
 			std::shared_ptr<node_ios_device::LogMessage> obj = std::make_shared<node_ios_device::LogMessage>(ns, msg); \
 			std::lock_guard<std::mutex> lock(node_ios_device::logLock); \
-			node_ios_device::logQueue.push(obj); \
-			::uv_async_send(&node_ios_device::logNotify); \
+			for (auto const& sink : node_ios_device::logSinks) { \
+				sink->queue.push(obj); \
+				::uv_async_send(sink->notify); \
+			} \
 		}
 #endif
 
@@ -0,0 +1,255 @@
+#include "port-proxy.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace node_ios_device {
+
+/**
+ * Switches a socket to non-blocking mode and, where supported, stops writes to a closed socket
+ * from raising SIGPIPE.
+ */
+static void prepareSocket(int fd) {
+	int flags = ::fcntl(fd, F_GETFL, 0);
+	::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+/**
+ * Initializes the proxy. Nothing is bound until `start()` is called.
+ */
+PortProxy::PortProxy(uint32_t devicePort, uint32_t localPort) :
+	devicePort(devicePort),
+	localPort(localPort),
+	listenFd(-1) {}
+
+/**
+ * Accepts all pending clients and connects each one to the device. Clients that can't be connected
+ * to the device are closed right away. The caller must hold the lock.
+ */
+void PortProxy::accept() {
+	while (1) {
+		int client = ::accept(listenFd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG_DEBUG_1("PortProxy::accept", "Failed to accept client: %s", ::strerror(errno))
+			}
+			break;
+		}
+
+		int device = connectDevice();
+		if (device < 0) {
+			LOG_DEBUG_1("PortProxy::accept", "Failed to connect client to device port %u", devicePort)
+			::close(client);
+			continue;
+		}
+
+		prepareSocket(client);
+		prepareSocket(device);
+
+		std::shared_ptr<ProxySession> session = std::make_shared<ProxySession>(client, device);
+		sessions[client] = session;
+		sessions[device] = session;
+		LOG_DEBUG_3("PortProxy::accept", "Connected client on port %u to device port %u (%zu sessions)", localPort, devicePort, sessions.size() / 2)
+
+		watch(client, true, false);
+		watch(device, true, false);
+	}
+}
+
+/**
+ * Stops watching and closes both sockets of a session. The caller must hold the lock.
+ */
+void PortProxy::closeSession(std::shared_ptr<ProxySession> session) {
+	unwatch(session->client);
+	unwatch(session->device);
+	sessions.erase(session->client);
+	sessions.erase(session->device);
+	::close(session->client);
+	::close(session->device);
+	LOG_DEBUG_2("PortProxy::closeSession", "Closed client on port %u (%zu sessions)", localPort, sessions.size() / 2)
+}
+
+/**
+ * Explicit initialization so that subclasses can hand a weak pointer to their event loop
+ * callbacks.
+ */
+void PortProxy::init() {
+	self = shared_from_this();
+}
+
+/**
+ * Called from the I/O thread when a socket has data to read or, for the listening socket, clients
+ * waiting to be accepted.
+ */
+void PortProxy::onReadable(int fd) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (fd == listenFd) {
+		accept();
+		watch(listenFd, true, false);
+		return;
+	}
+
+	auto it = sessions.find(fd);
+	if (it != sessions.end()) {
+		service(it->second);
+	}
+}
+
+/**
+ * Called from the I/O thread when a socket that has buffered data waiting can be written to.
+ */
+void PortProxy::onWritable(int fd) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = sessions.find(fd);
+	if (it != sessions.end()) {
+		service(it->second);
+	}
+}
+
+/**
+ * Copies as much data from `src` to `dest` as both sockets allow without blocking. Once `src`
+ * reaches the end of its stream and the buffer has been flushed, the write side of `dest` is shut
+ * down so that its peer sees the end of the stream too. Returns false if either socket failed.
+ */
+bool PortProxy::pump(int src, int dest, ProxyBuffer& buffer) {
+	for (int reads = 0; ; ++reads) {
+		while (!buffer.empty()) {
+			ssize_t n = ::send(dest, buffer.data.get() + buffer.start, buffer.end - buffer.start, SEND_FLAGS);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			buffer.start += (size_t)n;
+		}
+		buffer.start = buffer.end = 0;
+
+		if (buffer.eof) {
+			if (!buffer.shutdown) {
+				::shutdown(dest, SHUT_WR);
+				buffer.shutdown = true;
+			}
+			return true;
+		}
+
+		// give other sessions a turn; the socket is still readable, so the event fires again
+		if (reads == PROXY_MAX_READS) {
+			return true;
+		}
+
+		ssize_t n = ::recv(src, buffer.data.get(), PROXY_BUFFER_SIZE, 0);
+		if (n > 0) {
+			buffer.end = (size_t)n;
+		} else if (n == 0) {
+			buffer.eof = true;
+		} else if (errno != EINTR) {
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+	}
+}
+
+/**
+ * Moves data in both directions, then updates which events each socket is watched for. A socket
+ * is watched for reads while the buffer it reads into is empty and for writes while the buffer it
+ * writes from has data, so a slow reader on one end stops reads on the other end. The session is
+ * closed once both directions have finished or either socket fails. The caller must hold the lock.
+ */
+void PortProxy::service(std::shared_ptr<ProxySession> session) {
+	if (!pump(session->client, session->device, session->toDevice) || !pump(session->device, session->client, session->toClient)) {
+		closeSession(session);
+		return;
+	}
+
+	if (session->toDevice.done() && session->toClient.done()) {
+		closeSession(session);
+		return;
+	}
+
+	watch(session->client, session->toDevice.empty() && !session->toDevice.eof, !session->toClient.empty());
+	watch(session->device, session->toClient.empty() && !session->toClient.eof, !session->toDevice.empty());
+}
+
+/**
+ * Returns the number of connected clients.
+ */
+size_t PortProxy::size() {
+	std::lock_guard<std::mutex> guard(lock);
+	return sessions.size() / 2;
+}
+
+/**
+ * Binds the listening socket to the local port on the loopback interface and starts accepting
+ * clients. If the local port is 0, the OS picks a free port which `getLocalPort()` returns.
+ */
+void PortProxy::start() {
+	listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		throw std::runtime_error("Failed to create listening socket");
+	}
+
+	int on = 1;
+	::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr;
+	::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)localPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (::bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listenFd, SOMAXCONN) != 0) {
+		int err = errno;
+		::close(listenFd);
+		listenFd = -1;
+		std::stringstream error;
+		error << "Failed to listen on port " << localPort << ": " << ::strerror(err);
+		throw std::runtime_error(error.str());
+	}
+
+	socklen_t len = sizeof(addr);
+	if (::getsockname(listenFd, (struct sockaddr*)&addr, &len) == 0) {
+		localPort = ntohs(addr.sin_port);
+	}
+
+	prepareSocket(listenFd);
+	LOG_DEBUG_2("PortProxy::start", "Listening on port %u for device port %u", localPort, devicePort)
+
+	std::lock_guard<std::mutex> guard(lock);
+	watch(listenFd, true, false);
+}
+
+/**
+ * Stops accepting clients and closes all sessions. Subclasses must call this from their
+ * destructor.
+ */
+void PortProxy::stop() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (listenFd != -1) {
+		LOG_DEBUG_1("PortProxy::stop", "No longer listening on port %u", localPort)
+		unwatch(listenFd);
+		::close(listenFd);
+		listenFd = -1;
+	}
+
+	while (!sessions.empty()) {
+		closeSession(sessions.begin()->second);
+	}
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef __PORT_PROXY_H__
+#define __PORT_PROXY_H__
+
+#include "node-ios-device.h"
+#include <map>
+#include <memory>
+#include <mutex>
+
+// the number of bytes buffered in each direction of a proxy session
+#define PROXY_BUFFER_SIZE (64 * 1024)
+
+// the max number of reads per direction before yielding to other sessions
+#define PROXY_MAX_READS 16
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * Bytes read from one end of a proxy session that haven't been written to the other end yet.
+ * `eof` is set once the reading end has been closed and `shutdown` once the end of stream has been
+ * passed along to the writing end.
+ */
+struct ProxyBuffer {
+	ProxyBuffer() : data(new char[PROXY_BUFFER_SIZE]), start(0), end(0), eof(false), shutdown(false) {}
+
+	inline bool done() const { return shutdown && start == end; }
+	inline bool empty() const { return start == end; }
+
+	std::unique_ptr<char[]> data;
+	size_t                  start;
+	size_t                  end;
+	bool                    eof;
+	bool                    shutdown;
+};
+
+/**
+ * A local client connected through the proxy to its own connection to the device.
+ */
+struct ProxySession {
+	ProxySession(int client, int device) : client(client), device(device) {}
+
+	int         client;
+	int         device;
+	ProxyBuffer toDevice;
+	ProxyBuffer toClient;
+};
+
+/**
+ * Listens on a local TCP port and connects each accepted client to a port on the device. Bytes are
+ * shuttled between the two sockets entirely in native code, so JavaScript never sees the data.
+ *
+ * This class contains the session bookkeeping and the non-blocking copy loop. It has no knowledge
+ * of the event loop or how to reach the device; subclasses watch file descriptors for readiness,
+ * call `onReadable()` and `onWritable()` from their I/O thread, and open device connections. A
+ * watch only needs to fire once since every event is followed by a call to `watch()` that sets
+ * the interest again.
+ */
+class PortProxy : public std::enable_shared_from_this<PortProxy> {
+public:
+	PortProxy(uint32_t devicePort, uint32_t localPort);
+	virtual ~PortProxy() {}
+
+	inline uint32_t getDevicePort() const { return devicePort; }
+	inline uint32_t getLocalPort() const { return localPort; }
+	void init();
+	void onReadable(int fd);
+	void onWritable(int fd);
+	size_t size();
+	void start();
+	void stop();
+
+protected:
+	void accept();
+	void closeSession(std::shared_ptr<ProxySession> session);
+	virtual int connectDevice() = 0;
+	bool pump(int src, int dest, ProxyBuffer& buffer);
+	void service(std::shared_ptr<ProxySession> session);
+	virtual void unwatch(int fd) = 0;
+	virtual void watch(int fd, bool read, bool write) = 0;
+
+	std::weak_ptr<PortProxy>                     self;
+	uint32_t                                     devicePort;
+	uint32_t                                     localPort;
+	int                                          listenFd;
+	std::mutex                                   lock;
+	std::map<int, std::shared_ptr<ProxySession>> sessions;
+};
+
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include "probe-pool.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Converts the probe stats to a JavaScript object.
+ */
+napi_value ProbeStatsSnapshot::toJS(napi_env env) const {
+	napi_value obj, tmp;
+	NAPI_THROW_RETURN("ProbeStatsSnapshot::toJS", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &obj), NULL)
+
+	const struct {
+		const char* name;
+		uint64_t value;
+	} counters[] = {
+		{ "probes",   probes },
+		{ "failures", failures },
+		{ "pending",  pending },
+		{ "running",  running },
+		{ "workers",  workers }
+	};
+	for (auto const& counter : counters) {
+		NAPI_THROW_RETURN("ProbeStatsSnapshot::toJS", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)counter.value, &tmp), NULL)
+		NAPI_THROW_RETURN("ProbeStatsSnapshot::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, counter.name, tmp), NULL)
+	}
+
+	tmp = latency.toJS(env);
+	if (!tmp) {
+		return NULL;
+	}
+	NAPI_THROW_RETURN("ProbeStatsSnapshot::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "latency", tmp), NULL)
+
+	return obj;
+}
+
+/**
+ * Initializes the pool. No threads are started until the first probe is queued.
+ */
+ProbePool::ProbePool(size_t maxWorkers) :
+	maxWorkers(maxWorkers > 0 ? maxWorkers : 1),
+	idle(0),
+	stopping(false),
+	probes(0),
+	failures(0) {}
+
+/**
+ * Stops the pool and waits for the running probes to finish.
+ */
+ProbePool::~ProbePool() {
+	stop();
+}
+
+/**
+ * Copies the pool's stats.
+ */
+void ProbePool::snapshot(ProbeStatsSnapshot& out) {
+	std::lock_guard<std::mutex> guard(lock);
+	out.probes = probes;
+	out.failures = failures;
+	out.pending = queue.size();
+	out.running = active.size();
+	out.workers = workers.size();
+	latency.snapshot(out.latency);
+}
+
+/**
+ * Drops the queued probes and waits for the running ones to finish. Probes queued after the pool
+ * has been stopped are ignored.
+ */
+void ProbePool::stop() {
+	std::vector<std::thread> threads;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		queue.clear();
+		threads.swap(workers);
+	}
+	cond.notify_all();
+
+	for (auto& thread : threads) {
+		if (thread.get_id() == std::this_thread::get_id()) {
+			thread.detach();
+		} else {
+			thread.join();
+		}
+	}
+}
+
+/**
+ * Queues a probe. It runs once every probe queued before it with the same key has finished. The
+ * probe returns false, or throws, if it failed.
+ */
+void ProbePool::submit(const std::string& key, std::function<bool()> probe) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping) {
+			return;
+		}
+		queue.push_back({ key, std::move(probe), std::chrono::steady_clock::now() });
+		if (idle < queue.size() && workers.size() < maxWorkers) {
+			LOG_DEBUG_1("ProbePool::submit", "Starting probe worker %ld", workers.size() + 1)
+			workers.emplace_back(&ProbePool::work, this);
+		}
+	}
+	cond.notify_one();
+}
+
+/**
+ * Runs probes until the pool is stopped. A worker takes the oldest probe whose key isn't already
+ * being probed by another worker.
+ */
+void ProbePool::work() {
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (!stopping) {
+		auto it = queue.begin();
+		while (it != queue.end() && active.count(it->key)) {
+			++it;
+		}
+
+		if (it == queue.end()) {
+			++idle;
+			cond.wait(guard);
+			--idle;
+			continue;
+		}
+
+		Task task = std::move(*it);
+		queue.erase(it);
+		active.insert(task.key);
+		guard.unlock();
+
+		bool ok = false;
+		try {
+			ok = task.probe();
+		} catch (std::exception& e) {
+			LOG_DEBUG_2("ProbePool::work", "Probe for %s failed: %s", task.key.c_str(), e.what())
+		}
+
+		guard.lock();
+		active.erase(task.key);
+		++probes;
+		if (!ok) {
+			++failures;
+		}
+		latency.record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - task.queued).count());
+
+		// another probe for the same device may be waiting for this one
+		cond.notify_all();
+	}
+}
+
+}
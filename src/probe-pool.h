@@ -0,0 +1,81 @@
+#ifndef __PROBE_POOL_H__
+#define __PROBE_POOL_H__
+
+#include "node-ios-device.h"
+#include "relay-stats.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+// the max number of devices that are handshaked at the same time
+#define PROBE_POOL_WORKERS 8
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * A point in time copy of a probe pool's stats.
+ */
+struct ProbeStatsSnapshot {
+	ProbeStatsSnapshot() : probes(0), failures(0), pending(0), running(0), workers(0) {}
+
+	napi_value toJS(napi_env env) const;
+
+	uint64_t               probes;
+	uint64_t               failures;
+	uint64_t               pending;
+	uint64_t               running;
+	uint64_t               workers;
+	RelayHistogramSnapshot latency;
+};
+
+/**
+ * A bounded pool of worker threads that probes devices.
+ *
+ * Each probe is queued under a key, the device's udid, and probes with the same key run one at a
+ * time in the order they were queued while probes for other devices run in parallel. Worker threads
+ * are started as probes are queued, up to the max, and wait for more work until the pool is
+ * stopped. The time from queueing a probe to it finishing is recorded in microseconds.
+ */
+class ProbePool {
+public:
+	ProbePool(size_t maxWorkers = PROBE_POOL_WORKERS);
+	~ProbePool();
+
+	void snapshot(ProbeStatsSnapshot& out);
+	void stop();
+	void submit(const std::string& key, std::function<bool()> probe);
+
+private:
+	struct Task {
+		std::string key;
+		std::function<bool()> probe;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	void work();
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::deque<Task> queue;
+	std::set<std::string> active;
+	std::vector<std::thread> workers;
+	size_t maxWorkers;
+	size_t idle;
+	bool stopping;
+
+	// only updated while `lock` is held
+	uint64_t probes;
+	uint64_t failures;
+	RelayHistogram latency;
+};
+
+}
+
+#endif
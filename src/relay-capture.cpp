@@ -0,0 +1,404 @@
+#include "relay-capture.h"
+#include "relay-slab.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <uv.h>
+
+namespace node_ios_device {
+
+/**
+ * Rounds a size up to the next 8 byte boundary.
+ */
+static inline size_t align8(size_t n) {
+	return (n + 7) & ~(size_t)7;
+}
+
+/**
+ * Returns the number of index entries in a capture file of the specified size.
+ */
+static inline uint32_t indexCapacity(size_t fileSize) {
+	return (uint32_t)(fileSize / RELAY_CAPTURE_INDEX_INTERVAL + 1);
+}
+
+/**
+ * Returns the offset of the first record in a capture file of the specified size, which follows
+ * the header and the index.
+ */
+static inline size_t dataOffset(size_t fileSize) {
+	return align8(sizeof(RelayCaptureHeader) + indexCapacity(fileSize) * sizeof(RelayCaptureIndexEntry));
+}
+
+/**
+ * Returns the requested capture file size raised to the minimum and to what it takes to hold a
+ * record of the largest frame after the header and index. A delimited frame that reaches the max
+ * frame length can run past it by up to one read, so a slab is allowed on top of it.
+ */
+static size_t captureFileSize(size_t fileSize, size_t maxFrameLength) {
+	size_t record = align8(sizeof(RelayCaptureRecord) + maxFrameLength + RELAY_SLAB_SIZE);
+	size_t size = std::max(fileSize, (size_t)RELAY_CAPTURE_MIN_FILE_SIZE);
+
+	// the index grows with the file, so repeat until the record fits after it
+	while (dataOffset(size) + record > size) {
+		size = dataOffset(size) + record;
+	}
+
+	return size;
+}
+
+/**
+ * Returns the sequence numbers of the existing capture files for the path in ascending order.
+ */
+static std::vector<uint32_t> listSequences(const std::string& path) {
+	std::vector<uint32_t> sequences;
+	size_t slash = path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+	std::string prefix = (slash == std::string::npos ? path : path.substr(slash + 1)) + ".";
+
+	DIR* d = ::opendir(dir.c_str());
+	if (!d) {
+		return sequences;
+	}
+
+	struct dirent* entry;
+	while ((entry = ::readdir(d)) != NULL) {
+		std::string name(entry->d_name);
+		if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) {
+			continue;
+		}
+
+		std::string suffix = name.substr(prefix.size());
+		if (suffix.size() > 9 || suffix.find_first_not_of("0123456789") != std::string::npos) {
+			continue;
+		}
+
+		sequences.push_back((uint32_t)std::stoul(suffix));
+	}
+	::closedir(d);
+
+	std::sort(sequences.begin(), sequences.end());
+	return sequences;
+}
+
+/**
+ * Opens the first capture file after any existing ones for the path. The file size is raised if
+ * it's too small to hold a frame of the max frame length. Throws if the file can't be created.
+ */
+RelayCapture::RelayCapture(const std::string& path, size_t fileSize, uint32_t maxFiles, size_t maxFrameLength) :
+	path(path),
+	fileSize(captureFileSize(fileSize, maxFrameLength)),
+	maxFiles(maxFiles < 1 ? 1 : maxFiles),
+	sequence(0),
+	fd(-1),
+	map(NULL),
+	header(NULL),
+	lastIndexed(0) {
+
+	// frames are timestamped with the monotonic clock, but captures are searched by wall clock
+	struct timespec now;
+	::clock_gettime(CLOCK_REALTIME, &now);
+	clockOffset = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec - (int64_t)::uv_hrtime();
+
+	for (uint32_t seq : listSequences(path)) {
+		files.push_back(seq);
+		sequence = seq + 1;
+	}
+
+	open();
+}
+
+/**
+ * Trims and closes the current capture file.
+ */
+RelayCapture::~RelayCapture() {
+	close();
+}
+
+/**
+ * Unmaps the current capture file and trims it to the bytes used.
+ */
+void RelayCapture::close() {
+	if (!map) {
+		return;
+	}
+
+	size_t used = (size_t)header->dataEnd;
+	::munmap(map, fileSize);
+	map = NULL;
+	header = NULL;
+
+	if (::ftruncate(fd, (off_t)used) != 0) {
+		LOG_DEBUG_1("RelayCapture::close", "Failed to trim capture file: %s", ::strerror(errno))
+	}
+	::close(fd);
+	fd = -1;
+}
+
+/**
+ * Creates the capture file for the current sequence number, sizes it, maps it, and writes the
+ * header. The oldest capture files are deleted once there are more than `maxFiles`.
+ */
+void RelayCapture::open() {
+	std::string file = path + "." + std::to_string(sequence);
+
+	fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open capture file " + file + ": " + ::strerror(errno));
+	}
+
+	if (::ftruncate(fd, (off_t)fileSize) != 0) {
+		int error = errno;
+		::close(fd);
+		fd = -1;
+		throw std::runtime_error("Failed to size capture file " + file + ": " + ::strerror(error));
+	}
+
+	void* addr = ::mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		int error = errno;
+		::close(fd);
+		fd = -1;
+		throw std::runtime_error("Failed to map capture file " + file + ": " + ::strerror(error));
+	}
+
+	LOG_DEBUG_1("RelayCapture::open", "Capturing to %s", file.c_str())
+	map = static_cast<char*>(addr);
+	header = reinterpret_cast<RelayCaptureHeader*>(map);
+	::memset(header, 0, sizeof(RelayCaptureHeader));
+	::memcpy(header->magic, RELAY_CAPTURE_MAGIC, sizeof(header->magic));
+	header->indexCapacity = indexCapacity(fileSize);
+	header->dataOffset = dataOffset(fileSize);
+	header->dataEnd = header->dataOffset;
+	lastIndexed = 0;
+
+	files.push_back(sequence);
+	while (files.size() > maxFiles) {
+		std::string old = path + "." + std::to_string(files.front());
+		LOG_DEBUG_1("RelayCapture::open", "Removing old capture file %s", old.c_str())
+		::unlink(old.c_str());
+		files.pop_front();
+	}
+}
+
+/**
+ * Closes the full capture file and starts the next one. If the next file can't be created, the
+ * capture stops.
+ */
+void RelayCapture::rotate() {
+	close();
+	++sequence;
+
+	try {
+		open();
+	} catch (std::exception& e) {
+		LOG_DEBUG_1("RelayCapture::rotate", "Stopping capture: %s", e.what())
+	}
+}
+
+/**
+ * Appends a frame read at the `uv_hrtime()` timestamp. An index entry is added for the first
+ * record after every `RELAY_CAPTURE_INDEX_INTERVAL` bytes. The end of the data is published last
+ * so that readers of a live capture file never see a partial record.
+ */
+void RelayCapture::write(uint64_t timestamp, const char* data, size_t length) {
+	if (!map) {
+		return;
+	}
+
+	size_t recordSize = align8(sizeof(RelayCaptureRecord) + length);
+	if (header->dataEnd + recordSize > fileSize) {
+		if (header->dataOffset + recordSize > fileSize) {
+			LOG_DEBUG_1("RelayCapture::write", "Frame of %zu bytes is too large to capture", length)
+			return;
+		}
+		rotate();
+		if (!map) {
+			return;
+		}
+	}
+
+	uint64_t time = (uint64_t)((int64_t)timestamp + clockOffset);
+	uint64_t offset = header->dataEnd;
+
+	RelayCaptureRecord* record = reinterpret_cast<RelayCaptureRecord*>(map + offset);
+	record->time = time;
+	record->length = (uint32_t)length;
+	record->flags = 0;
+	::memcpy(record + 1, data, length);
+
+	if ((header->indexCount == 0 || offset - lastIndexed >= RELAY_CAPTURE_INDEX_INTERVAL) && header->indexCount < header->indexCapacity) {
+		RelayCaptureIndexEntry* index = reinterpret_cast<RelayCaptureIndexEntry*>(map + sizeof(RelayCaptureHeader));
+		index[header->indexCount++] = { time, offset };
+		lastIndexed = (size_t)offset;
+	}
+
+	if (header->startTime == 0) {
+		header->startTime = time;
+	}
+	header->endTime = time;
+	__atomic_store_n(&header->dataEnd, offset + recordSize, __ATOMIC_RELEASE);
+}
+
+/**
+ * Maps a capture file read-only and validates its header. Throws if the file isn't a capture file.
+ */
+RelayCaptureReader::RelayCaptureReader(const std::string& file) :
+	fd(-1),
+	map(NULL),
+	size(0),
+	header(NULL) {
+
+	fd = ::open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open capture file " + file + ": " + ::strerror(errno));
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RelayCaptureHeader)) {
+		::close(fd);
+		throw std::runtime_error("Invalid capture file " + file);
+	}
+	size = (size_t)st.st_size;
+
+	void* addr = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		int error = errno;
+		::close(fd);
+		throw std::runtime_error("Failed to map capture file " + file + ": " + ::strerror(error));
+	}
+
+	map = static_cast<char*>(addr);
+	header = reinterpret_cast<RelayCaptureHeader*>(map);
+
+	if (::memcmp(header->magic, RELAY_CAPTURE_MAGIC, sizeof(header->magic)) != 0 || header->dataOffset > size) {
+		::munmap(map, size);
+		::close(fd);
+		throw std::runtime_error("Invalid capture file " + file);
+	}
+}
+
+/**
+ * Unmaps and closes the capture file.
+ */
+RelayCaptureReader::~RelayCaptureReader() {
+	::munmap(map, size);
+	::close(fd);
+}
+
+/**
+ * Returns the paths of the capture files for the path from oldest to newest.
+ */
+std::vector<std::string> RelayCaptureReader::list(const std::string& path) {
+	std::vector<std::string> result;
+	for (uint32_t seq : listSequences(path)) {
+		result.push_back(path + "." + std::to_string(seq));
+	}
+	return result;
+}
+
+/**
+ * Reads the record at the offset and advances the offset to the next record. Returns false at the
+ * end of the data.
+ */
+bool RelayCaptureReader::next(uint64_t& offset, RelayCaptureFrame& frame) {
+	uint64_t end = __atomic_load_n(&header->dataEnd, __ATOMIC_ACQUIRE);
+	if (end > size) {
+		end = size;
+	}
+
+	if (offset < header->dataOffset) {
+		offset = header->dataOffset;
+	}
+
+	if (offset + sizeof(RelayCaptureRecord) > end) {
+		return false;
+	}
+
+	const RelayCaptureRecord* record = reinterpret_cast<const RelayCaptureRecord*>(map + offset);
+	if (offset + sizeof(RelayCaptureRecord) + record->length > end) {
+		return false;
+	}
+
+	frame.time = record->time;
+	frame.data = reinterpret_cast<const char*>(record + 1);
+	frame.length = record->length;
+	offset += align8(sizeof(RelayCaptureRecord) + record->length);
+	return true;
+}
+
+/**
+ * Creates a JavaScript object with up to `maxFrames` frames starting at the offset and the offset
+ * of the record after them. Each frame has its time in milliseconds since the epoch and a copy of
+ * its data.
+ */
+napi_value RelayCaptureReader::read(napi_env env, uint64_t offset, uint32_t maxFrames) {
+	napi_value rval, frames, tmp;
+	RelayCaptureFrame frame;
+	uint32_t count = 0;
+
+	NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &rval), NULL)
+	NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array(env, &frames), NULL)
+
+	while (count < maxFrames && next(offset, frame)) {
+		napi_value obj, data;
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &obj), NULL)
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)frame.time / 1e6, &tmp), NULL)
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "time", tmp), NULL)
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_BUFFER_COPY", ::napi_create_buffer_copy(env, frame.length, frame.data, NULL, &data), NULL)
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "data", data), NULL)
+		NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, frames, count++, obj), NULL)
+	}
+
+	NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, rval, "frames", frames), NULL)
+	NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)offset, &tmp), NULL)
+	NAPI_THROW_RETURN("RelayCaptureReader::read", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, rval, "next", tmp), NULL)
+
+	return rval;
+}
+
+/**
+ * Returns the offset of the first record at or after the time in milliseconds since the epoch. The
+ * record times are converted to milliseconds the same way `read()` reports them so that seeking to
+ * a time that was read back finds that record. The index narrows the search down to one index
+ * interval, which is then scanned.
+ */
+uint64_t RelayCaptureReader::seek(double time) {
+	const RelayCaptureIndexEntry* index = reinterpret_cast<const RelayCaptureIndexEntry*>(map + sizeof(RelayCaptureHeader));
+	uint32_t count = header->indexCount;
+	if (count > header->indexCapacity || sizeof(RelayCaptureHeader) + (size_t)count * sizeof(RelayCaptureIndexEntry) > size) {
+		count = 0;
+	}
+
+	// find the last index entry before the time
+	uint64_t offset = header->dataOffset;
+	uint32_t lo = 0, hi = count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if ((double)index[mid].time / 1e6 < time) {
+			offset = index[mid].offset;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	RelayCaptureFrame frame;
+	uint64_t pos = offset;
+	while (next(pos, frame)) {
+		if ((double)frame.time / 1e6 >= time) {
+			return offset;
+		}
+		offset = pos;
+	}
+
+	return offset;
+}
+
+}
@@ -0,0 +1,129 @@
+#ifndef __RELAY_CAPTURE_H__
+#define __RELAY_CAPTURE_H__
+
+#include "node-ios-device.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// identifies a capture file and its format version
+#define RELAY_CAPTURE_MAGIC "NIDCAP01"
+
+// the default size of each capture file and the default number of capture files to keep
+#define RELAY_CAPTURE_DEFAULT_FILE_SIZE (64 * 1024 * 1024)
+#define RELAY_CAPTURE_DEFAULT_MAX_FILES 8
+
+// the smallest capture file size, which is raised further when it can't hold a max length frame
+#define RELAY_CAPTURE_MIN_FILE_SIZE (2 * 1024 * 1024)
+
+// the number of record bytes between index entries
+#define RELAY_CAPTURE_INDEX_INTERVAL (64 * 1024)
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * The header at the start of every capture file. Times are nanoseconds since the epoch. `dataEnd`
+ * is updated after each record is written, so a capture file left behind by a crash is readable up
+ * to the last complete record.
+ */
+struct RelayCaptureHeader {
+	char     magic[8];
+	uint64_t startTime;
+	uint64_t endTime;
+	uint64_t dataOffset;
+	uint64_t dataEnd;
+	uint32_t indexCapacity;
+	uint32_t indexCount;
+	uint64_t reserved[2];
+};
+
+/**
+ * A sparse index entry pointing at the first record written after every
+ * `RELAY_CAPTURE_INDEX_INTERVAL` bytes. The index sits between the header and the records.
+ */
+struct RelayCaptureIndexEntry {
+	uint64_t time;
+	uint64_t offset;
+};
+
+/**
+ * The header of each record. The frame's bytes follow and the next record starts at the next 8
+ * byte boundary.
+ */
+struct RelayCaptureRecord {
+	uint64_t time;
+	uint32_t length;
+	uint32_t flags;
+};
+
+/**
+ * Tees relay frames into a set of rotating memory-mapped capture files named `<path>.<sequence>`.
+ * Each file is sized up front and mapped once, so writing a frame is a copy into the mapping. Once
+ * a file is full, it is trimmed to the bytes used, the next file is started, and the oldest files
+ * beyond `maxFiles` are deleted.
+ *
+ * Frames are written by the thread reading from the device with the time they were read. Each file
+ * is made large enough to hold the largest frame the relay connection can emit. A capture that
+ * fails to rotate stops capturing instead of interrupting the relay.
+ */
+class RelayCapture {
+public:
+	RelayCapture(const std::string& path, size_t fileSize, uint32_t maxFiles, size_t maxFrameLength);
+	~RelayCapture();
+
+	void write(uint64_t timestamp, const char* data, size_t length);
+
+protected:
+	void close();
+	void open();
+	void rotate();
+
+	std::string          path;
+	size_t               fileSize;
+	uint32_t             maxFiles;
+	int64_t              clockOffset;
+	uint32_t             sequence;
+	std::deque<uint32_t> files;
+	int                  fd;
+	char*                map;
+	RelayCaptureHeader*  header;
+	size_t               lastIndexed;
+};
+
+/**
+ * A frame read back from a capture file. The data points into the reader's mapping.
+ */
+struct RelayCaptureFrame {
+	uint64_t    time;
+	const char* data;
+	uint32_t    length;
+};
+
+/**
+ * Reads a single capture file by mapping it read-only. Records are addressed by their byte offset
+ * so that a replay can be resumed without keeping the file open.
+ */
+class RelayCaptureReader {
+public:
+	RelayCaptureReader(const std::string& file);
+	~RelayCaptureReader();
+
+	static std::vector<std::string> list(const std::string& path);
+
+	bool next(uint64_t& offset, RelayCaptureFrame& frame);
+	napi_value read(napi_env env, uint64_t offset, uint32_t maxFrames);
+	uint64_t seek(double time);
+
+protected:
+	int                 fd;
+	char*               map;
+	size_t              size;
+	RelayCaptureHeader* header;
+};
+
+}
+
+#endif
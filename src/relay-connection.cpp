@@ -0,0 +1,1611 @@
+#include "relay-connection.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/uio.h>
+
+namespace node_ios_device {
+
+/**
+ * Looks up an option and verifies its type. Returns false if the option is not set.
+ */
+static bool getOption(napi_env env, napi_value opts, const char* name, napi_valuetype expected, const char* expectedDesc, napi_value* value) {
+	napi_valuetype type;
+	if (::napi_get_named_property(env, opts, name, value) != napi_ok || ::napi_typeof(env, *value, &type) != napi_ok || type == napi_undefined) {
+		return false;
+	}
+
+	if (type != expected) {
+		std::string msg = std::string("Expected ") + name + " to be " + expectedDesc;
+		throw std::runtime_error(msg);
+	}
+
+	return true;
+}
+
+/**
+ * Copies a JavaScript string into `result`.
+ */
+static void readString(napi_env env, napi_value value, const char* name, std::string& result) {
+	size_t len = 0;
+	if (::napi_get_value_string_utf8(env, value, NULL, 0, &len) != napi_ok) {
+		throw std::runtime_error(std::string("Failed to read ") + name);
+	}
+	result.resize(len);
+	if (::napi_get_value_string_utf8(env, value, &result[0], len + 1, NULL) != napi_ok) {
+		throw std::runtime_error(std::string("Failed to read ") + name);
+	}
+}
+
+/**
+ * Reads a string option. Returns false if the option is not set.
+ */
+static bool getStringOption(napi_env env, napi_value opts, const char* name, const char* expectedDesc, std::string& result) {
+	napi_value value;
+	if (!getOption(env, opts, name, napi_string, expectedDesc, &value)) {
+		return false;
+	}
+
+	readString(env, value, name, result);
+	return true;
+}
+
+/**
+ * Reads a single include or exclude rule. Strings match anywhere in the frame, `{ prefix }` objects
+ * match the start of the frame, and objects with a string `source`, such as a `RegExp`, are
+ * compiled as a regex. Of the regex flags, only `i` changes how the frame is matched.
+ */
+static RelayFilterRule getFilterRule(napi_env env, napi_value value, const char* name, const char* expectedDesc) {
+	RelayFilterRule rule{ SubstringMatch, "", false };
+	napi_valuetype type;
+
+	if (::napi_typeof(env, value, &type) != napi_ok) {
+		throw std::runtime_error(std::string("Failed to read ") + name);
+	}
+
+	if (type == napi_string) {
+		readString(env, value, name, rule.pattern);
+	} else if (type == napi_object && getStringOption(env, value, "prefix", "a string", rule.pattern)) {
+		rule.kind = PrefixMatch;
+	} else if (type == napi_object && getStringOption(env, value, "source", "a string", rule.pattern)) {
+		rule.kind = RegexMatch;
+
+		std::string flags;
+		getStringOption(env, value, "flags", "a string", flags);
+		for (char flag : flags) {
+			if (flag == 'i') {
+				rule.ignoreCase = true;
+			} else if (flag != 'g' && flag != 'y' && flag != 'd') {
+				throw std::runtime_error(std::string("Unsupported regular expression flag \"") + flag + "\" in " + name);
+			}
+		}
+	} else {
+		throw std::runtime_error(std::string("Expected ") + name + " to be " + expectedDesc);
+	}
+
+	return rule;
+}
+
+/**
+ * Reads the `include` or `exclude` option, which is a single rule or an array of rules. Returns
+ * false if the option is not set.
+ */
+static bool getFilterOption(napi_env env, napi_value opts, const char* name, std::vector<RelayFilterRule>& rules) {
+	const char* expectedDesc = "a string, RegExp, or { prefix } object, or an array of them";
+	napi_value value;
+	napi_valuetype type;
+	bool isArray = false;
+
+	if (::napi_get_named_property(env, opts, name, &value) != napi_ok || ::napi_typeof(env, value, &type) != napi_ok || type == napi_undefined) {
+		return false;
+	}
+
+	::napi_is_array(env, value, &isArray);
+	if (!isArray) {
+		rules.push_back(getFilterRule(env, value, name, expectedDesc));
+		return true;
+	}
+
+	uint32_t length = 0;
+	::napi_get_array_length(env, value, &length);
+	for (uint32_t i = 0; i < length; ++i) {
+		napi_value item;
+		if (::napi_get_element(env, value, i, &item) != napi_ok) {
+			throw std::runtime_error(std::string("Failed to read ") + name);
+		}
+		rules.push_back(getFilterRule(env, item, name, expectedDesc));
+	}
+
+	return true;
+}
+
+/**
+ * Parses the relay options from the JavaScript options object passed into `forward()`. Missing
+ * options are left as their defaults. The framing defaults to newline for utf8 and raw for buffer
+ * encoding.
+ */
+RelayOptions RelayOptions::parse(napi_env env, napi_value opts) {
+	RelayOptions options;
+	napi_valuetype type;
+
+	if (opts == NULL || ::napi_typeof(env, opts, &type) != napi_ok || type == napi_undefined || type == napi_null) {
+		return options;
+	}
+
+	if (type != napi_object) {
+		throw std::runtime_error("Expected options to be an object");
+	}
+
+	std::string str;
+	if (getStringOption(env, opts, "encoding", "\"utf8\" or \"buffer\"", str)) {
+		if (str == "utf8") {
+			options.encoding = Utf8Encoding;
+		} else if (str == "buffer") {
+			options.encoding = BufferEncoding;
+		} else {
+			throw std::runtime_error("Expected encoding to be \"utf8\" or \"buffer\"");
+		}
+	}
+
+	options.framing = options.encoding == BufferEncoding ? RawFraming : NewlineFraming;
+
+	bool hasDelimiter = getStringOption(env, opts, "delimiter", "a non-empty string", options.delimiter);
+	if (hasDelimiter) {
+		if (options.delimiter.empty()) {
+			throw std::runtime_error("Expected delimiter to be a non-empty string");
+		}
+		options.framing = DelimiterFraming;
+	}
+
+	const char* framingDesc = "\"newline\", \"delimiter\", \"length-prefix\", or \"raw\"";
+	if (getStringOption(env, opts, "framing", framingDesc, str)) {
+		if (str == "newline") {
+			options.framing = NewlineFraming;
+		} else if (str == "delimiter") {
+			options.framing = DelimiterFraming;
+		} else if (str == "length-prefix") {
+			options.framing = LengthPrefixFraming;
+		} else if (str == "raw") {
+			options.framing = RawFraming;
+		} else {
+			throw std::runtime_error(std::string("Expected framing to be ") + framingDesc);
+		}
+	}
+
+	if (options.framing == DelimiterFraming && !hasDelimiter) {
+		throw std::runtime_error("Expected delimiter to be a non-empty string");
+	}
+
+	if (getStringOption(env, opts, "parse", "\"json\", \"logfmt\", or \"syslog\"", str)) {
+		if (str == "json") {
+			options.parsing = JsonParse;
+		} else if (str == "logfmt") {
+			options.parsing = LogfmtParse;
+		} else if (str == "syslog") {
+			options.parsing = SyslogParse;
+		} else {
+			throw std::runtime_error("Expected parse to be \"json\", \"logfmt\", or \"syslog\"");
+		}
+		if (options.encoding == BufferEncoding) {
+			throw std::runtime_error("Expected encoding to be \"utf8\" when parsing");
+		}
+	}
+
+	getFilterOption(env, opts, "include", options.include);
+	getFilterOption(env, opts, "exclude", options.exclude);
+
+	napi_value value;
+	if (::napi_get_named_property(env, opts, "capture", &value) == napi_ok && ::napi_typeof(env, value, &type) == napi_ok && type != napi_undefined) {
+		// `capture` is either the path or an object with the path and how much to keep
+		if (type == napi_string) {
+			getStringOption(env, opts, "capture", "a non-empty string", options.capturePath);
+		} else if (type == napi_object) {
+			napi_value num;
+			getStringOption(env, value, "path", "a non-empty string", options.capturePath);
+
+			if (getOption(env, value, "maxFileSize", napi_number, "a positive number", &num)) {
+				int64_t n = 0;
+				::napi_get_value_int64(env, num, &n);
+				if (n < 1) {
+					throw std::runtime_error("Expected maxFileSize to be a positive number");
+				}
+				options.captureFileSize = (size_t)n;
+			}
+
+			if (getOption(env, value, "maxFiles", napi_number, "a positive number", &num)) {
+				::napi_get_value_uint32(env, num, &options.captureMaxFiles);
+				if (options.captureMaxFiles < 1) {
+					throw std::runtime_error("Expected maxFiles to be a positive number");
+				}
+			}
+		} else {
+			throw std::runtime_error("Expected capture to be a string or an object");
+		}
+
+		if (options.capturePath.empty()) {
+			throw std::runtime_error("Expected path to be a non-empty string");
+		}
+	}
+
+	if (getOption(env, opts, "batch", napi_object, "an object", &value)) {
+		napi_value num;
+		options.batchSize = RELAY_DEFAULT_BATCH_SIZE;
+
+		if (getOption(env, value, "maxSize", napi_number, "a positive number", &num)) {
+			::napi_get_value_uint32(env, num, &options.batchSize);
+			if (options.batchSize < 1) {
+				throw std::runtime_error("Expected maxSize to be a positive number");
+			}
+		}
+
+		if (getOption(env, value, "maxLatency", napi_number, "a number", &num)) {
+			::napi_get_value_uint32(env, num, &options.batchLatency);
+		}
+	}
+
+	if (getOption(env, opts, "maxFrameLength", napi_number, "a positive number", &value)) {
+		int64_t n = 0;
+		::napi_get_value_int64(env, value, &n);
+		if (n < 1) {
+			throw std::runtime_error("Expected maxFrameLength to be a positive number");
+		}
+		options.maxFrameLength = (size_t)n;
+	}
+
+	if (getOption(env, opts, "highWaterMark", napi_number, "a positive number", &value)) {
+		int64_t n = 0;
+		::napi_get_value_int64(env, value, &n);
+		if (n < 1) {
+			throw std::runtime_error("Expected highWaterMark to be a positive number");
+		}
+		options.highWaterMark = (size_t)n;
+		options.lowWaterMark = options.highWaterMark / 4;
+	}
+
+	if (getOption(env, opts, "lowWaterMark", napi_number, "a non-negative number", &value)) {
+		int64_t n = 0;
+		::napi_get_value_int64(env, value, &n);
+		if (n < 0) {
+			throw std::runtime_error("Expected lowWaterMark to be a non-negative number");
+		}
+		options.lowWaterMark = (size_t)n;
+	}
+
+	if (options.lowWaterMark >= options.highWaterMark) {
+		throw std::runtime_error("Expected lowWaterMark to be less than highWaterMark");
+	}
+
+	if (getStringOption(env, opts, "overflow", "\"pause\" or \"drop-oldest\"", str)) {
+		if (str == "pause") {
+			options.overflow = PauseOverflow;
+		} else if (str == "drop-oldest") {
+			options.overflow = DropOldestOverflow;
+		} else {
+			throw std::runtime_error("Expected overflow to be \"pause\" or \"drop-oldest\"");
+		}
+	}
+
+	if (getOption(env, opts, "exclusive", napi_boolean, "a boolean", &value)) {
+		::napi_get_value_bool(env, value, &options.exclusive);
+	}
+
+	if (getOption(env, opts, "poolSize", napi_number, "a non-negative number", &value)) {
+		int64_t n = 0;
+		::napi_get_value_int64(env, value, &n);
+		if (n < 0) {
+			throw std::runtime_error("Expected poolSize to be a non-negative number");
+		}
+		options.poolSize = (uint32_t)n;
+	}
+
+	// `reconnect` is either a boolean or an object with the backoff delays
+	if (::napi_get_named_property(env, opts, "reconnect", &value) == napi_ok && ::napi_typeof(env, value, &type) == napi_ok && type != napi_undefined) {
+		if (type == napi_boolean) {
+			::napi_get_value_bool(env, value, &options.reconnect);
+		} else if (type == napi_object) {
+			napi_value num;
+			options.reconnect = true;
+
+			if (getOption(env, value, "delay", napi_number, "a positive number", &num)) {
+				::napi_get_value_uint32(env, num, &options.reconnectDelay);
+				if (options.reconnectDelay < 1) {
+					throw std::runtime_error("Expected delay to be a positive number");
+				}
+			}
+
+			if (getOption(env, value, "maxDelay", napi_number, "a positive number", &num)) {
+				::napi_get_value_uint32(env, num, &options.reconnectMaxDelay);
+				if (options.reconnectMaxDelay < 1) {
+					throw std::runtime_error("Expected maxDelay to be a positive number");
+				}
+			}
+
+			if (options.reconnectMaxDelay < options.reconnectDelay) {
+				options.reconnectMaxDelay = options.reconnectDelay;
+			}
+		} else {
+			throw std::runtime_error("Expected reconnect to be a boolean or an object");
+		}
+	}
+
+	return options;
+}
+
+/**
+ * Parses the relay options passed into `syslog()`. The syslog relay service terminates each record
+ * with a NUL, so the frames are always delimited by NUL. Syslog connections are started by the
+ * device rather than a connector, so they can't reconnect or be pooled, and the options for those
+ * and for framing are rejected.
+ */
+RelayOptions RelayOptions::parseSyslog(napi_env env, napi_value opts) {
+	napi_valuetype type;
+	if (opts != NULL && ::napi_typeof(env, opts, &type) == napi_ok && type == napi_object) {
+		for (const char* name : { "delimiter", "exclusive", "framing", "poolSize", "reconnect" }) {
+			napi_value value;
+			if (::napi_get_named_property(env, opts, name, &value) == napi_ok && ::napi_typeof(env, value, &type) == napi_ok && type != napi_undefined) {
+				throw std::runtime_error(std::string("Expected ") + name + " to not be set for syslog()");
+			}
+		}
+	}
+
+	RelayOptions options = parse(env, opts);
+	options.framing = DelimiterFraming;
+	options.delimiter = std::string(1, '\0');
+	return options;
+}
+
+/**
+ * Compares two sets of options. Listeners can only share a connection if the options match. The
+ * connection options `exclusive` and `poolSize` don't affect how data is delivered, so they are
+ * not compared. Whether the connection reconnects decides if listeners see "end" or "disconnect",
+ * so it must match.
+ */
+bool RelayOptions::operator==(const RelayOptions& other) const {
+	return batchLatency == other.batchLatency
+		&& batchSize == other.batchSize
+		&& capturePath == other.capturePath
+		&& captureFileSize == other.captureFileSize
+		&& captureMaxFiles == other.captureMaxFiles
+		&& encoding == other.encoding
+		&& exclude == other.exclude
+		&& framing == other.framing
+		&& delimiter == other.delimiter
+		&& highWaterMark == other.highWaterMark
+		&& include == other.include
+		&& lowWaterMark == other.lowWaterMark
+		&& maxFrameLength == other.maxFrameLength
+		&& overflow == other.overflow
+		&& parsing == other.parsing
+		&& reconnect == other.reconnect
+		&& reconnectDelay == other.reconnectDelay
+		&& reconnectMaxDelay == other.reconnectMaxDelay;
+}
+
+/**
+ * Initializes the relay connection and wires up the relay message async handler into Node's libuv
+ * runloop. Throws if the capture file can't be created or a filter regex is invalid.
+ */
+RelayConnection::RelayConnection(napi_env env, const RelayOptions& options) :
+	env(env),
+	options(options),
+	slabPool(std::make_shared<RelaySlabPool>()),
+	framer(slabPool, options.framing, options.delimiter, options.maxFrameLength),
+	filter(options.include, options.exclude),
+	parser(slabPool, options.parsing),
+	capture(options.capturePath.empty() ? nullptr : std::make_unique<RelayCapture>(options.capturePath, options.captureFileSize, options.captureMaxFiles, options.maxFrameLength)),
+	endQueued(false),
+	queuedBytes(0),
+	paused(false),
+	pauseEmitted(false),
+	dropping(false),
+	droppedFrames(0),
+	droppedBytes(0),
+	writeQueuedBytes(0),
+	writeBlocked(false),
+	nextWriteId(0),
+	reconnectRequested(false),
+	reconnectResult(ReconnectPending),
+	reconnecting(false),
+	suspended(false),
+	disconnectedAt(0),
+	reconnectAttempts(0),
+	reconnectBackoff(options.reconnectDelay),
+	tagged(false),
+	sourceNames(NULL) {
+
+	msgQueueUpdate = new uv_async_t;
+	batchTimer = new uv_timer_t;
+	reconnectTimer = new uv_timer_t;
+}
+
+/**
+ * Shuts down a relay connection and releases any slabs still referenced by undelivered frames.
+ * Subclasses must disconnect from their data source before this runs.
+ */
+RelayConnection::~RelayConnection() {
+	::uv_close(
+		(uv_handle_t*)msgQueueUpdate,
+		[](uv_handle_t* handle) {
+			delete (uv_async_t *)handle;
+		}
+	);
+
+	::uv_close(
+		(uv_handle_t*)batchTimer,
+		[](uv_handle_t* handle) {
+			delete (uv_timer_t *)handle;
+		}
+	);
+
+	::uv_close(
+		(uv_handle_t*)reconnectTimer,
+		[](uv_handle_t* handle) {
+			delete (uv_timer_t *)handle;
+		}
+	);
+
+	RelayFrame frame;
+	while (msgQueue.pop(frame)) {
+		if (frame.slab) {
+			frame.slab->release();
+		}
+	}
+
+	for (auto const& it : writeCallbacks) {
+		::napi_delete_reference(env, it.second);
+	}
+
+	if (sourceNames) {
+		::napi_delete_reference(env, sourceNames);
+	}
+}
+
+/**
+ * Adds a listener. If this is the first listener, it increments/refs the libuv async handle so
+ * prevent Node from exiting.
+ */
+void RelayConnection::add(napi_value listener) {
+	napi_ref ref;
+	NAPI_THROW_RETURN("RelayConnection::add", "ERROR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, listener, 1, &ref), )
+
+	size_t count = 0;
+	{
+		std::lock_guard<std::mutex> lock(listenersLock);
+		listeners.push_back(ref);
+		count = listeners.size();
+	}
+
+	if (count == 1) {
+		::uv_ref((uv_handle_t*)msgQueueUpdate);
+		connect();
+	}
+}
+
+/**
+ * Creates the JavaScript values for the frames in `batch` and stores them in the "batch" event
+ * arguments. Each frame's slab reference is consumed as its value is created, and `consumed` is
+ * set to the number of frames that no longer hold one. Returns false if a JavaScript exception is
+ * pending.
+ */
+bool RelayConnection::batchToJS(napi_value* argv, int argc, size_t& consumed) {
+	size_t count = batch.size();
+
+	if (tagged) {
+		// the name of each frame's source, which are the same few strings over and over
+		NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, count, &argv[argc - 1]), false)
+		for (size_t i = 0; i < count; ++i) {
+			napi_value name = sourceName(batch[i].source);
+			if (name == NULL) {
+				return false;
+			}
+			NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, argv[argc - 1], (uint32_t)i, name), false)
+		}
+	}
+
+	if (options.encoding == BufferEncoding) {
+		// concatenate the frames into a single buffer and pass the frame boundaries as a
+		// Uint32Array of `count + 1` offsets so that only 2 objects are created per batch
+		size_t total = 0;
+		for (auto const& frame : batch) {
+			total += frame.length;
+		}
+
+		char* data;
+		uint32_t* offsets;
+		napi_value offsetsBuffer;
+		NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_CREATE_BUFFER", ::napi_create_buffer(env, total, (void**)&data, &argv[1]), false)
+		NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_CREATE_ARRAYBUFFER", ::napi_create_arraybuffer(env, (count + 1) * sizeof(uint32_t), (void**)&offsets, &offsetsBuffer), false)
+		NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_CREATE_TYPEDARRAY", ::napi_create_typedarray(env, napi_uint32_array, count + 1, offsetsBuffer, 0, &argv[2]), false)
+
+		size_t pos = 0;
+		for (size_t i = 0; i < count; ++i) {
+			offsets[i] = (uint32_t)pos;
+			::memcpy(data + pos, batch[i].slab->data + batch[i].offset, batch[i].length);
+			pos += batch[i].length;
+			batch[i].slab->release();
+			consumed = i + 1;
+		}
+		offsets[count] = (uint32_t)pos;
+		return true;
+	}
+
+	if (options.parsing != NoParse) {
+		// the frames are consumed even if parsing them fails
+		consumed = count;
+		argv[1] = parseFrames(batch);
+		return argv[1] != NULL;
+	}
+
+	NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, count, &argv[1]), false)
+	for (size_t i = 0; i < count; ++i) {
+		napi_value item = frameToJS(batch[i]);
+		consumed = i + 1;
+		if (item == NULL) {
+			return false;
+		}
+		NAPI_THROW_RETURN("RelayConnection::batchToJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, argv[1], (uint32_t)i, item), false)
+	}
+	return true;
+}
+
+/**
+ * Pops the next frame and updates the number of queued bytes. With the drop oldest policy, data
+ * frames are discarded once the queue exceeds the high water mark until it is back down to the low
+ * water mark. The "end" frame is never dropped.
+ */
+bool RelayConnection::dequeue(RelayFrame& frame) {
+	while (msgQueue.pop(frame)) {
+		if (frame.event != DataEvent) {
+			return true;
+		}
+
+		size_t queued = queuedBytes.fetch_sub(frame.length, std::memory_order_relaxed) - frame.length;
+
+		if (options.overflow == DropOldestOverflow) {
+			if (!dropping && queued + frame.length > options.highWaterMark) {
+				LOG_DEBUG("RelayConnection::dequeue", "Queue exceeded high water mark, dropping oldest frames")
+				dropping = true;
+			}
+			if (dropping) {
+				++droppedFrames;
+				droppedBytes += frame.length;
+				stats.framesDropped.add(1);
+				stats.bytesDropped.add(frame.length);
+				frame.slab->release();
+				if (queued <= options.lowWaterMark) {
+					dropping = false;
+				}
+				continue;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Notifies all relay connection listeners of new data, the connection ending, or the connection
+ * being restored.
+ */
+void RelayConnection::dispatch() {
+	napi_handle_scope scope;
+	napi_value global, listener;
+
+	NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_OPEN_HANDLE_SCOPE", ::napi_open_handle_scope(env, &scope))
+	NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global))
+
+	std::list<napi_value> callbacks;
+
+	// resolves the listener N-API references and caches the JS callback functions in the
+	// `callbacks` list allowing the listener list to be quickly unlocked
+	{
+		std::lock_guard<std::mutex> lock(listenersLock);
+		for (auto const& ref : listeners) {
+			NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, ref, &listener))
+			if (listener != NULL) {
+				callbacks.push_back(listener);
+			}
+		}
+	}
+
+	dispatchWrites(global, callbacks);
+
+	if (suspended) {
+		if (reconnecting) {
+			finishReconnect(global, callbacks);
+		} else if (reconnectRequested.exchange(false)) {
+			retryReconnect(global, callbacks);
+		}
+	}
+
+	if (!callbacks.empty()) {
+		dispatchFlowControl(global, callbacks);
+		if (options.batchSize > 0) {
+			dispatchBatches(global, callbacks);
+		} else {
+			dispatchFrames(global, callbacks);
+		}
+		dispatchFlowControl(global, callbacks);
+	}
+
+	::napi_close_handle_scope(env, scope);
+}
+
+/**
+ * Emits the queued frames in batches of up to `batchSize` frames so that listeners are called once
+ * per batch instead of once per frame. With utf8 encoding, a batch is an array of strings. With
+ * buffer encoding, a batch is a single buffer and an array of frame offsets. Each "batch" event
+ * also includes the total number of frames coalesced during this wakeup. Batches of a relay group
+ * end with an array of each frame's source name.
+ *
+ * If a latency budget is set and there isn't a full batch yet, the frames are held until either
+ * the batch fills up or the oldest frame has waited for the budget.
+ */
+void RelayConnection::dispatchBatches(napi_value global, std::list<napi_value>& callbacks) {
+	// the end frame is always the last frame, so if it was queued before we count the frames, then
+	// it's included in the count
+	bool ended = endQueued.load(std::memory_order_acquire);
+	size_t available = msgQueue.size();
+	RelayFrame frame;
+
+	if (available == 0 || !msgQueue.peek(frame)) {
+		return;
+	}
+
+	if (!ended && available < options.batchSize && options.batchLatency > 0) {
+		uint64_t budget = (uint64_t)options.batchLatency * 1000000;
+		uint64_t age = ::uv_hrtime() - frame.timestamp;
+		if (age < budget) {
+			if (!::uv_is_active((uv_handle_t*)batchTimer)) {
+				::uv_timer_start(batchTimer, [](uv_timer_t* handle) {
+					std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(handle->data);
+					if (auto conn = (*ptr).lock()) {
+						conn->dispatch();
+					}
+				}, (budget - age + 999999) / 1000000, 0);
+			}
+			return;
+		}
+	}
+
+	::uv_timer_stop(batchTimer);
+
+	size_t remaining = ended ? available - 1 : available;
+	bool endPopped = false;
+	bool disconnected = false;
+	napi_value argv[5], rval;
+	int coalescedArg = options.encoding == BufferEncoding ? 3 : 2;
+	int argc = tagged ? coalescedArg + 2 : coalescedArg + 1;
+
+	NAPI_THROW("RelayConnection::dispatchBatches", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, "batch", NAPI_AUTO_LENGTH, &argv[0]))
+	NAPI_THROW("RelayConnection::dispatchBatches", "ERR_NAPI_CREATE_UINT32", ::napi_create_uint32(env, (uint32_t)remaining, &argv[coalescedArg]))
+
+	while (remaining > 0) {
+		size_t count = remaining < options.batchSize ? remaining : options.batchSize;
+		bool membership = false;
+		remaining -= count;
+
+		// dropping frames can reach the end frame early
+		for (size_t i = 0; i < count && dequeue(frame); ++i) {
+			if (frame.event == EndEvent) {
+				endPopped = true;
+				remaining = 0;
+				break;
+			}
+			if (frame.event == DisconnectEvent) {
+				disconnected = true;
+				remaining = 0;
+				break;
+			}
+			if (frame.event == AttachEvent || frame.event == DetachEvent) {
+				// a source joining or leaving ends the batch early so that the events stay in order
+				membership = true;
+				remaining += count - i - 1;
+				break;
+			}
+			batch.push_back(frame);
+		}
+
+		count = batch.size();
+		if (count == 0) {
+			if (membership && dispatchSource(global, callbacks, frame)) {
+				continue;
+			}
+			break;
+		}
+
+		uint64_t now = ::uv_hrtime();
+		for (auto const& frame : batch) {
+			stats.latency.record((now - frame.timestamp) / 1000);
+			stats.bytesEmitted.add(frame.length);
+		}
+
+		napi_handle_scope scope;
+		napi_status status = ::napi_open_handle_scope(env, &scope);
+		size_t consumed = 0;
+		bool ok = status == napi_ok && batchToJS(argv, argc, consumed);
+
+		// frames that didn't make it into a value still hold their slabs
+		for (size_t i = consumed; i < count; ++i) {
+			batch[i].slab->release();
+		}
+		batch.clear();
+
+		if (ok) {
+			stats.dispatches.add(1);
+			stats.framesEmitted.add(count);
+			stats.batchSizes.record(count);
+
+			for (auto const& callback : callbacks) {
+				if (::napi_make_callback(env, NULL, global, callback, argc, argv, &rval) != napi_ok) {
+					ok = false;
+					break;
+				}
+			}
+		}
+
+		if (status == napi_ok) {
+			::napi_close_handle_scope(env, scope);
+		}
+		NAPI_THROW("RelayConnection::dispatchBatches", "ERR_NAPI_OPEN_HANDLE_SCOPE", status)
+		if (!ok) {
+			return;
+		}
+
+		if (membership && !dispatchSource(global, callbacks, frame)) {
+			break;
+		}
+	}
+
+	if (disconnected) {
+		dispatchDisconnect(global, callbacks);
+	} else if (endPopped || (ended && dequeue(frame))) {
+		dispatchEnd(global, callbacks);
+	}
+}
+
+/**
+ * Emits the "disconnect" event after the device closed a connection that reconnects. The listeners
+ * are kept, the writes that didn't make it are failed, and the first reconnect attempt is made
+ * right away.
+ */
+void RelayConnection::dispatchDisconnect(napi_value global, std::list<napi_value>& callbacks) {
+	// report any frames dropped right before the disconnect
+	dispatchFlowControl(global, callbacks);
+
+	disconnect();
+	failWrites(EPIPE);
+	dispatchWrites(global, callbacks);
+
+	suspended = true;
+	disconnectedAt = ::uv_hrtime();
+	reconnectAttempts = 0;
+	reconnectBackoff = options.reconnectDelay;
+	reconnectRequested.store(false);
+	reconnectResult.store(ReconnectPending);
+	reconnecting = false;
+
+	LOG_DEBUG("RelayConnection::dispatchDisconnect", "Emitting \"disconnect\" event")
+	if (!emit(global, callbacks, "disconnect")) {
+		return;
+	}
+
+	retryReconnect(global, callbacks);
+}
+
+/**
+ * Emits the "end" event, then removes all listeners and disconnects.
+ */
+void RelayConnection::dispatchEnd(napi_value global, std::list<napi_value>& callbacks) {
+	napi_value event, rval;
+
+	// report any frames dropped right before the end
+	dispatchFlowControl(global, callbacks);
+
+	LOG_DEBUG("RelayConnection::dispatchEnd", "Emitting \"end\" event")
+	NAPI_THROW("RelayConnection::dispatchEnd", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, "end", NAPI_AUTO_LENGTH, &event))
+
+	for (auto const& callback : callbacks) {
+		NAPI_THROW("RelayConnection::dispatchEnd", "ERR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, 1, &event, &rval))
+		remove(callback);
+	}
+
+	disconnect();
+
+	// the connection is gone, so fail any writes that didn't make it
+	failWrites(EPIPE);
+	dispatchWrites(global, callbacks);
+}
+
+/**
+ * Emits the flow control events. A "drop" event reports how many frames and bytes were discarded
+ * since the last wakeup. A "pause" event is emitted once the producer has stopped reading and a
+ * "drain" event once the queue is back down to the low water mark, at which point reading resumes.
+ */
+void RelayConnection::dispatchFlowControl(napi_value global, std::list<napi_value>& callbacks) {
+	// the listeners are removed once the connection ends
+	if (size() == 0) {
+		return;
+	}
+
+	if (droppedFrames) {
+		napi_value args[2];
+		NAPI_THROW("RelayConnection::dispatchFlowControl", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)droppedFrames, &args[0]))
+		NAPI_THROW("RelayConnection::dispatchFlowControl", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)droppedBytes, &args[1]))
+		droppedFrames = droppedBytes = 0;
+		if (!emit(global, callbacks, "drop", 2, args)) {
+			return;
+		}
+	}
+
+	if (!pauseEmitted) {
+		if (paused.load(std::memory_order_acquire)) {
+			pauseEmitted = true;
+			stats.pauses.add(1);
+			emit(global, callbacks, "pause");
+		}
+	} else if (queuedBytes.load(std::memory_order_relaxed) <= options.lowWaterMark) {
+		LOG_DEBUG("RelayConnection::dispatchFlowControl", "Queue drained to low water mark, resuming reads")
+		pauseEmitted = false;
+		paused.store(false, std::memory_order_release);
+		resumeReading();
+		emit(global, callbacks, "drain");
+	}
+}
+
+/**
+ * Emits a "data" event for each queued frame. With the parse option, up to
+ * `RELAY_DEFAULT_BATCH_SIZE` frames at a time are parsed together, then emitted one by one. Frames
+ * of a relay group are emitted with the name of their source, and a source joining or leaving
+ * first flushes the frames parsed so far so that the events stay in order.
+ */
+void RelayConnection::dispatchFrames(napi_value global, std::list<napi_value>& callbacks) {
+	napi_value argv[3], rval;
+	size_t argc = tagged ? 3 : 2;
+
+	NAPI_THROW("RelayConnection::dispatchFrames", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, "data", NAPI_AUTO_LENGTH, &argv[0]))
+
+	RelayFrame frame;
+	uint64_t count = 0;
+	bool ended = false;
+	bool disconnected = false;
+	bool parsing = options.parsing != NoParse;
+
+	// flush the relay connection data to the listeners
+	while (true) {
+		bool more = dequeue(frame);
+		bool membership = false;
+		if (more && frame.event == EndEvent) {
+			ended = true;
+			more = false;
+		} else if (more && frame.event == DisconnectEvent) {
+			disconnected = true;
+			more = false;
+		} else if (more && (frame.event == AttachEvent || frame.event == DetachEvent)) {
+			membership = true;
+		}
+
+		if (more && !membership) {
+			stats.latency.record((::uv_hrtime() - frame.timestamp) / 1000);
+			stats.bytesEmitted.add(frame.length);
+			++count;
+
+			if (!parsing) {
+				if (tagged && (argv[2] = sourceName(frame.source)) == NULL) {
+					frame.slab->release();
+					break;
+				}
+				argv[1] = frameToJS(frame);
+				if (argv[1] == NULL) {
+					break;
+				}
+
+				for (auto const& callback : callbacks) {
+					NAPI_THROW("RelayConnection::dispatchFrames", "ERR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, argc, argv, &rval))
+				}
+				continue;
+			}
+
+			batch.push_back(frame);
+			if (batch.size() < RELAY_DEFAULT_BATCH_SIZE) {
+				continue;
+			}
+		}
+
+		if (!batch.empty()) {
+			// parsing consumes every frame's slab, so the batch is cleared before anything can fail
+			std::vector<uint32_t> sources;
+			if (tagged) {
+				for (auto const& frame : batch) {
+					sources.push_back(frame.source);
+				}
+			}
+			uint32_t size = (uint32_t)batch.size();
+			napi_value values = parseFrames(batch);
+			batch.clear();
+			if (values == NULL) {
+				break;
+			}
+
+			bool failed = false;
+			for (uint32_t i = 0; i < size && !failed; ++i) {
+				if (::napi_get_element(env, values, i, &argv[1]) != napi_ok || (tagged && (argv[2] = sourceName(sources[i])) == NULL)) {
+					failed = true;
+					break;
+				}
+				for (auto const& callback : callbacks) {
+					if (::napi_make_callback(env, NULL, global, callback, argc, argv, &rval) != napi_ok) {
+						failed = true;
+						break;
+					}
+				}
+			}
+			if (failed) {
+				break;
+			}
+		}
+
+		if (membership) {
+			// record the stats before emitting "attach" or "detach" so that their listeners see them
+			if (count > 0) {
+				stats.dispatches.add(1);
+				stats.framesEmitted.add(count);
+				stats.batchSizes.record(count);
+				count = 0;
+			}
+			if (!dispatchSource(global, callbacks, frame)) {
+				break;
+			}
+			continue;
+		}
+
+		if (!more) {
+			break;
+		}
+	}
+
+	// record the stats before emitting "end" so that "end" listeners see them
+	if (count > 0) {
+		stats.dispatches.add(1);
+		stats.framesEmitted.add(count);
+		stats.batchSizes.record(count);
+	}
+
+	if (disconnected) {
+		dispatchDisconnect(global, callbacks);
+	} else if (ended) {
+		dispatchEnd(global, callbacks);
+	}
+}
+
+/**
+ * Handles a relay group source joining or leaving. An "attach" frame carries the source's name,
+ * which is kept in an object indexed by source until the source leaves so that its frames can be
+ * tagged without creating a string for each one. Emits "attach" or "detach" with the name. Returns
+ * false if a callback failed.
+ */
+bool RelayConnection::dispatchSource(napi_value global, std::list<napi_value>& callbacks, const RelayFrame& frame) {
+	napi_value names, name;
+
+	if (!sourceNames) {
+		NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &names), false)
+		NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, names, 1, &sourceNames), false)
+	} else {
+		NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, sourceNames, &names), false)
+	}
+
+	if (frame.event == AttachEvent) {
+		napi_status status = ::napi_create_string_utf8(env, frame.slab->data + frame.offset, frame.length, &name);
+		frame.slab->release();
+		NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_CREATE_STRING_UTF8", status, false)
+		NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, names, frame.source, name), false)
+
+		LOG_DEBUG_1("RelayConnection::dispatchSource", "Emitting \"attach\" event for source %u", frame.source)
+		return emit(global, callbacks, "attach", 1, &name);
+	}
+
+	NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_GET_ELEMENT", ::napi_get_element(env, names, frame.source, &name), false)
+	NAPI_THROW_RETURN("RelayConnection::dispatchSource", "ERR_NAPI_DELETE_ELEMENT", ::napi_delete_element(env, names, frame.source, NULL), false)
+
+	LOG_DEBUG_1("RelayConnection::dispatchSource", "Emitting \"detach\" event for source %u", frame.source)
+	return emit(global, callbacks, "detach", 1, &name);
+}
+
+/**
+ * Calls the callbacks of writes that have completed or failed, then emits a "writeDrain" event if
+ * `write()` previously returned false and all queued data has been written.
+ */
+void RelayConnection::dispatchWrites(napi_value global, std::list<napi_value>& callbacks) {
+	std::vector<RelayWriteResult> results;
+
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+		results.swap(writeResults);
+	}
+
+	for (auto const& result : results) {
+		auto it = writeCallbacks.find(result.id);
+		if (it == writeCallbacks.end()) {
+			continue;
+		}
+
+		napi_value callback, err, rval;
+		napi_ref ref = it->second;
+		writeCallbacks.erase(it);
+		NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, ref, &callback))
+		::napi_delete_reference(env, ref);
+
+		if (result.error) {
+			napi_value code, msg;
+			NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, "ERR_FORWARD_WRITE", NAPI_AUTO_LENGTH, &code))
+			NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, ::strerror(result.error), NAPI_AUTO_LENGTH, &msg))
+			NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_CREATE_ERROR", ::napi_create_error(env, code, msg, &err))
+		} else {
+			NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_GET_NULL", ::napi_get_null(env, &err))
+		}
+
+		if (callback != NULL) {
+			NAPI_THROW("RelayConnection::dispatchWrites", "ERR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, 1, &err, &rval))
+		}
+	}
+
+	if (writeBlocked && writeQueuedBytes.load(std::memory_order_relaxed) == 0) {
+		writeBlocked = false;
+		if (size() > 0) {
+			emit(global, callbacks, "writeDrain");
+		}
+	}
+}
+
+/**
+ * Calls each listener with the specified event and arguments. Returns false if a callback failed.
+ */
+bool RelayConnection::emit(napi_value global, std::list<napi_value>& callbacks, const char* event, size_t argc, napi_value* args) {
+	napi_value argv[4], rval;
+
+	NAPI_THROW_RETURN("RelayConnection::emit", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, event, NAPI_AUTO_LENGTH, &argv[0]), false)
+	for (size_t i = 0; i < argc && i < 3; ++i) {
+		argv[i + 1] = args[i];
+	}
+
+	for (auto const& callback : callbacks) {
+		NAPI_THROW_RETURN("RelayConnection::emit", "ERR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, argc + 1, argv, &rval), false)
+	}
+
+	return true;
+}
+
+/**
+ * Adds a frame to the message queue. This must only be called from the thread feeding the
+ * connection. The queued bytes are counted before the frame is pushed so that the main thread
+ * never sees the count go negative.
+ */
+void RelayConnection::enqueue(RelayEvent event, RelaySlab* slab, size_t offset, size_t length, uint64_t timestamp, uint32_t source) {
+	if (slab) {
+		slab->retain();
+		if (event == DataEvent) {
+			queuedBytes.fetch_add(length, std::memory_order_relaxed);
+		}
+	}
+	msgQueue.push({ event, source, slab, (uint32_t)offset, (uint32_t)length, timestamp });
+}
+
+/**
+ * Captures a complete frame, filters it, parses it if the parse option is set, and queues it. The
+ * capture always gets the frame as it was read. Frames that are filtered out or malformed are
+ * counted and skipped. Returns true if the frame was queued.
+ */
+bool RelayConnection::enqueueData(const RelaySpan& frame, uint64_t timestamp, uint32_t source) {
+	if (capture) {
+		capture->write(timestamp, frame.slab->data + frame.offset, frame.length);
+	}
+
+	if (!filter.empty()) {
+		if (!filter.accept(frame.slab->data + frame.offset, frame.length)) {
+			stats.framesFiltered.add(1);
+			return false;
+		}
+		stats.framesMatched.add(1);
+	}
+
+	if (options.parsing == NoParse) {
+		enqueue(DataEvent, frame.slab, frame.offset, frame.length, timestamp, source);
+		return true;
+	}
+
+	RelaySpan parsed;
+	if (!parser.parse(frame, parsed)) {
+		stats.framesMalformed.add(1);
+		return false;
+	}
+	enqueue(DataEvent, parsed.slab, parsed.offset, parsed.length, timestamp, source);
+	return true;
+}
+
+/**
+ * Fails all queued writes with the specified `errno` value. The callbacks are called the next time
+ * the connection dispatches.
+ */
+void RelayConnection::failWrites(int error) {
+	std::lock_guard<std::mutex> lock(writeLock);
+	for (auto const& entry : writeQueue) {
+		writeResults.push_back({ entry.id, error });
+		writeQueuedBytes.fetch_sub(entry.data.size() - entry.offset, std::memory_order_relaxed);
+	}
+	writeQueue.clear();
+}
+
+/**
+ * Handles the outcome of a reconnect attempt once the subclass has reported it. On success, emits
+ * "reconnect" with the number of milliseconds the connection was down and the number of attempts,
+ * then flushes any writes queued in the meantime. Otherwise another attempt is scheduled and the
+ * delay is doubled up to the max delay.
+ */
+void RelayConnection::finishReconnect(napi_value global, std::list<napi_value>& callbacks) {
+	int result = reconnectResult.exchange(ReconnectPending);
+	if (result == ReconnectPending) {
+		return;
+	}
+	reconnecting = false;
+
+	if (result == ReconnectFailed) {
+		LOG_DEBUG_2("RelayConnection::finishReconnect", "Reconnect attempt %u failed, retrying in %ums", reconnectAttempts, reconnectBackoff)
+		// the loop's cached time may be stale by now, which would fire the timer early
+		::uv_update_time(reconnectTimer->loop);
+		::uv_timer_start(reconnectTimer, [](uv_timer_t* handle) {
+			std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(handle->data);
+			if (auto conn = (*ptr).lock()) {
+				conn->reconnectRequested.store(true);
+				conn->dispatch();
+			}
+		}, reconnectBackoff, 0);
+		reconnectBackoff = reconnectBackoff > options.reconnectMaxDelay / 2 ? options.reconnectMaxDelay : reconnectBackoff * 2;
+		return;
+	}
+
+	suspended = false;
+	LOG_DEBUG_1("RelayConnection::finishReconnect", "Reconnected after %u attempts", reconnectAttempts)
+
+	bool pending;
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+		pending = !writeQueue.empty();
+	}
+	if (pending) {
+		scheduleWrite();
+	}
+
+	napi_value args[2];
+	NAPI_THROW("RelayConnection::finishReconnect", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)(::uv_hrtime() - disconnectedAt) / 1e6, &args[0]))
+	NAPI_THROW("RelayConnection::finishReconnect", "ERR_NAPI_CREATE_UINT32", ::napi_create_uint32(env, reconnectAttempts, &args[1]))
+	emit(global, callbacks, "reconnect", 2, args);
+}
+
+/**
+ * Writes as much queued data as the socket will take without blocking. Up to `RELAY_MAX_IOV`
+ * queued writes are coalesced into each `sendmsg()` call. Returns true if data is still pending
+ * because the socket is full, in which case the caller must call this again once the socket is
+ * writable. This must only be called from the I/O thread.
+ */
+bool RelayConnection::flushWrites(int fd) {
+	bool completed = false;
+	bool pending = false;
+
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+
+		while (!writeQueue.empty()) {
+			struct iovec iov[RELAY_MAX_IOV];
+			int count = 0;
+			for (auto it = writeQueue.begin(); it != writeQueue.end() && count < RELAY_MAX_IOV; ++it, ++count) {
+				iov[count].iov_base = (void*)(it->data.data() + it->offset);
+				iov[count].iov_len = it->data.size() - it->offset;
+			}
+
+			struct msghdr msg;
+			::memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = count;
+
+			ssize_t written = ::sendmsg(fd, &msg, SEND_FLAGS);
+
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					pending = true;
+					break;
+				}
+
+				int error = errno;
+				LOG_DEBUG_1("RelayConnection::flushWrites", "Write failed: %s", ::strerror(error))
+				for (auto const& entry : writeQueue) {
+					writeResults.push_back({ entry.id, error });
+					writeQueuedBytes.fetch_sub(entry.data.size() - entry.offset, std::memory_order_relaxed);
+				}
+				writeQueue.clear();
+				completed = true;
+				break;
+			}
+
+			size_t n = (size_t)written;
+			size_t before = writeQueue.size();
+			stats.bytesWritten.add(n);
+			writeQueuedBytes.fetch_sub(n, std::memory_order_relaxed);
+
+			// retire the fully written entries, including empty ones
+			while (!writeQueue.empty()) {
+				RelayWrite& entry = writeQueue.front();
+				size_t remaining = entry.data.size() - entry.offset;
+				if (n < remaining) {
+					entry.offset += n;
+					break;
+				}
+				n -= remaining;
+				writeResults.push_back({ entry.id, 0 });
+				writeQueue.pop_front();
+				completed = true;
+			}
+
+			if (written == 0 && writeQueue.size() == before) {
+				pending = true;
+				break;
+			}
+		}
+	}
+
+	if (completed) {
+		::uv_async_send(msgQueueUpdate);
+	}
+
+	return pending;
+}
+
+/**
+ * Converts a data frame into a JavaScript string or buffer and consumes the frame's slab
+ * reference, even if the value couldn't be created.
+ *
+ * In buffer mode, the `Buffer` handed to JavaScript is backed directly by the slab memory and the
+ * slab reference held by the frame is transferred to the buffer's finalizer.
+ */
+napi_value RelayConnection::frameToJS(const RelayFrame& frame) {
+	napi_value value;
+	const char* data = frame.slab->data + frame.offset;
+
+	if (options.encoding == BufferEncoding) {
+		napi_status status = ::napi_create_external_buffer(env, frame.length, (void*)data, [](napi_env env, void* data, void* hint) {
+			static_cast<RelaySlab*>(hint)->release();
+		}, frame.slab, &value);
+		if (status != napi_ok) {
+			// the finalizer only owns the slab once the buffer exists
+			frame.slab->release();
+		}
+		NAPI_THROW_RETURN("RelayConnection::frameToJS", "ERR_NAPI_CREATE_EXTERNAL_BUFFER", status, NULL)
+	} else {
+		napi_status status = ::napi_create_string_utf8(env, data, frame.length, &value);
+		frame.slab->release();
+		NAPI_THROW_RETURN("RelayConnection::frameToJS", "ERR_NAPI_CREATE_STRING_UTF8", status, NULL)
+	}
+
+	return value;
+}
+
+/**
+ * Creates the values for a batch of parsed frames with a single `JSON.parse()` call and consumes
+ * the frames' slab references. The frames were checked when they were read, so the JSON array
+ * they are joined into is always valid. Returns the array of values or NULL if a JavaScript
+ * exception is pending.
+ */
+napi_value RelayConnection::parseFrames(const std::vector<RelayFrame>& frames) {
+	size_t total = frames.size() + 1;
+	for (auto const& frame : frames) {
+		total += frame.length;
+	}
+
+	parseBuffer.clear();
+	parseBuffer.reserve(total);
+	parseBuffer += '[';
+	for (auto const& frame : frames) {
+		if (parseBuffer.size() > 1) {
+			parseBuffer += ',';
+		}
+		parseBuffer.append(frame.slab->data + frame.offset, frame.length);
+		frame.slab->release();
+	}
+	parseBuffer += ']';
+
+	napi_value global, json, parse, text, result;
+	NAPI_THROW_RETURN("RelayConnection::parseFrames", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global), NULL)
+	NAPI_THROW_RETURN("RelayConnection::parseFrames", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, global, "JSON", &json), NULL)
+	NAPI_THROW_RETURN("RelayConnection::parseFrames", "ERR_NAPI_GET_NAMED_PROPERTY", ::napi_get_named_property(env, json, "parse", &parse), NULL)
+	NAPI_THROW_RETURN("RelayConnection::parseFrames", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, parseBuffer.data(), parseBuffer.size(), &text), NULL)
+	NAPI_THROW_RETURN("RelayConnection::parseFrames", "ERR_NAPI_CALL_FUNCTION", ::napi_call_function(env, json, parse, 1, &text, &result), NULL)
+	return result;
+}
+
+/**
+ * Explicit initialization so that we can get a weak pointer based on the shared pointer that
+ * created this instance and wire up the libuv callback.
+ */
+void RelayConnection::init() {
+	self = shared_from_this();
+
+	uv_loop_t* loop;
+	::napi_get_uv_event_loop(env, &loop);
+	msgQueueUpdate->data = &self;
+	::uv_async_init(loop, msgQueueUpdate, [](uv_async_t* handle) {
+		std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(handle->data);
+		if (auto conn = (*ptr).lock()) {
+			conn->dispatch();
+		}
+	});
+	::uv_unref((uv_handle_t*)msgQueueUpdate);
+
+	batchTimer->data = &self;
+	::uv_timer_init(loop, batchTimer);
+	::uv_unref((uv_handle_t*)batchTimer);
+
+	reconnectTimer->data = &self;
+	::uv_timer_init(loop, reconnectTimer);
+	::uv_unref((uv_handle_t*)reconnectTimer);
+}
+
+/**
+ * Flushes any incomplete frame, then creates an "end" frame and queues it. Connections that
+ * reconnect queue a "disconnect" frame instead.
+ */
+void RelayConnection::onClose() {
+	uint64_t now = ::uv_hrtime();
+	for (auto const& frame : framer.flush()) {
+		enqueueData(frame, now);
+		stats.framesRead.add(1);
+	}
+	if (options.reconnect) {
+		enqueue(DisconnectEvent, NULL, 0, 0, now);
+	} else {
+		enqueue(EndEvent, NULL, 0, 0, now);
+		endQueued.store(true, std::memory_order_release);
+	}
+
+	::uv_async_send(msgQueueUpdate);
+}
+
+/**
+ * Hands the incoming data to the framer, which copies it into a slab once, and queues a "data"
+ * frame for each complete frame. Frames only reference the slab and are copied into preallocated
+ * ring slots, so no per-frame allocations or locks are needed unless frames are parsed. Frames are
+ * captured before they are queued so that the capture holds every frame, including ones later
+ * filtered out, dropped, or malformed.
+ */
+void RelayConnection::onData(const char* data, size_t length) {
+	onData(framer, 0, data, length);
+}
+
+/**
+ * Frames data read from one of the connection's sources with that source's framer and queues the
+ * frames tagged with the source. Relay groups must not call this for two sources at once.
+ */
+void RelayConnection::onData(RelayFramer& framer, uint32_t source, const char* data, size_t length) {
+	stats.bytesRead.add(length);
+
+	const std::vector<RelaySpan>& frames = framer.push(data, length);
+	if (frames.empty()) {
+		return;
+	}
+
+	uint64_t now = ::uv_hrtime();
+	size_t queued = 0;
+	for (auto const& frame : frames) {
+		queued += enqueueData(frame, now, source);
+	}
+	stats.framesRead.add(frames.size());
+
+	// nothing to wake the main thread for if every frame was filtered out
+	if (queued == 0) {
+		return;
+	}
+	stats.maxQueueDepth.max(msgQueue.size());
+
+	// stop reading until the main thread catches up; this is checked on every read past the high
+	// water mark in case a read was already in flight when reading was paused
+	if (options.overflow == PauseOverflow && queuedBytes.load(std::memory_order_relaxed) >= options.highWaterMark) {
+		if (!paused.exchange(true, std::memory_order_acq_rel)) {
+			LOG_DEBUG("RelayConnection::onData", "Queue reached high water mark, pausing reads")
+		}
+		pauseReading();
+	}
+
+	::uv_async_send(msgQueueUpdate);
+}
+
+/**
+ * Reports the outcome of a reconnect attempt and wakes the main thread to handle it. This can be
+ * called from any thread, including from within `reconnect()`.
+ */
+void RelayConnection::onReconnect(bool connected) {
+	reconnectResult.store(connected ? ReconnectSucceeded : ReconnectFailed);
+	::uv_async_send(msgQueueUpdate);
+}
+
+/**
+ * Returns a snapshot of the connection's stats along with the current queue sizes. This never
+ * blocks the threads moving data.
+ */
+RelayStatsSnapshot RelayConnection::getStats() {
+	RelayStatsSnapshot snapshot;
+	stats.snapshot(snapshot);
+	snapshot.connections = 1;
+	snapshot.queueDepth = msgQueue.size();
+	snapshot.queuedBytes = queuedBytes.load(std::memory_order_relaxed);
+	snapshot.writeQueuedBytes = writeQueuedBytes.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+/**
+ * Returns true if the listener has been added to this relay connection.
+ */
+bool RelayConnection::has(napi_value listener) {
+	std::lock_guard<std::mutex> lock(listenersLock);
+
+	for (auto const& ref : listeners) {
+		napi_value callback;
+		bool same = false;
+		if (::napi_get_reference_value(env, ref, &callback) == napi_ok && ::napi_strict_equals(env, callback, listener, &same) == napi_ok && same) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Returns true if the underlying connection can be handed to another relay connection: the stream
+ * has not ended, it is not waiting to reconnect, and everything that was written has been flushed.
+ */
+bool RelayConnection::isReusable() {
+	return !endQueued.load(std::memory_order_acquire) && !suspended && writeQueuedBytes.load(std::memory_order_relaxed) == 0;
+}
+
+/**
+ * Removes a callback from the relay connection. Once there are no more listeners, it
+ * decrements/unrefs the libuv async handle to all Node to exit.
+ */
+void RelayConnection::remove(napi_value listener) {
+	std::lock_guard<std::mutex> lock(listenersLock);
+
+	for (auto it = listeners.begin(); it != listeners.end(); ) {
+		napi_value callback;
+		NAPI_THROW("RelayConnection::remove", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, *it, &callback))
+
+		bool same;
+		NAPI_THROW("RelayConnection::remove", "ERR_NAPI_STRICT_EQUALS", ::napi_strict_equals(env, callback, listener, &same))
+
+		if (same) {
+			LOG_DEBUG("RelayConnection::remove", "Removing listener")
+			::napi_delete_reference(env, *it);
+			it = listeners.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	if (listeners.size() == 0) {
+		::uv_unref((uv_handle_t*)msgQueueUpdate);
+		::uv_timer_stop(reconnectTimer);
+		suspended = false;
+		reconnecting = false;
+		disconnect();
+	}
+}
+
+/**
+ * Asks the subclass to reconnect to the device. The outcome is handled by `finishReconnect()` once
+ * the subclass has reported it, which may be right away.
+ */
+void RelayConnection::retryReconnect(napi_value global, std::list<napi_value>& callbacks) {
+	::uv_timer_stop(reconnectTimer);
+	++reconnectAttempts;
+
+	reconnecting = true;
+	reconnect();
+	finishReconnect(global, callbacks);
+}
+
+/**
+ * Returns the name of a relay group source, or undefined if the source's "attach" frame hasn't been
+ * seen. Returns NULL if the name couldn't be resolved.
+ */
+napi_value RelayConnection::sourceName(uint32_t source) {
+	napi_value names, name;
+
+	if (!sourceNames) {
+		NAPI_THROW_RETURN("RelayConnection::sourceName", "ERR_NAPI_GET_UNDEFINED", ::napi_get_undefined(env, &name), NULL)
+		return name;
+	}
+
+	NAPI_THROW_RETURN("RelayConnection::sourceName", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, sourceNames, &names), NULL)
+	NAPI_THROW_RETURN("RelayConnection::sourceName", "ERR_NAPI_GET_ELEMENT", ::napi_get_element(env, names, source, &name), NULL)
+	return name;
+}
+
+/**
+ * Returns the number of listeners for this relay connection.
+ */
+uint32_t RelayConnection::size() {
+	std::lock_guard<std::mutex> lock(listenersLock);
+	return listeners.size();
+}
+
+/**
+ * Asks a suspended connection to try reconnecting now instead of waiting for the next retry, such
+ * as when the device has come back. This can be called from any thread.
+ */
+void RelayConnection::wake() {
+	reconnectRequested.store(true);
+	::uv_async_send(msgQueueUpdate);
+}
+
+/**
+ * Queues data to be written to the device and asks the subclass to flush it on its I/O thread. The
+ * data is copied, so JavaScript is free to reuse the buffer. The optional callback is called with
+ * an error or null once the data has been handed to the socket.
+ *
+ * Returns false once the number of unwritten bytes reaches the write high water mark. A
+ * "writeDrain" event is emitted after everything has been written. Data written while waiting to
+ * reconnect is held until the connection is restored.
+ */
+bool RelayConnection::write(napi_value data, napi_value callback) {
+	RelayWrite entry = { std::string(), 0, ++nextWriteId };
+	napi_valuetype type;
+	bool isBuffer = false;
+
+	if (::napi_is_buffer(env, data, &isBuffer) == napi_ok && isBuffer) {
+		void* ptr = NULL;
+		size_t len = 0;
+		if (::napi_get_buffer_info(env, data, &ptr, &len) != napi_ok) {
+			throw std::runtime_error("Failed to read data");
+		}
+		entry.data.assign(static_cast<const char*>(ptr), len);
+	} else if (::napi_typeof(env, data, &type) == napi_ok && type == napi_string) {
+		size_t len = 0;
+		if (::napi_get_value_string_utf8(env, data, NULL, 0, &len) != napi_ok) {
+			throw std::runtime_error("Failed to read data");
+		}
+		entry.data.resize(len);
+		if (::napi_get_value_string_utf8(env, data, &entry.data[0], len + 1, NULL) != napi_ok) {
+			throw std::runtime_error("Failed to read data");
+		}
+	} else {
+		throw std::runtime_error("Expected data to be a string or Buffer");
+	}
+
+	if (callback != NULL && ::napi_typeof(env, callback, &type) == napi_ok && type == napi_function) {
+		napi_ref ref;
+		if (::napi_create_reference(env, callback, 1, &ref) != napi_ok) {
+			throw std::runtime_error("Failed to create write callback reference");
+		}
+		writeCallbacks[entry.id] = ref;
+	}
+
+	size_t queued = writeQueuedBytes.fetch_add(entry.data.size(), std::memory_order_relaxed) + entry.data.size();
+
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+		writeQueue.push_back(std::move(entry));
+	}
+
+	scheduleWrite();
+
+	if (queued >= RELAY_WRITE_HIGH_WATER_MARK) {
+		writeBlocked = true;
+		return false;
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,269 @@
+#ifndef __RELAY_CONNECTION_H__
+#define __RELAY_CONNECTION_H__
+
+#include "node-ios-device.h"
+#include "relay-capture.h"
+#include "relay-filter.h"
+#include "relay-framer.h"
+#include "relay-parser.h"
+#include "relay-ring.h"
+#include "relay-slab.h"
+#include "relay-stats.h"
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <uv.h>
+#include <vector>
+
+// the default max number of frames per batch when batching is enabled
+#define RELAY_DEFAULT_BATCH_SIZE 1024
+
+// the default number of queued bytes at which the relay stops reading or starts dropping frames
+#define RELAY_DEFAULT_HIGH_WATER_MARK (8 * 1024 * 1024)
+
+// the number of unwritten bytes at which `write()` starts returning false
+#define RELAY_WRITE_HIGH_WATER_MARK (1024 * 1024)
+
+// the max number of queued writes coalesced into a single `sendmsg()` call
+#define RELAY_MAX_IOV 64
+
+// the default delay in milliseconds before the first reconnect retry and the cap on its backoff
+#define RELAY_DEFAULT_RECONNECT_DELAY 250
+#define RELAY_DEFAULT_RECONNECT_MAX_DELAY 10000
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+enum RelayEncoding { Utf8Encoding, BufferEncoding };
+
+enum RelayEvent { DataEvent, EndEvent, DisconnectEvent, AttachEvent, DetachEvent };
+
+enum RelayOverflow { PauseOverflow, DropOldestOverflow };
+
+enum RelayReconnectResult { ReconnectPending, ReconnectFailed, ReconnectSucceeded };
+
+/**
+ * Options that control how a relay connection delivers data to its listeners, whether it is shared
+ * with other listeners of the same port, how many idle device sockets are kept for reuse, whether
+ * it reconnects after the device goes away, where the frames are captured to, which frames are
+ * filtered out, and whether frames are parsed before they are delivered.
+ */
+struct RelayOptions {
+	RelayOptions() :
+		batchLatency(0),
+		batchSize(0),
+		captureFileSize(RELAY_CAPTURE_DEFAULT_FILE_SIZE),
+		captureMaxFiles(RELAY_CAPTURE_DEFAULT_MAX_FILES),
+		encoding(Utf8Encoding),
+		exclusive(false),
+		framing(NewlineFraming),
+		highWaterMark(RELAY_DEFAULT_HIGH_WATER_MARK),
+		lowWaterMark(RELAY_DEFAULT_HIGH_WATER_MARK / 4),
+		maxFrameLength(RELAY_MAX_FRAME_LENGTH),
+		overflow(PauseOverflow),
+		parsing(NoParse),
+		poolSize(0),
+		reconnect(false),
+		reconnectDelay(RELAY_DEFAULT_RECONNECT_DELAY),
+		reconnectMaxDelay(RELAY_DEFAULT_RECONNECT_MAX_DELAY) {}
+
+	static RelayOptions parse(napi_env env, napi_value options);
+	static RelayOptions parseSyslog(napi_env env, napi_value options);
+
+	bool operator==(const RelayOptions& other) const;
+	inline bool operator!=(const RelayOptions& other) const { return !(*this == other); }
+
+	uint32_t                     batchLatency;
+	uint32_t                     batchSize;
+	size_t                       captureFileSize;
+	uint32_t                     captureMaxFiles;
+	std::string                  capturePath;
+	RelayEncoding                encoding;
+	std::vector<RelayFilterRule> exclude;
+	bool                         exclusive;
+	RelayFraming                 framing;
+	std::string                  delimiter;
+	size_t                       highWaterMark;
+	std::vector<RelayFilterRule> include;
+	size_t                       lowWaterMark;
+	size_t                       maxFrameLength;
+	RelayOverflow                overflow;
+	RelayParse                   parsing;
+	uint32_t                     poolSize;
+	bool                         reconnect;
+	uint32_t                     reconnectDelay;
+	uint32_t                     reconnectMaxDelay;
+};
+
+/**
+ * A frame containing an event and a range of bytes within a slab. Frames are created on the
+ * background thread, then pushed into the ring where the main thread is notified via libuv to
+ * emit the queued frames. Each data frame holds a reference to its slab. The timestamp is the
+ * `uv_hrtime()` when the frame was read. The source identifies which stream of a relay group the
+ * frame came from and is always 0 for a plain connection.
+ */
+struct RelayFrame {
+	RelayEvent event;
+	uint32_t   source;
+	RelaySlab* slab;
+	uint32_t   offset;
+	uint32_t   length;
+	uint64_t   timestamp;
+};
+
+/**
+ * A chunk of data waiting to be written to the device. The offset is the number of bytes already
+ * written.
+ */
+struct RelayWrite {
+	std::string data;
+	size_t      offset;
+	uint64_t    id;
+};
+
+/**
+ * The outcome of a write that is reported back to the write callback on the main thread. The
+ * error is an `errno` value or 0 on success.
+ */
+struct RelayWriteResult {
+	uint64_t id;
+	int      error;
+};
+
+/**
+ * A connection to a device where incoming data is copied into pooled slabs, split into frames by
+ * the framer, and queued for emitting.
+ *
+ * The number of queued bytes is bounded by the high water mark. With the pause overflow policy,
+ * the subclass is asked to stop reading once the high water mark is reached so that backpressure
+ * reaches the device, and to resume once the main thread has drained the queue down to the low
+ * water mark. With the drop oldest policy, reading never stops and the main thread discards the
+ * oldest frames instead.
+ *
+ * Data written by JavaScript is queued on the main thread and flushed by the subclass's I/O
+ * thread with `flushWrites()`, which coalesces queued writes into a single `sendmsg()` call.
+ *
+ * With the reconnect option, losing the device doesn't end the connection. The listeners get a
+ * "disconnect" event instead of "end" and the connection asks the subclass to `reconnect()` with
+ * exponential backoff until it succeeds or the last listener is removed, then emits "reconnect"
+ * with how long the connection was down. The subclass may reconnect on its own I/O thread and
+ * reports the outcome with `onReconnect()`, which wakes the main thread. `wake()` skips the wait
+ * when the device comes back.
+ *
+ * With the capture option, every frame is also written to a rotating memory-mapped capture file by
+ * the thread that read it, along with the time it was read.
+ *
+ * With the include and exclude options, frames are filtered by the thread that read them. Frames
+ * that are filtered out never reach the ring, hold on to a slab, or wake the main thread.
+ *
+ * With the parse option, frames are checked, and rewritten as JSON if needed, by the thread that read
+ * them. Malformed frames are counted and never queued. The main thread then creates the values for
+ * all of the frames it is about to emit with a single `JSON.parse()` call.
+ *
+ * Relay groups merge several streams into one connection. Their frames are tagged with the source
+ * they came from, and sources joining and leaving are queued as "attach" and "detach" frames in
+ * between the data frames. Each source's name is handed to the main thread in its attach frame.
+ *
+ * Every connection keeps lock-free stats of what it has read, emitted, dropped, and written along
+ * with histograms of the dispatch batch sizes and the time frames spent queued.
+ *
+ * This class contains the list of relay listeners and handles notifying them when new relay
+ * frames come in. It has no knowledge of where the data comes from; subclasses are responsible
+ * for connecting to the data source and feeding `onData()` and `onClose()`.
+ */
+class RelayConnection : public std::enable_shared_from_this<RelayConnection> {
+public:
+	RelayConnection(napi_env env, const RelayOptions& options);
+	virtual ~RelayConnection();
+
+	void add(napi_value listener);
+	virtual void disconnect() = 0;
+	void dispatch();
+	inline const RelayOptions& getOptions() const { return options; }
+	RelayStatsSnapshot getStats();
+	bool has(napi_value listener);
+	void init();
+	bool isReusable();
+	void onClose();
+	void onData(const char* data, size_t length);
+	void remove(napi_value listener);
+	uint32_t size();
+	void wake();
+	bool write(napi_value data, napi_value callback);
+
+protected:
+	bool batchToJS(napi_value* argv, int argc, size_t& consumed);
+	virtual void connect() = 0;
+	bool dequeue(RelayFrame& frame);
+	void dispatchBatches(napi_value global, std::list<napi_value>& callbacks);
+	void dispatchDisconnect(napi_value global, std::list<napi_value>& callbacks);
+	void dispatchEnd(napi_value global, std::list<napi_value>& callbacks);
+	void dispatchFlowControl(napi_value global, std::list<napi_value>& callbacks);
+	void dispatchFrames(napi_value global, std::list<napi_value>& callbacks);
+	bool dispatchSource(napi_value global, std::list<napi_value>& callbacks, const RelayFrame& frame);
+	void dispatchWrites(napi_value global, std::list<napi_value>& callbacks);
+	bool emit(napi_value global, std::list<napi_value>& callbacks, const char* event, size_t argc = 0, napi_value* args = NULL);
+	void enqueue(RelayEvent event, RelaySlab* slab, size_t offset, size_t length, uint64_t timestamp, uint32_t source = 0);
+	bool enqueueData(const RelaySpan& frame, uint64_t timestamp, uint32_t source = 0);
+	void failWrites(int error);
+	void finishReconnect(napi_value global, std::list<napi_value>& callbacks);
+	bool flushWrites(int fd);
+	napi_value frameToJS(const RelayFrame& frame);
+	void onData(RelayFramer& framer, uint32_t source, const char* data, size_t length);
+	void onReconnect(bool connected);
+	napi_value parseFrames(const std::vector<RelayFrame>& frames);
+	virtual void pauseReading() = 0;
+	virtual void reconnect() = 0;
+	virtual void resumeReading() = 0;
+	void retryReconnect(napi_value global, std::list<napi_value>& callbacks);
+	virtual void scheduleWrite() = 0;
+	napi_value sourceName(uint32_t source);
+
+	std::weak_ptr<RelayConnection> self;
+	napi_env                       env;
+	RelayOptions                   options;
+	std::mutex                     listenersLock;
+	std::list<napi_ref>            listeners;
+	std::shared_ptr<RelaySlabPool> slabPool;
+	RelayFramer                    framer;
+	RelayFilter                    filter;
+	RelayParser                    parser;
+	uv_async_t*                    msgQueueUpdate;
+	RelayRing<RelayFrame>          msgQueue;
+	RelayStats                     stats;
+	std::unique_ptr<RelayCapture>  capture;
+	std::atomic<bool>              endQueued;
+	std::atomic<size_t>            queuedBytes;
+	std::atomic<bool>              paused;
+	bool                           pauseEmitted;
+	bool                           dropping;
+	uint64_t                       droppedFrames;
+	uint64_t                       droppedBytes;
+	std::mutex                     writeLock;
+	std::deque<RelayWrite>         writeQueue;
+	std::vector<RelayWriteResult>  writeResults;
+	std::atomic<size_t>            writeQueuedBytes;
+	bool                           writeBlocked;
+	uint64_t                       nextWriteId;
+	std::map<uint64_t, napi_ref>   writeCallbacks;
+	uv_timer_t*                    batchTimer;
+	std::vector<RelayFrame>        batch;
+	std::string                    parseBuffer;
+	uv_timer_t*                    reconnectTimer;
+	std::atomic<bool>              reconnectRequested;
+	std::atomic<int>               reconnectResult;
+	bool                           reconnecting;
+	bool                           suspended;
+	uint64_t                       disconnectedAt;
+	uint32_t                       reconnectAttempts;
+	uint32_t                       reconnectBackoff;
+	bool                           tagged;
+	napi_ref                       sourceNames;
+};
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "relay-filter.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace node_ios_device {
+
+/**
+ * Compares two rules. Rules are equal if they are the same kind with the same pattern and flags.
+ */
+bool RelayFilterRule::operator==(const RelayFilterRule& other) const {
+	return kind == other.kind
+		&& pattern == other.pattern
+		&& ignoreCase == other.ignoreCase;
+}
+
+/**
+ * Compiles the include and exclude rules. Throws if a regex is invalid.
+ */
+RelayFilter::RelayFilter(const std::vector<RelayFilterRule>& include, const std::vector<RelayFilterRule>& exclude) :
+	include(compile(include)),
+	exclude(compile(exclude)) {}
+
+/**
+ * Returns true if the frame should be queued.
+ */
+bool RelayFilter::accept(const char* data, size_t length) const {
+	if (!include.empty()) {
+		bool matched = false;
+		for (auto const& rule : include) {
+			if (match(rule, data, length)) {
+				matched = true;
+				break;
+			}
+		}
+		if (!matched) {
+			return false;
+		}
+	}
+
+	for (auto const& rule : exclude) {
+		if (match(rule, data, length)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Compiles the regex rules. `std::regex` doesn't report which pattern failed, so the pattern is
+ * added to the error.
+ */
+std::vector<RelayFilter::Compiled> RelayFilter::compile(const std::vector<RelayFilterRule>& rules) {
+	std::vector<Compiled> compiled;
+	compiled.reserve(rules.size());
+
+	for (auto const& rule : rules) {
+		Compiled entry{ rule.kind, rule.pattern, std::regex() };
+		if (rule.kind == RegexMatch) {
+			auto flags = std::regex::ECMAScript | std::regex::nosubs | std::regex::optimize;
+			if (rule.ignoreCase) {
+				flags |= std::regex::icase;
+			}
+			try {
+				entry.regex.assign(rule.pattern, flags);
+			} catch (const std::regex_error& e) {
+				throw std::runtime_error(std::string("Invalid regular expression /") + rule.pattern + "/: " + e.what());
+			}
+		}
+		compiled.push_back(std::move(entry));
+	}
+
+	return compiled;
+}
+
+/**
+ * Tests a single rule against a frame.
+ */
+bool RelayFilter::match(const Compiled& rule, const char* data, size_t length) {
+	switch (rule.kind) {
+		case PrefixMatch:
+			return length >= rule.pattern.size() && ::memcmp(data, rule.pattern.data(), rule.pattern.size()) == 0;
+
+		case SubstringMatch:
+			return rule.pattern.empty() || ::memmem(data, length, rule.pattern.data(), rule.pattern.size()) != NULL;
+
+		case RegexMatch:
+			return std::regex_search(data, data + length, rule.regex);
+	}
+
+	return false;
+}
+
+}
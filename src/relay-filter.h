@@ -0,0 +1,65 @@
+#ifndef __RELAY_FILTER_H__
+#define __RELAY_FILTER_H__
+
+#include "node-ios-device.h"
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+enum RelayMatch { SubstringMatch, PrefixMatch, RegexMatch };
+
+/**
+ * A single include or exclude rule as passed in from JavaScript. Regex rules keep the pattern
+ * source so that the options of two connections can be compared.
+ */
+struct RelayFilterRule {
+	bool operator==(const RelayFilterRule& other) const;
+
+	RelayMatch  kind;
+	std::string pattern;
+	bool        ignoreCase;
+};
+
+/**
+ * Decides which frames are queued for JavaScript. A frame is kept if it matches any include rule,
+ * or there are no include rules, and it matches none of the exclude rules.
+ *
+ * Supported rules:
+ *  - substring: the frame contains the pattern
+ *  - prefix: the frame starts with the pattern
+ *  - regex: the pattern, compiled once as an ECMAScript regular expression, matches anywhere in
+ *    the frame
+ *
+ * Rules only read the frame, so a filter can be shared by any number of threads once built.
+ */
+class RelayFilter {
+public:
+	RelayFilter(const std::vector<RelayFilterRule>& include, const std::vector<RelayFilterRule>& exclude);
+
+	bool accept(const char* data, size_t length) const;
+	inline bool empty() const { return include.empty() && exclude.empty(); }
+
+private:
+	/**
+	 * A rule with its regex compiled.
+	 */
+	struct Compiled {
+		RelayMatch  kind;
+		std::string pattern;
+		std::regex  regex;
+	};
+
+	static std::vector<Compiled> compile(const std::vector<RelayFilterRule>& rules);
+	static bool match(const Compiled& rule, const char* data, size_t length);
+
+	std::vector<Compiled> include;
+	std::vector<Compiled> exclude;
+};
+
+}
+
+#endif
@@ -0,0 +1,220 @@
+#include "relay-framer.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Initializes the framer. The delimiter is only used in delimiter mode; newline mode always uses
+ * `\n`.
+ */
+RelayFramer::RelayFramer(std::shared_ptr<RelaySlabPool> pool, RelayFraming mode, const std::string& delimiter, size_t maxFrameLength) :
+	pool(pool),
+	mode(mode),
+	delimiter(mode == NewlineFraming ? std::string("\n") : delimiter),
+	maxFrameLength(maxFrameLength),
+	slab(NULL),
+	start(0),
+	scan(0),
+	skip(0) {
+
+	if (this->delimiter.empty()) {
+		this->delimiter = "\n";
+	}
+}
+
+/**
+ * Releases the framer's reference to the current slab.
+ */
+RelayFramer::~RelayFramer() {
+	if (slab) {
+		slab->release();
+	}
+}
+
+/**
+ * Copies the data into the current slab directly after the incomplete frame. If there isn't
+ * enough room, the incomplete frame is moved into a new slab first. Oversized frames grow
+ * geometrically so that a large frame arriving in many small reads isn't copied over and over.
+ */
+void RelayFramer::append(const char* data, size_t length) {
+	size_t pending = slab ? slab->used - start : 0;
+
+	if (!slab || slab->available() < length) {
+		size_t need = pending + length;
+		if (need > RELAY_SLAB_SIZE && need < pending * 2) {
+			need = pending * 2;
+		}
+
+		RelaySlab* next = pool->acquire(need);
+		if (pending) {
+			::memcpy(next->data, slab->data + start, pending);
+		}
+		next->used = pending;
+
+		scan -= start;
+		start = 0;
+
+		if (slab) {
+			slab->release();
+		}
+		slab = next;
+	}
+
+	::memcpy(slab->data + slab->used, data, length);
+	slab->used += length;
+}
+
+/**
+ * Emits the incomplete frame, if any. This is called when the connection closes so that a final
+ * line without a trailing delimiter isn't lost. Incomplete length prefixed frames are discarded.
+ */
+const std::vector<RelaySpan>& RelayFramer::flush() {
+	frames.clear();
+
+	if (slab && slab->used > start && (mode == NewlineFraming || mode == DelimiterFraming)) {
+		size_t length = slab->used - start;
+		if (mode == NewlineFraming && slab->data[slab->used - 1] == '\r') {
+			--length;
+		}
+		if (length) {
+			frames.push_back({ slab, start, length });
+		}
+	}
+
+	if (slab) {
+		start = scan = slab->used;
+	}
+	skip = 0;
+
+	return frames;
+}
+
+/**
+ * Appends the data and returns the frames it completed. The returned spans are only valid until
+ * the next call.
+ */
+const std::vector<RelaySpan>& RelayFramer::push(const char* data, size_t length) {
+	frames.clear();
+
+	if (length == 0) {
+		return frames;
+	}
+
+	if (mode == RawFraming) {
+		if (!slab || slab->available() < length) {
+			if (slab) {
+				slab->release();
+			}
+			slab = pool->acquire(length);
+		}
+		::memcpy(slab->data + slab->used, data, length);
+		frames.push_back({ slab, slab->used, length });
+		slab->used += length;
+		start = scan = slab->used;
+		return frames;
+	}
+
+	append(data, length);
+
+	if (mode == LengthPrefixFraming) {
+		scanLengthPrefixed();
+	} else {
+		scanDelimited();
+	}
+
+	return frames;
+}
+
+/**
+ * Finds complete frames in newline or delimiter mode using `memchr()` to jump to the next
+ * candidate delimiter. Scanning resumes where the previous read left off.
+ */
+void RelayFramer::scanDelimited() {
+	const char* base = slab->data;
+	const char first = delimiter[0];
+	const size_t dlen = delimiter.size();
+	const size_t end = slab->used;
+	size_t pos = scan;
+
+	while (pos < end) {
+		const char* hit = static_cast<const char*>(::memchr(base + pos, first, end - pos));
+		if (!hit) {
+			pos = end;
+			break;
+		}
+
+		size_t i = hit - base;
+
+		if (dlen > 1) {
+			if (end - i < dlen) {
+				// possible delimiter split across reads, try again when more data arrives
+				pos = i;
+				break;
+			}
+			if (::memcmp(hit + 1, delimiter.data() + 1, dlen - 1) != 0) {
+				pos = i + 1;
+				continue;
+			}
+		}
+
+		size_t length = i - start;
+		if (mode == NewlineFraming && length && base[i - 1] == '\r') {
+			--length;
+		}
+		if (length) {
+			frames.push_back({ slab, start, length });
+		}
+
+		start = pos = i + dlen;
+	}
+
+	scan = pos;
+
+	// never buffer more than the max frame length waiting for a delimiter
+	if (end - start >= maxFrameLength) {
+		frames.push_back({ slab, start, end - start });
+		start = scan = end;
+	}
+}
+
+/**
+ * Finds complete frames that are prefixed with a 4-byte big-endian length. Frames that claim to
+ * be larger than the max frame length are skipped.
+ */
+void RelayFramer::scanLengthPrefixed() {
+	const unsigned char* base = reinterpret_cast<const unsigned char*>(slab->data);
+	const size_t end = slab->used;
+
+	while (1) {
+		if (skip) {
+			size_t n = end - start < skip ? end - start : skip;
+			start += n;
+			skip -= n;
+			if (skip) {
+				break;
+			}
+		}
+
+		if (end - start < 4) {
+			break;
+		}
+
+		size_t length = ((size_t)base[start] << 24) | ((size_t)base[start + 1] << 16) | ((size_t)base[start + 2] << 8) | (size_t)base[start + 3];
+
+		if (length > maxFrameLength) {
+			skip = length + 4;
+			continue;
+		}
+
+		if (end - start - 4 < length) {
+			break;
+		}
+
+		frames.push_back({ slab, start + 4, length });
+		start += 4 + length;
+	}
+
+	scan = start;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef __RELAY_FRAMER_H__
+#define __RELAY_FRAMER_H__
+
+#include "relay-slab.h"
+#include <string>
+#include <vector>
+
+// the default maximum number of bytes buffered while waiting for a frame to complete
+#define RELAY_MAX_FRAME_LENGTH (1024 * 1024)
+
+namespace node_ios_device {
+
+enum RelayFraming { NewlineFraming, DelimiterFraming, LengthPrefixFraming, RawFraming };
+
+/**
+ * A range of bytes within a slab that makes up one complete frame.
+ */
+struct RelaySpan {
+	RelaySlab* slab;
+	size_t     offset;
+	size_t     length;
+};
+
+/**
+ * Splits a stream of bytes into frames.
+ *
+ * Incoming data is appended to the current slab right after any incomplete frame left over from
+ * the previous read, so frames that straddle reads are reassembled without an extra copy. Only
+ * when the slab runs out of room is the incomplete frame moved to a fresh slab.
+ *
+ * Supported modes:
+ *  - newline: frames end with `\n`, a trailing `\r` is stripped, and empty frames are skipped
+ *  - delimiter: frames end with an arbitrary byte sequence and empty frames are skipped
+ *  - length prefix: each frame starts with a 4-byte big-endian length
+ *  - raw: each read is a frame
+ *
+ * A framer is not thread safe and must only be fed from a single thread.
+ */
+class RelayFramer {
+public:
+	RelayFramer(std::shared_ptr<RelaySlabPool> pool, RelayFraming mode, const std::string& delimiter, size_t maxFrameLength);
+	~RelayFramer();
+
+	const std::vector<RelaySpan>& flush();
+	const std::vector<RelaySpan>& push(const char* data, size_t length);
+
+private:
+	void append(const char* data, size_t length);
+	void scanDelimited();
+	void scanLengthPrefixed();
+
+	std::shared_ptr<RelaySlabPool> pool;
+	RelayFraming                   mode;
+	std::string                    delimiter;
+	size_t                         maxFrameLength;
+
+	RelaySlab*                     slab;
+	size_t                         start;
+	size_t                         scan;
+	size_t                         skip;
+	std::vector<RelaySpan>         frames;
+};
+
+}
+
+#endif
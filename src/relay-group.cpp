@@ -0,0 +1,117 @@
+#include "relay-group.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Initializes the relay group. The main thread tags frames by their source once it has seen the
+ * source's "attach" frame.
+ */
+RelayGroup::RelayGroup(napi_env env, const RelayOptions& options, const std::vector<std::string>& udids) :
+	RelayConnection(env, options),
+	udids(udids.begin(), udids.end()),
+	nextSource(1) {
+
+	tagged = true;
+}
+
+/**
+ * Returns true if the device belongs in this group.
+ */
+bool RelayGroup::accepts(const std::string& udid) const {
+	return udids.empty() || udids.count(udid) > 0;
+}
+
+/**
+ * Adds a source for the device and queues an "attach" frame carrying its udid. Returns the new
+ * source, or 0 if the device is already attached. Subclasses must hold `sourcesLock` until the
+ * source's stream is registered so that its data can't arrive first.
+ */
+uint32_t RelayGroup::attachSource(const std::string& udid) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	if (attached.count(udid)) {
+		return 0;
+	}
+
+	uint32_t source = nextSource++;
+	framers.emplace(source, std::make_unique<RelayFramer>(slabPool, options.framing, options.delimiter, options.maxFrameLength));
+	attached[udid] = source;
+
+	LOG_DEBUG_2("RelayGroup::attachSource", "Attaching device %s as source %u", udid.c_str(), source)
+
+	RelaySlab* slab = slabPool->acquire(udid.size());
+	::memcpy(slab->data + slab->used, udid.data(), udid.size());
+	enqueue(AttachEvent, slab, slab->used, udid.size(), ::uv_hrtime(), source);
+	slab->used += udid.size();
+	slab->release();
+
+	::uv_async_send(msgQueueUpdate);
+	return source;
+}
+
+/**
+ * Detaches the device if it's attached, such as when it has been unplugged.
+ */
+void RelayGroup::detach(const std::string& udid) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	auto it = attached.find(udid);
+	if (it != attached.end()) {
+		onSourceClose(it->second);
+	}
+}
+
+/**
+ * Flushes the source's incomplete frame, queues a "detach" frame, and closes the source's stream.
+ * Closing a source that is already gone does nothing.
+ */
+void RelayGroup::onSourceClose(uint32_t source) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	auto it = framers.find(source);
+	if (it == framers.end()) {
+		return;
+	}
+
+	uint64_t now = ::uv_hrtime();
+	for (auto const& frame : it->second->flush()) {
+		enqueueData(frame, now, source);
+		stats.framesRead.add(1);
+	}
+	enqueue(DetachEvent, NULL, 0, 0, now, source);
+	framers.erase(it);
+
+	for (auto entry = attached.begin(); entry != attached.end(); ++entry) {
+		if (entry->second == source) {
+			LOG_DEBUG_2("RelayGroup::onSourceClose", "Detaching device %s (source %u)", entry->first.c_str(), source)
+			attached.erase(entry);
+			break;
+		}
+	}
+
+	closeSource(source);
+	::uv_async_send(msgQueueUpdate);
+}
+
+/**
+ * Frames data read from a source and queues it. Data for a source that has been closed is dropped.
+ */
+void RelayGroup::onSourceData(uint32_t source, const char* data, size_t length) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	auto it = framers.find(source);
+	if (it != framers.end()) {
+		onData(*it->second, source, data, length);
+	}
+}
+
+/**
+ * Groups don't reconnect; devices rejoin by being attached again.
+ */
+void RelayGroup::reconnect() {
+	onReconnect(false);
+}
+
+/**
+ * Groups don't support writes since there's no single device to write to.
+ */
+void RelayGroup::scheduleWrite() {}
+
+}
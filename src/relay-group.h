@@ -0,0 +1,60 @@
+#ifndef __RELAY_GROUP_H__
+#define __RELAY_GROUP_H__
+
+#include "node-ios-device.h"
+#include "relay-connection.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * A relay connection that merges the same port on many devices into a single stream. Each device
+ * is a source with its own framer, and its frames are tagged with the source so that listeners
+ * get the device's udid with every frame.
+ *
+ * Every source feeds the group's one ring, so sources take `sourcesLock` while pushing frames.
+ * Device sockets are all read on the device manager's run loop thread, so the lock is only ever
+ * contended by a device attaching from the main thread. Frames are queued in the order they were
+ * read, which is the order of their timestamps, and a single async handle drains every device.
+ *
+ * A group never ends on its own. Devices are attached when they match the group's udids, or any
+ * device if no udids were given, and detached when their stream closes or they go away. Attaching
+ * and detaching is queued between the frames as "attach" and "detach" events.
+ *
+ * Subclasses open the device streams, call `attachSource()` for each one, feed the data to
+ * `onSourceData()` and `onSourceClose()`, and close the stream in `closeSource()`. Groups don't
+ * support writes.
+ */
+class RelayGroup : public RelayConnection {
+public:
+	RelayGroup(napi_env env, const RelayOptions& options, const std::vector<std::string>& udids);
+	virtual ~RelayGroup() {}
+
+	bool accepts(const std::string& udid) const;
+	void detach(const std::string& udid);
+
+protected:
+	uint32_t attachSource(const std::string& udid);
+	virtual void closeSource(uint32_t source) = 0;
+	void onSourceClose(uint32_t source);
+	void onSourceData(uint32_t source, const char* data, size_t length);
+	void reconnect();
+	void scheduleWrite();
+
+	std::set<std::string>                            udids;
+	std::recursive_mutex                             sourcesLock;
+	std::map<uint32_t, std::unique_ptr<RelayFramer>> framers;
+	std::map<std::string, uint32_t>                  attached;
+	uint32_t                                         nextSource;
+};
+
+}
+
+#endif
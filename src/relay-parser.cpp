@@ -0,0 +1,511 @@
+#include "relay-parser.h"
+#include <cctype>
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Advances past JSON whitespace.
+ */
+static inline void skipSpace(const char* data, size_t& pos, size_t end) {
+	while (pos < end && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r')) {
+		++pos;
+	}
+}
+
+/**
+ * Returns true if the character is an ASCII digit.
+ */
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * Returns true if the character is an ASCII hex digit.
+ */
+static inline bool isHex(char c) {
+	return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/**
+ * Checks the JSON number at `pos` and advances past it.
+ */
+static bool validateNumber(const char* data, size_t& pos, size_t end) {
+	if (data[pos] == '-') {
+		++pos;
+	}
+
+	if (pos >= end || !isDigit(data[pos])) {
+		return false;
+	}
+	if (data[pos] == '0') {
+		++pos;
+	} else {
+		while (pos < end && isDigit(data[pos])) {
+			++pos;
+		}
+	}
+
+	if (pos < end && data[pos] == '.') {
+		if (++pos >= end || !isDigit(data[pos])) {
+			return false;
+		}
+		while (pos < end && isDigit(data[pos])) {
+			++pos;
+		}
+	}
+
+	if (pos < end && (data[pos] == 'e' || data[pos] == 'E')) {
+		if (++pos < end && (data[pos] == '+' || data[pos] == '-')) {
+			++pos;
+		}
+		if (pos >= end || !isDigit(data[pos])) {
+			return false;
+		}
+		while (pos < end && isDigit(data[pos])) {
+			++pos;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Checks the double quoted JSON string at `pos` and advances past the closing quote. Bytes outside
+ * of ASCII are not checked; invalid UTF-8 becomes U+FFFD when the string is created.
+ */
+static bool validateString(const char* data, size_t& pos, size_t end) {
+	++pos;
+
+	while (pos < end) {
+		unsigned char c = (unsigned char)data[pos++];
+
+		if (c == '"') {
+			return true;
+		}
+
+		if (c < 0x20) {
+			return false;
+		}
+
+		if (c == '\\') {
+			if (pos >= end) {
+				return false;
+			}
+			switch (data[pos++]) {
+				case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+					break;
+				case 'u':
+					if (end - pos < 4 || !isHex(data[pos]) || !isHex(data[pos + 1]) || !isHex(data[pos + 2]) || !isHex(data[pos + 3])) {
+						return false;
+					}
+					pos += 4;
+					break;
+				default:
+					return false;
+			}
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Checks the JSON value at `pos` and advances past it. Containers are limited to
+ * `RELAY_PARSE_MAX_DEPTH` levels so that the recursion is bounded.
+ */
+static bool validateJson(const char* data, size_t& pos, size_t end, uint32_t depth) {
+	skipSpace(data, pos, end);
+	if (pos >= end) {
+		return false;
+	}
+
+	char c = data[pos];
+
+	if (c == '{' || c == '[') {
+		if (depth >= RELAY_PARSE_MAX_DEPTH) {
+			return false;
+		}
+
+		bool isObject = c == '{';
+		char close = isObject ? '}' : ']';
+
+		++pos;
+		skipSpace(data, pos, end);
+		if (pos < end && data[pos] == close) {
+			++pos;
+			return true;
+		}
+
+		while (true) {
+			if (isObject) {
+				skipSpace(data, pos, end);
+				if (pos >= end || data[pos] != '"' || !validateString(data, pos, end)) {
+					return false;
+				}
+				skipSpace(data, pos, end);
+				if (pos >= end || data[pos] != ':') {
+					return false;
+				}
+				++pos;
+			}
+
+			if (!validateJson(data, pos, end, depth + 1)) {
+				return false;
+			}
+
+			skipSpace(data, pos, end);
+			if (pos >= end) {
+				return false;
+			}
+			if (data[pos] == close) {
+				++pos;
+				return true;
+			}
+			if (data[pos++] != ',') {
+				return false;
+			}
+		}
+	}
+
+	if (c == '"') {
+		return validateString(data, pos, end);
+	}
+
+	if (c == '-' || isDigit(c)) {
+		return validateNumber(data, pos, end);
+	}
+
+	static const char* literals[] = { "true", "false", "null" };
+	for (auto const& literal : literals) {
+		size_t length = ::strlen(literal);
+		if (c == literal[0]) {
+			if (end - pos < length || ::memcmp(data + pos, literal, length) != 0) {
+				return false;
+			}
+			pos += length;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Writes an unquoted logfmt key or value as a JSON string. Unquoted keys and values never contain
+ * whitespace or control characters, so only backslashes and quotes need escaping.
+ */
+static char* appendString(char* out, const char* data, size_t length) {
+	*out++ = '"';
+	for (size_t i = 0; i < length; ++i) {
+		if (data[i] == '"' || data[i] == '\\') {
+			*out++ = '\\';
+		}
+		*out++ = data[i];
+	}
+	*out++ = '"';
+	return out;
+}
+
+/**
+ * Writes arbitrary bytes as a JSON string, escaping quotes, backslashes, and control characters.
+ * Bytes outside of ASCII are copied as is.
+ */
+static char* appendEscaped(char* out, const char* data, size_t length) {
+	static const char hex[] = "0123456789abcdef";
+
+	*out++ = '"';
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char c = (unsigned char)data[i];
+		if (c == '"' || c == '\\') {
+			*out++ = '\\';
+			*out++ = (char)c;
+		} else if (c == '\n') {
+			*out++ = '\\';
+			*out++ = 'n';
+		} else if (c == '\t') {
+			*out++ = '\\';
+			*out++ = 't';
+		} else if (c < 0x20) {
+			::memcpy(out, "\\u00", 4);
+			out[4] = hex[c >> 4];
+			out[5] = hex[c & 0xf];
+			out += 6;
+		} else {
+			*out++ = (char)c;
+		}
+	}
+	*out++ = '"';
+	return out;
+}
+
+/**
+ * The location of each field of a syslog record's header.
+ */
+struct SyslogHeader {
+	size_t deviceStart, deviceEnd;
+	size_t processStart, processEnd;
+	size_t senderStart, senderEnd;
+	size_t pidStart, pidEnd;
+	size_t levelStart, levelEnd;
+	size_t message;
+};
+
+/**
+ * Finds the fields of a `Mmm dd hh:mm:ss device process(sender)[pid] <Level>: message` header.
+ * The sender is optional. Returns false if the record doesn't start with a header.
+ */
+static bool parseSyslogHeader(const char* data, size_t length, SyslogHeader& header) {
+	if (length < 16
+		|| !isalpha((unsigned char)data[0]) || !isalpha((unsigned char)data[1]) || !isalpha((unsigned char)data[2])
+		|| data[3] != ' ' || (data[4] != ' ' && !isDigit(data[4])) || !isDigit(data[5]) || data[6] != ' '
+		|| !isDigit(data[7]) || !isDigit(data[8]) || data[9] != ':'
+		|| !isDigit(data[10]) || !isDigit(data[11]) || data[12] != ':'
+		|| !isDigit(data[13]) || !isDigit(data[14]) || data[15] != ' ') {
+		return false;
+	}
+
+	size_t pos = 16;
+	header.deviceStart = pos;
+	while (pos < length && data[pos] != ' ') {
+		++pos;
+	}
+	if (pos == header.deviceStart || pos >= length) {
+		return false;
+	}
+	header.deviceEnd = pos++;
+
+	// the process name runs up to the pid, and may have the sender in parentheses at the end
+	header.processStart = pos;
+	while (pos < length && data[pos] != '[') {
+		++pos;
+	}
+	if (pos == header.processStart || pos >= length) {
+		return false;
+	}
+	header.processEnd = header.senderStart = header.senderEnd = pos;
+	if (data[pos - 1] == ')') {
+		for (size_t i = header.processStart + 1; i < pos - 1; ++i) {
+			if (data[i] == '(') {
+				header.processEnd = i;
+				header.senderStart = i + 1;
+				header.senderEnd = pos - 1;
+				break;
+			}
+		}
+	}
+
+	header.pidStart = ++pos;
+	while (pos < length && isDigit(data[pos])) {
+		++pos;
+	}
+	if (pos == header.pidStart || pos - header.pidStart > 9 || pos >= length || data[pos] != ']') {
+		return false;
+	}
+	header.pidEnd = pos++;
+	while (header.pidEnd - header.pidStart > 1 && data[header.pidStart] == '0') {
+		++header.pidStart;
+	}
+
+	if (length - pos < 4 || data[pos] != ' ' || data[pos + 1] != '<') {
+		return false;
+	}
+	pos += 2;
+	header.levelStart = pos;
+	while (pos < length && data[pos] != '>') {
+		++pos;
+	}
+	if (pos == header.levelStart || pos + 1 >= length || data[pos + 1] != ':') {
+		return false;
+	}
+	header.levelEnd = pos;
+	pos += 2;
+	if (pos < length && data[pos] == ' ') {
+		++pos;
+	}
+	header.message = pos;
+	return true;
+}
+
+/**
+ * Initializes the parser. Slabs for rewritten frames are only acquired once needed.
+ */
+RelayParser::RelayParser(std::shared_ptr<RelaySlabPool> pool, RelayParse mode) :
+	pool(pool),
+	mode(mode),
+	slab(NULL) {}
+
+/**
+ * Releases the parser's reference to the current slab.
+ */
+RelayParser::~RelayParser() {
+	if (slab) {
+		slab->release();
+	}
+}
+
+/**
+ * Makes sure the current slab has room for `bound` bytes and returns where the next rewritten frame
+ * starts.
+ */
+char* RelayParser::reserve(size_t bound) {
+	if (!slab || slab->available() < bound) {
+		if (slab) {
+			slab->release();
+		}
+		slab = pool->acquire(bound);
+	}
+	return slab->data + slab->used;
+}
+
+/**
+ * Checks a frame and sets `result` to the JSON text to hand to `JSON.parse()`, which is either the
+ * frame itself or its rewritten form. Returns false if the frame is malformed.
+ */
+bool RelayParser::parse(const RelaySpan& frame, RelaySpan& result) {
+	const char* data = frame.slab->data + frame.offset;
+
+	if (mode == LogfmtParse) {
+		return parseLogfmt(data, frame.length, result);
+	}
+
+	if (mode == SyslogParse) {
+		return parseSyslog(data, frame.length, result);
+	}
+
+	size_t pos = 0;
+	if (!validateJson(data, pos, frame.length, 0)) {
+		return false;
+	}
+	skipSpace(data, pos, frame.length);
+	if (pos != frame.length) {
+		return false;
+	}
+
+	result = frame;
+	return true;
+}
+
+/**
+ * Rewrites a logfmt line as a JSON object. Quoted values use JSON escapes and are copied as is.
+ * A line is malformed if it has no pairs, a key that is empty or contains a quote, or a value with
+ * an unterminated or stray quote.
+ */
+bool RelayParser::parseLogfmt(const char* data, size_t length, RelaySpan& result) {
+	// escaping at most doubles each byte and every pair, which takes at least 2 bytes including the
+	// separator, adds at most 8 bytes of punctuation
+	size_t bound = length * 6 + 6;
+	char* start = reserve(bound);
+	char* out = start;
+	size_t pos = 0;
+	uint32_t count = 0;
+
+	*out++ = '{';
+
+	while (true) {
+		while (pos < length && (unsigned char)data[pos] <= ' ') {
+			++pos;
+		}
+		if (pos >= length) {
+			break;
+		}
+
+		size_t keyStart = pos;
+		while (pos < length && (unsigned char)data[pos] > ' ' && data[pos] != '=' && data[pos] != '"') {
+			++pos;
+		}
+		if (pos == keyStart || (pos < length && data[pos] == '"')) {
+			return false;
+		}
+
+		if (count++) {
+			*out++ = ',';
+		}
+		out = appendString(out, data + keyStart, pos - keyStart);
+		*out++ = ':';
+
+		if (pos < length && data[pos] == '=') {
+			++pos;
+			if (pos < length && data[pos] == '"') {
+				size_t valueStart = pos;
+				if (!validateString(data, pos, length) || (pos < length && (unsigned char)data[pos] > ' ')) {
+					return false;
+				}
+				::memcpy(out, data + valueStart, pos - valueStart);
+				out += pos - valueStart;
+			} else {
+				size_t valueStart = pos;
+				while (pos < length && (unsigned char)data[pos] > ' ') {
+					if (data[pos] == '"') {
+						return false;
+					}
+					++pos;
+				}
+				out = appendString(out, data + valueStart, pos - valueStart);
+			}
+		} else {
+			::memcpy(out, "true", 4);
+			out += 4;
+		}
+	}
+
+	if (count == 0) {
+		return false;
+	}
+
+	*out++ = '}';
+	result = { slab, slab->used, (size_t)(out - start) };
+	slab->used += result.length;
+	return true;
+}
+
+/**
+ * Rewrites a syslog record as a JSON object. Trailing line breaks are trimmed from the message and
+ * a record without a header becomes an object with only its `message`, so records are never
+ * malformed.
+ */
+bool RelayParser::parseSyslog(const char* data, size_t length, RelaySpan& result) {
+	while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r')) {
+		--length;
+	}
+
+	// escaping grows each byte to at most 6 bytes, plus the field names and punctuation
+	size_t bound = length * 6 + 96;
+	char* start = reserve(bound);
+	char* out = start;
+	SyslogHeader header;
+
+	*out++ = '{';
+
+	if (parseSyslogHeader(data, length, header)) {
+		::memcpy(out, "\"time\":", 7);
+		out = appendEscaped(out + 7, data, 15);
+		::memcpy(out, ",\"device\":", 10);
+		out = appendEscaped(out + 10, data + header.deviceStart, header.deviceEnd - header.deviceStart);
+		::memcpy(out, ",\"process\":", 11);
+		out = appendEscaped(out + 11, data + header.processStart, header.processEnd - header.processStart);
+		if (header.senderEnd > header.senderStart) {
+			::memcpy(out, ",\"sender\":", 10);
+			out = appendEscaped(out + 10, data + header.senderStart, header.senderEnd - header.senderStart);
+		}
+		::memcpy(out, ",\"pid\":", 7);
+		out += 7;
+		::memcpy(out, data + header.pidStart, header.pidEnd - header.pidStart);
+		out += header.pidEnd - header.pidStart;
+		::memcpy(out, ",\"level\":", 9);
+		out = appendEscaped(out + 9, data + header.levelStart, header.levelEnd - header.levelStart);
+		*out++ = ',';
+		data += header.message;
+		length -= header.message;
+	}
+
+	::memcpy(out, "\"message\":", 10);
+	out = appendEscaped(out + 10, data, length);
+	*out++ = '}';
+
+	result = { slab, slab->used, (size_t)(out - start) };
+	slab->used += result.length;
+	return true;
+}
+
+}
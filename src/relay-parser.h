@@ -0,0 +1,53 @@
+#ifndef __RELAY_PARSER_H__
+#define __RELAY_PARSER_H__
+
+#include "node-ios-device.h"
+#include "relay-framer.h"
+#include "relay-slab.h"
+#include <memory>
+
+// the max nesting depth of a JSON value, deeper values are rejected as malformed
+#define RELAY_PARSE_MAX_DEPTH 64
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+enum RelayParse { NoParse, JsonParse, LogfmtParse, SyslogParse };
+
+/**
+ * Checks frames on the thread reading from the device so that the main thread can turn a whole
+ * batch of them into JavaScript values with a single `JSON.parse()` call that never throws.
+ *
+ * Supported modes:
+ *  - json: each frame must be a JSON value and is passed through as is
+ *  - logfmt: each frame is a list of `key=value` pairs where values may be double quoted and keys
+ *    without a value are `true`; the pairs are rewritten as a JSON object of strings
+ *  - syslog: each frame is a device syslog record such as
+ *    `Oct 17 04:44:00 iPhone SpringBoard(FrontBoard)[58] <Notice>: message` and is rewritten as a
+ *    JSON object with `time`, `device`, `process`, `sender`, `pid`, `level`, and `message` fields;
+ *    records without a header are passed through as an object with only a `message`
+ *
+ * Rewritten frames are written to slabs owned by the parser. The parser is not thread safe and must
+ * only be fed from the thread feeding the connection.
+ */
+class RelayParser {
+public:
+	RelayParser(std::shared_ptr<RelaySlabPool> pool, RelayParse mode);
+	~RelayParser();
+
+	bool parse(const RelaySpan& frame, RelaySpan& result);
+
+private:
+	char* reserve(size_t bound);
+	bool parseLogfmt(const char* data, size_t length, RelaySpan& result);
+	bool parseSyslog(const char* data, size_t length, RelaySpan& result);
+
+	std::shared_ptr<RelaySlabPool> pool;
+	RelayParse                     mode;
+	RelaySlab*                     slab;
+};
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef __RELAY_RING_H__
+#define __RELAY_RING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// the default number of preallocated slots in a relay ring
+#define RELAY_RING_CAPACITY 4096
+
+// the assumed cache line size used to keep the producer and consumer indexes apart
+#define RELAY_CACHE_LINE 64
+
+namespace node_ios_device {
+
+/**
+ * A bounded single-producer/single-consumer queue of preallocated slots.
+ *
+ * The producer (the thread reading from the device) only writes `head` and the consumer (the
+ * libuv thread) only writes `tail`, so pushing and popping never take a lock or allocate. Each
+ * side keeps a cached copy of the other side's index and only reloads it when the ring looks full
+ * or empty, which keeps the two cache lines from bouncing between cores on every frame.
+ *
+ * If the consumer falls so far behind that the ring fills up, items spill into a mutex protected
+ * overflow queue. Once spilling has started, every item goes to the overflow until the consumer
+ * drains it, which preserves ordering. Spilling should be rare and only exists so that a stalled
+ * main thread never blocks or drops data on the producer.
+ */
+template <typename T>
+class RelayRing {
+public:
+	/**
+	 * Allocates the slots. The capacity is rounded up to a power of 2 so that indexes can be
+	 * masked instead of divided.
+	 */
+	RelayRing(size_t capacity = RELAY_RING_CAPACITY) :
+		head(0),
+		cachedTail(0),
+		tail(0),
+		cachedHead(0),
+		overflowed(false),
+		overflowSize(0) {
+
+		size_t n = 2;
+		while (n < capacity) {
+			n <<= 1;
+		}
+		slots = new T[n];
+		mask = n - 1;
+	}
+
+	~RelayRing() {
+		delete[] slots;
+	}
+
+	/**
+	 * Returns the total number of slots.
+	 */
+	inline size_t capacity() const { return mask + 1; }
+
+	/**
+	 * Copies the oldest item without removing it. Returns false if the queue is empty. Consumer
+	 * only.
+	 */
+	bool peek(T& item) {
+		return take(item, false);
+	}
+
+	/**
+	 * Removes the oldest item. Returns false if the queue is empty. Consumer only.
+	 */
+	bool pop(T& item) {
+		return take(item, true);
+	}
+
+	/**
+	 * Adds an item to the ring, spilling into the overflow if the ring is full. Producer only.
+	 */
+	void push(const T& item) {
+		if (tryPush(item)) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(overflowLock);
+		if (!overflowed.load(std::memory_order_relaxed)) {
+			// the consumer drained the overflow and the ring may have room again
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) <= mask) {
+				slots[h & mask] = item;
+				head.store(h + 1, std::memory_order_release);
+				return;
+			}
+		}
+		overflow.push_back(item);
+		overflowed.store(true, std::memory_order_release);
+		overflowSize.store(overflow.size(), std::memory_order_release);
+	}
+
+	/**
+	 * Adds an item to the ring without spilling. Returns false if the ring is full or the
+	 * overflow is in use. Producer only.
+	 */
+	bool tryPush(const T& item) {
+		if (overflowed.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - cachedTail > mask && h - (cachedTail = tail.load(std::memory_order_acquire)) > mask) {
+			return false;
+		}
+
+		slots[h & mask] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Returns the number of queued items. This is only an estimate when called from the producer.
+	 */
+	inline size_t size() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) + overflowSize.load(std::memory_order_acquire);
+	}
+
+private:
+	/**
+	 * Copies the oldest item and optionally removes it. The overflow is only consulted once the
+	 * ring is empty. The ring is checked again while holding the overflow lock since the producer
+	 * may have filled it and started spilling after the first check.
+	 */
+	bool take(T& item, bool remove) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t != cachedHead || t != (cachedHead = head.load(std::memory_order_acquire))) {
+			item = slots[t & mask];
+			if (remove) {
+				tail.store(t + 1, std::memory_order_release);
+			}
+			return true;
+		}
+
+		if (!overflowed.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(overflowLock);
+
+		if (t != (cachedHead = head.load(std::memory_order_acquire))) {
+			item = slots[t & mask];
+			if (remove) {
+				tail.store(t + 1, std::memory_order_release);
+			}
+			return true;
+		}
+
+		if (overflow.empty()) {
+			return false;
+		}
+
+		item = overflow.front();
+		if (remove) {
+			overflow.pop_front();
+			overflowSize.store(overflow.size(), std::memory_order_relaxed);
+			if (overflow.empty()) {
+				overflowed.store(false, std::memory_order_release);
+			}
+		}
+		return true;
+	}
+
+	T*                  slots;
+	size_t              mask;
+	char                sharedPadding[RELAY_CACHE_LINE];
+
+	// producer owned
+	std::atomic<size_t> head;
+	size_t              cachedTail;
+	char                producerPadding[RELAY_CACHE_LINE];
+
+	// consumer owned
+	std::atomic<size_t> tail;
+	size_t              cachedHead;
+	char                consumerPadding[RELAY_CACHE_LINE];
+
+	std::mutex          overflowLock;
+	std::deque<T>       overflow;
+	std::atomic<bool>   overflowed;
+	std::atomic<size_t> overflowSize;
+};
+
+}
+
+#endif
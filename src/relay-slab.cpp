@@ -0,0 +1,96 @@
+#include "relay-slab.h"
+
+namespace node_ios_device {
+
+/**
+ * Allocates the slab's memory.
+ */
+RelaySlab::RelaySlab(size_t capacity) :
+	data(new char[capacity]),
+	capacity(capacity),
+	used(0),
+	refs(0) {}
+
+/**
+ * Frees the slab's memory.
+ */
+RelaySlab::~RelaySlab() {
+	delete[] data;
+}
+
+/**
+ * Drops a reference to the slab. When the last reference is released, the slab is handed back to
+ * the pool it was acquired from.
+ */
+void RelaySlab::release() {
+	if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::shared_ptr<RelaySlabPool> owner = std::move(pool);
+		if (owner) {
+			owner->recycle(this);
+		} else {
+			delete this;
+		}
+	}
+}
+
+/**
+ * Deletes all idle slabs.
+ */
+RelaySlabPool::~RelaySlabPool() {
+	for (auto slab : free) {
+		delete slab;
+	}
+}
+
+/**
+ * Returns an empty slab with a single reference owned by the caller. Slabs are reused when
+ * possible, however if the requested size is larger than a standard slab, a dedicated slab is
+ * allocated and it will be freed instead of recycled.
+ */
+RelaySlab* RelaySlabPool::acquire(size_t minSize) {
+	RelaySlab* slab = NULL;
+
+	if (minSize <= RELAY_SLAB_SIZE) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!free.empty()) {
+			slab = free.back();
+			free.pop_back();
+		}
+	}
+
+	if (!slab) {
+		slab = new RelaySlab(minSize > RELAY_SLAB_SIZE ? minSize : RELAY_SLAB_SIZE);
+	}
+
+	slab->used = 0;
+	slab->refs.store(1, std::memory_order_relaxed);
+	slab->pool = shared_from_this();
+	outstanding.fetch_add(1, std::memory_order_relaxed);
+	return slab;
+}
+
+/**
+ * Returns the number of slabs waiting in the pool to be reused.
+ */
+size_t RelaySlabPool::idle() {
+	std::lock_guard<std::mutex> guard(lock);
+	return free.size();
+}
+
+/**
+ * Puts a slab that no longer has any references back into the pool or frees it if it's oversized
+ * or the pool is full.
+ */
+void RelaySlabPool::recycle(RelaySlab* slab) {
+	outstanding.fetch_sub(1, std::memory_order_relaxed);
+	if (slab->capacity == RELAY_SLAB_SIZE) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (free.size() < RELAY_SLAB_POOL_MAX_FREE) {
+			free.push_back(slab);
+			return;
+		}
+	}
+	delete slab;
+}
+
+}
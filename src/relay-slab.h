@@ -0,0 +1,62 @@
+#ifndef __RELAY_SLAB_H__
+#define __RELAY_SLAB_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// the size of a pooled relay slab; incoming data larger than this gets a dedicated slab
+#define RELAY_SLAB_SIZE (64 * 1024)
+
+// the maximum number of idle slabs a pool will hold on to
+#define RELAY_SLAB_POOL_MAX_FREE 16
+
+namespace node_ios_device {
+
+class RelaySlabPool;
+
+/**
+ * A fixed size block of memory that incoming relay data is copied into. Frames reference ranges
+ * within the slab and each frame (and each JavaScript buffer backed by the slab) holds a reference
+ * so that the slab is only recycled once nothing points into it.
+ */
+struct RelaySlab {
+	RelaySlab(size_t capacity);
+	~RelaySlab();
+
+	inline size_t available() const { return capacity - used; }
+	void release();
+	inline void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+	char*                          data;
+	size_t                         capacity;
+	size_t                         used;
+	std::atomic<uint32_t>          refs;
+	std::shared_ptr<RelaySlabPool> pool;
+};
+
+/**
+ * A thread safe pool of relay slabs. Slabs are acquired on the background thread and released on
+ * the main thread after the last reference is dropped.
+ */
+class RelaySlabPool : public std::enable_shared_from_this<RelaySlabPool> {
+public:
+	RelaySlabPool() : outstanding(0) {}
+	~RelaySlabPool();
+
+	RelaySlab* acquire(size_t minSize = 0);
+	size_t idle();
+	inline uint32_t inUse() const { return outstanding.load(std::memory_order_relaxed); }
+	void recycle(RelaySlab* slab);
+
+private:
+	std::mutex              lock;
+	std::atomic<uint32_t>   outstanding;
+	std::vector<RelaySlab*> free;
+};
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include "relay-socket-pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace node_ios_device {
+
+/**
+ * Closes the idle sockets.
+ */
+RelaySocketPool::~RelaySocketPool() {
+	for (auto const& it : idle) {
+		for (int fd : it.second) {
+			::close(fd);
+		}
+	}
+}
+
+/**
+ * Takes an idle socket for the port if there is one that the device hasn't closed, otherwise calls
+ * `connect` for a new one.
+ */
+int RelaySocketPool::acquire(uint32_t port, const std::function<int()>& connect) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto pool = idle.find(port);
+		while (pool != idle.end() && !pool->second.empty()) {
+			int fd = pool->second.front();
+			pool->second.pop_front();
+			if (drain(fd)) {
+				LOG_DEBUG_2("RelaySocketPool::acquire", "Reusing idle socket for port %d (%zu left)", port, pool->second.size())
+				return fd;
+			}
+			LOG_DEBUG_1("RelaySocketPool::acquire", "Idle socket for port %d was closed by the device", port)
+			::close(fd);
+		}
+	}
+
+	return connect();
+}
+
+/**
+ * Reads everything waiting on an idle socket and throws it away so that the next relay connection
+ * starts with a clean stream. Returns false if the device has closed the socket.
+ */
+bool RelaySocketPool::drain(int fd) {
+	char buffer[4096];
+	while (1) {
+		ssize_t n = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (n > 0) {
+			continue;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+}
+
+/**
+ * Returns whether the port's pool has room for another idle socket.
+ */
+bool RelaySocketPool::hasRoom(uint32_t port) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto size = sizes.find(port);
+	auto pool = idle.find(port);
+	return size != sizes.end() && (pool == idle.end() || pool->second.size() < size->second);
+}
+
+/**
+ * Returns the number of idle sockets parked for the port.
+ */
+size_t RelaySocketPool::idleCount(uint32_t port) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto pool = idle.find(port);
+	return pool == idle.end() ? 0 : pool->second.size();
+}
+
+/**
+ * Parks the socket in the port's pool. The socket is closed instead if the pool is full or the
+ * device has closed it. Returns whether it was parked.
+ */
+bool RelaySocketPool::park(uint32_t port, int fd) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::deque<int>& pool = idle[port];
+	if (pool.size() >= sizes[port] || !drain(fd)) {
+		::close(fd);
+		return false;
+	}
+
+	pool.push_back(fd);
+	LOG_DEBUG_2("RelaySocketPool::park", "Parked idle socket for port %d (%zu idle)", port, pool.size())
+	return true;
+}
+
+/**
+ * Raises the number of idle sockets kept for the port. Handles of the same port may ask for
+ * different pool sizes, so the largest one wins.
+ */
+void RelaySocketPool::reserve(uint32_t port, uint32_t size) {
+	std::lock_guard<std::mutex> guard(lock);
+	uint32_t& current = sizes[port];
+	current = std::max(current, size);
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef __RELAY_SOCKET_POOL_H__
+#define __RELAY_SOCKET_POOL_H__
+
+#include "node-ios-device.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * A bounded per-port pool of idle sockets to a device.
+ *
+ * When a port relay connection is stopped, its socket is parked here instead of being closed, up to
+ * the largest pool size asked for on that port. The next relay connection for the port takes an
+ * idle socket before connecting a new one. Whatever arrived on a socket while it was idle is thrown
+ * away, and sockets the device has closed are discarded rather than handed out. The pool only deals
+ * in file descriptors, so it doesn't depend on CoreFoundation or MobileDevice.
+ */
+class RelaySocketPool {
+public:
+	~RelaySocketPool();
+
+	int acquire(uint32_t port, const std::function<int()>& connect);
+	static bool drain(int fd);
+	bool hasRoom(uint32_t port);
+	size_t idleCount(uint32_t port);
+	bool park(uint32_t port, int fd);
+	void reserve(uint32_t port, uint32_t size);
+
+private:
+	std::mutex                          lock;
+	std::map<uint32_t, std::deque<int>> idle;
+	std::map<uint32_t, uint32_t>        sizes;
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "relay-stats.h"
+#include <cstring>
+
+namespace node_ios_device {
+
+/**
+ * Sets a numeric property on a JavaScript object. Returns false if a JavaScript exception is
+ * pending.
+ */
+static bool setNumber(napi_env env, napi_value obj, const char* name, uint64_t value) {
+	napi_value tmp;
+	NAPI_THROW_RETURN("RelayStats::setNumber", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)value, &tmp), false)
+	NAPI_THROW_RETURN("RelayStats::setNumber", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, name, tmp), false)
+	return true;
+}
+
+/**
+ * Initializes an empty histogram snapshot.
+ */
+RelayHistogramSnapshot::RelayHistogramSnapshot() :
+	count(0),
+	sum(0),
+	max(0) {
+	::memset(buckets, 0, sizeof(buckets));
+}
+
+/**
+ * Adds another histogram's buckets to this one.
+ */
+void RelayHistogramSnapshot::merge(const RelayHistogramSnapshot& other) {
+	for (size_t i = 0; i < RELAY_HISTOGRAM_BUCKETS; ++i) {
+		buckets[i] += other.buckets[i];
+	}
+	count += other.count;
+	sum += other.sum;
+	if (other.max > max) {
+		max = other.max;
+	}
+}
+
+/**
+ * Returns the upper bound of the bucket containing the `p` percentile, capped at the largest value
+ * recorded. Since buckets are powers of 2, this is within a factor of 2 of the real value.
+ */
+uint64_t RelayHistogramSnapshot::percentile(double p) const {
+	if (count == 0) {
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)(p * (double)count);
+	if (target == 0) {
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < RELAY_HISTOGRAM_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen >= target) {
+			uint64_t bound = i == 0 ? 0 : (1ULL << i) - 1;
+			return bound < max ? bound : max;
+		}
+	}
+
+	return max;
+}
+
+/**
+ * Creates a JavaScript object with the count, mean, p50, p99, max, and the raw buckets.
+ */
+napi_value RelayHistogramSnapshot::toJS(napi_env env) const {
+	napi_value obj, arr, tmp;
+
+	NAPI_THROW_RETURN("RelayHistogramSnapshot::toJS", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &obj), NULL)
+
+	if (!setNumber(env, obj, "count", count)
+		|| !setNumber(env, obj, "mean", count ? sum / count : 0)
+		|| !setNumber(env, obj, "p50", percentile(0.5))
+		|| !setNumber(env, obj, "p99", percentile(0.99))
+		|| !setNumber(env, obj, "max", max)) {
+		return NULL;
+	}
+
+	NAPI_THROW_RETURN("RelayHistogramSnapshot::toJS", "ERR_NAPI_CREATE_ARRAY", ::napi_create_array_with_length(env, RELAY_HISTOGRAM_BUCKETS, &arr), NULL)
+	for (uint32_t i = 0; i < RELAY_HISTOGRAM_BUCKETS; ++i) {
+		NAPI_THROW_RETURN("RelayHistogramSnapshot::toJS", "ERR_NAPI_CREATE_DOUBLE", ::napi_create_double(env, (double)buckets[i], &tmp), NULL)
+		NAPI_THROW_RETURN("RelayHistogramSnapshot::toJS", "ERR_NAPI_SET_ELEMENT", ::napi_set_element(env, arr, i, tmp), NULL)
+	}
+	NAPI_THROW_RETURN("RelayHistogramSnapshot::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "buckets", arr), NULL)
+
+	return obj;
+}
+
+/**
+ * Copies the histogram's counters. The counters are read one at a time, so a snapshot taken while
+ * the histogram is being updated may be off by the values recorded in the meantime.
+ */
+void RelayHistogram::snapshot(RelayHistogramSnapshot& out) const {
+	for (size_t i = 0; i < RELAY_HISTOGRAM_BUCKETS; ++i) {
+		out.buckets[i] = buckets[i].get();
+	}
+	out.count = count.get();
+	out.sum = sum.get();
+	out.max = max.get();
+}
+
+/**
+ * Initializes an empty stats snapshot.
+ */
+RelayStatsSnapshot::RelayStatsSnapshot() :
+	connections(0),
+	bytesRead(0),
+	framesRead(0),
+	bytesEmitted(0),
+	framesEmitted(0),
+	bytesDropped(0),
+	framesDropped(0),
+	framesMalformed(0),
+	framesMatched(0),
+	framesFiltered(0),
+	bytesWritten(0),
+	pauses(0),
+	dispatches(0),
+	queueDepth(0),
+	maxQueueDepth(0),
+	queuedBytes(0),
+	writeQueuedBytes(0) {}
+
+/**
+ * Adds another snapshot to this one. Counters and current queue sizes are summed and the max queue
+ * depth is the largest of the two.
+ */
+void RelayStatsSnapshot::merge(const RelayStatsSnapshot& other) {
+	connections += other.connections;
+	bytesRead += other.bytesRead;
+	framesRead += other.framesRead;
+	bytesEmitted += other.bytesEmitted;
+	framesEmitted += other.framesEmitted;
+	bytesDropped += other.bytesDropped;
+	framesDropped += other.framesDropped;
+	framesMalformed += other.framesMalformed;
+	framesMatched += other.framesMatched;
+	framesFiltered += other.framesFiltered;
+	bytesWritten += other.bytesWritten;
+	pauses += other.pauses;
+	dispatches += other.dispatches;
+	queueDepth += other.queueDepth;
+	if (other.maxQueueDepth > maxQueueDepth) {
+		maxQueueDepth = other.maxQueueDepth;
+	}
+	queuedBytes += other.queuedBytes;
+	writeQueuedBytes += other.writeQueuedBytes;
+	batchSizes.merge(other.batchSizes);
+	latency.merge(other.latency);
+}
+
+/**
+ * Creates a JavaScript object containing the stats.
+ */
+napi_value RelayStatsSnapshot::toJS(napi_env env) const {
+	napi_value obj;
+
+	NAPI_THROW_RETURN("RelayStatsSnapshot::toJS", "ERR_NAPI_CREATE_OBJECT", ::napi_create_object(env, &obj), NULL)
+
+	if (!setNumber(env, obj, "connections", connections)
+		|| !setNumber(env, obj, "bytesRead", bytesRead)
+		|| !setNumber(env, obj, "framesRead", framesRead)
+		|| !setNumber(env, obj, "bytesEmitted", bytesEmitted)
+		|| !setNumber(env, obj, "framesEmitted", framesEmitted)
+		|| !setNumber(env, obj, "bytesDropped", bytesDropped)
+		|| !setNumber(env, obj, "framesDropped", framesDropped)
+		|| !setNumber(env, obj, "framesMalformed", framesMalformed)
+		|| !setNumber(env, obj, "framesMatched", framesMatched)
+		|| !setNumber(env, obj, "framesFiltered", framesFiltered)
+		|| !setNumber(env, obj, "bytesWritten", bytesWritten)
+		|| !setNumber(env, obj, "pauses", pauses)
+		|| !setNumber(env, obj, "dispatches", dispatches)
+		|| !setNumber(env, obj, "queueDepth", queueDepth)
+		|| !setNumber(env, obj, "maxQueueDepth", maxQueueDepth)
+		|| !setNumber(env, obj, "queuedBytes", queuedBytes)
+		|| !setNumber(env, obj, "writeQueuedBytes", writeQueuedBytes)) {
+		return NULL;
+	}
+
+	napi_value tmp = batchSizes.toJS(env);
+	if (tmp == NULL) {
+		return NULL;
+	}
+	NAPI_THROW_RETURN("RelayStatsSnapshot::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "batchSizes", tmp), NULL)
+
+	tmp = latency.toJS(env);
+	if (tmp == NULL) {
+		return NULL;
+	}
+	NAPI_THROW_RETURN("RelayStatsSnapshot::toJS", "ERR_NAPI_SET_NAMED_PROPERTY", ::napi_set_named_property(env, obj, "latency", tmp), NULL)
+
+	return obj;
+}
+
+/**
+ * Copies the counters into a snapshot. The current queue sizes are filled in by the relay
+ * connection.
+ */
+void RelayStats::snapshot(RelayStatsSnapshot& out) const {
+	out.bytesRead = bytesRead.get();
+	out.framesRead = framesRead.get();
+	out.framesMalformed = framesMalformed.get();
+	out.framesMatched = framesMatched.get();
+	out.framesFiltered = framesFiltered.get();
+	out.maxQueueDepth = maxQueueDepth.get();
+	out.bytesWritten = bytesWritten.get();
+	out.bytesEmitted = bytesEmitted.get();
+	out.framesEmitted = framesEmitted.get();
+	out.bytesDropped = bytesDropped.get();
+	out.framesDropped = framesDropped.get();
+	out.pauses = pauses.get();
+	out.dispatches = dispatches.get();
+	batchSizes.snapshot(out.batchSizes);
+	latency.snapshot(out.latency);
+}
+
+}
@@ -0,0 +1,140 @@
+#ifndef __RELAY_STATS_H__
+#define __RELAY_STATS_H__
+
+#include "node-ios-device.h"
+#include <atomic>
+#include <cstdint>
+
+// the number of power of 2 buckets in a relay histogram
+#define RELAY_HISTOGRAM_BUCKETS 32
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * A counter that is only ever updated by a single thread, but can be read from any thread. Updates
+ * are a relaxed load and store instead of an atomic read-modify-write, so they cost about the same
+ * as incrementing a plain integer.
+ */
+class RelayCounter {
+public:
+	RelayCounter() : value(0) {}
+
+	inline void add(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	inline uint64_t get() const { return value.load(std::memory_order_relaxed); }
+	inline void max(uint64_t n) { if (n > value.load(std::memory_order_relaxed)) value.store(n, std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> value;
+};
+
+/**
+ * A copy of a histogram's buckets that can be merged with other histograms and converted to
+ * JavaScript.
+ */
+struct RelayHistogramSnapshot {
+	RelayHistogramSnapshot();
+
+	void merge(const RelayHistogramSnapshot& other);
+	uint64_t percentile(double p) const;
+	napi_value toJS(napi_env env) const;
+
+	uint64_t buckets[RELAY_HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+/**
+ * A histogram of power of 2 buckets. Bucket 0 counts zeros and bucket `i` counts values from
+ * `2^(i-1)` up to `2^i - 1`. Like `RelayCounter`, it must only be updated by a single thread.
+ */
+class RelayHistogram {
+public:
+	/**
+	 * Adds a value to the histogram.
+	 */
+	inline void record(uint64_t value) {
+		size_t bucket = value == 0 ? 0 : 64 - (size_t)__builtin_clzll(value);
+		if (bucket >= RELAY_HISTOGRAM_BUCKETS) {
+			bucket = RELAY_HISTOGRAM_BUCKETS - 1;
+		}
+		buckets[bucket].add(1);
+		count.add(1);
+		sum.add(value);
+		max.max(value);
+	}
+
+	void snapshot(RelayHistogramSnapshot& out) const;
+
+private:
+	RelayCounter buckets[RELAY_HISTOGRAM_BUCKETS];
+	RelayCounter count;
+	RelayCounter sum;
+	RelayCounter max;
+};
+
+/**
+ * A point in time copy of one or more relay connections' stats.
+ */
+struct RelayStatsSnapshot {
+	RelayStatsSnapshot();
+
+	void merge(const RelayStatsSnapshot& other);
+	napi_value toJS(napi_env env) const;
+
+	uint64_t               connections;
+	uint64_t               bytesRead;
+	uint64_t               framesRead;
+	uint64_t               bytesEmitted;
+	uint64_t               framesEmitted;
+	uint64_t               bytesDropped;
+	uint64_t               framesDropped;
+	uint64_t               framesMalformed;
+	uint64_t               framesMatched;
+	uint64_t               framesFiltered;
+	uint64_t               bytesWritten;
+	uint64_t               pauses;
+	uint64_t               dispatches;
+	uint64_t               queueDepth;
+	uint64_t               maxQueueDepth;
+	uint64_t               queuedBytes;
+	uint64_t               writeQueuedBytes;
+	RelayHistogramSnapshot batchSizes;
+	RelayHistogramSnapshot latency;
+};
+
+/**
+ * Counters for a relay connection. Each counter has exactly one writer: the thread reading from the
+ * device owns the read counters, the thread flushing writes owns `bytesWritten`, and the main
+ * thread owns the rest. Nothing here takes a lock, so the stats are always on.
+ */
+struct RelayStats {
+	void snapshot(RelayStatsSnapshot& out) const;
+
+	// reader thread
+	RelayCounter   bytesRead;
+	RelayCounter   framesRead;
+	RelayCounter   framesMalformed;
+	RelayCounter   framesMatched;
+	RelayCounter   framesFiltered;
+	RelayCounter   maxQueueDepth;
+
+	// writer thread
+	RelayCounter   bytesWritten;
+
+	// main thread
+	RelayCounter   bytesEmitted;
+	RelayCounter   framesEmitted;
+	RelayCounter   bytesDropped;
+	RelayCounter   framesDropped;
+	RelayCounter   pauses;
+	RelayCounter   dispatches;
+	RelayHistogram batchSizes;
+	RelayHistogram latency;
+};
+
+}
+
+#endif
@@ -1,84 +1,92 @@
 #include "relay.h"
 #include <sstream>
+#include <sys/socket.h>
 
 namespace node_ios_device {
 
 /**
- * Initializes the relay connection and wires up the relay message async handler into Node's libuv
- * runloop.
+ * Initializes the socket relay connection for the specified native socket.
  */
-RelayConnection::RelayConnection(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int* fd) :
+SocketRelayConnection::SocketRelayConnection(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int fd, const RelayOptions& options, std::function<int()> connector) :
+	RelayConnection(env, options),
 	fd(fd),
-	env(env),
+	connector(connector),
 	runloop(runloop),
+	reconnectPending(false),
 	socket(NULL),
-	source(NULL) {
-
-	msgQueueUpdate = new uv_async_t;
-}
+	source(NULL) {}
 
 /**
- * Shuts down a relay connection.
+ * Shuts down a socket relay connection.
  */
-RelayConnection::~RelayConnection() {
-	::uv_close(
-		(uv_handle_t*)msgQueueUpdate,
-		[](uv_handle_t* handle) {
-			delete (uv_async_t *)handle;
-		}
-	);
+SocketRelayConnection::~SocketRelayConnection() {
 	disconnect();
 }
 
 /**
- * Adds a listener. If this is the first listener, it increments/refs the libuv async handle so
- * prevent Node from exiting.
+ * Dispatches activity from the relay socket back to the relay connection object.
  */
-void RelayConnection::add(napi_value listener) {
-	napi_ref ref;
-	NAPI_THROW_RETURN("RelayConnection::add", "ERROR_NAPI_CREATE_REFERENCE", ::napi_create_reference(env, listener, 1, &ref), )
-
-	size_t count = 0;
-	{
-		std::lock_guard<std::mutex> lock(listenersLock);
-		listeners.push_back(ref);
-		count = listeners.size();
-	}
+static void relaySocketCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void* data, void* connData) {
+	if (type == kCFSocketWriteCallBack) {
+		std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(connData);
+		if (auto conn = (*ptr).lock()) {
+			static_cast<SocketRelayConnection*>(conn.get())->onWritable();
+		}
+	} else if (type == kCFSocketDataCallBack) {
+		CFDataRef cfdata = (CFDataRef)data;
+		CFIndex size = ::CFDataGetLength(cfdata);
 
-	if (count == 1) {
-		::uv_ref((uv_handle_t*)msgQueueUpdate);
-		connect();
+		std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(connData);
+		if (auto conn = (*ptr).lock()) {
+			if (size > 0) {
+				conn->onData((const char*)::CFDataGetBytePtr(cfdata), (size_t)size);
+			} else {
+				conn->onClose();
+			}
+		}
 	}
 }
 
 /**
- * Dispatches activity from the relay socket back to the relay connection object.
+ * Removes the socket from the run loop and releases it, which closes the native socket. The socket
+ * lock must be held.
  */
-static void relaySocketCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void* data, void* connData) {
-	if (type == kCFSocketDataCallBack) {
-		CFDataRef cfdata = (CFDataRef)data;
-		CFIndex size = ::CFDataGetLength(cfdata);
-
-		std::shared_ptr<RelayConnection>* conn = static_cast<std::shared_ptr<RelayConnection>*>(connData);
-		if (size > 0) {
-			(*conn)->onData((const char*)::CFDataGetBytePtr(cfdata));
-		} else {
-			(*conn)->onClose();
+void SocketRelayConnection::closeSocket() {
+	if (source) {
+		LOG_DEBUG("SocketRelayConnection::closeSocket", "Removing socket source from run loop")
+		if (auto rl = runloop.lock()) {
+			::CFRunLoopRemoveSource(*rl, source, kCFRunLoopCommonModes);
 		}
+		::CFRelease(source);
+		source = NULL;
+	}
+
+	if (socket) {
+		LOG_DEBUG("SocketRelayConnection::closeSocket", "Releasing socket")
+		::CFSocketInvalidate(socket);
+		::CFRelease(socket);
+		socket = NULL;
 	}
 }
 
 /**
  * Connects to the specified native socket and wires up the callback.
  */
-void RelayConnection::connect() {
+void SocketRelayConnection::connect() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
 	CFSocketContext socketCtx = { 0, &self, NULL, NULL, NULL };
 
-	LOG_DEBUG_1("RelayConnection::connect", "Creating socket using specified file descriptor %d", *fd)
+#ifdef SO_NOSIGPIPE
+	// writing to a socket the device has closed must fail instead of raising SIGPIPE
+	int on = 1;
+	::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+	LOG_DEBUG_1("SocketRelayConnection::connect", "Creating socket using specified file descriptor %d", fd)
 	socket = ::CFSocketCreateWithNative(
 		kCFAllocatorDefault,
-		(CFSocketNativeHandle)*fd,
-		kCFSocketDataCallBack,
+		(CFSocketNativeHandle)fd,
+		kCFSocketDataCallBack | kCFSocketWriteCallBack,
 		&relaySocketCallback,
 		&socketCtx
 	);
@@ -87,216 +95,486 @@ void RelayConnection::connect() {
 		throw std::runtime_error("Failed to create socket");
 	}
 
-	LOG_DEBUG("RelayConnection::connect", "Creating run loop source")
+	LOG_DEBUG("SocketRelayConnection::connect", "Creating run loop source")
 	source = ::CFSocketCreateRunLoopSource(kCFAllocatorDefault, socket, 0);
 	if (!source) {
 		throw std::runtime_error("Failed to create socket run loop source");
 	}
 
-	LOG_DEBUG("RelayConnection::connect", "Adding socket source to run loop")
+	LOG_DEBUG("SocketRelayConnection::connect", "Adding socket source to run loop")
 	if (auto rl = runloop.lock()) {
 		::CFRunLoopAddSource(*rl, source, kCFRunLoopCommonModes);
 	}
 }
 
 /**
- * Creates an shared pointer to an instance of the device.
+ * Creates an shared pointer to an instance of the socket relay connection.
  */
-std::shared_ptr<RelayConnection> RelayConnection::create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int* fd) {
-	std::shared_ptr<RelayConnection> conn = std::make_shared<RelayConnection>(env, runloop, fd);
+std::shared_ptr<RelayConnection> SocketRelayConnection::create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int fd, const RelayOptions& options, std::function<int()> connector) {
+	std::shared_ptr<RelayConnection> conn = std::make_shared<SocketRelayConnection>(env, runloop, fd, options, connector);
 	conn->init();
 	return conn;
 }
 
 /**
- * Disconnects the socket and stops listening for incoming data.
+ * Disconnects the socket and stops listening for incoming data. A reconnect that hasn't run on the
+ * run loop thread yet is cancelled.
  */
-void RelayConnection::disconnect() {
-	if (source) {
-		LOG_DEBUG("RelayConnection::disconnect", "Removing socket source from run loop")
-		if (auto rl = runloop.lock()) {
-			::CFRunLoopRemoveSource(*rl, source, kCFRunLoopCommonModes);
-		}
-		::CFRelease(source);
-		source = NULL;
+void SocketRelayConnection::disconnect() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	reconnectPending = false;
+	closeSocket();
+}
+
+/**
+ * Flushes queued writes on the run loop thread. The write callback is not automatically re-enabled,
+ * so it is only re-armed when the socket filled up before everything was written.
+ */
+void SocketRelayConnection::onWritable() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	if (socket && flushWrites(fd)) {
+		::CFSocketEnableCallBacks(socket, kCFSocketWriteCallBack);
 	}
+}
 
+/**
+ * Stops the socket from reading so that unread data backs up in the kernel's socket buffers and
+ * TCP flow control pushes back on the device. The data callback is normally re-enabled after each
+ * read, so automatic re-enabling is turned off until reading resumes.
+ */
+void SocketRelayConnection::pauseReading() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
 	if (socket) {
-		LOG_DEBUG("RelayConnection::disconnect", "Releasing socket")
-		::CFSocketInvalidate(socket);
-		::CFRelease(socket);
-		socket = NULL;
+		::CFSocketSetSocketFlags(socket, ::CFSocketGetSocketFlags(socket) & ~kCFSocketAutomaticallyReenableDataCallBack);
+		::CFSocketDisableCallBacks(socket, kCFSocketDataCallBack);
 	}
 }
 
 /**
- * Notifies all relay connection listeners of new data or the connection ending.
+ * Resumes reading from the socket after the queue has drained.
  */
-void RelayConnection::dispatch() {
-	napi_handle_scope scope;
-	napi_value global, listener, argv[2], rval;
-	int argc;
-
-	NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_OPEN_HANDLE_SCOPE", ::napi_open_handle_scope(env, &scope))
-	NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_GET_GLOBAL", ::napi_get_global(env, &global))
+void SocketRelayConnection::resumeReading() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	if (socket) {
+		::CFSocketSetSocketFlags(socket, ::CFSocketGetSocketFlags(socket) | kCFSocketAutomaticallyReenableDataCallBack);
+		::CFSocketEnableCallBacks(socket, kCFSocketDataCallBack);
+	}
+}
 
-	std::list<napi_value> callbacks;
+/**
+ * Asks the run loop thread to open a new socket to the port on the device in place of the old
+ * one. The connector talks to usbmuxd, so it never runs on the main thread. The outcome is
+ * reported with `onReconnect()`.
+ */
+void SocketRelayConnection::reconnect() {
+	std::shared_ptr<CFRunLoopRef> rl = runloop.lock();
+	if (!connector || !rl) {
+		onReconnect(false);
+		return;
+	}
 
-	// resolves the listener N-API references and caches the JS callback functions in the
-	// `callbacks` list allowing the listener list to be quickly unlocked
 	{
-		std::lock_guard<std::mutex> lock(listenersLock);
-		for (auto const& ref : listeners) {
-			NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, ref, &listener))
-			if (listener != NULL) {
-				callbacks.push_back(listener);
+		std::lock_guard<std::recursive_mutex> lock(socketLock);
+		reconnectPending = true;
+	}
+
+	// the timer holds its own weak pointer since the connection may be gone by the time it fires
+	CFRunLoopTimerContext timerContext = {
+		0,
+		static_cast<void*>(new std::weak_ptr<RelayConnection>(self)),
+		NULL,
+		[](const void* info) {
+			delete static_cast<const std::weak_ptr<RelayConnection>*>(info);
+		},
+		NULL
+	};
+	CFRunLoopTimerRef timer = ::CFRunLoopTimerCreate(
+		kCFAllocatorDefault,
+		CFAbsoluteTimeGetCurrent(),
+		0, // interval
+		0, // flags
+		0, // order
+		[](CFRunLoopTimerRef timer, void* info) {
+			std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(info);
+			if (auto conn = (*ptr).lock()) {
+				static_cast<SocketRelayConnection*>(conn.get())->reconnectNow();
 			}
+		},
+		&timerContext
+	);
+
+	::CFRunLoopAddTimer(*rl, timer, kCFRunLoopCommonModes);
+	::CFRelease(timer);
+}
+
+/**
+ * Tears down the old socket, then opens a new socket to the port on the device and starts reading
+ * from it. This is run on the run loop thread. Reports a failure if the device isn't reachable
+ * yet, and reports nothing if the connection was disconnected in the meantime.
+ */
+void SocketRelayConnection::reconnectNow() {
+	{
+		std::lock_guard<std::recursive_mutex> lock(socketLock);
+		if (!reconnectPending) {
+			return;
 		}
 	}
 
-	if (callbacks.empty()) {
+	int newFd = connector();
+
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	if (!reconnectPending) {
+		if (newFd != -1) {
+			::close(newFd);
+		}
 		return;
 	}
+	reconnectPending = false;
 
-	while (1) {
-		std::shared_ptr<RelayMessage> relayMsg;
-
-		{
-			std::lock_guard<std::mutex> lock(msgQueueLock);
+	if (newFd == -1) {
+		onReconnect(false);
+		return;
+	}
 
-			// flush the relay connection data to the listeners
-			if (msgQueue.empty()) {
-				break;
-			}
+	closeSocket();
+	fd = newFd;
 
-			relayMsg = msgQueue.front();
-			msgQueue.pop();
+	try {
+		connect();
+	} catch (std::exception& e) {
+		LOG_DEBUG_1("SocketRelayConnection::reconnectNow", "%s", e.what())
+		// the socket closes the file descriptor when it's invalidated
+		bool owned = socket != NULL;
+		closeSocket();
+		if (!owned) {
+			::close(fd);
 		}
+		fd = -1;
+		onReconnect(false);
+		return;
+	}
 
-		bool isEnd = strncmp(relayMsg->event, "end", 3) == 0;
+	onReconnect(true);
+}
 
-		argc = 1;
-		NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, relayMsg->event, NAPI_AUTO_LENGTH, &argv[0]))
+/**
+ * Disconnects from the run loop without closing the native socket and hands ownership of it to
+ * the caller. Returns -1 if the socket was already closed.
+ */
+int SocketRelayConnection::release() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	if (socket) {
+		::CFSocketSetSocketFlags(socket, ::CFSocketGetSocketFlags(socket) & ~kCFSocketCloseOnInvalidate);
+	}
+	disconnect();
 
-		if (isEnd) {
-			LOG_DEBUG_1("RelayConnection::dispatch", "Emitting \"%s\" event", relayMsg->event);
-		} else {
-			argc = 2;
-			NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_CREATE_STRING_UTF8", ::napi_create_string_utf8(env, relayMsg->message.c_str(), NAPI_AUTO_LENGTH, &argv[1]))
-		}
+	int released = fd;
+	fd = -1;
+	return released;
+}
 
-		for (auto const& callback : callbacks) {
-			NAPI_THROW("RelayConnection::dispatch", "ERR_NAPI_MAKE_CALLBACK", ::napi_make_callback(env, NULL, global, callback, argc, argv, &rval))
+/**
+ * Asks the run loop to call back once the socket is writable so that the queued writes are flushed
+ * on the run loop thread.
+ */
+void SocketRelayConnection::scheduleWrite() {
+	std::lock_guard<std::recursive_mutex> lock(socketLock);
+	if (socket) {
+		::CFSocketEnableCallBacks(socket, kCFSocketWriteCallBack);
+	}
+}
 
-			if (isEnd) {
-				remove(callback);
-			}
-		}
+/**
+ * Initializes the socket relay group for the specified port.
+ */
+SocketRelayGroup::SocketRelayGroup(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, uint32_t port, const RelayOptions& options, const std::vector<std::string>& udids) :
+	RelayGroup(env, options, udids),
+	port(port),
+	runloop(runloop) {}
 
-		if (isEnd) {
-			disconnect();
-			return;
-		}
+/**
+ * Closes every device's socket.
+ */
+SocketRelayGroup::~SocketRelayGroup() {
+	disconnect();
+}
+
+/**
+ * Dispatches data from one of the group's device sockets back to the relay group.
+ */
+static void relayGroupSocketCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void* data, void* groupData) {
+	if (type != kCFSocketDataCallBack) {
+		return;
+	}
+
+	std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(groupData);
+	if (auto conn = (*ptr).lock()) {
+		CFDataRef cfdata = (CFDataRef)data;
+		static_cast<SocketRelayGroup*>(conn.get())->onSocketData(
+			(int)::CFSocketGetNative(s),
+			(const char*)::CFDataGetBytePtr(cfdata),
+			(size_t)::CFDataGetLength(cfdata)
+		);
 	}
 }
 
 /**
- * Explicit initialization so that we can get a weak pointer based on the shared pointer that
- * created this instance and wire up the libuv callback.
+ * Connects to the port on the device and adds it to the group. Devices that don't belong in the
+ * group, are already attached, or refuse the connection are skipped. This is called from the main
+ * thread when the group starts and from the run loop thread as devices connect.
  */
-void RelayConnection::init() {
-	self = shared_from_this();
+void SocketRelayGroup::attach(const std::string& udid, std::shared_ptr<DeviceInterface> iface) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	if (!iface || !accepts(udid) || attached.count(udid)) {
+		return;
+	}
 
-	uv_loop_t* loop;
-	::napi_get_uv_event_loop(env, &loop);
-	msgQueueUpdate->data = &self;
-	::uv_async_init(loop, msgQueueUpdate, [](uv_async_t* handle) {
-		std::weak_ptr<RelayConnection>* ptr = static_cast<std::weak_ptr<RelayConnection>*>(handle->data);
-		if (auto conn = (*ptr).lock()) {
-			conn->dispatch();
+	int fd = -1;
+	if (::USBMuxConnectByPort(::AMDeviceGetConnectionID(iface->dev), htons(port), &fd) != 0) {
+		if (fd != -1) {
+			::close(fd);
 		}
-	});
-	::uv_unref((uv_handle_t*)msgQueueUpdate);
+		LOG_DEBUG_2("SocketRelayGroup::attach", "Device %s refused port %d, skipping", udid.c_str(), port)
+		return;
+	}
+
+	CFSocketContext socketCtx = { 0, &self, NULL, NULL, NULL };
+	CFSocketRef socket = ::CFSocketCreateWithNative(
+		kCFAllocatorDefault,
+		(CFSocketNativeHandle)fd,
+		kCFSocketDataCallBack,
+		&relayGroupSocketCallback,
+		&socketCtx
+	);
+	if (!socket) {
+		LOG_DEBUG_1("SocketRelayGroup::attach", "Failed to create socket for device %s", udid.c_str())
+		::close(fd);
+		return;
+	}
+
+	CFRunLoopSourceRef source = ::CFSocketCreateRunLoopSource(kCFAllocatorDefault, socket, 0);
+	if (!source) {
+		LOG_DEBUG_1("SocketRelayGroup::attach", "Failed to create socket run loop source for device %s", udid.c_str())
+		// the socket closes the file descriptor when it's invalidated
+		::CFSocketInvalidate(socket);
+		::CFRelease(socket);
+		return;
+	}
+
+	// a device joining while the queue is full waits with the others
+	if (paused.load(std::memory_order_acquire)) {
+		::CFSocketSetSocketFlags(socket, ::CFSocketGetSocketFlags(socket) & ~kCFSocketAutomaticallyReenableDataCallBack);
+		::CFSocketDisableCallBacks(socket, kCFSocketDataCallBack);
+	}
+
+	sockets[attachSource(udid)] = SourceSocket{ fd, socket, source };
+
+	if (auto rl = runloop.lock()) {
+		::CFRunLoopAddSource(*rl, source, kCFRunLoopCommonModes);
+	}
 }
 
 /**
- * Creates an "end" message and queues it.
+ * Removes the device's socket from the run loop and closes it.
  */
-void RelayConnection::onClose() {
-	{
-		std::lock_guard<std::mutex> lock(msgQueueLock);
-		msgQueue.push(std::make_shared<RelayMessage>("end"));
+void SocketRelayGroup::closeSource(uint32_t source) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	auto it = sockets.find(source);
+	if (it == sockets.end()) {
+		return;
 	}
-	::uv_async_send(msgQueueUpdate);
+
+	if (auto rl = runloop.lock()) {
+		::CFRunLoopRemoveSource(*rl, it->second.source, kCFRunLoopCommonModes);
+	}
+	::CFRelease(it->second.source);
+	::CFSocketInvalidate(it->second.socket);
+	::CFRelease(it->second.socket);
+	sockets.erase(it);
 }
 
 /**
- * Creates an "data" message for each line and queues it.
+ * Devices are attached by the device manager, so there is nothing to connect up front.
  */
-void RelayConnection::onData(const char* data) {
-	std::string buffer;
-	bool changed = false;
+void SocketRelayGroup::connect() {}
 
-	{
-		std::lock_guard<std::mutex> lock(msgQueueLock);
-
-		for (; *data; ++data) {
-			if (*data == '\0' || *data == '\r' || *data == '\n') {
-				if (!buffer.empty()) {
-					msgQueue.push(std::make_shared<RelayMessage>("data", buffer));
-					changed = true;
-					buffer.clear();
-				}
+/**
+ * Creates a shared pointer to an instance of the socket relay group.
+ */
+std::shared_ptr<SocketRelayGroup> SocketRelayGroup::create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, uint32_t port, const RelayOptions& options, const std::vector<std::string>& udids) {
+	std::shared_ptr<SocketRelayGroup> group = std::make_shared<SocketRelayGroup>(env, runloop, port, options, udids);
+	group->init();
+	return group;
+}
+
+/**
+ * Closes every device's socket without queuing "detach" frames since nobody is listening anymore.
+ */
+void SocketRelayGroup::disconnect() {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	if (!sockets.empty()) {
+		LOG_DEBUG_1("SocketRelayGroup::disconnect", "Closing %zu device sockets", sockets.size())
+	}
+	while (!sockets.empty()) {
+		closeSource(sockets.begin()->first);
+	}
+	framers.clear();
+	attached.clear();
+}
+
+/**
+ * Hands data read from a device's socket to its source, or detaches the device once the socket has
+ * been closed.
+ */
+void SocketRelayGroup::onSocketData(int fd, const char* data, size_t length) {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	for (auto const& it : sockets) {
+		if (it.second.fd == fd) {
+			if (length > 0) {
+				onSourceData(it.first, data, length);
 			} else {
-				buffer += *data;
+				onSourceClose(it.first);
 			}
+			return;
 		}
+	}
+}
 
-		if (!buffer.empty()) {
-			msgQueue.push(std::make_shared<RelayMessage>("data", buffer));
-			changed = true;
-		}
+/**
+ * Stops every device's socket from reading until the queue has drained.
+ */
+void SocketRelayGroup::pauseReading() {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	for (auto const& it : sockets) {
+		::CFSocketSetSocketFlags(it.second.socket, ::CFSocketGetSocketFlags(it.second.socket) & ~kCFSocketAutomaticallyReenableDataCallBack);
+		::CFSocketDisableCallBacks(it.second.socket, kCFSocketDataCallBack);
 	}
+}
 
-	if (changed) {
-		::uv_async_send(msgQueueUpdate);
+/**
+ * Resumes reading from every device's socket.
+ */
+void SocketRelayGroup::resumeReading() {
+	std::lock_guard<std::recursive_mutex> lock(sourcesLock);
+	for (auto const& it : sockets) {
+		::CFSocketSetSocketFlags(it.second.socket, ::CFSocketGetSocketFlags(it.second.socket) | kCFSocketAutomaticallyReenableDataCallBack);
+		::CFSocketEnableCallBacks(it.second.socket, kCFSocketDataCallBack);
 	}
 }
 
 /**
- * Removes a callback from the relay connection. Once there are no more listeners, it
- * decrements/unrefs the libuv async handle to all Node to exit.
+ * Initializes the port proxy for the device with the specified usbmuxd connection id.
  */
-void RelayConnection::remove(napi_value listener) {
-	std::lock_guard<std::mutex> lock(listenersLock);
+SocketPortProxy::SocketPortProxy(std::weak_ptr<CFRunLoopRef> runloop, uint32_t connectionId, uint32_t devicePort, uint32_t localPort) :
+	PortProxy(devicePort, localPort),
+	runloop(runloop),
+	connectionId(connectionId) {}
 
-	for (auto it = listeners.begin(); it != listeners.end(); ) {
-		napi_value callback;
-		NAPI_THROW("RelayConnection::remove", "ERR_NAPI_GET_REFERENCE_VALUE", ::napi_get_reference_value(env, *it, &callback))
+/**
+ * Closes the listening socket and all client sessions.
+ */
+SocketPortProxy::~SocketPortProxy() {
+	stop();
+}
 
-		bool same;
-		NAPI_THROW("RelayConnection::remove", "ERR_NAPI_STRICT_EQUALS", ::napi_strict_equals(env, callback, listener, &same))
+/**
+ * Dispatches socket readiness from the run loop back to the port proxy.
+ */
+static void proxySocketCallback(CFSocketRef s, CFSocketCallBackType type, CFDataRef address, const void* data, void* proxyData) {
+	std::weak_ptr<PortProxy>* ptr = static_cast<std::weak_ptr<PortProxy>*>(proxyData);
+	if (auto proxy = (*ptr).lock()) {
+		int fd = (int)::CFSocketGetNative(s);
+		if (type == kCFSocketReadCallBack) {
+			proxy->onReadable(fd);
+		} else if (type == kCFSocketWriteCallBack) {
+			proxy->onWritable(fd);
+		}
+	}
+}
 
-		if (same) {
-			LOG_DEBUG("RelayConnection::remove", "Removing listener")
-			it = listeners.erase(it);
-		} else {
-			++it;
+/**
+ * Opens a new connection to the port on the device. Returns -1 if the device refused it.
+ */
+int SocketPortProxy::connectDevice() {
+	int fd = -1;
+	if (::USBMuxConnectByPort(connectionId, htons(devicePort), &fd) != 0) {
+		if (fd != -1) {
+			::close(fd);
 		}
+		return -1;
 	}
+	return fd;
+}
 
-	if (listeners.size() == 0) {
-		::uv_unref((uv_handle_t*)msgQueueUpdate);
-		disconnect();
+/**
+ * Creates a shared pointer to a port proxy and starts listening on the local port.
+ */
+std::shared_ptr<PortProxy> SocketPortProxy::create(std::weak_ptr<CFRunLoopRef> runloop, uint32_t connectionId, uint32_t devicePort, uint32_t localPort) {
+	std::shared_ptr<PortProxy> proxy = std::make_shared<SocketPortProxy>(runloop, connectionId, devicePort, localPort);
+	proxy->init();
+	proxy->start();
+	return proxy;
+}
+
+/**
+ * Removes the file descriptor's socket from the run loop. The file descriptor itself is closed by
+ * the port proxy.
+ */
+void SocketPortProxy::unwatch(int fd) {
+	auto it = watches.find(fd);
+	if (it == watches.end()) {
+		return;
+	}
+
+	if (auto rl = runloop.lock()) {
+		::CFRunLoopRemoveSource(*rl, it->second.source, kCFRunLoopCommonModes);
 	}
+	::CFRelease(it->second.source);
+	::CFSocketInvalidate(it->second.socket);
+	::CFRelease(it->second.socket);
+	watches.erase(it);
 }
 
 /**
- * Returns the number of listeners for this relay connection.
+ * Sets which callbacks are enabled for the file descriptor, wrapping it in a CFSocket and adding it
+ * to the run loop the first time it is watched. Neither callback is automatically re-enabled, so
+ * each one fires once per call to this function.
  */
-uint32_t RelayConnection::size() {
-	std::lock_guard<std::mutex> lock(listenersLock);
-	return listeners.size();
+void SocketPortProxy::watch(int fd, bool read, bool write) {
+	auto it = watches.find(fd);
+
+	if (it == watches.end()) {
+		CFSocketContext socketCtx = { 0, &self, NULL, NULL, NULL };
+		CFSocketRef socket = ::CFSocketCreateWithNative(
+			kCFAllocatorDefault,
+			(CFSocketNativeHandle)fd,
+			kCFSocketReadCallBack | kCFSocketWriteCallBack,
+			&proxySocketCallback,
+			&socketCtx
+		);
+		if (!socket) {
+			LOG_DEBUG_1("SocketPortProxy::watch", "Failed to create socket for file descriptor %d", fd)
+			return;
+		}
+
+		::CFSocketSetSocketFlags(socket, ::CFSocketGetSocketFlags(socket) & ~(kCFSocketAutomaticallyReenableReadCallBack | kCFSocketCloseOnInvalidate));
+
+		CFRunLoopSourceRef source = ::CFSocketCreateRunLoopSource(kCFAllocatorDefault, socket, 0);
+		if (auto rl = runloop.lock()) {
+			::CFRunLoopAddSource(*rl, source, kCFRunLoopCommonModes);
+		}
+
+		it = watches.insert(std::make_pair(fd, SocketWatch{ socket, source })).first;
+	}
+
+	CFOptionFlags disable = (read ? 0 : kCFSocketReadCallBack) | (write ? 0 : kCFSocketWriteCallBack);
+	CFOptionFlags enable = (read ? kCFSocketReadCallBack : 0) | (write ? kCFSocketWriteCallBack : 0);
+	if (disable) {
+		::CFSocketDisableCallBacks(it->second.socket, disable);
+	}
+	if (enable) {
+		::CFSocketEnableCallBacks(it->second.socket, enable);
+	}
 }
 
 /**
@@ -310,12 +588,58 @@ Relay::Relay(napi_env env, std::weak_ptr<CFRunLoopRef> runloop) :
  * Intializes a port relay instance along with its base class.
  */
 PortRelay::PortRelay(napi_env env, std::weak_ptr<CFRunLoopRef> runloop) :
-	Relay(env, runloop) {}
+	Relay(env, runloop),
+	target(std::make_shared<ReconnectTarget>()) {}
+
+/**
+ * Opens a new socket to the port on the device through usbmuxd.
+ */
+static int connectPort(uint32_t port, std::shared_ptr<DeviceInterface> iface) {
+	uint32_t id = ::AMDeviceGetConnectionID(iface->dev);
+	int fd = -1;
+
+	LOG_DEBUG_1("PortRelay::connect", "Trying to connect to port %d", port);
+	if (::USBMuxConnectByPort(id, htons(port), &fd) != 0) {
+		::close(fd);
+		std::stringstream error;
+		error << "Failed to connect to port " << port;
+		throw std::runtime_error(error.str());
+	}
+	LOG_DEBUG("PortRelay::connect", "Connected");
+
+	return fd;
+}
+
+/**
+ * Sets the device interface that relay connections reconnect through, or clears it when the device
+ * disconnects. When the device comes back, every relay connection waiting to reconnect is woken
+ * up. This is called from the run loop thread.
+ */
+void PortRelay::attach(std::shared_ptr<DeviceInterface> iface) {
+	{
+		std::lock_guard<std::mutex> lock(target->lock);
+		target->usb = iface;
+	}
+
+	if (!iface) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(resumableLock);
+	for (auto it = resumable.begin(); it != resumable.end(); ) {
+		if (auto conn = it->lock()) {
+			conn->wake();
+			++it;
+		} else {
+			it = resumable.erase(it);
+		}
+	}
+}
 
 /**
  * Adds or removes a listener to the specified port's relay connection.
  */
-void PortRelay::config(uint8_t action, napi_value nport, napi_value listener, std::shared_ptr<DeviceInterface> iface) {
+void PortRelay::config(uint8_t action, napi_value nport, napi_value listener, napi_value options, std::shared_ptr<DeviceInterface> iface) {
 	uint32_t port = 0;
 	napi_status status = ::napi_get_value_uint32(env, nport, &port);
 	if (status == napi_number_expected || status != napi_ok || port < 1 || port > 65535) {
@@ -326,37 +650,325 @@ void PortRelay::config(uint8_t action, napi_value nport, napi_value listener, st
 	auto it = connections.find(port);
 
 	if (action == RELAY_START) {
-		if (it == connections.end()) {
-			// port relay connection does not exist, so create it
-			uint32_t id = ::AMDeviceGetConnectionID(iface->dev);
-			int fd = -1;
+		RelayOptions opts = RelayOptions::parse(env, options);
 
-			LOG_DEBUG_1("PortRelay::config", "Trying to connect to port %d", port);
-			if (::USBMuxConnectByPort(id, htons(port), &fd) != 0) {
-				::close(fd);
-				std::stringstream error;
-				error << "Failed to connect to port " << port;
-				throw std::runtime_error(error.str());
+		// a connection that has ended has already dropped its listeners and closed its socket, so
+		// it's discarded and a new one is opened in its place
+		if (it != connections.end() && it->second->size() == 0) {
+			LOG_DEBUG_1("PortRelay::config", "Relay connection for port %d has ended, removing", port)
+			unregister(it->second);
+			connections.erase(it);
+			it = connections.end();
+		}
+		auto range = sessions.equal_range(port);
+		for (auto session = range.first; session != range.second;) {
+			if (session->second->size() == 0) {
+				unregister(session->second);
+				session = sessions.erase(session);
+			} else {
+				++session;
 			}
-			LOG_DEBUG("PortRelay::config", "Connected");
+		}
+
+		pool.reserve(port, opts.poolSize);
 
-			conn = RelayConnection::create(env, runloop, &fd);
+		if (opts.exclusive) {
+			LOG_DEBUG_1("PortRelay::config", "Creating exclusive relay connection for port %d", port)
+			conn = open(port, opts, iface);
+			sessions.insert(std::make_pair(port, conn));
+		} else if (it == connections.end()) {
+			// port relay connection does not exist, so create it
+			conn = open(port, opts, iface);
 			connections.insert(std::make_pair(port, conn));
 		} else {
 			conn = it->second;
+
+			// listeners share the port's connection, so they must agree on how the data is framed
+			if (conn->getOptions() != opts) {
+				std::stringstream error;
+				error << "Port " << port << " is already being forwarded using different options";
+				throw std::runtime_error(error.str());
+			}
 		}
 
 		LOG_DEBUG("PortRelay::config", "Adding listener to port relay connection")
 		conn->add(listener);
 
-	} else if (it != connections.end()) {
+	} else if (it != connections.end() && it->second->has(listener)) {
+		if (it->second->size() == 1) {
+			recycle(port, it->second);
+		}
+
 		LOG_DEBUG("PortRelay::config", "Removing listener from port relay connection")
 		it->second->remove(listener);
 
 		if (it->second->size() == 0) {
 			LOG_DEBUG("PortRelay::config", "Connection has no more listeners, removing")
+			unregister(it->second);
 			connections.erase(it);
 		}
+
+	} else {
+		auto range = sessions.equal_range(port);
+		for (auto session = range.first; session != range.second; ++session) {
+			if (session->second->has(listener)) {
+				LOG_DEBUG_1("PortRelay::config", "Removing exclusive relay connection for port %d", port)
+				recycle(port, session->second);
+				session->second->remove(listener);
+				unregister(session->second);
+				sessions.erase(session);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Returns a socket connected to the port on the device. An idle socket from the pool is used if
+ * there is one that the device hasn't closed, otherwise a new connection is made through usbmuxd.
+ */
+int PortRelay::connect(uint32_t port, std::shared_ptr<DeviceInterface> iface) {
+	return pool.acquire(port, [port, iface]() { return connectPort(port, iface); });
+}
+
+/**
+ * Disconnects the relay connections that reconnect, which also cancels any reconnect that hasn't
+ * run on the run loop thread yet, and stops them from reconnecting through the device. This is
+ * called when the Node environment that owns the port relay goes away.
+ */
+void PortRelay::disconnect() {
+	{
+		std::lock_guard<std::mutex> lock(target->lock);
+		target->usb = nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(resumableLock);
+	for (auto const& it : resumable) {
+		if (auto conn = it.lock()) {
+			conn->disconnect();
+		}
+	}
+	resumable.clear();
+}
+
+/**
+ * Returns true if any relay connection will try to reconnect once the device comes back, in which
+ * case the device must be kept around after it disconnects. This is called from the run loop
+ * thread.
+ */
+bool PortRelay::isResumable() {
+	std::lock_guard<std::mutex> lock(resumableLock);
+	for (auto const& it : resumable) {
+		if (!it.expired()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Creates a relay connection for the port. Connections with the reconnect option are tracked so
+ * that they can be woken up when the device comes back, and reconnect through whichever device
+ * interface is attached at the time. Their connector runs on the run loop thread, so it only holds
+ * on to the reconnect target and never touches the idle pool.
+ */
+std::shared_ptr<RelayConnection> PortRelay::open(uint32_t port, const RelayOptions& opts, std::shared_ptr<DeviceInterface> iface) {
+	int fd = connect(port, iface);
+	std::function<int()> connector;
+
+	if (opts.reconnect) {
+		std::weak_ptr<ReconnectTarget> weakTarget = target;
+		connector = [weakTarget, port]() {
+			std::shared_ptr<ReconnectTarget> owner = weakTarget.lock();
+			if (!owner) {
+				return -1;
+			}
+			std::shared_ptr<DeviceInterface> current;
+			{
+				std::lock_guard<std::mutex> lock(owner->lock);
+				current = owner->usb;
+			}
+			if (!current) {
+				return -1;
+			}
+			try {
+				return connectPort(port, current);
+			} catch (std::exception& e) {
+				LOG_DEBUG_1("PortRelay::open", "%s", e.what())
+				return -1;
+			}
+		};
+	}
+
+	std::shared_ptr<RelayConnection> conn;
+	try {
+		conn = SocketRelayConnection::create(env, runloop, fd, opts, connector);
+	} catch (...) {
+		// the relay connection never took ownership of the socket, such as when the capture file
+		// couldn't be created
+		::close(fd);
+		throw;
+	}
+
+	if (opts.reconnect) {
+		std::lock_guard<std::mutex> lock(resumableLock);
+		resumable.push_back(conn);
+	}
+
+	return conn;
+}
+
+/**
+ * Parks the relay connection's socket in the port's idle pool if there is room and the connection
+ * can be reused. Otherwise the socket is closed when the relay connection disconnects.
+ */
+void PortRelay::recycle(uint32_t port, std::shared_ptr<RelayConnection> conn) {
+	if (!pool.hasRoom(port) || !conn->isReusable()) {
+		return;
+	}
+
+	int fd = static_cast<SocketRelayConnection*>(conn.get())->release();
+	if (fd != -1) {
+		pool.park(port, fd);
+	}
+}
+
+/**
+ * Finds the relay connection for the listener on the specified port, preferring the listener's
+ * exclusive connection over the port's shared connection.
+ */
+std::shared_ptr<RelayConnection> PortRelay::find(napi_value nport, napi_value listener) {
+	uint32_t port = 0;
+	napi_status status = ::napi_get_value_uint32(env, nport, &port);
+	if (status != napi_ok || port < 1 || port > 65535) {
+		throw std::runtime_error("Expected port to be a number between 1 and 65535");
+	}
+
+	auto range = sessions.equal_range(port);
+	for (auto session = range.first; session != range.second; ++session) {
+		if (session->second->has(listener)) {
+			return session->second;
+		}
+	}
+
+	auto it = connections.find(port);
+	if (it == connections.end()) {
+		std::stringstream error;
+		error << "Port " << port << " is not being forwarded";
+		throw std::runtime_error(error.str());
+	}
+
+	return it->second;
+}
+
+/**
+ * Returns the stats for the listener's relay connection on the specified port.
+ */
+napi_value PortRelay::stats(napi_value nport, napi_value listener) {
+	return find(nport, listener)->getStats().toJS(env);
+}
+
+/**
+ * Adds the stats of every relay connection to the total.
+ */
+void PortRelay::stats(RelayStatsSnapshot& total) {
+	for (auto const& it : connections) {
+		total.merge(it.second->getStats());
+	}
+	for (auto const& it : sessions) {
+		total.merge(it.second->getStats());
+	}
+}
+
+/**
+ * Stops tracking a relay connection that has been removed.
+ */
+void PortRelay::unregister(std::shared_ptr<RelayConnection> conn) {
+	std::lock_guard<std::mutex> lock(resumableLock);
+	for (auto it = resumable.begin(); it != resumable.end(); ) {
+		auto other = it->lock();
+		if (!other || other == conn) {
+			it = resumable.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+/**
+ * Queues data to be written to the listener's relay connection on the specified port. Returns
+ * false if the caller should wait for the "writeDrain" event before writing more.
+ */
+bool PortRelay::write(napi_value nport, napi_value listener, napi_value data, napi_value callback) {
+	return find(nport, listener)->write(data, callback);
+}
+
+/**
+ * Intializes a syslog relay instance along with its base class.
+ */
+SyslogRelay::SyslogRelay(napi_env env, std::weak_ptr<CFRunLoopRef> runloop) :
+	Relay(env, runloop) {}
+
+/**
+ * Adds or removes a listener to the syslog relay connection. The syslog relay service is started
+ * when the first listener is added and its socket is closed when the last listener is removed.
+ */
+void SyslogRelay::config(uint8_t action, napi_value listener, napi_value options, std::shared_ptr<DeviceInterface> iface) {
+	if (action == RELAY_START) {
+		RelayOptions opts = RelayOptions::parseSyslog(env, options);
+
+		// once the syslog service ends, the connection has dropped its listeners and closed its
+		// socket, so the service is started again
+		if (connection && connection->size() == 0) {
+			LOG_DEBUG("SyslogRelay::config", "Syslog relay connection has ended, removing")
+			connection = nullptr;
+		}
+
+		if (!connection) {
+			service_conn_t fd = 0;
+			iface->startService(AMSVC_SYSLOG_RELAY, &fd);
+
+			LOG_DEBUG("SyslogRelay::config", "Creating syslog relay connection")
+			try {
+				connection = SocketRelayConnection::create(env, runloop, (int)fd, opts);
+			} catch (...) {
+				::close((int)fd);
+				throw;
+			}
+		} else if (connection->getOptions() != opts) {
+			throw std::runtime_error("Syslog is already being relayed using different options");
+		}
+
+		LOG_DEBUG("SyslogRelay::config", "Adding listener to syslog relay connection")
+		connection->add(listener);
+
+	} else if (connection && connection->has(listener)) {
+		LOG_DEBUG("SyslogRelay::config", "Removing listener from syslog relay connection")
+		connection->remove(listener);
+
+		if (connection->size() == 0) {
+			LOG_DEBUG("SyslogRelay::config", "Connection has no more listeners, removing")
+			connection = nullptr;
+		}
+	}
+}
+
+/**
+ * Returns the stats for the syslog relay connection.
+ */
+napi_value SyslogRelay::stats(napi_value listener) {
+	if (!connection || !connection->has(listener)) {
+		throw std::runtime_error("Syslog is not being relayed");
+	}
+	return connection->getStats().toJS(env);
+}
+
+/**
+ * Adds the stats of the syslog relay connection to the total.
+ */
+void SyslogRelay::stats(RelayStatsSnapshot& total) {
+	if (connection) {
+		total.merge(connection->getStats());
 	}
 }
 
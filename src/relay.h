@@ -4,66 +4,134 @@
 #include "node-ios-device.h"
 #include "device-interface.h"
 #include "mobiledevice.h"
+#include "port-proxy.h"
+#include "relay-connection.h"
+#include "relay-group.h"
+#include "relay-socket-pool.h"
 #include <CoreFoundation/CoreFoundation.h>
+#include <functional>
 #include <list>
 #include <map>
 #include <mutex>
-#include <queue>
-#include <uv.h>
+#include <string>
+#include <vector>
 
 namespace node_ios_device {
 
 class DeviceInterface;
 
 /**
- * A message containing an event and relay message. Instances are created on the background thread,
- * then pushed into the queue where the main thread is notified via libuv to emit the queued
- * messages.
+ * A relay connection backed by a native socket connected to a port on the device. The socket is
+ * scheduled on the device manager's CoreFoundation run loop where incoming data is handed to
+ * `onData()` and queued writes are flushed whenever the socket is writable.
+ *
+ * Connections that reconnect are given a connector that opens a new socket to the same port, or
+ * returns -1 if the device isn't reachable yet. The connector runs on the run loop thread, which is
+ * also where the old socket is torn down. The socket and its file descriptor are guarded by a lock
+ * since the main thread also disconnects, pauses, and writes to them.
  */
-struct RelayMessage {
-	RelayMessage(const char* event) : event(event) {}
-	RelayMessage(const char* event, std::string& message) : event(event), message(message) {}
-	const char* event;
-	std::string message;
+class SocketRelayConnection : public RelayConnection {
+public:
+	SocketRelayConnection(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int fd, const RelayOptions& options, std::function<int()> connector);
+	virtual ~SocketRelayConnection();
+
+	static std::shared_ptr<RelayConnection> create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int fd, const RelayOptions& options, std::function<int()> connector = nullptr);
+
+	void disconnect();
+	void onWritable();
+	int release();
+
+protected:
+	void closeSocket();
+	void connect();
+	void pauseReading();
+	void reconnect();
+	void reconnectNow();
+	void resumeReading();
+	void scheduleWrite();
+
+	int                         fd;
+	std::function<int()>        connector;
+	std::weak_ptr<CFRunLoopRef> runloop;
+	std::recursive_mutex        socketLock;
+	bool                        reconnectPending;
+	CFSocketRef                 socket;
+	CFRunLoopSourceRef          source;
 };
 
 /**
- * A socket connection to a device where incoming data is put in a `RelayMessage` object and queued
- * for emitting.
- *
- * This class contains the list of relay listeners and handles notifying them when new relay
- * messages come in.
+ * A relay group that reads the same port on every attached device. Each device gets a socket of its
+ * own connected through usbmuxd, and all of them are scheduled on the device manager's run loop so
+ * that every source is read on the same thread.
  */
-class RelayConnection : public std::enable_shared_from_this<RelayConnection> {
+class SocketRelayGroup : public RelayGroup {
 public:
-	RelayConnection(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int* fd);
-	virtual ~RelayConnection();
+	SocketRelayGroup(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, uint32_t port, const RelayOptions& options, const std::vector<std::string>& udids);
+	virtual ~SocketRelayGroup();
 
-	static std::shared_ptr<RelayConnection> create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, int* fd);
+	static std::shared_ptr<SocketRelayGroup> create(napi_env env, std::weak_ptr<CFRunLoopRef> runloop, uint32_t port, const RelayOptions& options, const std::vector<std::string>& udids);
 
-	void add(napi_value listener);
+	void attach(const std::string& udid, std::shared_ptr<DeviceInterface> iface);
 	void disconnect();
-	void dispatch();
-	void init();
-	void onClose();
-	void onData(const char* data);
-	void remove(napi_value listener);
-	uint32_t size();
+	void onSocketData(int fd, const char* data, size_t length);
 
 protected:
+	/**
+	 * A device's socket and its run loop source.
+	 */
+	struct SourceSocket {
+		int                fd;
+		CFSocketRef        socket;
+		CFRunLoopSourceRef source;
+	};
+
+	void closeSource(uint32_t source);
 	void connect();
+	void pauseReading();
+	void resumeReading();
+
+	uint32_t                         port;
+	std::weak_ptr<CFRunLoopRef>      runloop;
+	std::map<uint32_t, SourceSocket> sockets;
+};
+
+/**
+ * A port proxy whose sockets are scheduled on the device manager's CoreFoundation run loop and
+ * whose device connections are opened through usbmuxd. Each file descriptor is wrapped in its own
+ * CFSocket so that read and write callbacks can be toggled per socket.
+ */
+class SocketPortProxy : public PortProxy {
+public:
+	SocketPortProxy(std::weak_ptr<CFRunLoopRef> runloop, uint32_t connectionId, uint32_t devicePort, uint32_t localPort);
+	virtual ~SocketPortProxy();
+
+	static std::shared_ptr<PortProxy> create(std::weak_ptr<CFRunLoopRef> runloop, uint32_t connectionId, uint32_t devicePort, uint32_t localPort);
+
+protected:
+	/**
+	 * A CoreFoundation socket and its run loop source for one of the proxy's file descriptors.
+	 */
+	struct SocketWatch {
+		CFSocketRef        socket;
+		CFRunLoopSourceRef source;
+	};
+
+	int connectDevice();
+	void unwatch(int fd);
+	void watch(int fd, bool read, bool write);
+
+	std::weak_ptr<CFRunLoopRef> runloop;
+	uint32_t                    connectionId;
+	std::map<int, SocketWatch>  watches;
+};
 
-	std::weak_ptr<RelayConnection> self;
-	int*                           fd;
-	napi_env                       env;
-	std::mutex                     listenersLock;
-	std::list<napi_ref>            listeners;
-	std::weak_ptr<CFRunLoopRef>    runloop;
-	CFSocketRef                    socket;
-	CFRunLoopSourceRef             source;
-	std::mutex                     msgQueueLock;
-	uv_async_t*                    msgQueueUpdate;
-	std::queue<std::shared_ptr<RelayMessage>> msgQueue;
+/**
+ * The device interface that a port relay's connections reconnect through. It's shared with their
+ * connectors, which run on the run loop thread and may outlive the port relay.
+ */
+struct ReconnectTarget {
+	std::mutex                       lock;
+	std::shared_ptr<DeviceInterface> usb;
 };
 
 /**
@@ -82,16 +150,62 @@ protected:
 /**
  * Implementation for relaying data from a socket connected to a port on the device.
  *
- * This manages a relay connection for each port. You can still have multiple listeners per port,
- * but that is handled in the `RelayConnection` object.
+ * By default, this manages one shared relay connection for each port. You can still have multiple
+ * listeners per port, but that is handled in the `RelayConnection` object. Exclusive listeners get
+ * a relay connection of their own so that independent sessions can talk to the same port.
+ *
+ * When a relay connection is stopped, its socket can be parked in the idle socket pool instead of
+ * being closed. The next relay connection for that port takes an idle socket before asking usbmuxd
+ * for a new one.
+ *
+ * Relay connections started with the reconnect option keep their listeners when the device goes
+ * away. The device interface they reconnect through is swapped by `attach()` as the device comes
+ * and goes, which also wakes them up so that they reconnect right away. Reconnects always open a
+ * new socket through usbmuxd since the idle sockets went away with the device, which also keeps the
+ * idle pool on the main thread.
  */
 class PortRelay : public Relay {
 public:
 	PortRelay(napi_env env, std::weak_ptr<CFRunLoopRef> runloop);
-	void config(uint8_t action, napi_value nport, napi_value listener, std::shared_ptr<DeviceInterface> iface);
+
+	void attach(std::shared_ptr<DeviceInterface> iface);
+	void config(uint8_t action, napi_value nport, napi_value listener, napi_value options, std::shared_ptr<DeviceInterface> iface);
+	void disconnect();
+	bool isResumable();
+	napi_value stats(napi_value nport, napi_value listener);
+	void stats(RelayStatsSnapshot& total);
+	bool write(napi_value nport, napi_value listener, napi_value data, napi_value callback);
+
+protected:
+	int connect(uint32_t port, std::shared_ptr<DeviceInterface> iface);
+	std::shared_ptr<RelayConnection> find(napi_value nport, napi_value listener);
+	std::shared_ptr<RelayConnection> open(uint32_t port, const RelayOptions& opts, std::shared_ptr<DeviceInterface> iface);
+	void recycle(uint32_t port, std::shared_ptr<RelayConnection> conn);
+	void unregister(std::shared_ptr<RelayConnection> conn);
+
+	std::map<uint32_t, std::shared_ptr<RelayConnection>>      connections;
+	std::multimap<uint32_t, std::shared_ptr<RelayConnection>> sessions;
+	RelaySocketPool                                           pool;
+	std::shared_ptr<ReconnectTarget>                          target;
+	std::mutex                                                resumableLock;
+	std::list<std::weak_ptr<RelayConnection>>                 resumable;
+};
+
+/**
+ * Implementation for relaying the device's syslog. The `com.apple.syslog_relay` service streams
+ * NUL terminated records, so the relay connection always frames on NUL regardless of the options.
+ * All listeners share one relay connection to the service, and must agree on the options.
+ */
+class SyslogRelay : public Relay {
+public:
+	SyslogRelay(napi_env env, std::weak_ptr<CFRunLoopRef> runloop);
+
+	void config(uint8_t action, napi_value listener, napi_value options, std::shared_ptr<DeviceInterface> iface);
+	napi_value stats(napi_value listener);
+	void stats(RelayStatsSnapshot& total);
 
 protected:
-	std::map<uint32_t, std::shared_ptr<RelayConnection>> connections;
+	std::shared_ptr<RelayConnection> connection;
 };
 
 }
@@ -0,0 +1,78 @@
+#include "watch-batch.h"
+#include <map>
+
+namespace node_ios_device {
+
+/**
+ * Folds pending changes into at most one change per device, in the order the devices first
+ * changed. A device that attached and detached again is dropped, one that detached and attached
+ * again is an update, and the interface is the one that changed last.
+ */
+static std::vector<DeviceChange> foldChanges(const std::vector<DeviceChange>& pending) {
+	std::vector<DeviceChange> last;
+	std::vector<bool> existed;
+	std::map<std::string, size_t> index;
+
+	for (auto const& change : pending) {
+		auto it = index.find(change.udid);
+		if (it == index.end()) {
+			index.insert(std::make_pair(change.udid, last.size()));
+			last.push_back(change);
+			existed.push_back(change.type != AttachChange);
+		} else {
+			last[it->second] = change;
+		}
+	}
+
+	std::vector<DeviceChange> folded;
+	for (size_t i = 0; i < last.size(); ++i) {
+		bool exists = last[i].type != DetachChange;
+		if (existed[i] || exists) {
+			DeviceChangeType type = !existed[i] ? AttachChange : !exists ? DetachChange : UpdateChange;
+			folded.push_back({ type, last[i].udid, last[i].iface });
+		}
+	}
+
+	return folded;
+}
+
+/**
+ * Initializes an empty batch that's sent as soon as it has changes.
+ */
+WatchBatch::WatchBatch() : coalesce(0), throttle(0), lastEmit(0) {}
+
+/**
+ * Adds changes to the batch and returns the number of milliseconds to wait before taking it, which
+ * is the coalescing window or the rest of the throttle, whichever is longer. Returns 0 if the batch
+ * can be taken right away.
+ */
+uint64_t WatchBatch::add(const std::vector<DeviceChange>& changes, uint64_t now) {
+	pending.insert(pending.end(), changes.begin(), changes.end());
+
+	uint64_t delay = coalesce;
+	uint64_t elapsed = now - lastEmit;
+	if (throttle > 0 && elapsed < throttle && throttle - elapsed > delay) {
+		delay = throttle - elapsed;
+	}
+	return delay;
+}
+
+/**
+ * Drops the pending changes and starts the throttle over, such as when the listener is sent every
+ * connected device instead.
+ */
+void WatchBatch::reset(uint64_t now) {
+	lastEmit = now;
+	pending.clear();
+}
+
+/**
+ * Returns the pending changes folded into one change per device and starts the throttle over.
+ */
+std::vector<DeviceChange> WatchBatch::take(uint64_t now) {
+	std::vector<DeviceChange> folded = foldChanges(pending);
+	reset(now);
+	return folded;
+}
+
+}
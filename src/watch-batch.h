@@ -0,0 +1,41 @@
+#ifndef __WATCH_BATCH_H__
+#define __WATCH_BATCH_H__
+
+#include "node-ios-device.h"
+#include "device-notifier.h"
+#include <cstdint>
+#include <vector>
+
+namespace node_ios_device {
+
+LOG_DEBUG_EXTERN_VARS
+
+/**
+ * The device changes waiting to be sent to a watch listener.
+ *
+ * Changes are collected until the listener's coalescing window closes and its throttle has passed
+ * since the last batch was taken, then they're taken folded into at most one change per device. The
+ * caller waits for the delay `add()` returns and then takes the batch no matter how many changes
+ * arrived in the meantime, so the trailing changes of a storm are never held back. Times are in
+ * milliseconds on the caller's clock.
+ */
+class WatchBatch {
+public:
+	WatchBatch();
+
+	uint64_t add(const std::vector<DeviceChange>& changes, uint64_t now);
+	inline bool empty() const { return pending.empty(); }
+	void reset(uint64_t now);
+	std::vector<DeviceChange> take(uint64_t now);
+
+	uint32_t coalesce;
+	uint32_t throttle;
+
+private:
+	uint64_t lastEmit;
+	std::vector<DeviceChange> pending;
+};
+
+}
+
+#endif
@@ -0,0 +1,33 @@
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the probe tests run against the benchmark addon which simulates devices with an artificial
+// handshake delay instead of MobileDevice
+const bench = loadBench('device probe');
+
+describe.skipIf(!bench)('device probing', () => {
+	it('should probe devices in parallel and publish each as soon as it is probed', () => {
+		const handshakeUs = 20_000;
+		const { published, elapsedUs, firstPublishUs, errors, stats } = bench.probeStorm(
+			32,
+			handshakeUs,
+			8
+		);
+		expect(errors).to.equal(0);
+		expect(published).to.equal(32);
+		expect(elapsedUs).to.be.lessThan(32 * handshakeUs);
+		expect(firstPublishUs).to.be.lessThan(elapsedUs);
+		expect(stats.probes).to.equal(64);
+		expect(stats.failures).to.equal(0);
+		expect(stats.workers).to.equal(8);
+		expect(stats.latency.count).to.equal(64);
+		expect(stats.latency.max).to.be.greaterThanOrEqual(handshakeUs);
+	}, 60000);
+
+	it('should serialize probes for the same device', () => {
+		const { published, errors, stats } = bench.probeStorm(200, 0, 8);
+		expect(errors).to.equal(0);
+		expect(published).to.equal(200);
+		expect(stats.probes).to.equal(400);
+	}, 60000);
+});
@@ -0,0 +1,59 @@
+import { mkdtempSync, rmSync, statSync, writeFileSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { afterEach, beforeEach, describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the property cache tests run against the benchmark addon which doesn't need a device
+const bench = loadBench('device property cache');
+
+describe.skipIf(!bench)('device property cache', () => {
+	let dir: string;
+	let file: string;
+
+	beforeEach(() => {
+		dir = mkdtempSync(join(tmpdir(), 'node-ios-device-'));
+		file = join(dir, 'device-props.cache');
+	});
+
+	afterEach(() => {
+		rmSync(dir, { force: true, recursive: true });
+	});
+
+	it('should persist device properties by udid', () => {
+		expect(bench.propCacheGet(file, 'abc')).to.equal(null);
+
+		const props = { buildVersion: '21A100', name: 'My iPhone', serialNumber: 'X1' };
+		expect(bench.propCachePut(file, 'abc', props)).to.equal(true);
+		expect(bench.propCacheGet(file, 'abc')).to.deep.equal(props);
+
+		const updated = { buildVersion: '22A5', name: 'Renamed', serialNumber: 'X1' };
+		bench.propCachePut(file, 'abc', updated);
+		expect(bench.propCacheGet(file, 'abc')).to.deep.equal(updated);
+	});
+
+	it('should evict the least recently updated device when full', () => {
+		bench.propCachePut(file, 'first', { buildVersion: '1', name: 'first' });
+		for (let i = 0; i < 128; i++) {
+			bench.propCachePut(file, `device${i}`, { buildVersion: '1', name: `device${i}` });
+		}
+		expect(bench.propCacheGet(file, 'first')).to.equal(null);
+		expect(bench.propCacheGet(file, 'device127')).to.deep.equal({
+			buildVersion: '1',
+			name: 'device127',
+		});
+	});
+
+	it('should reset a cache file with a different format', () => {
+		bench.propCachePut(file, 'abc', { buildVersion: '1' });
+		const size = statSync(file).size;
+		writeFileSync(file, 'garbage');
+		expect(bench.propCacheGet(file, 'abc')).to.equal(null);
+		expect(statSync(file).size).to.equal(size);
+	});
+
+	it('should be disabled if the cache file cannot be opened', () => {
+		expect(bench.propCachePut(join(dir, 'missing', 'cache'), 'abc', {})).to.equal(false);
+		expect(bench.propCacheGet(join(dir, 'missing', 'cache'), 'abc')).to.equal(null);
+	});
+});
@@ -0,0 +1,24 @@
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the registry tests run against the benchmark addon which drives the device notifier from a
+// simulated notifier thread instead of MobileDevice
+const bench = loadBench('device registry');
+
+describe.skipIf(!bench)('device registry', () => {
+	it('should survive a connect and disconnect storm', () => {
+		const { published, generation, reads, errors } = bench.registryStress(64, 200_000, 0);
+		expect(errors).to.equal(0);
+		expect(published).to.be.greaterThan(0);
+		expect(generation).to.equal(published);
+		expect(reads).to.be.greaterThan(0);
+	}, 60000);
+
+	it('should not make readers wait for a device to be probed', () => {
+		const probeUs = 20_000;
+		const { published, errors, maxReadNs } = bench.registryStress(8, 200, probeUs);
+		expect(errors).to.equal(0);
+		expect(published).to.be.greaterThan(0);
+		expect(maxReadNs).to.be.lessThan(probeUs * 1000);
+	}, 60000);
+});
@@ -0,0 +1,32 @@
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the flap tests run against the benchmark addon which drives the device notifier with simulated
+// devices instead of MobileDevice
+const bench = loadBench('flap tracker');
+
+describe.skipIf(!bench)('flap tracker', () => {
+	it('should reuse devices that come back within the window', () => {
+		const { reused, handshakes, flaps, expired, errors, expireUs } = bench.flapStorm(
+			10,
+			20,
+			200,
+			1000
+		);
+		expect(errors).to.equal(0);
+		expect(reused).to.equal(200);
+		expect(handshakes).to.equal(0);
+		expect(flaps).to.equal(200);
+		expect(expired).to.equal(10);
+		expect(expireUs).to.be.greaterThanOrEqual(190_000);
+	});
+
+	it('should not hold devices when the window is 0', () => {
+		const { reused, handshakes, flaps, expired, errors } = bench.flapStorm(10, 5, 0, 0);
+		expect(errors).to.equal(0);
+		expect(reused).to.equal(0);
+		expect(handshakes).to.equal(50);
+		expect(flaps).to.equal(0);
+		expect(expired).to.equal(0);
+	});
+});
@@ -0,0 +1,26 @@
+import { existsSync } from 'node:fs';
+import { createRequire } from 'node:module';
+import { resolve } from 'node:path';
+
+// the benchmark addon stands in for devices with socketpairs and simulated notifier threads, so
+// the tests that use it don't need a device or macOS; `pnpm test` and `pnpm bench` build it
+const benchPath = resolve(
+	import.meta.dirname,
+	'..',
+	'..',
+	'build',
+	'Release',
+	'node_ios_device_bench.node'
+);
+const bench = existsSync(benchPath) ? createRequire(import.meta.url)(benchPath) : null;
+
+/**
+ * Loads the benchmark addon, or returns `null` and says which tests are skipped if it hasn't been
+ * built.
+ */
+export function loadBench(tests: string): any {
+	if (!bench) {
+		console.log(`NOTICE: Benchmark addon not built... skipping ${tests} tests`);
+	}
+	return bench;
+}
@@ -1,10 +1,13 @@
 import { IOSDevice } from '../src/index.js';
 import { spawnSync } from 'node:child_process';
+import { existsSync } from 'node:fs';
 import { join, resolve } from 'node:path';
+import { Worker } from 'node:worker_threads';
 import { assert, describe, expect, it } from 'vitest';
 
 const __dirname = import.meta.dirname;
 const appPath = resolve(__dirname, 'TestApp', 'build', 'Release-iphoneos', 'TestApp.app');
+const bindingPath = resolve(__dirname, '..', 'build', 'Release', 'node_ios_device.node');
 
 const iosDevice = new IOSDevice();
 let udid: string | null = null;
@@ -123,12 +126,99 @@ describe('devices()', () => {
 			expect(device.trustedHostAttached).to.be.a('boolean');
 		}
 	});
+
+	it('should resolve connected devices without blocking', async () => {
+		await iosDevice.ready();
+		const devices = await iosDevice.listAsync();
+		expect(devices).to.be.an('array');
+		expect(devices.map((device) => device.udid)).to.deep.equal(
+			iosDevice.list().map((device) => device.udid)
+		);
+	});
+
+	it('should return the same frozen list until a device changes', () => {
+		const devices = iosDevice.list();
+		expect(Object.isFrozen(devices)).to.equal(true);
+		expect(devices.every((device) => Object.isFrozen(device))).to.equal(true);
+		expect(iosDevice.list()).to.equal(devices);
+	});
+});
+
+describe('worker threads', () => {
+	(existsSync(bindingPath) ? it : it.skip)(
+		'should share the devices with a worker thread without probing them again',
+		async () => {
+			const probes = iosDevice.probeStats().probes;
+			const worker = new Worker(
+				`const { createRequire } = require('node:module');
+				const { parentPort, workerData } = require('node:worker_threads');
+				const binding = createRequire(workerData)(workerData);
+				binding.init(() => {});
+				binding.ready().then(() => parentPort.postMessage(binding.list().map((d) => d.udid)));`,
+				{ eval: true, workerData: bindingPath }
+			);
+
+			try {
+				const udids = await new Promise((resolve, reject) => {
+					worker.once('message', resolve);
+					worker.once('error', reject);
+				});
+				expect(udids).to.deep.equal(iosDevice.list().map((device) => device.udid));
+				expect(iosDevice.probeStats().probes).to.equal(probes);
+			} finally {
+				await worker.terminate();
+			}
+		}
+	);
 });
 
 describe('watch()', () => {
+	it('should error if options are invalid', () => {
+		expect(() => {
+			iosDevice.watch({ coalesce: -1 });
+		}).to.throw(TypeError, 'Expected coalesce to be a non-negative integer');
+
+		expect(() => {
+			(iosDevice.watch as any)({ snapshot: 'yes' });
+		}).to.throw(TypeError, 'Expected snapshot to be a boolean');
+
+		expect(() => {
+			iosDevice.watch({ throttle: 1.5 });
+		}).to.throw(TypeError, 'Expected throttle to be a non-negative integer');
+	});
+
+	it('should emit an attach event for each connected device', async () => {
+		const udids = iosDevice.list().map((device) => device.udid);
+		const attached: string[] = [];
+
+		await new Promise<void>((resolve, reject) => {
+			const handle = iosDevice.watch({ coalesce: 50 });
+			const timer = setTimeout(() => {
+				handle.stop();
+				try {
+					expect(attached.sort()).to.deep.equal(udids.sort());
+					resolve();
+				} catch (e) {
+					reject(e);
+				}
+			}, 3000);
+
+			handle.on('attach', (device, iface) => {
+				try {
+					expect(device.interfaces).to.include(iface);
+					attached.push(device.udid);
+				} catch (e) {
+					clearTimeout(timer);
+					handle.stop();
+					reject(e);
+				}
+			});
+		});
+	}, 10000);
+
 	it('should watch for devices', async () => {
 		await new Promise<void>((resolve, reject) => {
-			const handle = iosDevice.watch();
+			const handle = iosDevice.watch({ snapshot: true });
 			let timer = setTimeout(() => {
 				handle.stop();
 				resolve();
@@ -149,6 +239,41 @@ describe('watch()', () => {
 	}, 10000);
 });
 
+describe('getValues()', () => {
+	it('should error if udid is invalid', async () => {
+		await expect((iosDevice.getValues as any)()).rejects.toThrow(
+			'Expected udid to be a non-empty string'
+		);
+		await expect((iosDevice.getValues as any)(1234)).rejects.toThrow(
+			'Expected udid to be a non-empty string'
+		);
+	});
+
+	it('should error if keys are invalid', async () => {
+		await expect(iosDevice.getValues('foo', 'bar' as any)).rejects.toThrow(
+			'Expected keys to be an array of non-empty strings or null'
+		);
+		await expect(iosDevice.getValues('foo', [''])).rejects.toThrow(
+			'Expected keys to be an array of non-empty strings or null'
+		);
+	});
+
+	appit('should error if udid device is not connected', async () => {
+		await expect(iosDevice.getValues('foo')).rejects.toThrow('Device "foo" not found');
+	});
+
+	appit('should get values from the device', async () => {
+		assert(udid);
+		const all = await iosDevice.getValues(udid);
+		expect(all).to.be.an('object');
+		expect(all.UniqueDeviceID).to.equal(udid);
+
+		const values = await iosDevice.getValues(udid, ['BuildVersion', 'DoesNotExist']);
+		expect(values).to.have.keys(['BuildVersion']);
+		expect(values.BuildVersion).to.equal(all.BuildVersion);
+	});
+});
+
 describe('install()', () => {
 	it('should error if udid is invalid', () => {
 		expect(() => {
@@ -212,6 +337,113 @@ describe('forward()', () => {
 		}).to.throw(Error, 'Expected port to be a number');
 	});
 
+	it('should error if options are invalid', () => {
+		expect(() => {
+			iosDevice.forward('foo', 12345, 'bar' as any);
+		}).to.throw(TypeError, 'Expected options to be an object');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { encoding: 'hex' as any });
+		}).to.throw(TypeError, 'Expected encoding to be "utf8" or "buffer"');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { framing: 'lines' as any });
+		}).to.throw(
+			TypeError,
+			'Expected framing to be "newline", "delimiter", "length-prefix", or "raw"'
+		);
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { framing: 'delimiter' });
+		}).to.throw(TypeError, 'Expected delimiter to be a non-empty string');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { maxFrameLength: 0 });
+		}).to.throw(TypeError, 'Expected maxFrameLength to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { batch: 'yes' as any });
+		}).to.throw(TypeError, 'Expected batch to be a boolean or an object');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { batch: { maxSize: 0 } });
+		}).to.throw(TypeError, 'Expected maxSize to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { batch: { maxLatency: -1 } });
+		}).to.throw(TypeError, 'Expected maxLatency to be a non-negative number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { highWaterMark: 0 });
+		}).to.throw(TypeError, 'Expected highWaterMark to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { highWaterMark: 1024, lowWaterMark: 1024 });
+		}).to.throw(TypeError, 'Expected lowWaterMark to be less than highWaterMark');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { overflow: 'drop' as any });
+		}).to.throw(TypeError, 'Expected overflow to be "pause" or "drop-oldest"');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { exclusive: 'yes' as any });
+		}).to.throw(TypeError, 'Expected exclusive to be a boolean');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { poolSize: -1 });
+		}).to.throw(TypeError, 'Expected poolSize to be a non-negative number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { reconnect: 'yes' as any });
+		}).to.throw(TypeError, 'Expected reconnect to be a boolean or an object');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { reconnect: { delay: 0 } });
+		}).to.throw(TypeError, 'Expected delay to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { reconnect: { maxDelay: -1 } });
+		}).to.throw(TypeError, 'Expected maxDelay to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { include: 123 as any });
+		}).to.throw(
+			TypeError,
+			'Expected include to be a string, RegExp, or { prefix } object, or an array of them'
+		);
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { exclude: ['debug', {} as any] });
+		}).to.throw(
+			TypeError,
+			'Expected exclude to be a string, RegExp, or { prefix } object, or an array of them'
+		);
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { parse: 'xml' as any });
+		}).to.throw(TypeError, 'Expected parse to be "json", "logfmt", or "syslog"');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { parse: 'json', encoding: 'buffer' });
+		}).to.throw(TypeError, 'Expected encoding to be "utf8" when parsing');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { capture: 123 as any });
+		}).to.throw(TypeError, 'Expected capture to be a string or an object');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { capture: '' });
+		}).to.throw(TypeError, 'Expected path to be a non-empty string');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { capture: { path: '/tmp/x', maxFileSize: 0 } });
+		}).to.throw(TypeError, 'Expected maxFileSize to be a positive number');
+
+		expect(() => {
+			iosDevice.forward('foo', 12345, { capture: { path: '/tmp/x', maxFiles: -1 } });
+		}).to.throw(TypeError, 'Expected maxFiles to be a positive number');
+	});
+
 	usbAppIt('should fail if port is invalid', () => {
 		expect(() => {
 			iosDevice.forward(udid!, 123 as any);
@@ -285,3 +517,118 @@ describe('forward()', () => {
 		15000
 	);
 });
+
+describe('forwardAll()', () => {
+	it('should error if port is invalid', () => {
+		expect(() => {
+			(iosDevice.forwardAll as any)();
+		}).to.throw(TypeError, 'Expected port to be a number');
+	});
+
+	it('should error if options are invalid', () => {
+		expect(() => {
+			iosDevice.forwardAll(12345, 'bar' as any);
+		}).to.throw(TypeError, 'Expected options to be an object');
+
+		expect(() => {
+			iosDevice.forwardAll(12345, { encoding: 'hex' as any });
+		}).to.throw(TypeError, 'Expected encoding to be "utf8" or "buffer"');
+
+		expect(() => {
+			iosDevice.forwardAll(12345, { udids: 'foo' as any });
+		}).to.throw(TypeError, 'Expected udids to be an array of non-empty strings');
+
+		expect(() => {
+			iosDevice.forwardAll(12345, { udids: ['foo', ''] });
+		}).to.throw(TypeError, 'Expected udids to be an array of non-empty strings');
+	});
+});
+
+describe('replay()', () => {
+	it('should error if path is invalid', () => {
+		expect(() => {
+			(iosDevice.replay as any)();
+		}).to.throw(TypeError, 'Expected path to be a non-empty string');
+	});
+
+	it('should error if options are invalid', () => {
+		expect(() => {
+			iosDevice.replay('foo', { encoding: 'ascii' as any });
+		}).to.throw(TypeError, 'Expected encoding to be "utf8" or "buffer"');
+
+		expect(() => {
+			iosDevice.replay('foo', { from: 'now' as any });
+		}).to.throw(TypeError, 'Expected from to be a Date or a number');
+
+		expect(() => {
+			iosDevice.replay('foo', { speed: -1 });
+		}).to.throw(TypeError, 'Expected speed to be a non-negative number');
+	});
+
+	it('should end right away if there are no capture files', async () => {
+		const handle = iosDevice.replay(join(__dirname, 'does_not_exist'));
+		await new Promise((resolve) => handle.on('end', resolve));
+	});
+});
+
+describe('listen()', () => {
+	it('should error if udid is invalid', () => {
+		expect(() => {
+			(iosDevice.listen as any)();
+		}).to.throw(TypeError, 'Expected udid to be a non-empty string');
+	});
+
+	it('should error if ports are invalid', () => {
+		expect(() => {
+			(iosDevice.listen as any)('foo');
+		}).to.throw(TypeError, 'Expected device port to be a number');
+
+		expect(() => {
+			iosDevice.listen('foo', 12345, -1);
+		}).to.throw(TypeError, 'Expected local port to be a number between 0 and 65535');
+
+		expect(() => {
+			iosDevice.listen('foo', 12345, 70000);
+		}).to.throw(TypeError, 'Expected local port to be a number between 0 and 65535');
+	});
+
+	wifiAppIt('should error trying to listen on Wi-Fi only device', () => {
+		expect(() => {
+			iosDevice.listen(wifiUDID!, 12345);
+		}).to.throw(Error, 'listen requires a USB connected iOS device');
+	});
+});
+
+describe('syslog()', () => {
+	it('should error if udid is invalid', () => {
+		expect(() => {
+			(iosDevice.syslog as any)();
+		}).to.throw(TypeError, 'Expected udid to be a non-empty string');
+	});
+
+	it('should error if options are invalid', () => {
+		expect(() => {
+			iosDevice.syslog('foo', 'bar' as any);
+		}).to.throw(TypeError, 'Expected options to be an object');
+
+		expect(() => {
+			iosDevice.syslog('foo', { parse: 'syslog' as any });
+		}).to.throw(TypeError, 'Expected parse to be a boolean');
+
+		expect(() => {
+			iosDevice.syslog('foo', { parse: true, encoding: 'buffer' });
+		}).to.throw(TypeError, 'Expected encoding to be "utf8" when parsing');
+
+		expect(() => {
+			iosDevice.syslog('foo', { overflow: 'block' as any });
+		}).to.throw(TypeError, 'Expected overflow to be "pause" or "drop-oldest"');
+	});
+
+	it('should error if forward only options are set', () => {
+		for (const name of ['delimiter', 'exclusive', 'framing', 'poolSize', 'reconnect']) {
+			expect(() => {
+				iosDevice.syslog('foo', { [name]: true } as any);
+			}).to.throw(TypeError, `Expected ${name} to not be set for syslog()`);
+		}
+	});
+});
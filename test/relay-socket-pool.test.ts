@@ -0,0 +1,72 @@
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the socket pool tests run against the benchmark addon which connects socketpairs instead of
+// device ports
+const bench = loadBench('socket pool');
+
+describe.skipIf(!bench)('socket pool', () => {
+	it('should give exclusive handles on one port independent streams', () => {
+		const { connects, idle, replies } = bench.socketPool(2, [
+			['open', 1],
+			['open', 2],
+			['write', 1, 'a'],
+			['write', 2, 'b'],
+			['write', 1, 'c'],
+		]);
+		expect(connects).to.equal(2);
+		expect(idle).to.equal(0);
+		expect(replies).to.deep.equal(['peer1:a', 'peer2:b', 'peer1:c']);
+	});
+
+	it('should park a stopped handle and reuse its socket', () => {
+		const { connects, idle, replies } = bench.socketPool(1, [
+			['open', 1],
+			['write', 1, 'a'],
+			['stop', 1],
+			['send', 1, 'stale'],
+			['open', 2],
+			['write', 2, 'b'],
+		]);
+		expect(connects).to.equal(1);
+		expect(idle).to.equal(0);
+		// the data that arrived while the socket was idle is thrown away
+		expect(replies).to.deep.equal(['peer1:a', 'peer1:b']);
+	});
+
+	it('should close stopped handles once the pool is full', () => {
+		const { connects, idle } = bench.socketPool(1, [
+			['open', 1],
+			['open', 2],
+			['stop', 1],
+			['stop', 2],
+		]);
+		expect(connects).to.equal(2);
+		expect(idle).to.equal(1);
+	});
+
+	it('should not park sockets when the pool size is 0', () => {
+		const { connects, idle, replies } = bench.socketPool(0, [
+			['open', 1],
+			['stop', 1],
+			['open', 2],
+			['write', 2, 'a'],
+		]);
+		expect(connects).to.equal(2);
+		expect(idle).to.equal(0);
+		expect(replies).to.deep.equal(['peer2:a']);
+	});
+
+	it('should discard an idle socket the device closed', () => {
+		const { connects, idle, replies } = bench.socketPool(1, [
+			['open', 1],
+			['stop', 1],
+			['closePeer', 1],
+			['open', 2],
+			['write', 2, 'a'],
+		]);
+		expect(connects).to.equal(2);
+		expect(idle).to.equal(0);
+		expect(replies).to.deep.equal(['peer2:a']);
+	});
+});
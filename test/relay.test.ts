@@ -0,0 +1,712 @@
+import { mkdtempSync, rmSync } from 'node:fs';
+import { connect, createServer, type AddressInfo } from 'node:net';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { setFlagsFromString } from 'node:v8';
+import { runInNewContext } from 'node:vm';
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the relay tests run against the benchmark addon which feeds relay connections from a socketpair
+// instead of a device
+const bench = loadBench('relay');
+
+describe.skipIf(!bench)('relay', () => {
+	// writes the lines through an echo connection and resolves the emitted frames once it ends
+	const echoLines = (options: object, lines: string[]) =>
+		new Promise<any[]>((resolve) => {
+			const values: any[] = [];
+			bench.echo(options, (event: string, data: any) => {
+				if (event === 'data') {
+					values.push(data);
+				} else if (event === 'batch') {
+					values.push(...data);
+				} else if (event === 'end') {
+					resolve(values);
+				}
+			});
+
+			for (const line of lines) {
+				bench.echoWrite(`${line}\n`);
+			}
+			setTimeout(() => bench.echoClose(), 50);
+		});
+
+	// writes each chunk through an echo connection in a read of its own and resolves the emitted
+	// frames as strings once it ends
+	const echoChunks = (options: object, chunks: (string | Buffer)[]) =>
+		new Promise<string[]>((resolve) => {
+			const values: string[] = [];
+			bench.echo(options, (event: string, data: any) => {
+				if (event === 'data') {
+					values.push(data.toString());
+				} else if (event === 'end') {
+					resolve(values);
+				}
+			});
+
+			let i = 0;
+			const next = () => {
+				if (i < chunks.length) {
+					bench.echoWrite(chunks[i++]);
+					setTimeout(next, 20);
+				} else {
+					bench.echoClose();
+				}
+			};
+			next();
+		});
+
+	// a 4-byte big-endian length followed by the data
+	const lengthPrefixed = (data: string, length = data.length) => {
+		const frame = Buffer.alloc(4 + data.length);
+		frame.writeUInt32BE(length);
+		frame.write(data, 4);
+		return frame;
+	};
+
+	describe('buffer encoding', () => {
+		it('should emit the exact bytes and recycle slabs once the buffers are collected', async () => {
+			// every byte value, including NULs and newlines, spread over more than one slab
+			const payload = Buffer.alloc(200000);
+			for (let i = 0; i < payload.length; i++) {
+				payload[i] = (i * 7) & 0xff;
+			}
+
+			let chunks: Buffer[] | null = [];
+			await new Promise<void>((resolve) => {
+				bench.echo({ encoding: 'buffer' }, (event: string, data: Buffer) => {
+					if (event === 'data') {
+						chunks!.push(data);
+					} else if (event === 'end') {
+						resolve();
+					}
+				});
+				bench.echoWrite(payload);
+				setTimeout(() => bench.echoClose(), 50);
+			});
+
+			expect(chunks.every((chunk) => Buffer.isBuffer(chunk))).toBe(true);
+			expect(Buffer.concat(chunks).equals(payload)).toBe(true);
+
+			// the emitted buffers point into the slabs, so they can't be reused yet
+			const held = bench.echoSlabs();
+			expect(held.inUse).toBeGreaterThan(1);
+			expect(held.idle).toBe(0);
+
+			chunks = null;
+			setFlagsFromString('--expose-gc');
+			const gc = runInNewContext('gc');
+			for (let i = 0; i < 10 && bench.echoSlabs().idle === 0; i++) {
+				gc();
+				await new Promise((resolve) => setImmediate(resolve));
+			}
+
+			// only the slab the framer is still filling remains in use
+			const released = bench.echoSlabs();
+			expect(released.inUse).toBeLessThanOrEqual(1);
+			expect(released.idle).toBe(held.inUse - released.inUse);
+		});
+	});
+
+	describe('framing', () => {
+		it('should join a line split across reads', async () => {
+			expect(await echoChunks({}, ['hel', 'lo\nwor', 'ld\r', '\n'])).toEqual(['hello', 'world']);
+		});
+
+		it('should find a multi-byte delimiter split across reads', async () => {
+			expect(
+				await echoChunks({ delimiter: '\r\n\r\n' }, ['a\r\n', '\r\nb\r\nc\r', '\n\r', '\n'])
+			).toEqual(['a', 'b\r\nc']);
+		});
+
+		it('should keep embedded NULs', async () => {
+			expect(await echoChunks({}, ['a\0b\n\0\n'])).toEqual(['a\0b', '\0']);
+
+			const chunk = Buffer.from([0, 1, 0, 10, 0, 10]);
+			expect(await echoChunks({ encoding: 'buffer', framing: 'newline' }, [chunk])).toEqual([
+				'\0\x01\0',
+				'\0',
+			]);
+		});
+
+		it('should split length prefixed frames and skip oversized ones', async () => {
+			const oversized = lengthPrefixed('x'.repeat(20));
+			const stream = Buffer.concat([
+				lengthPrefixed('abc'),
+				oversized,
+				lengthPrefixed(''),
+				lengthPrefixed('ok'),
+			]);
+
+			// split inside the first prefix, the oversized frame's prefix and data, and the last two
+			// prefixes
+			const chunks = [2, 9, 20, 33, 37, stream.length].map((end, i, ends) =>
+				stream.subarray(ends[i - 1] || 0, end)
+			);
+
+			const options = { encoding: 'buffer', framing: 'length-prefix', maxFrameLength: 8 };
+			expect(await echoChunks(options, chunks)).toEqual(['abc', '', 'ok']);
+		});
+
+		it('should emit a frame once it reaches the max frame length', async () => {
+			expect(await echoChunks({ maxFrameLength: 8 }, ['abcdef', 'ghij', 'kl\n'])).toEqual([
+				'abcdefghij',
+				'kl',
+			]);
+		});
+
+		it('should emit the final line without a trailing newline', async () => {
+			expect(await echoChunks({}, ['first\nlast', ' line'])).toEqual(['first', 'last line']);
+			expect(await echoChunks({ delimiter: '||' }, ['a||b|'])).toEqual(['a', 'b|']);
+		});
+	});
+
+	describe('flow control', () => {
+		// writes `total` 100 byte lines through an echo connection to a listener that stalls every
+		// 500 lines and resolves the lines and the other events once it ends
+		const slowListener = (options: object, total: number) =>
+			new Promise<{ lines: string[]; events: any[][] }>((resolve) => {
+				const lines: string[] = [];
+				const events: any[][] = [];
+				bench.echo(options, (event: string, ...args: any[]) => {
+					if (event === 'data') {
+						if (lines.length % 500 === 0) {
+							const until = Date.now() + 20;
+							while (Date.now() < until) {
+								// too busy to keep up
+							}
+						}
+						lines.push(args[0]);
+					} else {
+						events.push([event, ...args]);
+						if (event === 'end') {
+							resolve({ lines, events });
+						}
+					}
+				});
+
+				for (let i = 0; i < total; i++) {
+					bench.echoWrite(`${String(i).padStart(99, '0')}\n`);
+				}
+				setTimeout(() => bench.echoClose(), 500);
+			});
+
+		it('should pause at the high water mark and drain without losing data', async () => {
+			const { lines, events } = await slowListener({ highWaterMark: 16384 }, 5000);
+			expect(lines.map(Number)).toEqual(Array.from({ length: 5000 }, (_, i) => i));
+
+			const names = events.map(([event]) => event);
+			const pauses = names.filter((event) => event === 'pause').length;
+			expect(pauses).toBeGreaterThan(0);
+			expect(names).toEqual([...Array(pauses).fill(['pause', 'drain']).flat(), 'end']);
+
+			const { framesDropped, pauses: pauseCount } = bench.stats();
+			expect(pauseCount).toBe(pauses);
+			expect(framesDropped).toBe(0);
+		});
+
+		it('should drop the oldest frames and report how many', async () => {
+			const options = { highWaterMark: 16384, overflow: 'drop-oldest' };
+			const { lines, events } = await slowListener(options, 5000);
+
+			const drops = events.filter(([event]) => event === 'drop');
+			expect(drops.length).toBeGreaterThan(0);
+			expect(events.some(([event]) => event === 'pause')).toBe(false);
+
+			const dropped = drops.reduce((sum, [, frames]) => sum + frames, 0);
+			const droppedBytes = drops.reduce((sum, [, , bytes]) => sum + bytes, 0);
+			expect(dropped + lines.length).toBe(5000);
+			expect(droppedBytes).toBe(dropped * 99);
+
+			// what's left is the newest data, still in order
+			const values = lines.map(Number);
+			expect(values.at(-1)).toBe(4999);
+			expect(values.every((value, i) => i === 0 || value > values[i - 1])).toBe(true);
+
+			const { framesDropped, bytesDropped } = bench.stats();
+			expect(framesDropped).toBe(dropped);
+			expect(bytesDropped).toBe(droppedBytes);
+		});
+	});
+
+	describe('write()', () => {
+		it('should write and read back data', async () => {
+			const lines: string[] = [];
+			const results: (Error | null)[] = [];
+
+			await new Promise<void>((resolve) => {
+				bench.echo({}, (event: string, data: string) => {
+					if (event === 'data') {
+						lines.push(data);
+						if (lines.length === 3) {
+							bench.echoClose();
+						}
+					} else if (event === 'end') {
+						resolve();
+					}
+				});
+
+				expect(bench.echoWrite('foo\n', (err: Error | null) => results.push(err))).toBe(true);
+				bench.echoWrite(Buffer.from('bar\nbaz'), (err: Error | null) => results.push(err));
+				bench.echoWrite('\n');
+			});
+
+			expect(lines).toEqual(['foo', 'bar', 'baz']);
+			expect(results).toEqual([null, null]);
+		});
+
+		it('should report backpressure and drain', async () => {
+			const chunk = Buffer.alloc(64 * 1024, 'x');
+			const total = chunk.length * 64;
+			let blocked = false;
+			let drained = false;
+			let bytes = 0;
+
+			await new Promise<void>((resolve) => {
+				bench.echo({ encoding: 'buffer' }, (event: string, data: Buffer) => {
+					if (event === 'data') {
+						bytes += data.length;
+						if (bytes === total) {
+							bench.echoClose();
+						}
+					} else if (event === 'writeDrain') {
+						drained = true;
+					} else if (event === 'end') {
+						resolve();
+					}
+				});
+
+				for (let i = 0; i < 64; i++) {
+					if (!bench.echoWrite(chunk)) {
+						blocked = true;
+					}
+				}
+			});
+
+			expect(blocked).toBe(true);
+			expect(drained).toBe(true);
+			expect(bytes).toBe(total);
+		});
+
+		it('should round trip requests and responses', async () => {
+			const samples: number[] = [];
+			let start = process.hrtime.bigint();
+
+			await new Promise<void>((resolve) => {
+				bench.echo({}, (event: string, data: string) => {
+					if (event === 'data') {
+						expect(data).toBe(`ping ${samples.length}`);
+						samples.push(Number(process.hrtime.bigint() - start) / 1e3);
+						if (samples.length === 1000) {
+							bench.echoClose();
+						} else {
+							start = process.hrtime.bigint();
+							bench.echoWrite(`ping ${samples.length}\n`);
+						}
+					} else if (event === 'end') {
+						resolve();
+					}
+				});
+
+				bench.echoWrite('ping 0\n');
+			});
+
+			// the latency percentiles are reported by `pnpm bench`
+			samples.sort((a, b) => a - b);
+			const p50 = samples[Math.floor(samples.length * 0.5)];
+
+			expect(samples.length).toBe(1000);
+			expect(p50).toBeLessThan(10000);
+		});
+	});
+
+	describe('reconnect', () => {
+		it('should emit disconnect and reconnect instead of end', async () => {
+			const events: any[][] = [];
+
+			await new Promise<void>((resolve) => {
+				bench.echo(
+					{ reconnect: { delay: 10, maxDelay: 20 } },
+					(event: string, ...args: any[]) => {
+						events.push([event, ...args]);
+						if (event === 'data' && args[0] === 'before') {
+							bench.echoClose();
+						} else if (event === 'disconnect') {
+							// queued until the connection is restored
+							bench.echoWrite('after\n');
+						} else if (event === 'data' && args[0] === 'after') {
+							resolve();
+						}
+					},
+					2
+				);
+
+				bench.echoWrite('before\n');
+			});
+
+			expect(events.map(([event]) => event)).toEqual(['data', 'disconnect', 'reconnect', 'data']);
+			const [, gap, attempts] = events[2];
+			expect(attempts).toBe(3);
+			// two retries of 10ms and 20ms, each of which libuv may fire up to 1ms early since its
+			// clock has millisecond resolution
+			expect(gap).toBeGreaterThanOrEqual(28);
+		});
+	});
+
+	describe('capture', () => {
+		it('should capture frames to rotating files and read them back', async () => {
+			const dir = mkdtempSync(join(tmpdir(), 'node-ios-device-'));
+			const path = join(dir, 'capture');
+			const line = 'x'.repeat(1000);
+
+			try {
+				await new Promise<void>((resolve) => {
+					let count = 0;
+					bench.echo(
+						{ capture: { path, maxFileSize: 2 * 1024 * 1024, maxFiles: 2 } },
+						(event: string) => {
+							if (event === 'data' && ++count === 5000) {
+								bench.echoClose();
+							} else if (event === 'end') {
+								resolve();
+							}
+						}
+					);
+
+					for (let i = 0; i < 5000; i++) {
+						bench.echoWrite(`${i} ${line}\n`);
+					}
+				});
+
+				// the oldest file was deleted once the third file was started
+				const files = bench.captureFiles(path);
+				expect(files).toEqual([`${path}.1`, `${path}.2`]);
+
+				const { frames, next } = bench.captureRead(files[1], 0, 10);
+				expect(frames.length).toBe(10);
+				expect(next).toBeGreaterThan(0);
+				const first = Number(frames[0].data.toString().split(' ')[0]);
+				expect(frames[9].data.toString()).toBe(`${first + 9} ${line}`);
+				expect(frames[9].time).toBeGreaterThanOrEqual(frames[0].time);
+
+				const offset = bench.captureSeek(files[1], frames[5].time);
+				expect(bench.captureRead(files[1], offset, 1).frames[0].time).toBe(frames[5].time);
+			} finally {
+				rmSync(dir, { recursive: true });
+			}
+		});
+
+		it('should raise the file size to hold a frame of the max frame length', async () => {
+			const dir = mkdtempSync(join(tmpdir(), 'node-ios-device-'));
+			const path = join(dir, 'capture');
+			const line = 'x'.repeat(3 * 1024 * 1024);
+
+			try {
+				await new Promise<void>((resolve) => {
+					bench.echo(
+						{ capture: { path, maxFileSize: 2 * 1024 * 1024 }, maxFrameLength: 4 * 1024 * 1024 },
+						(event: string) => {
+							if (event === 'data') {
+								bench.echoClose();
+							} else if (event === 'end') {
+								resolve();
+							}
+						}
+					);
+					bench.echoWrite(`${line}\n`);
+				});
+
+				const files = bench.captureFiles(path);
+				expect(files).toEqual([`${path}.0`]);
+				const { frames } = bench.captureRead(files[0], 0, 1);
+				expect(frames.length).toBe(1);
+				expect(frames[0].data.length).toBe(line.length);
+			} finally {
+				rmSync(dir, { recursive: true });
+			}
+		});
+	});
+
+	describe('parse', () => {
+		it('should parse JSON lines and count malformed lines', async () => {
+			const lines = [
+				'{"a":1,"b":[true,false,null],"c":{"d":"\\u00e9\\n"}}',
+				'{"bad":}',
+				' [1.5e3, -0, "x\\"y"] ',
+				'{"a":1} trailing',
+				'{"__proto__":{"x":1}}',
+			];
+			const values = await echoLines({ parse: 'json' }, lines);
+			expect(values).toEqual([JSON.parse(lines[0]), JSON.parse(lines[2]), JSON.parse(lines[4])]);
+			expect(Object.getPrototypeOf(values[2])).toBe(Object.prototype);
+			expect(bench.stats().framesMalformed).toBe(2);
+		});
+
+		it('should parse logfmt lines in batches', async () => {
+			const values = await echoLines({ parse: 'logfmt', batch: {} }, [
+				'level=info msg="hello \\"world\\"" ok url=/a?b=c empty=',
+				'msg="unterminated',
+				'=value',
+			]);
+			expect(values).toEqual([
+				{ level: 'info', msg: 'hello "world"', ok: true, url: '/a?b=c', empty: '' },
+			]);
+			expect(bench.stats().framesMalformed).toBe(2);
+		});
+	});
+
+	describe('filter', () => {
+		const lines = ['[DEBUG] a', '[INFO] b', '[debug] c', 'x [ERROR] d', '[INFO] noise e'];
+
+		it('should only emit lines matching an include rule', async () => {
+			expect(await echoLines({ include: '[INFO]' }, lines)).toEqual(['[INFO] b', '[INFO] noise e']);
+			const { framesMatched, framesFiltered } = bench.stats();
+			expect(framesMatched).toBe(2);
+			expect(framesFiltered).toBe(3);
+		});
+
+		it('should combine include and exclude rules', async () => {
+			const values = await echoLines(
+				{ include: [/error|info/i, { prefix: '[debug]' }], exclude: 'noise', batch: {} },
+				lines
+			);
+			expect(values).toEqual(['[INFO] b', '[debug] c', 'x [ERROR] d']);
+			expect(bench.stats().framesFiltered).toBe(2);
+		});
+
+		it('should reject unsupported regular expressions', () => {
+			expect(() => bench.echo({ exclude: /a/m }, () => {})).toThrow(
+				'Unsupported regular expression flag "m" in exclude'
+			);
+			expect(() => bench.echo({ include: /(?<=a)b/ }, () => {})).toThrow(
+				'Invalid regular expression'
+			);
+		});
+	});
+
+	describe('group', () => {
+		// streams `bytes` of 100 byte lines from each source through a relay group and resolves the
+		// events once every source has detached
+		const fanIn = (options: object, sources: string[], bytes: number, udids?: string[]) =>
+			new Promise<{ events: string[]; counts: Record<string, number> }>((resolve) => {
+				const events: string[] = [];
+				const counts: Record<string, number> = {};
+				let remaining = udids ? udids.length : sources.length;
+
+				bench.fanIn(
+					options,
+					sources,
+					bytes,
+					100,
+					(event: string, ...args: any[]) => {
+						if (event === 'data') {
+							counts[args[1]] = (counts[args[1]] || 0) + 1;
+						} else if (event === 'batch') {
+							for (const udid of args[args.length - 1]) {
+								counts[udid] = (counts[udid] || 0) + 1;
+							}
+						} else {
+							events.push(`${event} ${args[0]}`);
+							if (event === 'detach' && --remaining === 0) {
+								resolve({ events, counts });
+							}
+						}
+					},
+					udids
+				);
+			});
+
+		it('should tag each frame with its source', async () => {
+			const { events, counts } = await fanIn({}, ['a', 'b', 'c'], 10000);
+			expect(counts).toEqual({ a: 100, b: 100, c: 100 });
+			expect(events.filter((e) => e.startsWith('attach')).sort()).toEqual([
+				'attach a',
+				'attach b',
+				'attach c',
+			]);
+			expect(bench.stats().framesEmitted).toBe(300);
+		});
+
+		it('should emit attach before and detach after the frames of a source', async () => {
+			const events: string[] = [];
+			await new Promise<void>((resolve) => {
+				bench.fanIn(
+					{ batch: { maxSize: 16 } },
+					['a'],
+					10000,
+					100,
+					(event: string, ...args: any[]) => {
+						events.push(event);
+						if (event === 'batch') {
+							expect(args[2]).toHaveLength(args[0].length);
+						} else if (event === 'detach') {
+							resolve();
+						}
+					}
+				);
+			});
+			expect(events[0]).toBe('attach');
+			expect(events[events.length - 1]).toBe('detach');
+			expect(events.filter((e) => e === 'batch').length).toBeGreaterThanOrEqual(7);
+		});
+
+		it('should only attach the listed udids', async () => {
+			const { events, counts } = await fanIn({}, ['a', 'b', 'c'], 10000, ['b']);
+			expect(counts).toEqual({ b: 100 });
+			expect(events).toEqual(['attach b', 'detach b']);
+		});
+	});
+
+	describe('syslog', () => {
+		// NUL terminated records as sent by the syslog relay service
+		const records = Buffer.from(
+			[
+				'Oct 17 04:44:00 iPhone SpringBoard(FrontBoard)[58] <Notice>: said "hi"\n',
+				'Oct  7 14:04:09 iPhone kernel[0] <Error>: tab\there\n',
+				'no header\n',
+			]
+				.map((record) => `${record}\0`)
+				.join('')
+		);
+
+		// replays the records `repeat` times and resolves the emitted records once the stream ends
+		const replay = (options: object, repeat: number) =>
+			new Promise<any[]>((resolve) => {
+				const values: any[] = [];
+				bench.syslog(options, records, repeat, (event: string, data: any) => {
+					if (event === 'data') {
+						values.push(data);
+					} else if (event === 'batch') {
+						values.push(...data);
+					} else if (event === 'end') {
+						resolve(values);
+					}
+				});
+			});
+
+		it('should reject forward only options', () => {
+			for (const name of ['delimiter', 'exclusive', 'framing', 'poolSize', 'reconnect']) {
+				expect(() => bench.syslog({ [name]: true }, records, 1, () => {})).toThrow(
+					`Expected ${name} to not be set for syslog()`
+				);
+			}
+		});
+
+		it('should split and parse records in batches', async () => {
+			const values = await replay({ parse: 'syslog', batch: {} }, 1000);
+			expect(values).toHaveLength(3000);
+			expect(values.slice(-3)).toEqual([
+				{
+					time: 'Oct 17 04:44:00',
+					device: 'iPhone',
+					process: 'SpringBoard',
+					sender: 'FrontBoard',
+					pid: 58,
+					level: 'Notice',
+					message: 'said "hi"',
+				},
+				{
+					time: 'Oct  7 14:04:09',
+					device: 'iPhone',
+					process: 'kernel',
+					pid: 0,
+					level: 'Error',
+					message: 'tab\there',
+				},
+				{ message: 'no header' },
+			]);
+			expect(bench.stats().framesMalformed).toBe(0);
+		});
+
+		it('should filter raw records', async () => {
+			const values = await replay({ include: '<Error>' }, 10);
+			expect(values).toHaveLength(10);
+			expect(values[0]).toBe('Oct  7 14:04:09 iPhone kernel[0] <Error>: tab\there\n');
+			expect(bench.stats().framesFiltered).toBe(20);
+		});
+	});
+
+	describe('stats()', () => {
+		it('should count data read, emitted, and written', async () => {
+			await new Promise<void>((resolve) => {
+				let count = 0;
+				bench.echo({}, (event: string) => {
+					if (event === 'data' && ++count === 100) {
+						bench.echoClose();
+					} else if (event === 'end') {
+						resolve();
+					}
+				});
+
+				for (let i = 0; i < 100; i++) {
+					bench.echoWrite(`line ${i}\n`);
+				}
+			});
+
+			const bytes = Array.from({ length: 100 }, (_, i) => `line ${i}\n`.length).reduce(
+				(a, b) => a + b
+			);
+			const stats = bench.stats();
+			expect(stats.connections).toBe(1);
+			expect(stats.bytesRead).toBe(bytes);
+			expect(stats.bytesWritten).toBe(bytes);
+			expect(stats.framesRead).toBe(100);
+			expect(stats.framesEmitted).toBe(100);
+			expect(stats.bytesEmitted).toBe(bytes - 100);
+			expect(stats.queueDepth).toBe(0);
+			expect(stats.maxQueueDepth).toBeGreaterThan(0);
+			expect(stats.batchSizes.count).toBe(stats.dispatches);
+			expect(stats.latency.count).toBe(100);
+			expect(stats.latency.buckets.reduce((a: number, b: number) => a + b)).toBe(100);
+			expect(stats.latency.p50).toBeLessThanOrEqual(stats.latency.p99);
+			expect(stats.latency.p99).toBeLessThanOrEqual(stats.latency.max);
+		});
+	});
+
+	describe('proxy()', () => {
+		it('should proxy many clients to the target port', async () => {
+			// the echo server stands in for the port on the device
+			const server = createServer((socket) => socket.pipe(socket));
+			await new Promise<void>((resolve) => server.listen(0, '127.0.0.1', resolve));
+			const port = bench.proxy((server.address() as AddressInfo).port, 0);
+
+			try {
+				const payload = Buffer.alloc(256 * 1024);
+				for (let i = 0; i < payload.length; i++) {
+					payload[i] = i % 251;
+				}
+
+				const results = await Promise.all(
+					Array.from(
+						{ length: 100 },
+						() =>
+							new Promise<Buffer>((resolve, reject) => {
+								const chunks: Buffer[] = [];
+								const client = connect(port, '127.0.0.1', () => client.end(payload));
+								client.on('data', (chunk) => chunks.push(chunk));
+								client.on('end', () => resolve(Buffer.concat(chunks)));
+								client.on('error', reject);
+							})
+					)
+				);
+
+				for (const result of results) {
+					expect(result.equals(payload)).toBe(true);
+				}
+			} finally {
+				bench.proxyClose();
+				await new Promise((resolve) => server.close(resolve));
+			}
+		});
+
+		it('should error if the local port is in use', () => {
+			const port = bench.proxy(1, 0);
+			try {
+				expect(() => bench.proxy(1, port)).toThrow(`Failed to listen on port ${port}`);
+			} finally {
+				bench.proxyClose();
+			}
+		});
+	});
+});
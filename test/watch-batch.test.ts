@@ -0,0 +1,56 @@
+import { describe, expect, it } from 'vitest';
+import { loadBench } from './helpers/bench.js';
+
+// the watch batch tests run against the benchmark addon which feeds device changes to a watch
+// listener's batch on a simulated clock
+const bench = loadBench('watch batch');
+
+describe.skipIf(!bench)('watch batch', () => {
+	it('should emit the trailing batch once the throttle has passed', () => {
+		const batches = bench.watchBatch(0, 100, [
+			{ at: 200, udid: 'a', type: 'attach' },
+			{ at: 210, udid: 'b', type: 'attach' },
+			{ at: 220, udid: 'a', type: 'update' },
+			{ at: 230, udid: 'b', type: 'update' },
+			{ at: 450, udid: 'c', type: 'attach' }
+		]);
+		expect(batches).to.deep.equal([
+			{ at: 200, changes: [{ type: 'attach', udid: 'a' }] },
+			{
+				at: 300,
+				changes: [
+					{ type: 'attach', udid: 'b' },
+					{ type: 'update', udid: 'a' }
+				]
+			},
+			{ at: 450, changes: [{ type: 'attach', udid: 'c' }] }
+		]);
+	});
+
+	it('should hold changes until the throttle has passed since the last batch', () => {
+		const batches = bench.watchBatch(0, 100, [
+			{ at: 50, udid: 'a', type: 'attach' },
+			{ at: 200, udid: 'a', type: 'detach' },
+			{ at: 250, udid: 'a', type: 'attach' }
+		]);
+		expect(batches).to.deep.equal([
+			{ at: 100, changes: [{ type: 'attach', udid: 'a' }] },
+			{ at: 200, changes: [{ type: 'detach', udid: 'a' }] },
+			{ at: 300, changes: [{ type: 'attach', udid: 'a' }] }
+		]);
+	});
+
+	it('should fold changes within the coalescing window', () => {
+		const batches = bench.watchBatch(50, 0, [
+			{ at: 0, udid: 'a', type: 'attach' },
+			{ at: 10, udid: 'a', type: 'detach' },
+			{ at: 20, udid: 'b', type: 'detach' },
+			{ at: 30, udid: 'b', type: 'attach' },
+			{ at: 100, udid: 'c', type: 'attach' }
+		]);
+		expect(batches).to.deep.equal([
+			{ at: 50, changes: [{ type: 'update', udid: 'b' }] },
+			{ at: 150, changes: [{ type: 'attach', udid: 'c' }] }
+		]);
+	});
+});